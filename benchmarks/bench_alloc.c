@@ -0,0 +1,183 @@
+/* Heap allocations done by the downloader per target: creation of
+ * the LrDownloadTargets, lr_download() of them (local files) and
+ * freeing of the targets
+ *
+ * The allocations are counted by wrappers of the malloc() family
+ * (glibc only).
+ *
+ * Usage: bench_alloc [targets [iterations]]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <glib.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <librepo/librepo.h>
+
+#define DEFAULT_TARGETS     10000
+#define DEFAULT_ITERATIONS  3
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+
+static long allocations = 0;
+static long frees = 0;
+
+void *
+malloc(size_t size)
+{
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+    allocations++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+    if (!ptr)
+        allocations++;
+    return __libc_realloc(ptr, size);
+}
+
+void
+free(void *ptr)
+{
+    if (ptr)
+        frees++;
+    __libc_free(ptr);
+}
+
+typedef struct {
+    long allocations;
+    long frees;
+    gint64 usec;
+} Phase;
+
+static void
+phase_start(Phase *phase)
+{
+    phase->allocations -= allocations;
+    phase->frees -= frees;
+    phase->usec -= g_get_monotonic_time();
+}
+
+static void
+phase_end(Phase *phase)
+{
+    phase->allocations += allocations;
+    phase->frees += frees;
+    phase->usec += g_get_monotonic_time();
+}
+
+static void
+report(const char *name, Phase *phase, long count)
+{
+    printf("%-10s %8.1f allocs/target %8.1f frees/target %8.2f us/target\n",
+           name,
+           (double) phase->allocations / count,
+           (double) phase->frees / count,
+           (double) phase->usec / count);
+}
+
+static void
+bench(LrHandle *h, const char *prefix, const char *baseurl, int fd, int count,
+      Phase *create, Phase *download, Phase *destroy)
+{
+    GSList *targets = NULL;
+    GError *tmp_err = NULL;
+    char path[PATH_MAX];
+
+    phase_start(create);
+    for (int x = 0; x < count; x++) {
+        snprintf(path, sizeof(path), "%spackages/package-%d.rpm",
+                 prefix, x % 2);
+        LrDownloadTarget *t = lr_downloadtarget_new(h, path, baseurl, fd,
+                                                    NULL, NULL, 0, FALSE,
+                                                    NULL, NULL, NULL, NULL,
+                                                    NULL, 0, 0);
+        targets = g_slist_prepend(targets, t);
+    }
+    targets = g_slist_reverse(targets);
+    phase_end(create);
+
+    phase_start(download);
+    if (!lr_download(targets, TRUE, &tmp_err)) {
+        fprintf(stderr, "Error: %s\n", tmp_err->message);
+        exit(EXIT_FAILURE);
+    }
+    phase_end(download);
+
+    phase_start(destroy);
+    g_slist_free_full(targets, (GDestroyNotify) lr_downloadtarget_free);
+    phase_end(destroy);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int count = (argc > 1) ? atoi(argv[1]) : DEFAULT_TARGETS;
+    int iterations = (argc > 2) ? atoi(argv[2]) : DEFAULT_ITERATIONS;
+
+    if (count <= 0 || iterations <= 0) {
+        fprintf(stderr, "Usage: %s [targets [iterations]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char *dir = g_dir_make_tmp("librepo-bench-XXXXXX", NULL);
+    if (!dir) {
+        fprintf(stderr, "Cannot create temporary directory\n");
+        return EXIT_FAILURE;
+    }
+
+    char *packages = g_build_filename(dir, "packages", NULL);
+    char *package0 = g_build_filename(packages, "package-0.rpm", NULL);
+    char *package1 = g_build_filename(packages, "package-1.rpm", NULL);
+    char *baseurl = g_strconcat("file://", dir, "/", NULL);
+    mkdir(packages, 0755);
+    g_file_set_contents(package0, "package", -1, NULL);
+    g_file_set_contents(package1, "package", -1, NULL);
+
+    int fd = open("/dev/null", O_RDWR);
+    LrHandle *h = lr_handle_init();
+    lr_handle_setopt(h, NULL, LRO_MAXPARALLELDOWNLOADS, 20L);
+
+    Phase create = {0}, download = {0}, destroy = {0};
+    for (int x = 0; x < iterations; x++) {
+        // Complete urls
+        bench(h, baseurl, NULL, fd, count, &create, &download, &destroy);
+        // Relative paths and a base url
+        bench(h, "", baseurl, fd, count, &create, &download, &destroy);
+    }
+
+    printf("%d targets, %d iterations\n", count, iterations);
+    report("create", &create, 2L * count * iterations);
+    report("download", &download, 2L * count * iterations);
+    report("free", &destroy, 2L * count * iterations);
+
+    lr_handle_free(h);
+    close(fd);
+    unlink(package0);
+    unlink(package1);
+    rmdir(packages);
+    rmdir(dir);
+    g_free(baseurl);
+    g_free(package0);
+    g_free(package1);
+    g_free(packages);
+    g_free(dir);
+
+    return EXIT_SUCCESS;
+}
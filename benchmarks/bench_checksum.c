@@ -0,0 +1,135 @@
+/* Compare per-file lr_checksum_fd() with lr_checksum_pool_fd()
+ *
+ * Usage: bench_checksum [number_of_files [file_size [checksum_type]]]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <glib.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <librepo/librepo.h>
+
+#define DEFAULT_FILES   5000
+#define DEFAULT_SIZE    4096
+#define BATCH_SIZE      256
+
+static char **
+create_files(const char *dir, int count, size_t size)
+{
+    char **paths = g_new0(char *, count + 1);
+    char *data = g_malloc(size);
+
+    for (int x = 0; x < count; x++) {
+        // Make content of every file unique
+        memset(data, 'a' + x % 26, size);
+        if (size >= sizeof(x))
+            memcpy(data, &x, sizeof(x));
+
+        paths[x] = g_strdup_printf("%s/file_%d", dir, x);
+        if (!g_file_set_contents(paths[x], data, size, NULL)) {
+            fprintf(stderr, "Cannot create %s\n", paths[x]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    g_free(data);
+    return paths;
+}
+
+static double
+bench_single(char **paths, int count, LrChecksumType type)
+{
+    gint64 start = g_get_monotonic_time();
+
+    for (int x = 0; x < count; x++) {
+        GError *tmp_err = NULL;
+        int fd = open(paths[x], O_RDONLY);
+        char *checksum = lr_checksum_fd(type, fd, &tmp_err);
+        if (!checksum) {
+            fprintf(stderr, "Error: %s\n", tmp_err->message);
+            exit(EXIT_FAILURE);
+        }
+        g_free(checksum);
+        close(fd);
+    }
+
+    return (g_get_monotonic_time() - start) / 1000000.0;
+}
+
+static double
+bench_pool(char **paths, int count, LrChecksumType type)
+{
+    LrChecksumBatchItem items[BATCH_SIZE];
+    gint64 start = g_get_monotonic_time();
+    LrChecksumPool *pool = lr_checksum_pool_new();
+
+    // Open files in chunks to stay below the limit of opened files
+    for (int first = 0; first < count; first += BATCH_SIZE) {
+        GError *tmp_err = NULL;
+        int n = MIN(BATCH_SIZE, count - first);
+
+        memset(items, 0, sizeof(items));
+        for (int x = 0; x < n; x++) {
+            items[x].fd = open(paths[first + x], O_RDONLY);
+            items[x].type = type;
+        }
+
+        if (!lr_checksum_pool_fd(pool, items, n, FALSE, &tmp_err)) {
+            fprintf(stderr, "Error: %s\n", tmp_err->message);
+            exit(EXIT_FAILURE);
+        }
+
+        for (int x = 0; x < n; x++)
+            close(items[x].fd);
+        lr_checksum_batch_clear(items, n);
+    }
+
+    lr_checksum_pool_free(pool);
+
+    return (g_get_monotonic_time() - start) / 1000000.0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int count = (argc > 1) ? atoi(argv[1]) : DEFAULT_FILES;
+    size_t size = (argc > 2) ? (size_t) atol(argv[2]) : DEFAULT_SIZE;
+    LrChecksumType type = lr_checksum_type((argc > 3) ? argv[3] : "sha256");
+
+    if (count <= 0 || type == LR_CHECKSUM_UNKNOWN) {
+        fprintf(stderr, "Usage: %s [files [size [checksum_type]]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char *dir = g_dir_make_tmp("librepo-bench-XXXXXX", NULL);
+    if (!dir) {
+        fprintf(stderr, "Cannot create temporary directory\n");
+        return EXIT_FAILURE;
+    }
+
+    char **paths = create_files(dir, count, size);
+
+    // Warm up the page cache, both variants should measure hashing only
+    bench_single(paths, count, type);
+
+    double single = bench_single(paths, count, type);
+    double pool = bench_pool(paths, count, type);
+
+    printf("%d files, %zu bytes each, %s\n",
+           count, size, lr_checksum_type_to_str(type));
+    printf("lr_checksum_fd:      %8.3f s  %10.0f files/s\n",
+           single, count / single);
+    printf("lr_checksum_pool_fd: %8.3f s  %10.0f files/s  (%.2fx)\n",
+           pool, count / pool, single / pool);
+
+    for (int x = 0; x < count; x++)
+        unlink(paths[x]);
+    rmdir(dir);
+    g_strfreev(paths);
+    g_free(dir);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,170 @@
+/* Ingestion of large mirrorlists and metalinks into the internal
+ * mirror list of a handle (parsing, URL substitution, deduplication)
+ *
+ * Usage: bench_mirrorlist [mirrors [iterations]]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <glib.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <librepo/librepo.h>
+
+#define DEFAULT_MIRRORS     50000
+#define DEFAULT_ITERATIONS  5
+#define DUPLICATE_EVERY     10      // Every n-th mirror is a duplicate
+
+static char *
+write_file(const char *dir, const char *name, GString *content)
+{
+    char *path = g_build_filename(dir, name, NULL);
+    if (!g_file_set_contents(path, content->str, content->len, NULL)) {
+        fprintf(stderr, "Cannot create %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    g_string_free(content, TRUE);
+    return path;
+}
+
+/** Number of the mirror on the given position (some are duplicates) */
+static int
+mirror_number(int x)
+{
+    return (x % DUPLICATE_EVERY == DUPLICATE_EVERY - 1) ? x / 2 : x;
+}
+
+static char *
+create_mirrorlist(const char *dir, int mirrors)
+{
+    GString *str = g_string_new("# repo = fedora-20 arch = x86_64\n");
+
+    for (int x = 0; x < mirrors; x++)
+        g_string_append_printf(str,
+            "http://mirror%d.example.com/pub/fedora/linux/releases/"
+            "$releasever/Everything/$basearch/os/\n", mirror_number(x));
+
+    return write_file(dir, "mirrorlist", str);
+}
+
+static char *
+create_metalink(const char *dir, int mirrors)
+{
+    GString *str = g_string_new(
+        "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+        "<metalink version=\"3.0\" xmlns=\"http://www.metalinker.org/\" "
+        "type=\"dynamic\" xmlns:mm0=\"http://fedorahosted.org/mirrormanager\">\n"
+        "  <files>\n"
+        "    <file name=\"repomd.xml\">\n"
+        "      <mm0:timestamp>1337942396</mm0:timestamp>\n"
+        "      <size>4309</size>\n"
+        "      <verification>\n"
+        "        <hash type=\"sha256\">0076c44aabd352da878d5c4d794901ac87f66afac869488f6a4ef166de018cdf</hash>\n"
+        "      </verification>\n"
+        "      <resources maxconnections=\"1\">\n");
+
+    for (int x = 0; x < mirrors; x++)
+        g_string_append_printf(str,
+            "        <url protocol=\"http\" type=\"http\" location=\"US\" "
+            "preference=\"%d\">http://mirror%d.example.com/pub/fedora/linux/"
+            "releases/20/Everything/x86_64/os/repodata/repomd.xml</url>\n",
+            100 - x % 100, mirror_number(x));
+
+    g_string_append(str,
+        "      </resources>\n"
+        "    </file>\n"
+        "  </files>\n"
+        "</metalink>\n");
+
+    return write_file(dir, "metalink.xml", str);
+}
+
+/** Let a handle download (from a local file) and ingest the list.
+ * @return      Number of mirrors in the internal mirror list.
+ */
+static int
+ingest(const char *dir, LrHandleOption option, const char *path)
+{
+    GError *tmp_err = NULL;
+    LrHandle *h = lr_handle_init();
+    LrResult *r = lr_result_init();
+    LrUrlVars *urlvars = NULL;
+    char **mirrors = NULL;
+
+    urlvars = lr_urlvars_set(urlvars, "releasever", "20");
+    urlvars = lr_urlvars_set(urlvars, "basearch", "x86_64");
+
+    lr_handle_setopt(h, NULL, option, path);
+    lr_handle_setopt(h, NULL, LRO_VARSUB, urlvars);
+    lr_handle_setopt(h, NULL, LRO_REPOTYPE, LR_YUMREPO);
+    lr_handle_setopt(h, NULL, LRO_FETCHMIRRORS, 1L);
+    lr_handle_setopt(h, NULL, LRO_DESTDIR, dir);
+
+    if (!lr_handle_perform(h, r, &tmp_err)) {
+        fprintf(stderr, "Error: %s\n", tmp_err->message);
+        exit(EXIT_FAILURE);
+    }
+
+    lr_handle_getinfo(h, NULL, LRI_MIRRORS, &mirrors);
+    int count = mirrors ? (int) g_strv_length(mirrors) : 0;
+
+    g_strfreev(mirrors);
+    lr_result_free(r);
+    lr_handle_free(h);
+    return count;
+}
+
+static void
+bench(const char *name,
+      const char *dir,
+      LrHandleOption option,
+      const char *path,
+      int iterations)
+{
+    int count = 0;
+    gint64 start = g_get_monotonic_time();
+
+    for (int x = 0; x < iterations; x++)
+        count = ingest(dir, option, path);
+
+    double sec = (g_get_monotonic_time() - start) / 1000000.0;
+    printf("%-10s %8d unique mirrors  %8.2f ms/ingest\n",
+           name, count, sec * 1000.0 / iterations);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int mirrors = (argc > 1) ? atoi(argv[1]) : DEFAULT_MIRRORS;
+    int iterations = (argc > 2) ? atoi(argv[2]) : DEFAULT_ITERATIONS;
+
+    if (mirrors <= 0 || iterations <= 0) {
+        fprintf(stderr, "Usage: %s [mirrors [iterations]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char *dir = g_dir_make_tmp("librepo-bench-XXXXXX", NULL);
+    if (!dir) {
+        fprintf(stderr, "Cannot create temporary directory\n");
+        return EXIT_FAILURE;
+    }
+
+    char *mirrorlist = create_mirrorlist(dir, mirrors);
+    char *metalink = create_metalink(dir, mirrors);
+
+    printf("%d mirrors (every %dth is a duplicate), %d iterations\n",
+           mirrors, DUPLICATE_EVERY, iterations);
+    bench("mirrorlist", dir, LRO_MIRRORLISTURL, mirrorlist, iterations);
+    bench("metalink", dir, LRO_METALINKURL, metalink, iterations);
+
+    unlink(mirrorlist);
+    unlink(metalink);
+    rmdir(dir);
+    g_free(mirrorlist);
+    g_free(metalink);
+    g_free(dir);
+
+    return EXIT_SUCCESS;
+}
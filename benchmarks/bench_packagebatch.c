@@ -0,0 +1,264 @@
+/* Peak memory (RSS) of downloading a large number of packages
+ * described by a GSList of LrPackageTargets, by a LrPackageBatch
+ * and pulled one by one by lr_download_packages_stream()
+ *
+ * Every variant runs in its own process. The peak RSS is reported
+ * once all the targets are created (in the middle of the download
+ * for the stream) and after the download.
+ *
+ * Usage: bench_packagebatch [packages]
+ */
+
+#define _DEFAULT_SOURCE
+#include <glib.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <librepo/librepo.h>
+
+#define DEFAULT_PACKAGES    20000
+#define PACKAGE_CONTENT     "package"
+
+static char *checksum = NULL;
+
+static char *
+relative_url(int x)
+{
+    return g_strdup_printf("Packages/p/package-%d-1.0-1.fc20.x86_64.rpm", x);
+}
+
+static long
+peak_rss(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;  // KiB
+}
+
+static void
+report(const char *name, long targets_rss, long download_rss)
+{
+    printf("%-6s %8ld KiB after targets %8ld KiB after download\n",
+           name, targets_rss, download_rss);
+}
+
+static void
+fail(const char *msg)
+{
+    fprintf(stderr, "Error: %s\n", msg);
+    exit(EXIT_FAILURE);
+}
+
+static void
+check_error(gboolean ret, GError *err)
+{
+    if (!ret)
+        fail(err->message);
+}
+
+static void
+bench_list(LrHandle *h, const char *baseurl, const char *dest, int count)
+{
+    GSList *targets = NULL;
+    GError *tmp_err = NULL;
+
+    for (int x = 0; x < count; x++) {
+        char *url = relative_url(x);
+        LrPackageTarget *t = lr_packagetarget_new(h, url, dest,
+                                                  LR_CHECKSUM_SHA256, checksum,
+                                                  0, baseurl, FALSE,
+                                                  NULL, NULL, &tmp_err);
+        check_error(t != NULL, tmp_err);
+        targets = g_slist_prepend(targets, t);
+        g_free(url);
+    }
+    targets = g_slist_reverse(targets);
+    long targets_rss = peak_rss();
+
+    check_error(lr_download_packages(targets, 0, &tmp_err), tmp_err);
+    for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
+        LrPackageTarget *t = elem->data;
+        if (t->err)
+            fail(t->err);
+    }
+
+    report("list", targets_rss, peak_rss());
+    g_slist_free_full(targets, (GDestroyNotify) lr_packagetarget_free);
+}
+
+static void
+bench_batch(LrHandle *h, const char *baseurl, const char *dest, int count)
+{
+    GError *tmp_err = NULL;
+    LrPackageBatch *batch = lr_packagebatch_new(count);
+
+    for (int x = 0; x < count; x++) {
+        char *url = relative_url(x);
+        gboolean ret = lr_packagebatch_add(batch, h, url, dest,
+                                           LR_CHECKSUM_SHA256, checksum,
+                                           0, baseurl, FALSE, NULL, &tmp_err);
+        check_error(ret, tmp_err);
+        g_free(url);
+    }
+    long targets_rss = peak_rss();
+
+    check_error(lr_download_packagebatch(batch, 0, &tmp_err), tmp_err);
+    for (int x = 0; x < count; x++)
+        if (lr_packagebatch_error(batch, x))
+            fail(lr_packagebatch_error(batch, x));
+
+    report("batch", targets_rss, peak_rss());
+    lr_packagebatch_free(batch);
+}
+
+typedef struct {
+    LrHandle *handle;
+    const char *baseurl;
+    const char *dest;
+    int count;
+    int pulled;
+    long targets_rss;
+} StreamData;
+
+static LrPackageTarget *
+stream_nextcb(void *cbdata)
+{
+    StreamData *data = cbdata;
+    GError *tmp_err = NULL;
+
+    if (data->pulled == data->count)
+        return NULL;
+
+    char *url = relative_url(data->pulled++);
+    LrPackageTarget *t = lr_packagetarget_new(data->handle, url, data->dest,
+                                              LR_CHECKSUM_SHA256, checksum,
+                                              0, data->baseurl, FALSE,
+                                              NULL, NULL, &tmp_err);
+    check_error(t != NULL, tmp_err);
+    g_free(url);
+
+    // The stream never holds all the targets, take the peak
+    // in the middle of the download
+    if (data->pulled == data->count / 2)
+        data->targets_rss = peak_rss();
+    return t;
+}
+
+static void
+stream_donecb(G_GNUC_UNUSED void *cbdata, LrPackageTarget *target)
+{
+    if (target->err)
+        fail(target->err);
+    lr_packagetarget_free(target);
+}
+
+static void
+bench_stream(LrHandle *h, const char *baseurl, const char *dest, int count)
+{
+    GError *tmp_err = NULL;
+    StreamData data = { h, baseurl, dest, count, 0, 0 };
+
+    check_error(lr_download_packages_stream(stream_nextcb, stream_donecb,
+                                            &data, 0, &tmp_err),
+                tmp_err);
+
+    report("stream", data.targets_rss, peak_rss());
+}
+
+typedef void (*BenchFunc)(LrHandle *, const char *, const char *, int);
+
+/** Run the variant in a child process, so it has its own peak RSS */
+static void
+run(BenchFunc func, const char *dir, const char *baseurl, int count)
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        char *dest = g_build_filename(dir, "dest", NULL);
+        mkdir(dest, 0755);
+
+        LrHandle *h = lr_handle_init();
+        lr_handle_setopt(h, NULL, LRO_REPOTYPE, LR_YUMREPO);
+        lr_handle_setopt(h, NULL, LRO_MAXPARALLELDOWNLOADS, 20L);
+
+        func(h, baseurl, dest, count);
+
+        lr_handle_free(h);
+        for (int x = 0; x < count; x++) {
+            char *url = relative_url(x);
+            char *name = g_path_get_basename(url);
+            char *path = g_build_filename(dest, name, NULL);
+            unlink(path);
+            g_free(path);
+            g_free(name);
+            g_free(url);
+        }
+        rmdir(dest);
+        g_free(dest);
+        exit(EXIT_SUCCESS);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+        exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int count = (argc > 1) ? atoi(argv[1]) : DEFAULT_PACKAGES;
+
+    if (count <= 0) {
+        fprintf(stderr, "Usage: %s [packages]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char *dir = g_dir_make_tmp("librepo-bench-XXXXXX", NULL);
+    if (!dir) {
+        fprintf(stderr, "Cannot create temporary directory\n");
+        return EXIT_FAILURE;
+    }
+
+    // Local repository
+    char *packages = g_build_filename(dir, "Packages", "p", NULL);
+    g_mkdir_with_parents(packages, 0755);
+    for (int x = 0; x < count; x++) {
+        char *url = relative_url(x);
+        char *path = g_build_filename(dir, url, NULL);
+        g_file_set_contents(path, PACKAGE_CONTENT, -1, NULL);
+        g_free(path);
+        g_free(url);
+    }
+    char *baseurl = g_strconcat("file://", dir, "/", NULL);
+    checksum = g_compute_checksum_for_string(G_CHECKSUM_SHA256,
+                                             PACKAGE_CONTENT, -1);
+
+    printf("%d packages, peak RSS of a process\n", count);
+    run(bench_list, dir, baseurl, count);
+    run(bench_batch, dir, baseurl, count);
+    run(bench_stream, dir, baseurl, count);
+
+    for (int x = 0; x < count; x++) {
+        char *url = relative_url(x);
+        char *path = g_build_filename(dir, url, NULL);
+        unlink(path);
+        g_free(path);
+        g_free(url);
+    }
+    rmdir(packages);
+    char *packages_parent = g_path_get_dirname(packages);
+    rmdir(packages_parent);
+    rmdir(dir);
+    g_free(packages_parent);
+    g_free(packages);
+    g_free(baseurl);
+    g_free(checksum);
+    g_free(dir);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,132 @@
+/* Download of many small files by lr_download(): time per file
+ *
+ * Without an url, the files are created in a local repository and
+ * downloaded from it (file://). With an url (e.g. of a small file on
+ * a local HTTP server), the url is downloaded the given number of times,
+ * which also exercises the reuse of the connections.
+ *
+ * Usage: bench_smallfiles [files [url]]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <glib.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <librepo/librepo.h>
+
+#define DEFAULT_FILES       5000
+#define PARALLEL_DOWNLOADS  5L
+#define FILE_CONTENT        "small file"
+
+static void
+fail(const char *msg)
+{
+    fprintf(stderr, "Error: %s\n", msg);
+    exit(EXIT_FAILURE);
+}
+
+static char *
+file_name(int x)
+{
+    return g_strdup_printf("file-%d", x);
+}
+
+static void
+report(const char *name, int count, gint64 usec)
+{
+    printf("%-8s %6d files %8.1f us/file\n", name, count,
+           (double) usec / count);
+}
+
+static gint64
+bench(LrHandle *h, const char *baseurl, const char *url, int count)
+{
+    GSList *targets = NULL;
+    GError *tmp_err = NULL;
+    int fd = open("/dev/null", O_RDWR);
+
+    if (fd < 0)
+        fail("Cannot open /dev/null");
+
+    for (int x = 0; x < count; x++) {
+        char *path = url ? g_strdup(url) : file_name(x);
+        LrDownloadTarget *t = lr_downloadtarget_new(h, path, baseurl, fd,
+                                                    NULL, NULL, 0, FALSE,
+                                                    NULL, NULL, NULL, NULL,
+                                                    NULL, 0, 0);
+        targets = g_slist_prepend(targets, t);
+        g_free(path);
+    }
+    targets = g_slist_reverse(targets);
+
+    gint64 start = g_get_monotonic_time();
+    if (!lr_download(targets, FALSE, &tmp_err))
+        fail(tmp_err->message);
+    gint64 usec = g_get_monotonic_time() - start;
+
+    for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
+        LrDownloadTarget *t = elem->data;
+        if (t->err)
+            fail(t->err);
+    }
+
+    g_slist_free_full(targets, (GDestroyNotify) lr_downloadtarget_free);
+    close(fd);
+    return usec;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int count = (argc > 1) ? atoi(argv[1]) : DEFAULT_FILES;
+    const char *url = (argc > 2) ? argv[2] : NULL;
+    char *dir = NULL;
+    char *baseurl = NULL;
+
+    if (count <= 0) {
+        fprintf(stderr, "Usage: %s [files [url]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (!url) {
+        // Local repository
+        dir = g_dir_make_tmp("librepo-bench-XXXXXX", NULL);
+        if (!dir)
+            fail("Cannot create temporary directory");
+        for (int x = 0; x < count; x++) {
+            char *name = file_name(x);
+            char *path = g_build_filename(dir, name, NULL);
+            g_file_set_contents(path, FILE_CONTENT, -1, NULL);
+            g_free(path);
+            g_free(name);
+        }
+        baseurl = g_strconcat("file://", dir, "/", NULL);
+    }
+
+    LrHandle *h = lr_handle_init();
+    lr_handle_setopt(h, NULL, LRO_REPOTYPE, LR_YUMREPO);
+    lr_handle_setopt(h, NULL, LRO_MAXPARALLELDOWNLOADS, PARALLEL_DOWNLOADS);
+
+    printf("%ld parallel downloads\n", PARALLEL_DOWNLOADS);
+    report(url ? "url" : "file://", count, bench(h, baseurl, url, count));
+
+    lr_handle_free(h);
+
+    if (dir) {
+        for (int x = 0; x < count; x++) {
+            char *name = file_name(x);
+            char *path = g_build_filename(dir, name, NULL);
+            unlink(path);
+            g_free(path);
+            g_free(name);
+        }
+        rmdir(dir);
+    }
+    g_free(baseurl);
+    g_free(dir);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,124 @@
+/* Substitution of variables in urls: lr_url_substitute() per url,
+ * compiled variables (LrUrlVarsIndex) and rendering of a compiled
+ * template (LrUrlTemplate)
+ *
+ * Usage: bench_urlsubst [urls [iterations]]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <glib.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <librepo/librepo.h>
+
+#define DEFAULT_URLS        100000
+#define DEFAULT_ITERATIONS  5
+
+static LrUrlVars *
+create_urlvars(void)
+{
+    LrUrlVars *urlvars = NULL;
+
+    // Variables similar to the ones set by the package managers
+    urlvars = lr_urlvars_set(urlvars, "arch", "x86_64");
+    urlvars = lr_urlvars_set(urlvars, "basearch", "x86_64");
+    urlvars = lr_urlvars_set(urlvars, "releasever", "20");
+    urlvars = lr_urlvars_set(urlvars, "releasever_major", "20");
+    urlvars = lr_urlvars_set(urlvars, "releasever_minor", "0");
+    urlvars = lr_urlvars_set(urlvars, "infra", "stock");
+    urlvars = lr_urlvars_set(urlvars, "contentdir", "pub/fedora");
+    urlvars = lr_urlvars_set(urlvars, "uuid", "8f3b1a2c9d");
+
+    return urlvars;
+}
+
+static char **
+create_urls(int count)
+{
+    char **urls = g_new0(char *, count + 1);
+
+    for (int x = 0; x < count; x++)
+        urls[x] = g_strdup_printf("http://mirror%d.example.com/$contentdir/"
+                                  "linux/releases/$releasever/Everything/"
+                                  "$basearch/os/?infra=$infra", x);
+
+    return urls;
+}
+
+static void
+report(const char *name, int count, gint64 usec)
+{
+    printf("%-12s %8.1f ns/url\n", name, usec * 1000.0 / count);
+}
+
+static gint64
+bench_substitute(char **urls, LrUrlVars *urlvars)
+{
+    gint64 start = g_get_monotonic_time();
+
+    for (char **url = urls; *url; url++)
+        g_free(lr_url_substitute(*url, urlvars));
+
+    return g_get_monotonic_time() - start;
+}
+
+static gint64
+bench_index(char **urls, LrUrlVars *urlvars)
+{
+    gint64 start = g_get_monotonic_time();
+    LrUrlVarsIndex *index = lr_urlvars_index_new(urlvars);
+
+    for (char **url = urls; *url; url++)
+        g_free(lr_url_substitute_index(*url, index));
+
+    lr_urlvars_index_free(index);
+    return g_get_monotonic_time() - start;
+}
+
+static gint64
+bench_render(char **urls, LrUrlVars *urlvars)
+{
+    LrUrlVarsIndex *index = lr_urlvars_index_new(urlvars);
+    LrUrlTemplate *tmpl = lr_urltemplate_new(urls[0], index);
+    gint64 start = g_get_monotonic_time();
+
+    for (char **url = urls; *url; url++)
+        g_free(lr_urltemplate_render(tmpl));
+
+    gint64 usec = g_get_monotonic_time() - start;
+    lr_urltemplate_free(tmpl);
+    lr_urlvars_index_free(index);
+    return usec;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int count = (argc > 1) ? atoi(argv[1]) : DEFAULT_URLS;
+    int iterations = (argc > 2) ? atoi(argv[2]) : DEFAULT_ITERATIONS;
+
+    if (count <= 0 || iterations <= 0) {
+        fprintf(stderr, "Usage: %s [urls [iterations]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    LrUrlVars *urlvars = create_urlvars();
+    char **urls = create_urls(count);
+    gint64 substitute = 0, index = 0, render = 0;
+
+    for (int x = 0; x < iterations; x++) {
+        substitute += bench_substitute(urls, urlvars);
+        index += bench_index(urls, urlvars);
+        render += bench_render(urls, urlvars);
+    }
+
+    printf("%d urls, 8 variables, %d iterations\n", count, iterations);
+    report("substitute", count * iterations, substitute);
+    report("index", count * iterations, index);
+    report("render", count * iterations, render);
+
+    g_strfreev(urls);
+    lr_urlvars_free(urlvars);
+
+    return EXIT_SUCCESS;
+}
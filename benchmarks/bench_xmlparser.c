@@ -0,0 +1,187 @@
+/* Parser throughput on a synthetic metalink and repomd.xml
+ *
+ * Usage: bench_xmlparser [metalink_urls [repomd_records [iterations]]]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <glib.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <librepo/librepo.h>
+
+#define DEFAULT_URLS        10000
+#define DEFAULT_RECORDS     2000
+#define DEFAULT_ITERATIONS  20
+
+static char *
+write_file(const char *dir, const char *name, GString *content)
+{
+    char *path = g_build_filename(dir, name, NULL);
+    if (!g_file_set_contents(path, content->str, content->len, NULL)) {
+        fprintf(stderr, "Cannot create %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    g_string_free(content, TRUE);
+    return path;
+}
+
+static char *
+create_metalink(const char *dir, int urls)
+{
+    GString *str = g_string_new(
+        "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+        "<metalink version=\"3.0\" xmlns=\"http://www.metalinker.org/\" "
+        "type=\"dynamic\" xmlns:mm0=\"http://fedorahosted.org/mirrormanager\">\n"
+        "  <files>\n"
+        "    <file name=\"repomd.xml\">\n"
+        "      <mm0:timestamp>1337942396</mm0:timestamp>\n"
+        "      <size>4309</size>\n"
+        "      <verification>\n"
+        "        <hash type=\"sha256\">0076c44aabd352da878d5c4d794901ac87f66afac869488f6a4ef166de018cdf</hash>\n"
+        "      </verification>\n"
+        "      <resources maxconnections=\"1\">\n");
+
+    for (int x = 0; x < urls; x++)
+        g_string_append_printf(str,
+            "        <url protocol=\"http\" type=\"http\" location=\"US\" "
+            "preference=\"%d\">http://mirror%d.example.com/pub/fedora/linux/"
+            "releases/20/Everything/x86_64/os/repodata/repomd.xml</url>\n",
+            100 - x % 100, x);
+
+    g_string_append(str,
+        "      </resources>\n"
+        "    </file>\n"
+        "  </files>\n"
+        "</metalink>\n");
+
+    return write_file(dir, "metalink.xml", str);
+}
+
+static char *
+create_repomd(const char *dir, int records)
+{
+    GString *str = g_string_new(
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<repomd xmlns=\"http://linux.duke.edu/metadata/repo\" "
+        "xmlns:rpm=\"http://linux.duke.edu/metadata/rpm\">\n"
+        "  <revision>1347459931</revision>\n"
+        "  <tags>\n"
+        "    <content>binary-x86_64</content>\n"
+        "  </tags>\n");
+
+    for (int x = 0; x < records; x++)
+        g_string_append_printf(str,
+            "  <data type=\"type%d\">\n"
+            "    <checksum type=\"sha256\">%064x</checksum>\n"
+            "    <open-checksum type=\"sha256\">%064x</open-checksum>\n"
+            "    <location href=\"repodata/%064x-type%d.xml.gz\"/>\n"
+            "    <timestamp>1347459930</timestamp>\n"
+            "    <size>936</size>\n"
+            "    <open-size>3385</open-size>\n"
+            "  </data>\n",
+            x, x, x + 1, x, x);
+
+    g_string_append(str, "</repomd>\n");
+
+    return write_file(dir, "repomd.xml", str);
+}
+
+static void
+report(const char *name, const char *path, int iterations, gint64 usec)
+{
+    struct stat st;
+    double sec = usec / 1000000.0;
+
+    if (stat(path, &st) == -1)
+        st.st_size = 0;
+
+    printf("%-10s %8.2f MB  %8.3f ms/parse  %8.1f MB/s\n",
+           name, st.st_size / 1e6, sec * 1000.0 / iterations,
+           st.st_size / 1e6 * iterations / sec);
+}
+
+static gint64
+bench_metalink(const char *path, int iterations)
+{
+    gint64 start = g_get_monotonic_time();
+
+    for (int x = 0; x < iterations; x++) {
+        GError *tmp_err = NULL;
+        LrMetalink *metalink = lr_metalink_init();
+        int fd = open(path, O_RDONLY);
+        if (!lr_metalink_parse_file(metalink, fd, "repomd.xml",
+                                    NULL, NULL, &tmp_err)) {
+            fprintf(stderr, "Error: %s\n", tmp_err->message);
+            exit(EXIT_FAILURE);
+        }
+        close(fd);
+        lr_metalink_free(metalink);
+    }
+
+    return g_get_monotonic_time() - start;
+}
+
+static gint64
+bench_repomd(const char *path, int iterations)
+{
+    gint64 start = g_get_monotonic_time();
+
+    for (int x = 0; x < iterations; x++) {
+        GError *tmp_err = NULL;
+        LrYumRepoMd *repomd = lr_yum_repomd_init();
+        int fd = open(path, O_RDONLY);
+        if (!lr_yum_repomd_parse_file(repomd, fd, NULL, NULL, &tmp_err)) {
+            fprintf(stderr, "Error: %s\n", tmp_err->message);
+            exit(EXIT_FAILURE);
+        }
+        close(fd);
+        lr_yum_repomd_free(repomd);
+    }
+
+    return g_get_monotonic_time() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int urls = (argc > 1) ? atoi(argv[1]) : DEFAULT_URLS;
+    int records = (argc > 2) ? atoi(argv[2]) : DEFAULT_RECORDS;
+    int iterations = (argc > 3) ? atoi(argv[3]) : DEFAULT_ITERATIONS;
+
+    if (urls <= 0 || records <= 0 || iterations <= 0) {
+        fprintf(stderr, "Usage: %s [metalink_urls [repomd_records "
+                "[iterations]]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char *dir = g_dir_make_tmp("librepo-bench-XXXXXX", NULL);
+    if (!dir) {
+        fprintf(stderr, "Cannot create temporary directory\n");
+        return EXIT_FAILURE;
+    }
+
+    char *metalink = create_metalink(dir, urls);
+    char *repomd = create_repomd(dir, records);
+
+    // Warm up the page cache
+    bench_metalink(metalink, 1);
+    bench_repomd(repomd, 1);
+
+    printf("%d metalink urls, %d repomd records, %d iterations\n",
+           urls, records, iterations);
+    report("metalink", metalink, iterations, bench_metalink(metalink, iterations));
+    report("repomd", repomd, iterations, bench_repomd(repomd, iterations));
+
+    unlink(metalink);
+    unlink(repomd);
+    rmdir(dir);
+    g_free(metalink);
+    g_free(repomd);
+    g_free(dir);
+
+    return EXIT_SUCCESS;
+}
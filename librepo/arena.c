@@ -0,0 +1,172 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2013  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+#include <glib.h>
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "arena_internal.h"
+#include "util.h"
+
+#define ARENA_DEFAULT_BLOCK_SIZE    (64 * 1024)
+#define ARENA_ALIGNMENT             (2 * sizeof(void *))
+
+typedef struct _LrArenaBlock LrArenaBlock;
+
+struct _LrArenaBlock {
+    LrArenaBlock *next; /*!< Previously allocated block */
+    gsize size;         /*!< Usable size of the block */
+    gsize used;         /*!< Already allocated bytes */
+    /* Keep data aligned for any type */
+    union {
+        char data[1];
+        long double _align_ld;
+        void *_align_ptr;
+        gint64 _align_int64;
+    } mem;
+};
+
+struct _LrArena {
+    LrArenaBlock *blocks;   /*!< Current block (the head of the list) */
+    LrArenaBlock *large;    /*!< Blocks of the oversized allocations */
+    GSList *free_nodes;     /*!< List nodes returned by lr_arena_slist_free() */
+    gsize block_size;       /*!< Size of a regular block */
+    guint n_blocks;         /*!< Number of allocated blocks */
+};
+
+static inline gsize
+lr_arena_align(gsize size)
+{
+    return (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+}
+
+static LrArenaBlock *
+lr_arena_block_new(LrArena *arena, gsize size)
+{
+    LrArenaBlock *block = lr_malloc(offsetof(LrArenaBlock, mem) + size);
+    block->size = size;
+    block->used = 0;
+    arena->n_blocks++;
+    return block;
+}
+
+LrArena *
+lr_arena_new(gsize block_size)
+{
+    LrArena *arena = lr_malloc0(sizeof(*arena));
+    arena->block_size = block_size ? block_size : ARENA_DEFAULT_BLOCK_SIZE;
+    return arena;
+}
+
+void *
+lr_arena_alloc0(LrArena *arena, gsize size)
+{
+    LrArenaBlock *block;
+
+    assert(arena);
+
+    size = lr_arena_align(size ? size : 1);
+
+    if (size > arena->block_size / 4) {
+        // Oversized allocations get a block of their own, so the rest
+        // of the current block is not wasted
+        block = lr_arena_block_new(arena, size);
+        block->next = arena->large;
+        arena->large = block;
+    } else {
+        block = arena->blocks;
+        if (!block || block->size - block->used < size) {
+            block = lr_arena_block_new(arena, arena->block_size);
+            block->next = arena->blocks;
+            arena->blocks = block;
+        }
+    }
+
+    void *mem = block->mem.data + block->used;
+    block->used += size;
+    memset(mem, 0, size);
+    return mem;
+}
+
+char *
+lr_arena_strdup(LrArena *arena, const char *str)
+{
+    if (!str)
+        return NULL;
+
+    gsize len = strlen(str);
+    char *copy = lr_arena_alloc0(arena, len + 1);
+    memcpy(copy, str, len);
+    return copy;
+}
+
+GSList *
+lr_arena_slist_prepend(LrArena *arena, GSList *list, gpointer data)
+{
+    GSList *node = arena->free_nodes;
+
+    if (node)
+        arena->free_nodes = node->next;
+    else
+        node = lr_arena_alloc0(arena, sizeof(*node));
+
+    node->data = data;
+    node->next = list;
+    return node;
+}
+
+void
+lr_arena_slist_free(LrArena *arena, GSList *list)
+{
+    if (!list)
+        return;
+
+    GSList *last = g_slist_last(list);
+    last->next = arena->free_nodes;
+    arena->free_nodes = list;
+}
+
+guint
+lr_arena_blocks(LrArena *arena)
+{
+    return arena ? arena->n_blocks : 0;
+}
+
+static void
+lr_arena_blocks_free(LrArenaBlock *block)
+{
+    while (block) {
+        LrArenaBlock *next = block->next;
+        lr_free(block);
+        block = next;
+    }
+}
+
+void
+lr_arena_free(LrArena *arena)
+{
+    if (!arena)
+        return;
+
+    lr_arena_blocks_free(arena->blocks);
+    lr_arena_blocks_free(arena->large);
+    lr_free(arena);
+}
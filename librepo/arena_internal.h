@@ -0,0 +1,99 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2013  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+#ifndef LR_ARENA_INTERNAL_H
+#define LR_ARENA_INTERNAL_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/** Memory arena.
+ *
+ * Many small objects with the same lifetime are carved out of big
+ * blocks and all of them are released at once by lr_arena_free().
+ * Objects allocated from the arena must never be freed individually
+ * (this also applies to the list nodes, don't use g_slist_free(),
+ * g_slist_remove(), etc. on lists built by lr_arena_slist_prepend(),
+ * use lr_arena_slist_free() instead).
+ * The arena is not thread safe.
+ */
+typedef struct _LrArena LrArena;
+
+/** Create a new arena.
+ * @param block_size    Size of the blocks or 0 for the default size.
+ * @return              New arena.
+ */
+LrArena *
+lr_arena_new(gsize block_size);
+
+/** Allocate zeroed memory from the arena.
+ * @param arena         Arena.
+ * @param size          Number of bytes.
+ * @return              Memory aligned for any type, valid until
+ *                      the arena is freed.
+ */
+void *
+lr_arena_alloc0(LrArena *arena, gsize size);
+
+/** Copy a string into the arena.
+ * @param arena         Arena.
+ * @param str           String or NULL.
+ * @return              Copy of the string or NULL if str is NULL.
+ */
+char *
+lr_arena_strdup(LrArena *arena, const char *str);
+
+/** Same as g_slist_prepend() but the new node is allocated from
+ * the arena.
+ * @param arena         Arena.
+ * @param list          List.
+ * @param data          Data of the new node.
+ * @return              New start of the list.
+ */
+GSList *
+lr_arena_slist_prepend(LrArena *arena, GSList *list, gpointer data);
+
+/** Return the nodes of the list built by lr_arena_slist_prepend()
+ * to the arena. They are reused by the next lr_arena_slist_prepend()
+ * calls, so a long running user of the arena doesn't need more nodes
+ * than it has at once.
+ * @param arena         Arena.
+ * @param list          List or NULL.
+ */
+void
+lr_arena_slist_free(LrArena *arena, GSList *list);
+
+/** Number of the blocks allocated by the arena.
+ * @param arena         Arena.
+ * @return              Number of the blocks.
+ */
+guint
+lr_arena_blocks(LrArena *arena);
+
+/** Free the arena and everything allocated from it.
+ * @param arena         Arena or NULL.
+ */
+void
+lr_arena_free(LrArena *arena);
+
+G_END_DECLS
+
+#endif
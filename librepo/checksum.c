@@ -29,10 +29,13 @@
 #include <openssl/evp.h>
 
 #include "checksum.h"
+#include "checksumcache_internal.h"
 #include "rcodes.h"
 #include "util.h"
 
 #define BUFFER_SIZE             2048
+#define BATCH_BUFFER_SIZE       (128*1024)
+#define BATCH_MAX_THREADS       16
 #define MAX_CHECKSUM_NAME_LEN   7
 
 LrChecksumType
@@ -98,47 +101,53 @@ lr_checksum_type_to_str(LrChecksumType type)
     return NULL;
 }
 
-char *
-lr_checksum_fd(LrChecksumType type, int fd, GError **err)
+static const EVP_MD *
+lr_checksum_evp_md(LrChecksumType type, GError **err)
 {
-    unsigned int len;
-    ssize_t readed;
-    char buf[BUFFER_SIZE];
-    unsigned char raw_checksum[EVP_MAX_MD_SIZE];
-    char *checksum;
-    EVP_MD_CTX *ctx;
-    const EVP_MD *ctx_type;
-
-    assert(fd > -1);
-    assert(!err || *err == NULL);
-
     switch (type) {
-        case LR_CHECKSUM_MD5:       ctx_type = EVP_md5();    break;
-        case LR_CHECKSUM_SHA1:      ctx_type = EVP_sha1();   break;
-        case LR_CHECKSUM_SHA224:    ctx_type = EVP_sha224(); break;
-        case LR_CHECKSUM_SHA256:    ctx_type = EVP_sha256(); break;
-        case LR_CHECKSUM_SHA384:    ctx_type = EVP_sha384(); break;
-        case LR_CHECKSUM_SHA512:    ctx_type = EVP_sha512(); break;
+        case LR_CHECKSUM_MD5:       return EVP_md5();
+        case LR_CHECKSUM_SHA1:      return EVP_sha1();
+        case LR_CHECKSUM_SHA224:    return EVP_sha224();
+        case LR_CHECKSUM_SHA256:    return EVP_sha256();
+        case LR_CHECKSUM_SHA384:    return EVP_sha384();
+        case LR_CHECKSUM_SHA512:    return EVP_sha512();
         case LR_CHECKSUM_UNKNOWN:
         default:
             g_debug("%s: Unknown checksum type", __func__);
-            assert(0);
             g_set_error(err, LR_CHECKSUM_ERROR, LRE_BADFUNCARG,
                         "Unknown checksum type: %d", type);
             return NULL;
     }
+}
 
-    ctx = EVP_MD_CTX_create();
-    if (!ctx) {
-        g_set_error(err, LR_CHECKSUM_ERROR, LRE_OPENSSL,
-                    "EVP_MD_CTX_create() failed");
+/** Calculate checksum of the file using already allocated context
+ * and buffer. The context is reinitialized, so it could be reused
+ * for an arbitrary number of files.
+ */
+static char *
+lr_checksum_fd_ctx(EVP_MD_CTX *ctx,
+                   LrChecksumType type,
+                   int fd,
+                   char *buf,
+                   size_t buf_size,
+                   GError **err)
+{
+    unsigned int len;
+    ssize_t readed;
+    unsigned char raw_checksum[EVP_MAX_MD_SIZE];
+    char *checksum;
+    const EVP_MD *ctx_type;
+
+    assert(fd > -1);
+    assert(!err || *err == NULL);
+
+    ctx_type = lr_checksum_evp_md(type, err);
+    if (!ctx_type)
         return NULL;
-    }
 
     if (!EVP_DigestInit_ex(ctx, ctx_type, NULL)) {
         g_set_error(err, LR_CHECKSUM_ERROR, LRE_OPENSSL,
                     "EVP_DigestInit_ex() failed");
-        EVP_MD_CTX_destroy(ctx);
         return NULL;
     }
 
@@ -149,7 +158,7 @@ lr_checksum_fd(LrChecksumType type, int fd, GError **err)
         return NULL;
     }
 
-    while ((readed = read(fd, buf, BUFFER_SIZE)) > 0)
+    while ((readed = read(fd, buf, buf_size)) > 0)
         if (!EVP_DigestUpdate(ctx, buf, readed)) {
             g_set_error(err, LR_CHECKSUM_ERROR, LRE_OPENSSL,
                         "EVP_DigestUpdate() failed");
@@ -157,7 +166,6 @@ lr_checksum_fd(LrChecksumType type, int fd, GError **err)
         }
 
     if (readed == -1) {
-        EVP_MD_CTX_destroy(ctx);
         g_set_error(err, LR_CHECKSUM_ERROR, LRE_IO,
                     "read(%d) failed: %s", fd, strerror(errno));
         return NULL;
@@ -169,8 +177,6 @@ lr_checksum_fd(LrChecksumType type, int fd, GError **err)
         return NULL;
     }
 
-    EVP_MD_CTX_destroy(ctx);
-
     checksum = lr_malloc0(sizeof(char) * (len * 2 + 1));
     for (size_t x = 0; x < len; x++)
         sprintf(checksum+(x*2), "%02x", raw_checksum[x]);
@@ -178,6 +184,230 @@ lr_checksum_fd(LrChecksumType type, int fd, GError **err)
     return checksum;
 }
 
+char *
+lr_checksum_fd(LrChecksumType type, int fd, GError **err)
+{
+    char buf[BUFFER_SIZE];
+    char *checksum;
+    EVP_MD_CTX *ctx;
+
+    assert(fd > -1);
+    assert(!err || *err == NULL);
+
+    if (type == LR_CHECKSUM_UNKNOWN || type > LR_CHECKSUM_SHA512) {
+        g_debug("%s: Unknown checksum type", __func__);
+        assert(0);
+        g_set_error(err, LR_CHECKSUM_ERROR, LRE_BADFUNCARG,
+                    "Unknown checksum type: %d", type);
+        return NULL;
+    }
+
+    ctx = EVP_MD_CTX_create();
+    if (!ctx) {
+        g_set_error(err, LR_CHECKSUM_ERROR, LRE_OPENSSL,
+                    "EVP_MD_CTX_create() failed");
+        return NULL;
+    }
+
+    checksum = lr_checksum_fd_ctx(ctx, type, fd, buf, BUFFER_SIZE, err);
+    EVP_MD_CTX_destroy(ctx);
+
+    return checksum;
+}
+
+struct _LrChecksumPool {
+    GThreadPool *threads;   /*!< Worker threads (except the caller) or NULL
+                                 if the caller is the only worker */
+    guint nthreads;         /*!< Number of threads in the threads pool */
+};
+
+/** Shared state of workers of a single lr_checksum_pool_fd() call */
+typedef struct {
+    LrChecksumBatchItem *items; /*!< Items to process */
+    gint count;                 /*!< Number of items */
+    gint next;                  /*!< Index of the next unclaimed item */
+    gboolean failfast;          /*!< Stop after the first failed item */
+    gint stop;                  /*!< Set when the rest should be skipped */
+    guint running;              /*!< Workers of the pool not finished yet */
+    GMutex mutex;               /*!< Guards running */
+    GCond done;                 /*!< Signalled when running drops to 0 */
+} LrChecksumBatch;
+
+static void
+lr_checksum_batch_worker(LrChecksumBatch *batch)
+{
+    EVP_MD_CTX *ctx = EVP_MD_CTX_create();
+    char *buf = lr_malloc(BATCH_BUFFER_SIZE);
+    gint x;
+
+    // Items are claimed one by one, so a single huge file doesn't
+    // block the rest of the batch behind it
+    while ((x = g_atomic_int_add(&batch->next, 1)) < batch->count) {
+        LrChecksumBatchItem *item = &batch->items[x];
+
+        if (g_atomic_int_get(&batch->stop)) {
+            g_set_error(&item->err, LR_CHECKSUM_ERROR, LRE_INTERRUPTED,
+                        "Skipped after a failure of another file");
+            continue;
+        }
+
+        if (!ctx) {
+            g_set_error(&item->err, LR_CHECKSUM_ERROR, LRE_OPENSSL,
+                        "EVP_MD_CTX_create() failed");
+        } else {
+            item->checksum = lr_checksum_fd_ctx(ctx, item->type, item->fd,
+                                                buf, BATCH_BUFFER_SIZE,
+                                                &item->err);
+            if (item->checksum && item->expected)
+                item->matches = strcmp(item->expected, item->checksum) ? FALSE : TRUE;
+        }
+
+        if (batch->failfast
+            && (item->err || (item->expected && !item->matches)))
+            g_atomic_int_set(&batch->stop, 1);
+    }
+
+    if (ctx)
+        EVP_MD_CTX_destroy(ctx);
+    lr_free(buf);
+}
+
+static void
+lr_checksum_pool_worker(gpointer data, G_GNUC_UNUSED gpointer user_data)
+{
+    LrChecksumBatch *batch = data;
+
+    lr_checksum_batch_worker(batch);
+
+    g_mutex_lock(&batch->mutex);
+    if (--batch->running == 0)
+        g_cond_signal(&batch->done);
+    g_mutex_unlock(&batch->mutex);
+}
+
+LrChecksumPool *
+lr_checksum_pool_new(void)
+{
+    LrChecksumPool *pool = lr_malloc0(sizeof(*pool));
+
+    // The calling thread works as one of the workers
+    guint nthreads = MIN(g_get_num_processors(), BATCH_MAX_THREADS) - 1;
+    if (nthreads > 0) {
+        GError *tmp_err = NULL;
+        pool->threads = g_thread_pool_new(lr_checksum_pool_worker, NULL,
+                                          nthreads, TRUE, &tmp_err);
+        if (!pool->threads) {
+            // Not fatal, the caller does the job alone
+            g_debug("%s: Cannot create worker threads: %s",
+                    __func__, tmp_err->message);
+            g_error_free(tmp_err);
+            nthreads = 0;
+        }
+    }
+    pool->nthreads = nthreads;
+
+    g_debug("%s: Checksums are calculated in %u threads",
+            __func__, nthreads + 1);
+
+    return pool;
+}
+
+gboolean
+lr_checksum_pool_fd(LrChecksumPool *pool,
+                    LrChecksumBatchItem *items,
+                    size_t count,
+                    gboolean failfast,
+                    GError **err)
+{
+    LrChecksumBatch batch;
+
+    assert(pool);
+    assert(items || count == 0);
+    assert(!err || *err == NULL);
+
+    if (!count)
+        return TRUE;
+
+    if (count > G_MAXINT) {
+        g_set_error(err, LR_CHECKSUM_ERROR, LRE_BADFUNCARG,
+                    "Too many items in the batch: %zu", count);
+        return FALSE;
+    }
+
+    for (size_t x = 0; x < count; x++) {
+        assert(items[x].fd > -1);
+        items[x].checksum = NULL;
+        items[x].matches = FALSE;
+        items[x].cached = FALSE;
+        items[x].err = NULL;
+    }
+
+    batch.items = items;
+    batch.count = (gint) count;
+    batch.next = 0;
+    batch.failfast = failfast;
+    batch.stop = 0;
+    batch.running = 0;
+    g_mutex_init(&batch.mutex);
+    g_cond_init(&batch.done);
+
+    // Wake up only as many workers as there are items for them
+    guint nworkers = MIN(pool->nthreads, count - 1);
+    for (guint x = 0; x < nworkers; x++) {
+        g_mutex_lock(&batch.mutex);
+        batch.running++;
+        g_mutex_unlock(&batch.mutex);
+        if (!g_thread_pool_push(pool->threads, &batch, NULL)) {
+            // Not fatal, the already running workers do the job
+            g_mutex_lock(&batch.mutex);
+            batch.running--;
+            g_mutex_unlock(&batch.mutex);
+            break;
+        }
+    }
+
+    lr_checksum_batch_worker(&batch);
+
+    g_mutex_lock(&batch.mutex);
+    while (batch.running > 0)
+        g_cond_wait(&batch.done, &batch.mutex);
+    g_mutex_unlock(&batch.mutex);
+
+    g_mutex_clear(&batch.mutex);
+    g_cond_clear(&batch.done);
+
+    for (size_t x = 0; x < count; x++) {
+        if (items[x].err) {
+            g_propagate_error(err, g_error_copy(items[x].err));
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+void
+lr_checksum_pool_free(LrChecksumPool *pool)
+{
+    if (!pool)
+        return;
+    if (pool->threads)
+        g_thread_pool_free(pool->threads, FALSE, TRUE);
+    lr_free(pool);
+}
+
+void
+lr_checksum_batch_clear(LrChecksumBatchItem *items, size_t count)
+{
+    for (size_t x = 0; x < count; x++) {
+        lr_free(items[x].checksum);
+        items[x].checksum = NULL;
+        if (items[x].err)
+            g_error_free(items[x].err);
+        items[x].err = NULL;
+    }
+}
+
 gboolean
 lr_checksum_fd_cmp(LrChecksumType type,
                    int fd,
@@ -201,24 +431,11 @@ lr_checksum_fd_cmp(LrChecksumType type,
 
     if (caching) {
         // Load cached checksum if enabled and used
-        struct stat st;
-        if (fstat(fd, &st) == 0) {
-            ssize_t attr_ret;
-            char *key;
-            char buf[256];
-
-            key = g_strdup_printf("user.Zif.MdChecksum[%llu]",
-                                  (unsigned long long) st.st_mtime);
-            attr_ret = fgetxattr(fd, key, &buf, 256);
-            if (attr_ret != -1) {
-                // Cached checksum found
-                g_debug("%s: Using checksum cached in xattr: [%s] %s",
-                        __func__, key, buf);
-                lr_free(key);
-                *matches = strcmp(expected, buf) ? FALSE : TRUE;
-                return TRUE;
-            }
-            lr_free(key);
+        checksum = lr_checksumcache_lookup(NULL, fd, type);
+        if (checksum) {
+            *matches = strcmp(expected, checksum) ? FALSE : TRUE;
+            lr_free(checksum);
+            return TRUE;
         }
     }
 
@@ -228,16 +445,14 @@ lr_checksum_fd_cmp(LrChecksumType type,
 
     *matches = (strcmp(expected, checksum)) ? FALSE : TRUE;
 
+    if (caching)
+        lr_checksumcache_store(NULL, fd, type, checksum);
+
     if (caching && *matches) {
-        // Store checksum as extended file attribute if caching is enabled
-        struct stat st;
-        if (fstat(fd, &st) == 0) {
-            char *key;
-            key = g_strdup_printf("user.Zif.MdChecksum[%llu]",
-                                  (unsigned long long) st.st_mtime);
-            fsetxattr(fd, key, checksum, strlen(checksum)+1, 0);
-            lr_free(key);
-        }
+        // Store checksum also under the key used by Zif and older
+        // versions of librepo. This key is not used for lookups because
+        // it doesn't identify the checksum type nor the file version.
+        lr_checksumcache_store_legacy(fd, checksum);
     }
 
     lr_free(checksum);
@@ -85,6 +85,71 @@ lr_checksum_fd_cmp(LrChecksumType type,
                    gboolean *matches,
                    GError **err);
 
+/** Single file of a batch checksum calculation.
+ */
+typedef struct {
+    int fd;                 /*!< Opened file descriptor (input) */
+    LrChecksumType type;    /*!< Checksum type (input) */
+    const char *expected;   /*!< Expected checksum value or NULL (input) */
+    char *checksum;         /*!< Malloced calculated checksum or NULL
+                                 if an error occured (output) */
+    gboolean matches;       /*!< TRUE if the calculated checksum matches
+                                 the expected one (output) */
+    gboolean cached;        /*!< TRUE if the checksum was taken from
+                                 a checksum cache (output) */
+    GError *err;            /*!< Error of this file or NULL (output) */
+} LrChecksumBatchItem;
+
+/** Pool of worker threads which calculate checksums of files in parallel.
+ * The threads are created once by lr_checksum_pool_new() and reused
+ * by all lr_checksum_pool_fd() calls with the pool.
+ */
+typedef struct _LrChecksumPool LrChecksumPool;
+
+/** Create a pool with one worker thread per available processor
+ * (the thread calling lr_checksum_pool_fd() is one of the workers).
+ * @return          New pool.
+ */
+LrChecksumPool *
+lr_checksum_pool_new(void);
+
+/** Calculate checksums of several files in parallel by the worker
+ * threads of the pool. Every worker reuses its digest context and read
+ * buffer for all its files. The files are hashed one by one, every file
+ * by a single thread.
+ * @param pool      Pool of worker threads.
+ * @param items     Array of items. Output members of every item are
+ *                  (re)set by this function. Use
+ *                  lr_checksum_batch_clear() to free them.
+ * @param count     Number of items in the array.
+ * @param failfast  If TRUE, the items not started yet are skipped
+ *                  (their err is set) as soon as an item fails or
+ *                  doesn't match its expected checksum.
+ * @param err       GError ** - Copy of the error of the first failed item.
+ * @return          TRUE if checksums of all items were calculated,
+ *                  FALSE otherwise (every failed item has its own
+ *                  error set).
+ */
+gboolean
+lr_checksum_pool_fd(LrChecksumPool *pool,
+                    LrChecksumBatchItem *items,
+                    size_t count,
+                    gboolean failfast,
+                    GError **err);
+
+/** Free the pool. Waits for its worker threads to finish.
+ * @param pool      Pool or NULL.
+ */
+void
+lr_checksum_pool_free(LrChecksumPool *pool);
+
+/** Free output members of items filled by lr_checksum_pool_fd().
+ * @param items     Array of items.
+ * @param count     Number of items in the array.
+ */
+void
+lr_checksum_batch_clear(LrChecksumBatchItem *items, size_t count);
+
 /** @} */
 
 G_END_DECLS
@@ -0,0 +1,565 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2013  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+#define _XOPEN_SOURCE   700 // Because of st_mtim
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <attr/xattr.h>
+
+#include "checksumcache_internal.h"
+#include "rcodes.h"
+#include "util.h"
+
+#define XATTR_PREFIX        "user.librepo.checksum."
+#define XATTR_VALUE_LEN     256
+
+#define INDEX_MAGIC         "LRCHKSUM"  // 8 bytes, without the trailing \0
+#define INDEX_VERSION       1           // Current version of index format
+#define INDEX_MAX_RECORDS   100000      // Older records are dropped
+#define INDEX_LOCK_SUFFIX   ".lock"     // Suffix of the lock file
+#define MAX_DIGEST_LEN      64          // Length of SHA512 digest
+
+/** Record of the index file.
+ * The index file is: LrChecksumCacheHeader followed by
+ * LrChecksumCacheHeader.count records sorted by (dev, ino, type).
+ * All values are in the host byte order - the index is not intended
+ * to be shared between machines.
+ */
+typedef struct {
+    guint64 dev;        // st_dev
+    guint64 ino;        // st_ino
+    guint64 size;       // st_size
+    guint64 mtime_ns;   // st_mtim in nanoseconds
+    guint32 type;       // LrChecksumType
+    guint32 digest_len; // Number of valid bytes in digest
+    guint8 digest[MAX_DIGEST_LEN]; // Binary digest
+} LrChecksumCacheRecord;
+
+typedef struct {
+    char magic[8];
+    guint32 version;
+    guint32 record_size;
+    guint64 count;
+} LrChecksumCacheHeader;
+
+struct _LrChecksumCache {
+    gchar *path;            // Path to the index file
+    void *map;              // Mmaped index file or NULL
+    size_t map_len;         // Length of the map
+    const LrChecksumCacheRecord *records; // Records in the map
+    guint64 count;          // Number of records in the map
+    GHashTable *updates;    // New records (LrChecksumCacheRecord *)
+};
+
+static guint
+lr_record_hash(gconstpointer key)
+{
+    const LrChecksumCacheRecord *rec = key;
+    return (guint) (rec->dev ^ (rec->ino * 31) ^ (rec->type << 24));
+}
+
+static gboolean
+lr_record_equal(gconstpointer a, gconstpointer b)
+{
+    const LrChecksumCacheRecord *ra = a, *rb = b;
+    return ra->dev == rb->dev && ra->ino == rb->ino && ra->type == rb->type;
+}
+
+static int
+lr_record_cmp(const void *a, const void *b)
+{
+    const LrChecksumCacheRecord *ra = a, *rb = b;
+    if (ra->dev != rb->dev)
+        return (ra->dev < rb->dev) ? -1 : 1;
+    if (ra->ino != rb->ino)
+        return (ra->ino < rb->ino) ? -1 : 1;
+    if (ra->type != rb->type)
+        return (ra->type < rb->type) ? -1 : 1;
+    return 0;
+}
+
+static int
+lr_record_cmp_mtime_desc(const void *a, const void *b)
+{
+    const LrChecksumCacheRecord *ra = a, *rb = b;
+    if (ra->mtime_ns == rb->mtime_ns)
+        return 0;
+    return (ra->mtime_ns > rb->mtime_ns) ? -1 : 1;
+}
+
+/** Fill the identification of the file into the record.
+ */
+static gboolean
+lr_record_init(LrChecksumCacheRecord *rec, int fd, LrChecksumType type)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) != 0)
+        return FALSE;
+
+    memset(rec, 0, sizeof(*rec));
+    rec->dev        = (guint64) st.st_dev;
+    rec->ino        = (guint64) st.st_ino;
+    rec->size       = (guint64) st.st_size;
+    rec->mtime_ns   = (guint64) st.st_mtim.tv_sec * 1000000000
+                      + (guint64) st.st_mtim.tv_nsec;
+    rec->type       = (guint32) type;
+    return TRUE;
+}
+
+static gboolean
+lr_hex_to_digest(const char *hex, LrChecksumCacheRecord *rec)
+{
+    size_t len = strlen(hex);
+
+    if (len == 0 || len % 2 || len / 2 > MAX_DIGEST_LEN)
+        return FALSE;
+
+    for (size_t x = 0; x < len / 2; x++) {
+        int hi = g_ascii_xdigit_value(hex[2*x]);
+        int lo = g_ascii_xdigit_value(hex[2*x+1]);
+        if (hi < 0 || lo < 0)
+            return FALSE;
+        rec->digest[x] = (guint8) (hi << 4 | lo);
+    }
+
+    rec->digest_len = (guint32) (len / 2);
+    return TRUE;
+}
+
+static char *
+lr_digest_to_hex(const LrChecksumCacheRecord *rec)
+{
+    static const char hexdigits[] = "0123456789abcdef";
+    char *hex = lr_malloc(rec->digest_len * 2 + 1);
+
+    for (guint32 x = 0; x < rec->digest_len; x++) {
+        hex[2*x]   = hexdigits[rec->digest[x] >> 4];
+        hex[2*x+1] = hexdigits[rec->digest[x] & 0x0f];
+    }
+    hex[rec->digest_len * 2] = '\0';
+    return hex;
+}
+
+LrChecksumCache *
+lr_checksumcache_load(const char *path)
+{
+    LrChecksumCache *cache = lr_malloc0(sizeof(*cache));
+
+    cache->updates = g_hash_table_new_full(lr_record_hash,
+                                           lr_record_equal,
+                                           lr_free,
+                                           NULL);
+    if (!path)
+        return cache;
+
+    cache->path = g_strdup(path);
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        g_debug("%s: Cannot open %s: %s", __func__, path, strerror(errno));
+        return cache;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(LrChecksumCacheHeader)) {
+        g_debug("%s: %s is not a checksum cache", __func__, path);
+        close(fd);
+        return cache;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        g_debug("%s: Cannot mmap %s: %s", __func__, path, strerror(errno));
+        return cache;
+    }
+
+    const LrChecksumCacheHeader *hdr = map;
+    if (memcmp(hdr->magic, INDEX_MAGIC, sizeof(hdr->magic))
+        || hdr->version != INDEX_VERSION
+        || hdr->record_size != sizeof(LrChecksumCacheRecord)
+        || hdr->count != (st.st_size - sizeof(LrChecksumCacheHeader))
+                         / sizeof(LrChecksumCacheRecord)
+        || (st.st_size - sizeof(LrChecksumCacheHeader))
+                         % sizeof(LrChecksumCacheRecord))
+    {
+        g_debug("%s: %s is not a compatible checksum cache", __func__, path);
+        munmap(map, st.st_size);
+        return cache;
+    }
+
+    cache->map = map;
+    cache->map_len = st.st_size;
+    cache->records = (const LrChecksumCacheRecord *)
+                     ((const char *) map + sizeof(LrChecksumCacheHeader));
+    cache->count = hdr->count;
+
+    g_debug("%s: Loaded %"G_GUINT64_FORMAT" records from %s",
+            __func__, cache->count, path);
+
+    return cache;
+}
+
+static char *
+lr_checksumcache_xattr_lookup(int fd,
+                              LrChecksumType type,
+                              const LrChecksumCacheRecord *key)
+{
+    char *name = g_strconcat(XATTR_PREFIX, lr_checksum_type_to_str(type), NULL);
+    char buf[XATTR_VALUE_LEN];
+    ssize_t len = fgetxattr(fd, name, buf, sizeof(buf) - 1);
+
+    lr_free(name);
+
+    if (len <= 0)
+        return NULL;
+    buf[len] = '\0';
+
+    // Value format: "<size> <mtime_ns> <checksum>"
+    char *endptr;
+    guint64 size = g_ascii_strtoull(buf, &endptr, 10);
+    if (*endptr != ' ')
+        return NULL;
+    guint64 mtime_ns = g_ascii_strtoull(endptr + 1, &endptr, 10);
+    if (*endptr != ' ')
+        return NULL;
+
+    if (size != key->size || mtime_ns != key->mtime_ns) {
+        // Outdated record
+        return NULL;
+    }
+
+    return g_strdup(endptr + 1);
+}
+
+char *
+lr_checksumcache_lookup(LrChecksumCache *cache, int fd, LrChecksumType type)
+{
+    LrChecksumCacheRecord key;
+    const LrChecksumCacheRecord *rec = NULL;
+    char *checksum;
+
+    if (type == LR_CHECKSUM_UNKNOWN || !lr_record_init(&key, fd, type))
+        return NULL;
+
+    checksum = lr_checksumcache_xattr_lookup(fd, type, &key);
+    if (checksum) {
+        g_debug("%s: Using checksum cached in xattr: %s", __func__, checksum);
+        return checksum;
+    }
+
+    if (!cache)
+        return NULL;
+
+    rec = g_hash_table_lookup(cache->updates, &key);
+    if (!rec && cache->count)
+        rec = bsearch(&key, cache->records, cache->count,
+                      sizeof(LrChecksumCacheRecord), lr_record_cmp);
+
+    if (!rec || rec->size != key.size || rec->mtime_ns != key.mtime_ns)
+        return NULL;
+
+    checksum = lr_digest_to_hex(rec);
+    g_debug("%s: Using checksum cached in %s: %s",
+            __func__, cache->path, checksum);
+    return checksum;
+}
+
+void
+lr_checksumcache_store(LrChecksumCache *cache,
+                       int fd,
+                       LrChecksumType type,
+                       const char *checksum)
+{
+    LrChecksumCacheRecord *rec;
+
+    if (type == LR_CHECKSUM_UNKNOWN || !checksum)
+        return;
+
+    rec = lr_malloc0(sizeof(*rec));
+    if (!lr_record_init(rec, fd, type) || !lr_hex_to_digest(checksum, rec)) {
+        lr_free(rec);
+        return;
+    }
+
+    char *name = g_strconcat(XATTR_PREFIX, lr_checksum_type_to_str(type), NULL);
+    char *value = g_strdup_printf("%"G_GUINT64_FORMAT" %"G_GUINT64_FORMAT" %s",
+                                  rec->size, rec->mtime_ns, checksum);
+    int rc = fsetxattr(fd, name, value, strlen(value), 0);
+    lr_free(name);
+    lr_free(value);
+
+    if (rc == 0 || !cache || !cache->path) {
+        lr_free(rec);
+        return;
+    }
+
+    // Extended attributes are not available, use the index file
+    g_debug("%s: Cannot set xattr (%s), using index file %s",
+            __func__, strerror(errno), cache->path);
+    g_hash_table_replace(cache->updates, rec, rec);
+}
+
+gboolean
+lr_checksumcache_fd_cmp(LrChecksumCache *cache,
+                        LrChecksumType type,
+                        int fd,
+                        const char *expected,
+                        gboolean *matches,
+                        GError **err)
+{
+    char *checksum;
+
+    assert(fd >= 0);
+    assert(!err || *err == NULL);
+
+    *matches = FALSE;
+
+    if (!expected) {
+        g_set_error(err, LR_CHECKSUM_ERROR, LRE_BADFUNCARG,
+                    "No expected checksum passed");
+        return FALSE;
+    }
+
+    checksum = lr_checksumcache_lookup(cache, fd, type);
+    if (!checksum) {
+        checksum = lr_checksum_fd(type, fd, err);
+        if (!checksum)
+            return FALSE;
+        lr_checksumcache_store(cache, fd, type, checksum);
+    }
+
+    *matches = strcmp(expected, checksum) ? FALSE : TRUE;
+    lr_free(checksum);
+
+    return TRUE;
+}
+
+gboolean
+lr_checksumcache_pool_fd(LrChecksumCache *cache,
+                         LrChecksumPool *pool,
+                         LrChecksumBatchItem *items,
+                         size_t count,
+                         gboolean failfast,
+                         GError **err)
+{
+    gboolean ret;
+    size_t missing = 0;
+    LrChecksumBatchItem *todo;
+    GError *first_err = NULL;
+
+    assert(pool);
+    assert(!err || *err == NULL);
+
+    for (size_t x = 0; x < count; x++) {
+        LrChecksumBatchItem *item = &items[x];
+
+        item->matches = FALSE;
+        item->err = NULL;
+        item->checksum = lr_checksumcache_lookup(cache, item->fd, item->type);
+        item->cached = item->checksum ? TRUE : FALSE;
+        if (item->checksum && item->expected)
+            item->matches = strcmp(item->expected, item->checksum) ? FALSE : TRUE;
+        else if (!item->checksum)
+            missing++;
+    }
+
+    if (!missing)
+        return TRUE;
+
+    // Calculate only the missing checksums
+    todo = g_new(LrChecksumBatchItem, missing);
+    for (size_t x = 0, y = 0; x < count; x++)
+        if (!items[x].cached)
+            todo[y++] = items[x];
+
+    ret = lr_checksum_pool_fd(pool, todo, missing, failfast, &first_err);
+
+    for (size_t x = 0, y = 0; x < count; x++) {
+        if (items[x].cached)
+            continue;
+        items[x] = todo[y++];
+        if (items[x].checksum)
+            lr_checksumcache_store(cache, items[x].fd, items[x].type,
+                                   items[x].checksum);
+    }
+
+    g_free(todo);
+
+    if (!ret)
+        g_propagate_error(err, first_err);
+
+    return ret;
+}
+
+void
+lr_checksumcache_store_legacy(int fd, const char *checksum)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) == 0) {
+        char *key;
+        key = g_strdup_printf("user.Zif.MdChecksum[%llu]",
+                              (unsigned long long) st.st_mtime);
+        fsetxattr(fd, key, checksum, strlen(checksum)+1, 0);
+        lr_free(key);
+    }
+}
+
+/** Lock the index file.
+ * @return      File descriptor of the lock (closing it releases the lock)
+ *              or -1 if err is set.
+ */
+static int
+lr_checksumcache_lock(const char *path, GError **err)
+{
+    gchar *lock_path = g_strconcat(path, INDEX_LOCK_SUFFIX, NULL);
+    int lock_fd = open(lock_path, O_RDWR|O_CREAT, 0644);
+
+    if (lock_fd == -1) {
+        g_set_error(err, LR_CHECKSUM_ERROR, LRE_IO,
+                    "Cannot open %s: %s", lock_path, strerror(errno));
+    } else if (flock(lock_fd, LOCK_EX) == -1) {
+        g_set_error(err, LR_CHECKSUM_ERROR, LRE_IO,
+                    "Cannot lock %s: %s", lock_path, strerror(errno));
+        close(lock_fd);
+        lock_fd = -1;
+    }
+
+    g_free(lock_path);
+    return lock_fd;
+}
+
+gboolean
+lr_checksumcache_write(LrChecksumCache *cache, GError **err)
+{
+    assert(!err || *err == NULL);
+
+    if (!cache || !cache->path || !g_hash_table_size(cache->updates))
+        return TRUE;  // Nothing to do
+
+    // Serialize writers - a record written by another process between
+    // our load and write must not be lost
+    int lock_fd = lr_checksumcache_lock(cache->path, err);
+    if (lock_fd == -1)
+        return FALSE;
+
+    // Merge the current content of the file with our records
+    LrChecksumCache *current = lr_checksumcache_load(cache->path);
+    guint64 count = 0;
+    guint64 max = current->count + g_hash_table_size(cache->updates);
+    LrChecksumCacheRecord *records = g_new(LrChecksumCacheRecord, max);
+
+    for (guint64 x = 0; x < current->count; x++) {
+        if (g_hash_table_lookup(cache->updates, &current->records[x]))
+            continue;  // Superseded by a new record
+        records[count++] = current->records[x];
+    }
+
+    lr_checksumcache_free(current);
+
+    GHashTableIter iter;
+    gpointer key;
+    g_hash_table_iter_init(&iter, cache->updates);
+    while (g_hash_table_iter_next(&iter, &key, NULL))
+        records[count++] = *((LrChecksumCacheRecord *) key);
+
+    if (count > INDEX_MAX_RECORDS) {
+        // Keep only the most recently modified files
+        qsort(records, count, sizeof(*records), lr_record_cmp_mtime_desc);
+        count = INDEX_MAX_RECORDS;
+    }
+
+    qsort(records, count, sizeof(*records), lr_record_cmp);
+
+    LrChecksumCacheHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic));
+    hdr.version = INDEX_VERSION;
+    hdr.record_size = sizeof(LrChecksumCacheRecord);
+    hdr.count = count;
+
+    // Write to a temporary file and atomically replace the old one
+    gchar *tmp_path = g_strconcat(cache->path, ".XXXXXX", NULL);
+    int fd = g_mkstemp(tmp_path);
+    if (fd == -1) {
+        g_set_error(err, LR_CHECKSUM_ERROR, LRE_IO,
+                    "Cannot create %s: %s", tmp_path, strerror(errno));
+        g_free(tmp_path);
+        g_free(records);
+        close(lock_fd);
+        return FALSE;
+    }
+
+    gboolean ret = TRUE;
+    size_t len = count * sizeof(*records);
+    if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)
+        || write(fd, records, len) != (ssize_t) len)
+    {
+        g_set_error(err, LR_CHECKSUM_ERROR, LRE_IO,
+                    "Cannot write %s: %s", tmp_path, strerror(errno));
+        ret = FALSE;
+    }
+
+    fchmod(fd, 0644);
+    close(fd);
+    g_free(records);
+
+    if (ret && rename(tmp_path, cache->path) == -1) {
+        g_set_error(err, LR_CHECKSUM_ERROR, LRE_IO,
+                    "Cannot rename %s to %s: %s",
+                    tmp_path, cache->path, strerror(errno));
+        ret = FALSE;
+    }
+
+    if (!ret)
+        unlink(tmp_path);
+    else
+        g_debug("%s: Written %"G_GUINT64_FORMAT" records to %s",
+                __func__, count, cache->path);
+
+    g_free(tmp_path);
+    close(lock_fd);
+    return ret;
+}
+
+void
+lr_checksumcache_free(LrChecksumCache *cache)
+{
+    if (!cache)
+        return;
+    if (cache->map)
+        munmap(cache->map, cache->map_len);
+    g_hash_table_destroy(cache->updates);
+    g_free(cache->path);
+    lr_free(cache);
+}
@@ -0,0 +1,137 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2013  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+#ifndef LR_CHECKSUMCACHE_INTERNAL_H
+#define LR_CHECKSUMCACHE_INTERNAL_H
+
+#include <glib.h>
+
+#include "checksum.h"
+
+G_BEGIN_DECLS
+
+/** Persistent cache of calculated checksums.
+ *
+ * Every record is identified by (st_dev, st_ino, st_size, mtime in
+ * nanoseconds, checksum type) of the file. Records are primarily
+ * stored as user extended attributes of the files. If the file system
+ * doesn't support them (overlayfs, some NFS setups, ...), records are
+ * stored to an index file which could be directly mmaped.
+ */
+typedef struct _LrChecksumCache LrChecksumCache;
+
+/** Load the checksum cache.
+ * @param path      Path to the index file or NULL. If NULL, only
+ *                  extended attributes are used.
+ * @return          New checksum cache. Broken or incompatible index file
+ *                  is silently ignored (and rewritten by the next write).
+ */
+LrChecksumCache *
+lr_checksumcache_load(const char *path);
+
+/** Lookup a checksum of the file in the cache.
+ * @param cache     Cache or NULL (only extended attributes are used).
+ * @param fd        Opened file descriptor.
+ * @param type      Checksum type.
+ * @return          Malloced checksum string or NULL if no valid record
+ *                  for the current version of the file exists.
+ */
+char *
+lr_checksumcache_lookup(LrChecksumCache *cache, int fd, LrChecksumType type);
+
+/** Store a checksum of the file to the cache.
+ * @param cache     Cache or NULL (only extended attributes are used).
+ * @param fd        Opened file descriptor.
+ * @param type      Checksum type.
+ * @param checksum  Checksum string.
+ */
+void
+lr_checksumcache_store(LrChecksumCache *cache,
+                       int fd,
+                       LrChecksumType type,
+                       const char *checksum);
+
+/** Calculate checksum of the file (or use the cached one) and
+ * compare it to the expected value.
+ * @param cache     Cache or NULL (only extended attributes are used).
+ * @param type      Checksum type.
+ * @param fd        Opened file descriptor.
+ * @param expected  Expected checksum value.
+ * @param matches   Set pointed variable to TRUE if checksum matches.
+ * @param err       GError **
+ * @return          TRUE if error is not set and FALSE if it is.
+ */
+gboolean
+lr_checksumcache_fd_cmp(LrChecksumCache *cache,
+                        LrChecksumType type,
+                        int fd,
+                        const char *expected,
+                        gboolean *matches,
+                        GError **err);
+
+/** Batch variant of lr_checksumcache_fd_cmp().
+ * Checksums missing in the cache are calculated by
+ * lr_checksum_pool_fd() and stored to the cache.
+ * @param cache     Cache or NULL (only extended attributes are used).
+ * @param pool      Pool of worker threads.
+ * @param items     Array of items (see lr_checksum_pool_fd()).
+ * @param count     Number of items in the array.
+ * @param failfast  Skip the items not started yet after the first
+ *                  failed or mismatching one (cached mismatches
+ *                  don't stop the calculation).
+ * @param err       GError ** - Copy of the error of the first failed item.
+ * @return          TRUE if no item failed, FALSE otherwise.
+ */
+gboolean
+lr_checksumcache_pool_fd(LrChecksumCache *cache,
+                         LrChecksumPool *pool,
+                         LrChecksumBatchItem *items,
+                         size_t count,
+                         gboolean failfast,
+                         GError **err);
+
+/** Store the checksum as the "user.Zif.MdChecksum[mtime]" extended
+ * attribute used by Zif and older versions of librepo. This key is never
+ * used for lookups because it identifies neither the checksum type nor
+ * the exact version of the file.
+ * @param fd        Opened file descriptor.
+ * @param checksum  Checksum string.
+ */
+void
+lr_checksumcache_store_legacy(int fd, const char *checksum);
+
+/** Write modified index file (if any) back to the disk.
+ * The file is written to a temporary file and atomically renamed.
+ * @param cache     Cache or NULL.
+ * @param err       GError **
+ * @return          TRUE if error is not set and FALSE if it is.
+ */
+gboolean
+lr_checksumcache_write(LrChecksumCache *cache, GError **err);
+
+/** Free the cache. Unwritten changes are lost.
+ * @param cache     Cache or NULL.
+ */
+void
+lr_checksumcache_free(LrChecksumCache *cache);
+
+G_END_DECLS
+
+#endif
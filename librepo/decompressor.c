@@ -0,0 +1,470 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2013  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#define _XOPEN_SOURCE   500 // Because of ftruncate()
+#include <glib.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <openssl/evp.h>
+#include <zlib.h>
+#include <bzlib.h>
+#include <lzma.h>
+
+#include "decompressor_internal.h"
+#include "rcodes.h"
+#include "util.h"
+
+#define OUT_BUFFER_SIZE     (128*1024)
+#define MAGIC_LEN           6
+
+typedef enum {
+    LR_COMPRESSION_UNKNOWN,
+    LR_COMPRESSION_GZ,
+    LR_COMPRESSION_BZ2,
+    LR_COMPRESSION_XZ,
+} LrCompression;
+
+struct _LrDecompressor {
+    char *fn;               /*!< Output filename */
+    int fd;                 /*!< Output file */
+
+    LrChecksumType checksum_type;   /*!< Expected checksum type */
+    char *checksum;         /*!< Expected checksum or NULL */
+    gint64 expected_size;   /*!< Expected size or <= 0 */
+
+    LrCompression compression; /*!< Detected compression */
+    unsigned char magic[MAGIC_LEN]; /*!< The first bytes of the data */
+    size_t magic_len;       /*!< Number of bytes in the magic */
+    gboolean stream_end;    /*!< The last compressed stream is complete.
+                                 Next data start a concatenated stream. */
+
+    z_stream zs;            /*!< gzip state */
+    bz_stream bzs;          /*!< bzip2 state */
+    lzma_stream xzs;        /*!< xz state */
+
+    EVP_MD_CTX *ctx;        /*!< Checksum of the decompressed data or NULL */
+    gint64 size;            /*!< Size of the decompressed data */
+    char *out;              /*!< Output buffer */
+};
+
+static LrCompression
+lr_detect_compression(const unsigned char *magic, size_t len)
+{
+    if (len >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+        return LR_COMPRESSION_GZ;
+    if (len >= 3 && !memcmp(magic, "BZh", 3))
+        return LR_COMPRESSION_BZ2;
+    if (len >= 6 && !memcmp(magic, "\xfd" "7zXZ\0", 6))
+        return LR_COMPRESSION_XZ;
+    return LR_COMPRESSION_UNKNOWN;
+}
+
+static gboolean
+lr_decompressor_init_stream(LrDecompressor *d, GError **err)
+{
+    int rc;
+
+    switch (d->compression) {
+    case LR_COMPRESSION_GZ:
+        memset(&d->zs, 0, sizeof(d->zs));
+        rc = inflateInit2(&d->zs, 15 + 16);  // gzip header only
+        if (rc == Z_OK)
+            return TRUE;
+        break;
+    case LR_COMPRESSION_BZ2:
+        memset(&d->bzs, 0, sizeof(d->bzs));
+        rc = BZ2_bzDecompressInit(&d->bzs, 0, 0);
+        if (rc == BZ_OK)
+            return TRUE;
+        break;
+    case LR_COMPRESSION_XZ:
+        memset(&d->xzs, 0, sizeof(d->xzs));
+        rc = lzma_stream_decoder(&d->xzs, UINT64_MAX, LZMA_CONCATENATED);
+        if (rc == LZMA_OK)
+            return TRUE;
+        break;
+    default:
+        assert(0);
+        rc = -1;
+    }
+
+    g_set_error(err, LR_DOWNLOADER_ERROR, LRE_MEMORY,
+                "Cannot initialize decompression (code: %d)", rc);
+    d->compression = LR_COMPRESSION_UNKNOWN;
+    return FALSE;
+}
+
+static void
+lr_decompressor_end_stream(LrDecompressor *d)
+{
+    switch (d->compression) {
+    case LR_COMPRESSION_GZ:  inflateEnd(&d->zs);            break;
+    case LR_COMPRESSION_BZ2: BZ2_bzDecompressEnd(&d->bzs);  break;
+    case LR_COMPRESSION_XZ:  lzma_end(&d->xzs);             break;
+    default:                                                break;
+    }
+
+    d->compression = LR_COMPRESSION_UNKNOWN;
+    d->stream_end = FALSE;
+}
+
+static gboolean
+lr_decompressor_output(LrDecompressor *d, size_t len, GError **err)
+{
+    if (!len)
+        return TRUE;
+
+    if (d->ctx && !EVP_DigestUpdate(d->ctx, d->out, len)) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_OPENSSL,
+                    "EVP_DigestUpdate() failed");
+        return FALSE;
+    }
+
+    d->size += len;
+    if (d->expected_size > 0 && d->size > d->expected_size) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_BADCHECKSUM,
+                    "Decompressed data are bigger than expected "
+                    "(%"G_GINT64_FORMAT" bytes)", d->expected_size);
+        return FALSE;
+    }
+
+    for (size_t written = 0; written < len;) {
+        ssize_t rc = write(d->fd, d->out + written, len - written);
+        if (rc == -1) {
+            if (errno == EINTR)
+                continue;
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                        "Cannot write to %s: %s", d->fn, strerror(errno));
+            return FALSE;
+        }
+        written += rc;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+lr_decompressor_corrupted(LrDecompressor *d, int rc, GError **err)
+{
+    g_set_error(err, LR_DOWNLOADER_ERROR, LRE_BADCHECKSUM,
+                "Corrupted compressed data (code: %d) for %s", rc, d->fn);
+    return FALSE;
+}
+
+/** Decompress the data. If finish is TRUE, no more data will follow.
+ * Every loop runs while there is an input or while the output buffer
+ * was filled up (the decoder could have more pending output).
+ */
+static gboolean
+lr_decompressor_process(LrDecompressor *d,
+                        const unsigned char *buf,
+                        size_t len,
+                        gboolean finish,
+                        GError **err)
+{
+    gboolean full = FALSE;
+
+    switch (d->compression) {
+    case LR_COMPRESSION_GZ:
+        d->zs.next_in = (unsigned char *) buf;
+        d->zs.avail_in = len;
+        while (d->zs.avail_in > 0 || full) {
+            if (d->stream_end) {
+                if (!d->zs.avail_in)
+                    break;
+                // Concatenated gzip member
+                inflateReset(&d->zs);
+                d->stream_end = FALSE;
+            }
+            d->zs.next_out = (unsigned char *) d->out;
+            d->zs.avail_out = OUT_BUFFER_SIZE;
+            int rc = inflate(&d->zs, Z_NO_FLUSH);
+            if (rc == Z_STREAM_END)
+                d->stream_end = TRUE;
+            else if (rc != Z_OK && rc != Z_BUF_ERROR)
+                return lr_decompressor_corrupted(d, rc, err);
+            if (!lr_decompressor_output(d, OUT_BUFFER_SIZE - d->zs.avail_out, err))
+                return FALSE;
+            full = (d->zs.avail_out == 0);
+        }
+        break;
+
+    case LR_COMPRESSION_BZ2:
+        d->bzs.next_in = (char *) buf;
+        d->bzs.avail_in = len;
+        while (d->bzs.avail_in > 0 || full) {
+            if (d->stream_end) {
+                if (!d->bzs.avail_in)
+                    break;
+                // Concatenated bzip2 stream
+                char *next_in = d->bzs.next_in;
+                unsigned int avail_in = d->bzs.avail_in;
+                BZ2_bzDecompressEnd(&d->bzs);
+                memset(&d->bzs, 0, sizeof(d->bzs));
+                if (BZ2_bzDecompressInit(&d->bzs, 0, 0) != BZ_OK)
+                    return lr_decompressor_corrupted(d, BZ_MEM_ERROR, err);
+                d->bzs.next_in = next_in;
+                d->bzs.avail_in = avail_in;
+                d->stream_end = FALSE;
+            }
+            d->bzs.next_out = d->out;
+            d->bzs.avail_out = OUT_BUFFER_SIZE;
+            int rc = BZ2_bzDecompress(&d->bzs);
+            if (rc == BZ_STREAM_END)
+                d->stream_end = TRUE;
+            else if (rc != BZ_OK)
+                return lr_decompressor_corrupted(d, rc, err);
+            if (!lr_decompressor_output(d, OUT_BUFFER_SIZE - d->bzs.avail_out, err))
+                return FALSE;
+            full = (d->bzs.avail_out == 0);
+        }
+        break;
+
+    case LR_COMPRESSION_XZ:
+        // LZMA_CONCATENATED decoder handles concatenated streams itself,
+        // the end is reported only after LZMA_FINISH
+        d->xzs.next_in = buf;
+        d->xzs.avail_in = len;
+        while (d->xzs.avail_in > 0 || full || (finish && !d->stream_end)) {
+            d->xzs.next_out = (uint8_t *) d->out;
+            d->xzs.avail_out = OUT_BUFFER_SIZE;
+            lzma_ret rc = lzma_code(&d->xzs, finish ? LZMA_FINISH : LZMA_RUN);
+            if (rc == LZMA_STREAM_END)
+                d->stream_end = TRUE;
+            else if (rc != LZMA_OK)
+                return lr_decompressor_corrupted(d, rc, err);
+            if (!lr_decompressor_output(d, OUT_BUFFER_SIZE - d->xzs.avail_out, err))
+                return FALSE;
+            full = (d->xzs.avail_out == 0);
+            if (d->stream_end)
+                break;
+        }
+        break;
+
+    default:
+        assert(0);
+    }
+
+    return TRUE;
+}
+
+LrDecompressor *
+lr_decompressor_new(const char *fn,
+                    LrChecksumType checksum_type,
+                    const char *checksum,
+                    gint64 expected_size,
+                    GError **err)
+{
+    assert(fn);
+    assert(!err || *err == NULL);
+
+    int fd = open(fn, O_CREAT|O_TRUNC|O_WRONLY, 0666);
+    if (fd < 0) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "Cannot create/open %s: %s", fn, strerror(errno));
+        return NULL;
+    }
+
+    LrDecompressor *d = lr_malloc0(sizeof(*d));
+    d->fn = g_strdup(fn);
+    d->fd = fd;
+    d->checksum_type = checksum_type;
+    d->checksum = g_strdup(checksum);
+    d->expected_size = expected_size;
+    d->out = lr_malloc(OUT_BUFFER_SIZE);
+
+    if (!lr_decompressor_reset(d, err)) {
+        lr_decompressor_free(d);
+        return NULL;
+    }
+
+    return d;
+}
+
+gboolean
+lr_decompressor_reset(LrDecompressor *d, GError **err)
+{
+    assert(d);
+    assert(!err || *err == NULL);
+
+    lr_decompressor_end_stream(d);
+    d->magic_len = 0;
+    d->size = 0;
+
+    if (ftruncate(d->fd, 0) == -1 || lseek(d->fd, 0, SEEK_SET) == -1) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "Cannot truncate %s: %s", d->fn, strerror(errno));
+        return FALSE;
+    }
+
+    if (!d->checksum)
+        return TRUE;
+
+    const EVP_MD *md = NULL;
+    switch (d->checksum_type) {
+        case LR_CHECKSUM_MD5:       md = EVP_md5();    break;
+        case LR_CHECKSUM_SHA1:      md = EVP_sha1();   break;
+        case LR_CHECKSUM_SHA224:    md = EVP_sha224(); break;
+        case LR_CHECKSUM_SHA256:    md = EVP_sha256(); break;
+        case LR_CHECKSUM_SHA384:    md = EVP_sha384(); break;
+        case LR_CHECKSUM_SHA512:    md = EVP_sha512(); break;
+        case LR_CHECKSUM_UNKNOWN:
+        default:
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_UNKNOWNCHECKSUM,
+                        "Unknown checksum type: %d", d->checksum_type);
+            return FALSE;
+    }
+
+    if (!d->ctx)
+        d->ctx = EVP_MD_CTX_create();
+
+    if (!d->ctx || !EVP_DigestInit_ex(d->ctx, md, NULL)) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_OPENSSL,
+                    "Cannot initialize checksum calculation");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+gboolean
+lr_decompressor_write(LrDecompressor *d,
+                      const char *buf,
+                      size_t len,
+                      GError **err)
+{
+    assert(d);
+    assert(!err || *err == NULL);
+
+    if (d->compression == LR_COMPRESSION_UNKNOWN) {
+        // Collect the magic bytes first
+        size_t n = MIN(len, MAGIC_LEN - d->magic_len);
+        memcpy(d->magic + d->magic_len, buf, n);
+        d->magic_len += n;
+        buf += n;
+        len -= n;
+
+        if (d->magic_len < MAGIC_LEN)
+            return TRUE;
+
+        d->compression = lr_detect_compression(d->magic, d->magic_len);
+        if (d->compression == LR_COMPRESSION_UNKNOWN) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_BADCHECKSUM,
+                        "Unknown compression of data for %s", d->fn);
+            return FALSE;
+        }
+
+        if (!lr_decompressor_init_stream(d, err))
+            return FALSE;
+
+        if (!lr_decompressor_process(d, d->magic, d->magic_len, FALSE, err))
+            return FALSE;
+    }
+
+    return lr_decompressor_process(d, (const unsigned char *) buf, len,
+                                   FALSE, err);
+}
+
+gboolean
+lr_decompressor_finish(LrDecompressor *d, GError **err)
+{
+    assert(d);
+    assert(!err || *err == NULL);
+
+    if (d->compression == LR_COMPRESSION_UNKNOWN) {
+        // Less than MAGIC_LEN bytes of data
+        d->compression = lr_detect_compression(d->magic, d->magic_len);
+        if (d->compression == LR_COMPRESSION_UNKNOWN) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_BADCHECKSUM,
+                        "Unknown compression of data for %s", d->fn);
+            return FALSE;
+        }
+        if (!lr_decompressor_init_stream(d, err))
+            return FALSE;
+        if (!lr_decompressor_process(d, d->magic, d->magic_len, FALSE, err))
+            return FALSE;
+    }
+
+    if (!lr_decompressor_process(d, NULL, 0, TRUE, err))
+        return FALSE;
+
+    if (!d->stream_end) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_BADCHECKSUM,
+                    "Compressed data for %s are incomplete", d->fn);
+        return FALSE;
+    }
+
+    if (d->expected_size > 0 && d->size != d->expected_size) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_BADCHECKSUM,
+                    "Size of decompressed %s doesn't match "
+                    "(%"G_GINT64_FORMAT" != %"G_GINT64_FORMAT")",
+                    d->fn, d->size, d->expected_size);
+        return FALSE;
+    }
+
+    if (d->checksum) {
+        unsigned char raw[EVP_MAX_MD_SIZE];
+        unsigned int raw_len;
+        char hex[EVP_MAX_MD_SIZE * 2 + 1];
+
+        if (!EVP_DigestFinal_ex(d->ctx, raw, &raw_len)) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_OPENSSL,
+                        "EVP_DigestFinal_ex() failed");
+            return FALSE;
+        }
+
+        for (unsigned int x = 0; x < raw_len; x++)
+            sprintf(hex + x * 2, "%02x", raw[x]);
+
+        if (g_ascii_strcasecmp(hex, d->checksum)) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_BADCHECKSUM,
+                        "Checksum of decompressed %s doesn't match "
+                        "(%s != %s)", d->fn, hex, d->checksum);
+            return FALSE;
+        }
+    }
+
+    g_debug("%s: Decompressed %s (%"G_GINT64_FORMAT" bytes)",
+            __func__, d->fn, d->size);
+
+    return TRUE;
+}
+
+void
+lr_decompressor_free(LrDecompressor *d)
+{
+    if (!d)
+        return;
+
+    lr_decompressor_end_stream(d);
+    if (d->ctx)
+        EVP_MD_CTX_destroy(d->ctx);
+    if (d->fd >= 0)
+        close(d->fd);
+    lr_free(d->out);
+    lr_free(d->checksum);
+    lr_free(d->fn);
+    lr_free(d);
+}
@@ -0,0 +1,96 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2013  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+#ifndef LR_DECOMPRESSOR_INTERNAL_H
+#define LR_DECOMPRESSOR_INTERNAL_H
+
+#include <glib.h>
+
+#include "checksum.h"
+
+G_BEGIN_DECLS
+
+/** Streaming decompressor.
+ *
+ * Compressed data are passed in arbitrary pieces (as they come from
+ * the network) and the decompressed data are written to an output file.
+ * The compression (gzip, bzip2 or xz) is detected from the magic bytes
+ * of the data. Checksum and size of the decompressed data are calculated
+ * on the fly, so the output file never has to be read again.
+ */
+typedef struct _LrDecompressor LrDecompressor;
+
+/** Create a new decompressor.
+ * @param fn                Output file. It is created (or truncated).
+ * @param checksum_type     Type of the expected checksum.
+ * @param checksum          Expected checksum of the decompressed data
+ *                          or NULL.
+ * @param expected_size     Expected size of the decompressed data or
+ *                          a value <= 0 if unknown.
+ * @param err               GError **
+ * @return                  New decompressor or NULL on error.
+ */
+LrDecompressor *
+lr_decompressor_new(const char *fn,
+                    LrChecksumType checksum_type,
+                    const char *checksum,
+                    gint64 expected_size,
+                    GError **err);
+
+/** Start again from the beginning. The output file is truncated.
+ * Used when a download is restarted (e.g. from another mirror).
+ * @param decompressor      Decompressor.
+ * @param err               GError **
+ * @return                  TRUE if error is not set and FALSE if it is.
+ */
+gboolean
+lr_decompressor_reset(LrDecompressor *decompressor, GError **err);
+
+/** Decompress the next piece of the compressed data.
+ * @param decompressor      Decompressor.
+ * @param buf               Compressed data.
+ * @param len               Length of the data.
+ * @param err               GError **
+ * @return                  TRUE if error is not set and FALSE if it is.
+ */
+gboolean
+lr_decompressor_write(LrDecompressor *decompressor,
+                      const char *buf,
+                      size_t len,
+                      GError **err);
+
+/** Check that the compressed stream is complete and that the checksum
+ * and the size of the decompressed data match the expected values.
+ * @param decompressor      Decompressor.
+ * @param err               GError **
+ * @return                  TRUE if error is not set and FALSE if it is.
+ */
+gboolean
+lr_decompressor_finish(LrDecompressor *decompressor, GError **err);
+
+/** Free the decompressor and close the output file.
+ * @param decompressor      Decompressor or NULL.
+ */
+void
+lr_decompressor_free(LrDecompressor *decompressor);
+
+G_END_DECLS
+
+#endif
@@ -28,15 +28,41 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
 #include <curl/curl.h>
 
 #include "downloader.h"
+#include "downloader_internal.h"
+#include "arena_internal.h"
+#include "decompressor_internal.h"
 #include "rcodes.h"
 #include "util.h"
 #include "downloadtarget.h"
 #include "downloadtarget_internal.h"
 #include "handle.h"
 #include "handle_internal.h"
+#include "mirrorstats_internal.h"
+
+/* Max number of the pulled targets which are not done yet
+ * (as a multiple of the max number of parallel connections) */
+#define STREAM_WINDOW   2
+
+/* Adaptive timeouts (LRO_ADAPTIVETIMEOUTS) */
+#define ADAPTIVE_CONNECTTIMEOUT_MIN     3000    // Lower bound in ms
+#define ADAPTIVE_CONNECTTIMEOUT_FACTOR  4       // Timeout = factor * (srtt + 4 * rttvar)
+#define ADAPTIVE_RATE_WINDOW            5       // Rate of a transfer is measured over seconds
+#define ADAPTIVE_RATE_MIN_BYTES         65536   // Smaller transfers say nothing about the rate
+#define ADAPTIVE_RATE_SAMPLES           64      // Recent rates used for the median
+#define ADAPTIVE_RATE_MIN_SAMPLES       4       // Don't judge without enough rates
+#define ADAPTIVE_SLOW_FACTOR            10      // Slow means below median / factor
+
+/* Autotuning of the number of parallel downloads (LRO_AUTOTUNE) */
+#define AUTOTUNE_INTERVAL   2       // Seconds between two decisions
+#define AUTOTUNE_GAIN       0.1     // Min relative gain of throughput to grow
+#define AUTOTUNE_HOLD       5       // Intervals without growing after back off
 
 volatile sig_atomic_t lr_interrupt = 0;
 
@@ -51,10 +77,16 @@ typedef enum {
         The target is waiting to be processed. */
     LR_DS_RUNNING, /*!<
         The transfer is running. */
+    LR_DS_VERIFYING, /*!<
+        The transfer is finished and its checksum is being
+        verified by a worker thread. */
     LR_DS_FINISHED, /*!<
         The transfer is successfully finished. */
     LR_DS_FAILED, /*!<
         The transfer is finished without success. */
+    LR_DS_DUPLICATE, /*!<
+        The target downloads the same file as another target.
+        It waits for the result of that target. */
 } LrDownloadState;
 
 typedef enum {
@@ -74,8 +106,45 @@ typedef struct {
         Handle */
     GSList *lrmirrors; /*!<
         List of LrMirrors created from the handle internal mirrorlist */
+    LrMirrorStats *mirrorstats; /*!<
+        Statistics of the mirrors (LRO_MIRRORSTATS) or NULL */
+    GSList *curl_handles; /*!<
+        Idle curl easy handles configured from the handle. They are
+        reused by the next transfers, so the handle is duplicated
+        only once per parallel transfer. */
 } LrHandleMirrors;
 
+/** Magic bytes at the start of a file type. Entries of the same
+ * suffix are alternatives and must follow each other. */
+typedef struct {
+    const char *suffix; /*!<
+        Suffix of the file name */
+    const char *magic; /*!<
+        Bytes at the start of the file */
+    size_t len; /*!<
+        Number of the bytes */
+} LrMagic;
+
+#define LR_MAGIC_MAX    8   // Longest magic
+
+static const LrMagic lr_magics[] = {
+    { ".rpm",   "\xed\xab\xee\xdb",          4 },  // RPM lead
+    { ".gz",    "\x1f\x8b",                  2 },
+    { ".xz",    "\xfd" "7zXZ\x00",            6 },
+    { ".bz2",   "BZh",                       3 },
+    { ".zst",   "\x28\xb5\x2f\xfd",          4 },
+    { ".xml",   "<?xml",                     5 },
+    { ".xml",   "\xef\xbb\xbf<?xml",          8 },  // With UTF-8 BOM
+    { NULL,     NULL,                        0 },
+};
+
+typedef struct {
+    double srtt; /*!<
+        Smoothed connect time in seconds, 0 if nothing observed yet */
+    double rttvar; /*!<
+        Mean deviation of the connect time in seconds */
+} LrConnectTime;
+
 typedef struct {
     LrInternalMirror *mirror; /*!<
         Mirror */
@@ -85,6 +154,9 @@ typedef struct {
         How many transfers was finished successfully from the mirror. */
     int failed_transfers; /*!<
         How many transfers failed. */
+    LrConnectTime connect_time; /*!<
+        Connect times of the new connections to the mirror
+        (LRO_ADAPTIVETIMEOUTS). */
 } LrMirror;
 
 typedef struct {
@@ -111,7 +183,8 @@ typedef struct {
         in curl_handle. */
     GSList *tried_mirrors; /*!<
         List of already tried mirrors (LrMirror *).
-        This mirrors won't be tried again. */
+        This mirrors won't be tried again.
+        The nodes are allocated from the arena of the LrDownload. */
     gint64 original_offset; /*!<
         If resume is enabled, this is the specified offset where to resume
         the downloading. If resume is not enabled, then value is -1. */
@@ -121,18 +194,102 @@ typedef struct {
         and is common for all targets that uses the handle. */
     LrHandle *handle; /*!<
         LrHandle associated with this target */
+    LrHandleMirrors *handle_mirrors; /*!<
+        LrHandleMirrors of the handle */
+    LrMirrorStats *mirrorstats; /*!<
+        Statistics of the mirrors of the handle or NULL.
+        Common for all targets that uses the handle. */
     LrHeaderCbState headercb_state; /*!<
         State of the header callback for current transfer */
     gchar *headercb_interrupt_reason; /*!<
         Reason why was the transfer interrupted */
+    gchar *writecb_interrupt_reason; /*!<
+        Reason why the write callback interrupted the transfer
+        (the data can't be the expected file) or NULL */
+    gboolean writecb_check; /*!<
+        Check the received data (expected size, magic) in the write
+        callback. Disabled when the response is not a success. */
+    const LrMagic *magic; /*!<
+        First of the magics the file could start with or NULL if
+        the start of the file is not checked (anymore). */
+    guchar magic_buf[LR_MAGIC_MAX]; /*!<
+        First bytes of the file */
+    guint magic_len; /*!<
+        Number of the bytes in the magic_buf */
     gint64 writecb_recieved; /*!<
         Total number of bytes recieved by the write function
         during the current transfer. */
     gboolean writecb_required_range_written; /*!<
         If a byte range was specified to download and the
         range was downloaded, it is TRUE. Otherwise FALSE. */
+    double transfer_time; /*!<
+        Total time of the last transfer (in seconds). */
+    double transfer_ttfb; /*!<
+        Time to first byte of the last transfer (in seconds). */
+    gchar *effective_url; /*!<
+        Effective URL of the finished transfer. Used only when
+        the state is LR_DS_VERIFYING. */
+    gboolean checksum_matches; /*!<
+        Result of the checksum verification done by a worker thread. */
+    GError *checksum_err; /*!<
+        Error encountered by a worker thread during the checksum
+        calculation or NULL. */
+    LrDecompressor *decompressor; /*!<
+        Decompressor used if the decompressfn of the target is set,
+        otherwise NULL. */
+    GError *decompress_err; /*!<
+        Error from the decompressor that interrupted the current
+        transfer or NULL. */
+    gboolean keep_partial; /*!<
+        The data received by the last (failed) transfer are a part of
+        the file, so the next mirror could continue from their end
+        (LRO_MIRRORRESUME). */
+    gboolean resumed_from_mirror; /*!<
+        The file contains data received from a previous mirror. */
+    gint64 mirror_offset; /*!<
+        Size of the data received from the previous mirrors, the next
+        transfer continues from their end. Valid if resumed_from_mirror
+        is set. */
+    gboolean no_mirror_resume; /*!<
+        Don't keep the received data anymore, because the checksum
+        of the file resumed from another mirror didn't match. */
+    gboolean too_slow; /*!<
+        The transfer is much slower than the others, its progress
+        callback aborts it (LRO_ADAPTIVETIMEOUTS). */
+    gint64 rate_window_start; /*!<
+        Monotonic time when the current measurement of the rate
+        of the transfer started, 0 until the first byte is received
+        (the time to the first byte doesn't count to the rate). */
+    gint64 rate_window_recieved; /*!<
+        writecb_recieved when the current measurement started. */
+    gint64 autotune_recieved; /*!<
+        Part of the writecb_recieved already counted by the autotuning. */
+    GSList *duplicates; /*!<
+        Targets (LrTarget *) in the LR_DS_DUPLICATE state which get
+        the file downloaded by this target. */
 } LrTarget;
 
+typedef struct {
+    gboolean enabled; /*!<
+        Tune the number of parallel downloads (LRO_AUTOTUNE) */
+    gint64 last_tick; /*!<
+        Monotonic time of the last decision */
+    gint64 recieved; /*!<
+        Bytes recieved by all transfers since the last decision */
+    int errors; /*!<
+        Transfers failed by a curl error since the last decision */
+    LrAutotuneState state; /*!<
+        State of the decisions */
+} LrAutotune;
+
+typedef struct {
+    LrMirror *mirror; /*!<
+        Mirror used by the finished transfer or NULL */
+    gchar *baseurl; /*!<
+        Base url used by the finished transfer (if no mirror
+        was used) or NULL */
+} LrConnectionOrigin;
+
 typedef struct {
 
     // Configuration
@@ -141,7 +298,8 @@ typedef struct {
         Fail fast */
 
     int max_parallel_connections; /*!<
-        Maximal number of parallel downloads. */
+        Maximal number of parallel downloads. Changed while downloading
+        if autotune is enabled. */
 
     int max_connection_per_host; /*!<
         Maximal number of connections per host. -1 means no limit. */
@@ -152,8 +310,39 @@ typedef struct {
     gint64 max_speed; /*!<
         Maximal speed in bytes per sec */
 
+    gboolean connection_affinity; /*!<
+        Prefer the targets that could reuse a just freed connection */
+
     // Data
 
+    LrArena *arena; /*!<
+        Arena for the data that live until the end of the download:
+        LrTargets, LrHandleMirrors, LrMirrors and nodes of their lists.
+        Everything is freed at once at the end. */
+
+    GString *url; /*!<
+        Buffer for the URL of the transfer that is being prepared */
+
+    GString *effective_url; /*!<
+        Buffer for the effective URL of the finished transfer */
+
+    LrDownloadNextTargetCb nextcb; /*!<
+        Callback that provides the next target or NULL if all targets
+        were passed at once (or all were already pulled). */
+
+    LrDownloadDoneTargetCb donecb; /*!<
+        Callback which takes over the targets that are done or NULL if
+        all targets were passed at once. */
+
+    void *cbdata; /*!<
+        User data for the nextcb and donecb */
+
+    guint n_targets; /*!<
+        Number of targets in the targets list */
+
+    GSList *free_targets; /*!<
+        LrTargets that were handed to the donecb and could be reused */
+
     CURLM *multi_handle; /*!<
         Curl Multi handle */
 
@@ -161,11 +350,54 @@ typedef struct {
         All mirrors (list of pointers to LrHandleMirrors structures) */
 
     GSList *targets; /*!<
-        List of all targets (list of pointers to LrTarget stuctures) */
+        List of all targets (list of pointers to LrTarget stuctures).
+        If the targets are pulled by the nextcb, only the targets that
+        are not done yet are in the list. */
 
     GSList *running_transfers; /*!<
         List of running transfers (list of pointer to LrTarget structures) */
 
+    GSList *verifying_transfers; /*!<
+        List of finished transfers which checksums are currently
+        verified (list of pointers to LrTarget structures) */
+
+    GThreadPool *verify_pool; /*!<
+        Pool of worker threads that verify checksums of finished
+        transfers. Created lazily when the first verification is needed. */
+
+    GAsyncQueue *verified_targets; /*!<
+        Queue of targets (LrTarget *) which verification is done.
+        Filled by worker threads, consumed by the main loop. */
+
+    int verify_pipe[2]; /*!<
+        Pipe used by worker threads to wake up the select() call
+        in the main loop. Both ends are -1 if not created yet. */
+
+    LrFastestMirrorDetection *fmdetection; /*!<
+        Fastest mirror detection which runs in the main loop together
+        with the transfers or NULL. */
+
+    LrConnectTime connect_time; /*!<
+        Connect times of the new connections to all mirrors. Used for
+        the mirrors without own observations (LRO_ADAPTIVETIMEOUTS). */
+
+    double rates[ADAPTIVE_RATE_SAMPLES]; /*!<
+        Ring buffer of the recently observed rates (bytes per second)
+        of the transfers (LRO_ADAPTIVETIMEOUTS). */
+
+    guint n_rates; /*!<
+        Number of the rates observed so far */
+
+    gint64 last_slow_check; /*!<
+        Monotonic time of the last lookup of too slow transfers */
+
+    LrAutotune autotune; /*!<
+        State of the autotuning of the max_parallel_connections */
+
+    GArray *freed_origins; /*!<
+        LrConnectionOrigins of the transfers finished since the new
+        transfers were started last time (connection_affinity). */
+
 } LrDownload;
 
 /** Schema of structures as used in downloader module:
@@ -223,14 +455,80 @@ typedef struct {
  *      Points to list of LrMirrors <---/          +--------------------------+
  */
 
+static gint
+lr_mirror_cmp_by_detection(gconstpointer a, gconstpointer b, gpointer detection)
+{
+    const LrMirror *ma = a, *mb = b;
+    return lr_fastestmirror_detection_cmp(detection,
+                                          ma->mirror->url,
+                                          mb->mirror->url);
+}
+
+/** Re-rank the mirrors by the results of the fastest mirror detection.
+ * The lists are reordered in place, because the targets keep
+ * pointers to them.
+ */
+static void
+lr_rerank_mirrors(LrDownload *dd)
+{
+    for (GSList *elem = dd->handle_mirrors; elem; elem = g_slist_next(elem)) {
+        LrHandleMirrors *handle_mirrors = elem->data;
+        GSList *sorted = g_slist_sort_with_data(
+                                    g_slist_copy(handle_mirrors->lrmirrors),
+                                    lr_mirror_cmp_by_detection,
+                                    dd->fmdetection);
+
+        GSList *s = sorted;
+        for (GSList *m = handle_mirrors->lrmirrors; m; m = g_slist_next(m)) {
+            m->data = s->data;
+            s = g_slist_next(s);
+        }
+        g_slist_free(sorted);
+    }
+}
+
+/** Let the fastest mirror detection do its work and re-rank
+ * the mirrors if new results are available.
+ * An error of the detection is not fatal for the downloads,
+ * the detection is just not used anymore.
+ */
+static void
+lr_perform_fastestmirror(LrDownload *dd)
+{
+    gboolean changed = FALSE;
+    GError *tmp_err = NULL;
+
+    if (!dd->fmdetection)
+        return;
+
+    if (!lr_fastestmirror_detection_perform(dd->fmdetection, &changed,
+                                            &tmp_err)) {
+        g_warning("%s: Fastest mirror detection failed: %s",
+                  __func__, tmp_err->message);
+        g_error_free(tmp_err);
+        dd->fmdetection = NULL;
+        return;
+    }
+
+    if (changed) {
+        g_debug("%s: Re-ranking mirrors", __func__);
+        lr_rerank_mirrors(dd);
+    }
+}
+
 static GSList *
-lr_prepare_lrmirrors(GSList *list, LrHandle *handle, LrTarget **target)
+lr_prepare_lrmirrors(LrArena *arena,
+                     GSList *list,
+                     LrHandle *handle,
+                     LrTarget **target)
 {
     for (GSList *elem = list; elem; elem = g_slist_next(elem)) {
         LrHandleMirrors *handle_mirrors = elem->data;
         if (handle_mirrors->handle == handle) {
             // List of LrMirrors for this handle is already created
+            (*target)->handle_mirrors = handle_mirrors;
             (*target)->lrmirrors = handle_mirrors->lrmirrors;
+            (*target)->mirrorstats = handle_mirrors->mirrorstats;
             return list;
         }
     }
@@ -249,17 +547,38 @@ lr_prepare_lrmirrors(GSList *list, LrHandle *handle, LrTarget **target)
         assert(imirror->url);
         g_debug("%s: Mirror: %s", __func__, imirror->url);
 
-        LrMirror *mirror = lr_malloc0(sizeof(*mirror));
+        LrMirror *mirror = lr_arena_alloc0(arena, sizeof(*mirror));
         mirror->mirror = imirror;
-        lrmirrors = g_slist_append(lrmirrors, mirror);
+        lrmirrors = lr_arena_slist_prepend(arena, lrmirrors, mirror);
     }
+    lrmirrors = g_slist_reverse(lrmirrors);
 
-    LrHandleMirrors *handle_mirrors = lr_malloc0(sizeof(*handle_mirrors));
+    LrHandleMirrors *handle_mirrors = lr_arena_alloc0(arena,
+                                                      sizeof(*handle_mirrors));
     handle_mirrors->handle = handle;
     handle_mirrors->lrmirrors = lrmirrors;
 
+    if (handle) {
+        // Statistics of this download
+        handle->transfers = 0;
+        handle->reusedconnections = 0;
+    }
+
+    if (handle && handle->mirrorstats) {
+        GError *tmp_err = NULL;
+        if (!lr_mirrorstats_load(&handle_mirrors->mirrorstats,
+                                 handle->mirrorstats,
+                                 &tmp_err)) {
+            g_debug("%s: Cannot load mirror statistics: %s",
+                    __func__, tmp_err->message);
+            g_error_free(tmp_err);
+        }
+    }
+
+    (*target)->handle_mirrors = handle_mirrors;
     (*target)->lrmirrors = lrmirrors;
-    list = g_slist_append(list, handle_mirrors);
+    (*target)->mirrorstats = handle_mirrors->mirrorstats;
+    list = lr_arena_slist_prepend(arena, list, handle_mirrors);
 
     return list;
 }
@@ -278,6 +597,8 @@ lr_progresscb(void *ptr,
 
     if (target->state != LR_DS_RUNNING)
         return 0;
+    if (target->too_slow)
+        return 1;  // Abort, see lr_check_slow_transfers()
     if (!target->target->progresscb)
         return 0;
 
@@ -286,6 +607,363 @@ lr_progresscb(void *ptr,
                                       now_downloaded);
 }
 
+static gboolean
+lr_adaptive_timeouts(LrTarget *target)
+{
+    return target->handle && target->handle->adaptivetimeouts;
+}
+
+/** Add an observed connect time (RFC 6298 style smoothing) */
+static void
+lr_connect_time_add(LrConnectTime *ct, double sample)
+{
+    if (ct->srtt <= 0.0) {
+        ct->srtt = sample;
+        ct->rttvar = sample / 2;
+        return;
+    }
+    ct->rttvar = 0.75 * ct->rttvar + 0.25 * ABS(ct->srtt - sample);
+    ct->srtt = 0.875 * ct->srtt + 0.125 * sample;
+}
+
+long
+lr_adaptive_connect_timeout(double srtt, double rttvar, long max_timeout)
+{
+    long timeout;
+
+    if (srtt <= 0.0)
+        return max_timeout;  // Nothing observed yet
+
+    timeout = (long) (ADAPTIVE_CONNECTTIMEOUT_FACTOR
+                      * (srtt + 4 * rttvar) * 1000);
+    timeout = MAX(timeout, ADAPTIVE_CONNECTTIMEOUT_MIN);
+    return MIN(timeout, max_timeout);
+}
+
+/** Set the connect timeout of the transfer from the connect times
+ * observed for the mirror (or for all mirrors, if the mirror has no
+ * own yet). The timeout is never longer than LRO_CONNECTTIMEOUT.
+ * Transfers which don't use a mirror get the LRO_CONNECTTIMEOUT.
+ */
+static void
+lr_set_connect_timeout(LrDownload *dd,
+                       LrTarget *target,
+                       LrMirror *mirror,
+                       CURL *h)
+{
+    LrConnectTime *ct = NULL;
+    long max_timeout = target->handle->connecttimeout;
+    long timeout;
+
+    if (max_timeout <= 0)
+        max_timeout = 300;  // Default of curl
+    max_timeout *= 1000;
+
+    if (mirror)
+        ct = (mirror->connect_time.srtt > 0.0) ? &mirror->connect_time
+                                               : &dd->connect_time;
+
+    if (ct)
+        timeout = lr_adaptive_connect_timeout(ct->srtt, ct->rttvar,
+                                              max_timeout);
+    else
+        timeout = max_timeout;
+
+    g_debug("%s: Connect timeout: %ld ms", __func__, timeout);
+    curl_easy_setopt(h, CURLOPT_CONNECTTIMEOUT_MS, timeout);
+}
+
+static void
+lr_add_rate(LrDownload *dd, double rate)
+{
+    dd->rates[dd->n_rates % ADAPTIVE_RATE_SAMPLES] = rate;
+    dd->n_rates++;
+}
+
+static gint
+lr_cmp_rates(gconstpointer a, gconstpointer b)
+{
+    double ra = *(const double *) a, rb = *(const double *) b;
+    return (ra > rb) - (ra < rb);
+}
+
+gboolean
+lr_rate_too_slow(double rate, const double *rates, guint n_rates)
+{
+    double sorted[ADAPTIVE_RATE_SAMPLES];
+    guint n = MIN(n_rates, ADAPTIVE_RATE_SAMPLES);
+
+    if (n < ADAPTIVE_RATE_MIN_SAMPLES)
+        return FALSE;  // Not enough rates to judge
+
+    memcpy(sorted, rates, n * sizeof(*sorted));
+    qsort(sorted, n, sizeof(*sorted), lr_cmp_rates);
+    return rate < sorted[n / 2] / ADAPTIVE_SLOW_FACTOR;
+}
+
+/** Remember the connect time and the rate of the finished transfer */
+static void
+lr_observe_transfer(LrDownload *dd, LrTarget *target, CURL *curl_handle)
+{
+    double connect_time = 0.0;
+    long connects = 0;
+
+    // Only new connections say something about the connect time
+    curl_easy_getinfo(curl_handle, CURLINFO_NUM_CONNECTS, &connects);
+    if (connects > 0) {
+        curl_easy_getinfo(curl_handle, CURLINFO_APPCONNECT_TIME,
+                          &connect_time);
+        if (connect_time <= 0.0)
+            curl_easy_getinfo(curl_handle, CURLINFO_CONNECT_TIME,
+                              &connect_time);
+    }
+
+    if (connect_time > 0.0 && target->mirror) {
+        lr_connect_time_add(&target->mirror->connect_time, connect_time);
+        lr_connect_time_add(&dd->connect_time, connect_time);
+    }
+
+    double data_time = target->transfer_time - target->transfer_ttfb;
+    if (target->writecb_recieved >= ADAPTIVE_RATE_MIN_BYTES && data_time > 0.0)
+        lr_add_rate(dd, target->writecb_recieved / data_time);
+}
+
+/** Check if the target could be downloaded from a mirror that
+ * wasn't tried yet.
+ */
+static gboolean
+lr_other_mirror_available(LrDownload *dd, LrTarget *target)
+{
+    if (target->target->baseurl || strstr(target->target->path, "://"))
+        return FALSE;
+
+    // The current mirror is not in the tried_mirrors yet
+    if (dd->max_mirrors_to_try > 0
+        && (int) g_slist_length(target->tried_mirrors) + 1 >= dd->max_mirrors_to_try)
+        return FALSE;
+
+    for (GSList *elem = target->lrmirrors; elem; elem = g_slist_next(elem)) {
+        LrMirror *mirror = elem->data;
+        if (mirror != target->mirror
+            && mirror->mirror->protocol != LR_PROTOCOL_RSYNC
+            && !g_slist_find(target->tried_mirrors, mirror))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/** Find the running transfers which are much slower than the other
+ * transfers (LRO_ADAPTIVETIMEOUTS). The rate of each transfer is
+ * measured over ADAPTIVE_RATE_WINDOW seconds (the first window starts
+ * with its first received byte) and compared with
+ * the median of the recently observed rates. A too slow transfer
+ * is aborted by its progress callback and continues from another
+ * mirror.
+ */
+static void
+lr_check_slow_transfers(LrDownload *dd)
+{
+    gint64 now = g_get_monotonic_time();
+
+    if (now - dd->last_slow_check < G_USEC_PER_SEC)
+        return;
+    dd->last_slow_check = now;
+
+    for (GSList *elem = dd->running_transfers; elem; elem = g_slist_next(elem)) {
+        LrTarget *target = elem->data;
+
+        if (!lr_adaptive_timeouts(target)
+            || target->too_slow
+            || !target->rate_window_start)
+            continue;
+
+        gint64 elapsed = now - target->rate_window_start;
+        if (elapsed < ADAPTIVE_RATE_WINDOW * G_USEC_PER_SEC)
+            continue;
+
+        double rate = (target->writecb_recieved - target->rate_window_recieved)
+                      * (double) G_USEC_PER_SEC / elapsed;
+        target->rate_window_start = now;
+        target->rate_window_recieved = target->writecb_recieved;
+
+        if (lr_rate_too_slow(rate, dd->rates, dd->n_rates)
+            && lr_other_mirror_available(dd, target))
+        {
+            g_debug("%s: Transfer of %s is too slow (%.0f B/s)",
+                    __func__, target->target->path, rate);
+            target->too_slow = TRUE;
+            continue;
+        }
+
+        lr_add_rate(dd, rate);
+    }
+}
+
+/** Count the bytes recieved by the transfer since the last count */
+static void
+lr_autotune_count(LrDownload *dd, LrTarget *target)
+{
+    dd->autotune.recieved += target->writecb_recieved - target->autotune_recieved;
+    target->autotune_recieved = target->writecb_recieved;
+}
+
+int
+lr_autotune_decide(LrAutotuneState *state,
+                   int limit,
+                   int running,
+                   double rate,
+                   int errors)
+{
+    int new_limit = limit;
+
+    if (errors > 0) {
+        // Back off
+        new_limit = MAX(state->min, limit - MAX(1, limit / 4));
+        state->hold = AUTOTUNE_HOLD;
+    } else if (limit > state->prev_limit
+               && rate < state->prev_rate * (1 + AUTOTUNE_GAIN)) {
+        // More transfers didn't help
+        new_limit = state->prev_limit;
+        state->hold = AUTOTUNE_HOLD;
+    } else if (state->hold > 0) {
+        state->hold--;
+    } else if (running >= limit && limit < state->max) {
+        // All slots are used, try one more
+        new_limit = limit + 1;
+    }
+
+    state->prev_limit = limit;
+    state->prev_rate = rate;
+    return new_limit;
+}
+
+/** Tune the number of parallel downloads (LRO_AUTOTUNE).
+ * Every AUTOTUNE_INTERVAL seconds the total throughput is measured
+ * and lr_autotune_decide() chooses the number for the next interval.
+ */
+static void
+lr_autotune(LrDownload *dd)
+{
+    LrAutotune *at = &dd->autotune;
+    gint64 now = g_get_monotonic_time();
+    int running = 0;
+
+    if (!at->enabled)
+        return;
+
+    gint64 elapsed = now - at->last_tick;
+    if (elapsed < AUTOTUNE_INTERVAL * G_USEC_PER_SEC)
+        return;
+
+    for (GSList *elem = dd->running_transfers; elem; elem = g_slist_next(elem)) {
+        lr_autotune_count(dd, elem->data);
+        running++;
+    }
+
+    double rate = at->recieved * (double) G_USEC_PER_SEC / elapsed;
+    int limit = lr_autotune_decide(&at->state, dd->max_parallel_connections,
+                                   running, rate, at->errors);
+
+    if (limit != dd->max_parallel_connections)
+        g_debug("%s: Parallel downloads: %d -> %d (%.0f B/s, %d errors)",
+                __func__, dd->max_parallel_connections, limit,
+                rate, at->errors);
+
+    at->last_tick = now;
+    at->recieved = 0;
+    at->errors = 0;
+    dd->max_parallel_connections = limit;
+}
+
+/** Remember where the finished transfer was connected to,
+ * a next transfer could reuse the connection.
+ */
+static void
+lr_remember_origin(LrDownload *dd, LrTarget *target)
+{
+    LrConnectionOrigin origin = { NULL, NULL };
+
+    if (target->mirror)
+        origin.mirror = target->mirror;
+    else if (target->target->baseurl
+             && !strstr(target->target->path, "://"))
+        origin.baseurl = g_strdup(target->target->baseurl);
+    else
+        return;
+
+    g_array_append_val(dd->freed_origins, origin);
+}
+
+static void
+lr_forget_origins(LrDownload *dd)
+{
+    for (guint x = 0; x < dd->freed_origins->len; x++)
+        g_free(g_array_index(dd->freed_origins, LrConnectionOrigin, x).baseurl);
+    g_array_set_size(dd->freed_origins, 0);
+}
+
+/** Check if the next transfer of the waiting target would go
+ * to the origin.
+ */
+static gboolean
+lr_target_uses_origin(LrTarget *target, LrConnectionOrigin *origin)
+{
+    if (strstr(target->target->path, "://"))
+        return FALSE;
+
+    if (target->target->baseurl)
+        return origin->baseurl
+               && !strcmp(origin->baseurl, target->target->baseurl);
+
+    if (!origin->mirror)
+        return FALSE;
+
+    // The first untried mirror is going to be used
+    for (GSList *elem = target->lrmirrors; elem; elem = g_slist_next(elem)) {
+        LrMirror *mirror = elem->data;
+        if (mirror->mirror->protocol == LR_PROTOCOL_RSYNC
+            || g_slist_find(target->tried_mirrors, mirror))
+            continue;
+        return mirror == origin->mirror;
+    }
+
+    return FALSE;
+}
+
+/** Find a waiting target which would be downloaded from the origin
+ * of a finished transfer. The origins are consumed.
+ * @return              the target or NULL
+ */
+static LrTarget *
+lr_affinity_target(LrDownload *dd)
+{
+    while (dd->freed_origins->len > 0) {
+        guint last = dd->freed_origins->len - 1;
+        LrConnectionOrigin *origin = &g_array_index(dd->freed_origins,
+                                                    LrConnectionOrigin,
+                                                    last);
+        LrTarget *found = NULL;
+
+        for (GSList *elem = dd->targets; elem; elem = g_slist_next(elem)) {
+            LrTarget *target = elem->data;
+            if (target->state == LR_DS_WAITING
+                && lr_target_uses_origin(target, origin)) {
+                found = target;
+                break;
+            }
+        }
+
+        g_free(origin->baseurl);
+        g_array_set_size(dd->freed_origins, last);
+
+        if (found)
+            return found;
+    }
+
+    return NULL;
+}
+
 #define STRLEN(s) (sizeof(s)/sizeof(s[0]) - 1)
 
 static size_t
@@ -380,6 +1058,99 @@ lr_headercb(void *ptr, size_t size, size_t nmemb, void *userdata)
     return ret;
 }
 
+/** Find the magics expected at the start of the file by the suffix
+ * of its path.
+ * @return              the first of the magics or NULL if unknown
+ */
+static const LrMagic *
+lr_find_magic(const char *path)
+{
+    if (strchr(path, '?'))
+        return NULL;  // Not a plain file name
+
+    for (const LrMagic *magic = lr_magics; magic->suffix; magic++)
+        if (g_str_has_suffix(path, magic->suffix))
+            return magic;
+
+    return NULL;
+}
+
+/** Offset in the file where the current transfer of the target starts.
+ */
+static gint64
+lr_transfer_offset(LrTarget *target)
+{
+    if (target->resumed_from_mirror)
+        return target->mirror_offset;
+    return MAX(target->original_offset, 0);
+}
+
+/** Check that the data received so far could be the expected file.
+ * They must not be longer than the expected size and they must start
+ * with the magic of the file type. This catches HTML error pages and
+ * the like served with a success status code before they are
+ * downloaded completely.
+ * @return              FALSE if the transfer should be interrupted,
+ *                      writecb_interrupt_reason is set then
+ */
+static gboolean
+lr_check_received_data(LrTarget *target, const char *ptr, gint64 len)
+{
+    gint64 expected = target->target->expectedsize;
+
+    if (target->writecb_recieved == 0) {
+        // Error pages of an unsuccessful response are reported
+        // by the status code
+        long code = 0;
+        curl_easy_getinfo(target->curl_handle, CURLINFO_RESPONSE_CODE, &code);
+        if (code >= 300) {
+            target->writecb_check = FALSE;
+            return TRUE;
+        }
+    }
+
+    if (expected > 0) {
+        gint64 offset = lr_transfer_offset(target);
+        if (offset + target->writecb_recieved + len > expected) {
+            target->writecb_interrupt_reason = g_strdup_printf(
+                "Received more data than the expected size %"G_GINT64_FORMAT,
+                expected);
+            return FALSE;
+        }
+    }
+
+    if (target->magic) {
+        guint n = MIN((gint64) (LR_MAGIC_MAX - target->magic_len), len);
+        gboolean possible = FALSE;
+
+        memcpy(target->magic_buf + target->magic_len, ptr, n);
+        target->magic_len += n;
+
+        for (const LrMagic *magic = target->magic;
+             magic->suffix && !strcmp(magic->suffix, target->magic->suffix);
+             magic++)
+        {
+            if (memcmp(target->magic_buf, magic->magic,
+                       MIN(target->magic_len, magic->len)))
+                continue;
+            possible = TRUE;
+            if (target->magic_len >= magic->len) {
+                // The file starts with the magic, done
+                target->magic = NULL;
+                break;
+            }
+        }
+
+        if (!possible) {
+            target->writecb_interrupt_reason = g_strdup_printf(
+                "The data don't look like a %s file", target->magic->suffix);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
 size_t
 lr_writecb(char *ptr, size_t size, size_t nmemb, void *userdata)
 {
@@ -390,10 +1161,23 @@ lr_writecb(char *ptr, size_t size, size_t nmemb, void *userdata)
     gint64 range_start = target->target->byterangestart;
     gint64 range_end = target->target->byterangeend;
 
+    if (!target->rate_window_start && all > 0)
+        target->rate_window_start = g_get_monotonic_time();
+
     if (range_start <= 0 && range_end <= 0) {
+        if (target->writecb_check && !lr_check_received_data(target, ptr, all))
+            return 0; // Leads to CURLE_WRITE_ERROR
+
         // Write everything curl give to you
         target->writecb_recieved += all;
-        return fwrite(ptr, size, nmemb, target->f);
+        cur_written = fwrite(ptr, size, nmemb, target->f);
+        if (target->decompressor && cur_written == nmemb) {
+            // Decompress the data as they come
+            if (!lr_decompressor_write(target->decompressor, ptr, all,
+                                       &target->decompress_err))
+                return 0; // Leads to CURLE_WRITE_ERROR
+        }
+        return cur_written;
     }
 
     /* Deal with situation when user wants only specific byte range of the
@@ -468,40 +1252,400 @@ lr_writecb(char *ptr, size_t size, size_t nmemb, void *userdata)
     return cur_written_expected;
 }
 
+/** Prepare the decompressor of the target for a new transfer.
+ * If the download is resumed, the already downloaded part of the file
+ * is passed to the decompressor first.
+ */
 static gboolean
-prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
+lr_prepare_decompressor(LrTarget *target, GError **err)
 {
-    LrTarget *target;
-    LrMirror *mirror = NULL;
-    char *full_url = NULL;
-    int complete_url_in_path = 0;
+    LrDownloadTarget *dtarget = target->target;
 
-    assert(dd);
     assert(!err || *err == NULL);
 
-    *candidatefound = FALSE;
+    if (!target->decompressor) {
+        target->decompressor = lr_decompressor_new(
+                                        dtarget->decompressfn,
+                                        dtarget->decompresschecksumtype,
+                                        dtarget->decompresschecksum,
+                                        dtarget->decompressexpectedsize,
+                                        err);
+        if (!target->decompressor)
+            return FALSE;
+    } else if (!lr_decompressor_reset(target->decompressor, err)) {
+        return FALSE;
+    }
 
-    GSList *elem = dd->targets;
+    g_clear_error(&target->decompress_err);
 
-    while (1) {
+    gint64 resume_offset = lr_transfer_offset(target);
+    if (resume_offset <= 0)
+        return TRUE;
 
-        target = NULL;
+    // Decompress the part of the file from the previous download
+    int fd = fileno(target->f);
+    char buf[BUFSIZ];
+    off_t offset = 0;
 
-        // Select a waiting target
-        for (; elem; elem = g_slist_next(elem)) {
-            LrTarget *c_target = elem->data;
-            if (c_target->state == LR_DS_WAITING) {
-                target = c_target;
-                elem = g_slist_next(elem);
-                break;
-            }
+    while (offset < resume_offset) {
+        size_t len = MIN(sizeof(buf), (size_t) (resume_offset - offset));
+        ssize_t readed = pread(fd, buf, len, offset);
+        if (readed < 0) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                        "Cannot read %s: %s",
+                        dtarget->path, strerror(errno));
+            return FALSE;
         }
+        if (readed == 0)
+            break;
+        if (!lr_decompressor_write(target->decompressor, buf, readed, err))
+            return FALSE;
+        offset += readed;
+    }
 
-        if (!target)  // No target is waiting
-            return TRUE;
-
-        // Determine if path is a complete URL
-        complete_url_in_path = strstr(target->target->path, "://") ? 1 : 0;
+    return TRUE;
+}
+
+/** Same as lr_pathconcat(base, path, NULL) but the result is stored
+ * to the buffer. Only the usual case (both parts contain something else
+ * than slashes and the path doesn't end with a slash) is handled here,
+ * the rest is left to lr_pathconcat().
+ */
+static char *
+lr_build_url(GString *buf, const char *base, const char *path)
+{
+    size_t base_len = strlen(base);
+    size_t path_len = strlen(path);
+
+    while (base_len && base[base_len-1] == '/')
+        base_len--;
+    while (*path == '/') {
+        path++;
+        path_len--;
+    }
+
+    if (!base_len || !path_len || path[path_len-1] == '/') {
+        char *url = lr_pathconcat(base, path, NULL);
+        g_string_assign(buf, url);
+        lr_free(url);
+        return buf->str;
+    }
+
+    g_string_truncate(buf, 0);
+    g_string_append_len(buf, base, base_len);
+    g_string_append_c(buf, '/');
+    g_string_append_len(buf, path, path_len);
+    return buf->str;
+}
+
+/** Get a curl easy handle for a transfer of the target. An idle handle
+ * of the same LrHandle is reused if there is one, otherwise the curl
+ * handle of the LrHandle is duplicated.
+ * @return          Curl easy handle or NULL if the duplication failed.
+ */
+static CURL *
+lr_get_transfer_handle(LrDownload *dd, LrTarget *target)
+{
+    LrHandleMirrors *handle_mirrors = target->handle_mirrors;
+    CURL *h;
+
+    if (handle_mirrors->curl_handles) {
+        GSList *node = handle_mirrors->curl_handles;
+        handle_mirrors->curl_handles = node->next;
+        node->next = NULL;
+        h = node->data;
+        lr_arena_slist_free(dd->arena, node);
+        return h;
+    }
+
+    if (target->handle)
+        h = curl_easy_duphandle(target->handle->curl_handle);
+    else
+        h = lr_get_curl_handle();
+
+    // Reuse connections (e.g. those opened by the fastest mirror
+    // detection) and DNS cache of the handle
+    if (h && target->handle && target->handle->curl_share)
+        curl_easy_setopt(h, CURLOPT_SHARE, target->handle->curl_share);
+
+    return h;
+}
+
+/** Return the curl easy handle of the finished transfer to the idle
+ * handles of its LrHandle. The options set per transfer (except
+ * the URL which is always set) are reset to their defaults.
+ */
+static void
+lr_release_transfer_handle(LrDownload *dd, LrTarget *target)
+{
+    CURL *h = target->curl_handle;
+    LrHandleMirrors *handle_mirrors = target->handle_mirrors;
+
+    curl_easy_setopt(h, CURLOPT_RESUME_FROM_LARGE, (curl_off_t) 0);
+    curl_easy_setopt(h, CURLOPT_NOPROGRESS, 1L);
+    curl_easy_setopt(h, CURLOPT_PROGRESSFUNCTION, NULL);
+    curl_easy_setopt(h, CURLOPT_PROGRESSDATA, NULL);
+    curl_easy_setopt(h, CURLOPT_HEADERFUNCTION, NULL);
+    curl_easy_setopt(h, CURLOPT_HEADERDATA, NULL);
+    curl_easy_setopt(h, CURLOPT_WRITEFUNCTION, NULL);
+    curl_easy_setopt(h, CURLOPT_WRITEDATA, NULL);
+    curl_easy_setopt(h, CURLOPT_MAX_RECV_SPEED_LARGE, (curl_off_t) 0);
+
+    handle_mirrors->curl_handles = lr_arena_slist_prepend(
+                                        dd->arena,
+                                        handle_mirrors->curl_handles,
+                                        h);
+    target->curl_handle = NULL;
+}
+
+/** Copy the content of the src file to the dest file. If the filesystem
+ * supports it, the data are shared by both files (reflink) instead.
+ * Nothing is done if both paths lead to the same file.
+ */
+static gboolean
+lr_copy_file(const char *src, const char *dest, GError **err)
+{
+    struct stat src_stat, dest_stat;
+    gboolean cloned = FALSE;
+    gboolean ret = TRUE;
+
+    int src_fd = open(src, O_RDONLY);
+    if (src_fd < 0) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "Cannot open %s: %s", src, strerror(errno));
+        return FALSE;
+    }
+
+    if (fstat(src_fd, &src_stat) == 0
+        && stat(dest, &dest_stat) == 0
+        && src_stat.st_dev == dest_stat.st_dev
+        && src_stat.st_ino == dest_stat.st_ino)
+    {
+        close(src_fd);
+        return TRUE;
+    }
+
+    int dest_fd = open(dest, O_CREAT|O_TRUNC|O_WRONLY, 0666);
+    if (dest_fd < 0) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "Cannot open %s: %s", dest, strerror(errno));
+        close(src_fd);
+        return FALSE;
+    }
+
+#ifdef FICLONE
+    cloned = (ioctl(dest_fd, FICLONE, src_fd) == 0);
+#endif
+
+    if (!cloned) {
+        char buf[65536];
+        ssize_t len;
+
+        while (ret && (len = read(src_fd, buf, sizeof(buf))) != 0) {
+            if (len < 0) {
+                g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                            "Cannot read %s: %s", src, strerror(errno));
+                ret = FALSE;
+                break;
+            }
+
+            for (ssize_t written = 0; written < len; ) {
+                ssize_t rc = write(dest_fd, buf + written, len - written);
+                if (rc < 0) {
+                    g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                                "Cannot write %s: %s", dest, strerror(errno));
+                    ret = FALSE;
+                    break;
+                }
+                written += rc;
+            }
+        }
+    }
+
+    if (close(dest_fd) != 0 && ret) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "Cannot close %s: %s", dest, strerror(errno));
+        ret = FALSE;
+    }
+    close(src_fd);
+
+    if (!ret)
+        unlink(dest);
+
+    return ret;
+}
+
+/** Give the file downloaded by the finished target to its duplicates.
+ */
+static gboolean
+lr_finish_duplicates(LrDownload *dd, LrTarget *target, GError **err)
+{
+    GSList *duplicates = target->duplicates;
+
+    target->duplicates = NULL;
+
+    for (GSList *elem = duplicates; elem; elem = g_slist_next(elem)) {
+        LrTarget *duplicate = elem->data;
+        LrDownloadTarget *dtarget = duplicate->target;
+        GError *tmp_err = NULL;
+
+        assert(duplicate->state == LR_DS_DUPLICATE);
+
+        if (!lr_copy_file(target->target->fn, dtarget->fn, &tmp_err)) {
+            g_debug("%s: %s", __func__, tmp_err->message);
+            duplicate->state = LR_DS_FAILED;
+
+            // Call end callback
+            LrEndCb end_cb = dtarget->endcb;
+            if (end_cb)
+                end_cb(dtarget->cbdata, LR_TRANSFER_ERROR, tmp_err->message);
+
+            lr_downloadtarget_set_error(dtarget, tmp_err->code,
+                                        "Cannot copy the downloaded file: %s",
+                                        tmp_err->message);
+
+            if (dd->failfast) {
+                g_propagate_error(err, tmp_err);
+                return FALSE;
+            }
+            g_error_free(tmp_err);
+            continue;
+        }
+
+        duplicate->state = LR_DS_FINISHED;
+        lr_downloadtarget_set_error(dtarget, LRE_OK, NULL);
+        lr_downloadtarget_set_usedmirror(dtarget, target->target->usedmirror);
+        lr_downloadtarget_set_effectiveurl(dtarget,
+                                           target->target->effectiveurl);
+
+        // Call end callback
+        LrEndCb end_cb = dtarget->endcb;
+        if (end_cb)
+            end_cb(dtarget->cbdata, LR_TRANSFER_SUCCESSFUL, NULL);
+    }
+
+    return TRUE;
+}
+
+/** Give the failure of the target to its duplicates which would be
+ * downloaded from the same place. The first of the other duplicates
+ * is downloaded instead and the rest waits for its result.
+ */
+static void
+lr_fail_duplicates(LrDownload *dd, LrTarget *target)
+{
+    LrDownloadTarget *failed = target->target;
+    LrTarget *successor = NULL;
+
+    for (GSList *elem = target->duplicates; elem; elem = g_slist_next(elem)) {
+        LrTarget *duplicate = elem->data;
+        LrDownloadTarget *dtarget = duplicate->target;
+
+        assert(duplicate->state == LR_DS_DUPLICATE);
+
+        if (dtarget->handle == failed->handle
+            && !g_strcmp0(dtarget->baseurl, failed->baseurl)
+            && !strcmp(dtarget->path, failed->path))
+        {
+            duplicate->state = LR_DS_FAILED;
+
+            // Call end callback
+            LrEndCb end_cb = dtarget->endcb;
+            if (end_cb)
+                end_cb(dtarget->cbdata, LR_TRANSFER_ERROR, failed->err);
+
+            lr_downloadtarget_set_error(dtarget, failed->rcode,
+                                        "%s", failed->err);
+        } else if (!successor) {
+            g_debug("%s: Download %s instead of %s", __func__,
+                    dtarget->path, failed->path);
+            successor = duplicate;
+            successor->state = LR_DS_WAITING;
+        } else {
+            successor->duplicates = lr_arena_slist_prepend(
+                                            dd->arena,
+                                            successor->duplicates,
+                                            duplicate);
+        }
+    }
+
+    if (successor)
+        successor->duplicates = g_slist_reverse(successor->duplicates);
+    target->duplicates = NULL;
+}
+
+/** Remove the data kept from the previous mirrors (LRO_MIRRORRESUME)
+ * of the failed target. The file is truncated to its original offset.
+ */
+static gboolean
+lr_remove_mirror_data(LrTarget *target, GError **err)
+{
+    off_t offset = MAX(target->original_offset, 0);
+    int rc;
+
+    if (!target->resumed_from_mirror)
+        return TRUE;
+
+    target->resumed_from_mirror = FALSE;
+
+    if (target->target->fn) {
+        rc = truncate(target->target->fn, offset);
+    } else {
+        rc = ftruncate(target->target->fd, offset);
+        if (rc != -1 && lseek(target->target->fd, offset, SEEK_SET) == -1)
+            rc = -1;
+    }
+
+    if (rc == -1) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "Cannot truncate %s: %s",
+                    target->target->path, strerror(errno));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
+{
+    LrTarget *target;
+    LrMirror *mirror = NULL;
+    char *full_url = NULL;
+    int complete_url_in_path = 0;
+
+    assert(dd);
+    assert(!err || *err == NULL);
+
+    *candidatefound = FALSE;
+
+    GSList *elem = dd->targets;
+
+    // A target that could reuse the connection of a finished transfer
+    LrTarget *preferred = NULL;
+    if (dd->connection_affinity)
+        preferred = lr_affinity_target(dd);
+
+    while (1) {
+
+        target = preferred;
+        preferred = NULL;
+
+        // Select a waiting target
+        for (; elem && !target; elem = g_slist_next(elem)) {
+            LrTarget *c_target = elem->data;
+            if (c_target->state == LR_DS_WAITING) {
+                target = c_target;
+                elem = g_slist_next(elem);
+                break;
+            }
+        }
+
+        if (!target)  // No target is waiting
+            return TRUE;
+
+        // Determine if path is a complete URL
+        complete_url_in_path = strstr(target->target->path, "://") ? 1 : 0;
 
         if (!target->target->baseurl
             && !target->lrmirrors
@@ -520,12 +1664,12 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
         // Select a base part of url (use the baseurl or some mirror)
         if (complete_url_in_path) {
             // In path we got a complete url, do not use mirror or basepath
-            full_url = g_strdup(target->target->path);
+            full_url = g_string_assign(dd->url, target->target->path)->str;
         } else if (target->target->baseurl) {
             // Use base URL
-            full_url = lr_pathconcat(target->target->baseurl,
-                                     target->target->path,
-                                     NULL);
+            full_url = lr_build_url(dd->url,
+                                    target->target->baseurl,
+                                    target->target->path);
         } else {
             // Try to find a suitable mirror
 
@@ -567,9 +1711,9 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
 
             if (mirror) {
                 // Suitable (untried and with available capacity) mirror found
-                full_url = lr_pathconcat(mirror->mirror->url,
-                                         target->target->path,
-                                         NULL);
+                full_url = lr_build_url(dd->url,
+                                        mirror->mirror->url,
+                                        target->target->path);
             } else if (!at_least_one_suitable_mirror_found) {
                 // No suitable mirror even exists => Set transfer as failed
                 g_debug("%s: All mirrors were tried without success", __func__);
@@ -586,6 +1730,10 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
                 lr_downloadtarget_set_error(target->target, LRE_NOURL,
                             "Cannot download, all mirrors were already tried "
                             "without success");
+                lr_fail_duplicates(dd, target);
+
+                if (!lr_remove_mirror_data(target, err))
+                    return FALSE;
 
                 if (dd->failfast) {
                     g_set_error(err, LR_DOWNLOADER_ERROR, LRE_NOURL,
@@ -618,11 +1766,7 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
 
     // Prepare CURL easy handle
     CURLcode c_rc;
-    CURL *h;
-    if (target->handle)
-        h = curl_easy_duphandle(target->handle->curl_handle);
-    else
-        h = lr_get_curl_handle();
+    CURL *h = lr_get_transfer_handle(dd, target);
     if (!h) {
         // Something went wrong
         g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURL,
@@ -636,13 +1780,10 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
         g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURL,
                     "curl_easy_setopt(h, CURLOPT_URL, %s) failed: %s",
                     full_url, curl_easy_strerror(c_rc));
-        lr_free(full_url);
         curl_easy_cleanup(h);
         return FALSE;
     }
 
-    lr_free(full_url);
-
     // Prepare FILE
     int fd;
 
@@ -659,7 +1800,7 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
     } else {
         // Use supplied filename
         int open_flags = O_CREAT|O_TRUNC|O_RDWR;
-        if (target->target->resume)
+        if (target->target->resume || target->resumed_from_mirror)
             open_flags &= ~O_TRUNC;
 
         fd = open(target->target->fn, open_flags, 0666);
@@ -683,11 +1824,15 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
 
     target->f = f;
     target->writecb_recieved = 0;
+    target->autotune_recieved = 0;
     target->writecb_required_range_written = FALSE;
 
     // Resume - set offset to resume incomplete download
-    if (target->target->resume) {
-        if (target->original_offset == -1) {
+    // (the one that was there before or the one from the previous mirror)
+    if (target->target->resume || target->resumed_from_mirror) {
+        if (target->resumed_from_mirror) {
+            fseek(f, target->mirror_offset, SEEK_SET);
+        } else if (target->original_offset == -1) {
             // Determine offset
             fseek(f, 0L, SEEK_END);
             gint64 determined_offset = ftell(f);
@@ -697,9 +1842,11 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
                 determined_offset = 0;
             }
             target->original_offset = determined_offset;
+        } else {
+            fseek(f, target->original_offset, SEEK_SET);
         }
 
-        gint64 used_offset = target->original_offset;
+        gint64 used_offset = lr_transfer_offset(target);
         g_debug("%s: Used offset for download resume: %"G_GINT64_FORMAT,
                 __func__, used_offset);
 
@@ -724,8 +1871,41 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
                                 (curl_off_t) target->target->byterangestart);
     }
 
+    // Prepare the early check of the received data. The magic is
+    // checked (LRO_CHECKMAGIC) only if the content is known by
+    // a checksum and the transfer starts at the beginning of the file.
+    target->magic = NULL;
+    target->magic_len = 0;
+    if (target->handle
+        && target->handle->checkmagic
+        && target->target->checksums
+        && lr_transfer_offset(target) <= 0
+        && target->target->byterangestart <= 0)
+        target->magic = lr_find_magic(target->target->path);
+    target->writecb_check = target->magic || target->target->expectedsize > 0;
+
+    // Prepare decompressor
+    if (target->target->decompressfn) {
+        assert(target->target->byterangestart <= 0);
+        assert(target->target->byterangeend <= 0);
+        if (!lr_prepare_decompressor(target, err)) {
+            fclose(f);
+            target->f = NULL;
+            curl_easy_cleanup(h);
+            return FALSE;
+        }
+    }
+
+    // Adaptive timeouts
+    target->too_slow = FALSE;
+    target->rate_window_start = 0;
+    target->rate_window_recieved = 0;
+    if (lr_adaptive_timeouts(target))
+        lr_set_connect_timeout(dd, target, mirror, h);
+
     // Prepare progress callback
-    if (target->target->progresscb) {
+    // (it also aborts the too slow transfers if adaptive timeouts are used)
+    if (target->target->progresscb || lr_adaptive_timeouts(target)) {
         curl_easy_setopt(h, CURLOPT_PROGRESSFUNCTION, lr_progresscb);
         curl_easy_setopt(h, CURLOPT_NOPROGRESS, 0);
         curl_easy_setopt(h, CURLOPT_PROGRESSDATA, target);
@@ -744,77 +1924,760 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
     // Add the new handle to the curl multi handle
     curl_multi_add_handle(dd->multi_handle, h);
 
-    // Set the state of transfer as running
-    target->state = LR_DS_RUNNING;
+    // Set the state of transfer as running
+    target->state = LR_DS_RUNNING;
+
+    // Set the state of header callback for this transfer
+    target->headercb_state = LR_HCS_DEFAULT;
+    g_free(target->headercb_interrupt_reason);
+    target->headercb_interrupt_reason = NULL;
+    g_free(target->writecb_interrupt_reason);
+    target->writecb_interrupt_reason = NULL;
+
+    // Set mirror for the target
+    target->mirror = mirror;  // mirror could be NULL if baseurl is used
+
+    // Save curl handle for the current transfer
+    target->curl_handle = h;
+
+    // Add the transfer to the list of running transfers
+    dd->running_transfers = g_slist_append(dd->running_transfers, target);
+
+    return TRUE;
+}
+
+static gboolean
+set_max_speeds_to_transfers(LrDownload *dd, GError **err)
+{
+    guint length;
+    gint64 single_target_speed;
+
+    if (!dd->max_speed)  // Nothing to do
+        return TRUE;
+
+    length = g_slist_length(dd->running_transfers);
+    if (!length)  // Nothing to do
+        return TRUE;
+
+    // Calculate a max speed (rounded up) per target
+    single_target_speed = (dd->max_speed + (length - 1)) / length;
+
+    for (GSList *elem = dd->running_transfers; elem; elem = g_slist_next(elem)) {
+        LrTarget *ltarget = elem->data;
+        CURL *curl_handle = ltarget->curl_handle;
+        CURLcode code = curl_easy_setopt(curl_handle,
+                                         CURLOPT_MAX_RECV_SPEED_LARGE,
+                                         (curl_off_t) single_target_speed);
+        if (code != CURLE_OK) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURLSETOPT,
+                        "Cannot set CURLOPT_MAX_RECV_SPEED_LARGE option: %s",
+                        curl_easy_strerror(code));
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/** Create a LrTarget for the download target and add it to the targets.
+ */
+static void
+lr_add_target(LrDownload *dd, LrDownloadTarget *dtarget)
+{
+    LrTarget *target;
+
+    assert(dtarget);
+    assert(dtarget->path);
+    assert((dtarget->fd > 0 && !dtarget->fn) || (dtarget->fd < 0 && dtarget->fn));
+    g_debug("%s: Target: %s (%s)", __func__,
+            dtarget->path,
+            (dtarget->baseurl) ? dtarget->baseurl : "-");
+
+    if (dd->free_targets) {
+        // Reuse a target which is already done
+        GSList *node = dd->free_targets;
+        dd->free_targets = node->next;
+        node->next = NULL;
+        target = node->data;
+        lr_arena_slist_free(dd->arena, node);
+    } else {
+        target = lr_arena_alloc0(dd->arena, sizeof(*target));
+    }
+
+    target->state           = LR_DS_WAITING;
+    target->target          = dtarget;
+    target->original_offset = -1;
+    target->target->rcode   = LRE_UNFINISHED;
+    target->target->err     = "Not finished";
+    target->handle          = dtarget->handle;
+    if (dd->nextcb) {
+        // Keep the pulled targets in order, the list is short
+        GSList **link = &dd->targets;
+        while (*link)
+            link = &(*link)->next;
+        *link = lr_arena_slist_prepend(dd->arena, NULL, target);
+    } else {
+        dd->targets = lr_arena_slist_prepend(dd->arena, dd->targets, target);
+    }
+    dd->n_targets++;
+    // Add list of handle internal mirrors to dd.handle_mirrors
+    // if doesn't exists yet and set the list reference
+    // to the target.
+    dd->handle_mirrors = lr_prepare_lrmirrors(dd->arena,
+                                              dd->handle_mirrors,
+                                              dtarget->handle,
+                                              &target);
+}
+
+/** Key which is the same for the targets that download the same file:
+ * the same checksums or the same URL, and the same expected size.
+ * @return              the key (free it by g_free) or NULL if the target
+ *                      cannot share its file with another target
+ */
+static gchar *
+lr_duplicate_key(LrDownloadTarget *dtarget)
+{
+    // Only complete files stored under a filename could be shared
+    if (!dtarget->fn
+        || dtarget->resume
+        || dtarget->byterangestart
+        || dtarget->byterangeend
+        || dtarget->decompressfn)
+        return NULL;
+
+    GString *key = g_string_new(NULL);
+    g_string_printf(key, "%" G_GINT64_FORMAT, dtarget->expectedsize);
+
+    gboolean checksum = FALSE;
+    for (GSList *elem = dtarget->checksums; elem; elem = g_slist_next(elem)) {
+        LrDownloadTargetChecksum *dtch = elem->data;
+        if (!dtch->value || dtch->type == LR_CHECKSUM_UNKNOWN)
+            continue;
+        gchar *value = g_ascii_strdown(dtch->value, -1);
+        g_string_append_printf(key, "\n%d:%s", dtch->type, value);
+        g_free(value);
+        checksum = TRUE;
+    }
+
+    if (!checksum) {
+        if (strstr(dtarget->path, "://"))
+            g_string_append_printf(key, "\nurl:%s", dtarget->path);
+        else if (dtarget->baseurl)
+            g_string_append_printf(key, "\nurl:%s\n%s",
+                                   dtarget->baseurl, dtarget->path);
+        else
+            g_string_append_printf(key, "\nhandle:%p\n%s",
+                                   (void *) dtarget->handle, dtarget->path);
+    }
+
+    return g_string_free(key, FALSE);
+}
+
+/** Add the targets passed at once. A target which downloads the same
+ * file as one of the previous targets is not downloaded, it gets a copy
+ * of the file downloaded by the previous target.
+ */
+static void
+lr_add_targets(LrDownload *dd, GSList *targets)
+{
+    GHashTable *originals = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                  g_free, NULL);
+    guint duplicates = 0;
+
+    for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
+        lr_add_target(dd, elem->data);
+
+        LrTarget *target = dd->targets->data;
+        gchar *key = lr_duplicate_key(target->target);
+        if (!key)
+            continue;
+
+        LrTarget *original = g_hash_table_lookup(originals, key);
+        if (!original) {
+            g_hash_table_insert(originals, key, target);
+            continue;
+        }
+        g_free(key);
+
+        g_debug("%s: %s is the same file as %s", __func__,
+                target->target->fn, original->target->fn);
+        target->state = LR_DS_DUPLICATE;
+        original->duplicates = lr_arena_slist_prepend(dd->arena,
+                                                      original->duplicates,
+                                                      target);
+        duplicates++;
+    }
+
+    dd->targets = g_slist_reverse(dd->targets);
+    for (GSList *elem = dd->targets; elem && duplicates; elem = g_slist_next(elem)) {
+        LrTarget *target = elem->data;
+        target->duplicates = g_slist_reverse(target->duplicates);
+    }
+
+    if (duplicates)
+        g_debug("%s: %u targets are copies of other targets", __func__,
+                duplicates);
+
+    g_hash_table_destroy(originals);
+}
+
+/** Clean up the target which is not going to be downloaded anymore.
+ */
+static void
+lr_cleanup_target(LrTarget *target)
+{
+    assert(target->curl_handle == NULL);
+    assert(target->f == NULL);
+
+    if (target->decompressor) {
+        // Not finished target - remove the decompressed file
+        lr_decompressor_free(target->decompressor);
+        target->decompressor = NULL;
+        unlink(target->target->decompressfn);
+    }
+    g_clear_error(&target->decompress_err);
+}
+
+/** Hand the finished and failed targets over to the donecb and keep
+ * their LrTargets for reuse. Only used if the targets are pulled
+ * by the nextcb.
+ */
+static void
+lr_release_done_targets(LrDownload *dd)
+{
+    if (!dd->donecb)
+        return;
+
+    GSList **link = &dd->targets;
+    while (*link) {
+        GSList *node = *link;
+        LrTarget *target = node->data;
+
+        if (target->state != LR_DS_FINISHED && target->state != LR_DS_FAILED) {
+            link = &node->next;
+            continue;
+        }
+
+        *link = node->next;
+        node->next = NULL;
+        lr_arena_slist_free(dd->arena, node);
+        dd->n_targets--;
+
+        LrDownloadTarget *dtarget = target->target;
+        lr_cleanup_target(target);
+        lr_arena_slist_free(dd->arena, target->tried_mirrors);
+        memset(target, 0, sizeof(*target));
+        dd->free_targets = lr_arena_slist_prepend(dd->arena,
+                                                  dd->free_targets,
+                                                  target);
+
+        dd->donecb(dd->cbdata, dtarget);
+    }
+}
+
+/** Pull the next target from the nextcb. The number of the targets
+ * which are not done yet is limited, so the memory doesn't grow
+ * with the total number of the targets.
+ * @return          TRUE if a new target was added.
+ */
+static gboolean
+lr_pull_target(LrDownload *dd)
+{
+    if (!dd->nextcb)
+        return FALSE;
+
+    lr_release_done_targets(dd);
+
+    if (dd->n_targets >= STREAM_WINDOW * (guint) dd->max_parallel_connections)
+        return FALSE;
+
+    LrDownloadTarget *dtarget = dd->nextcb(dd->cbdata);
+    if (!dtarget) {
+        g_debug("%s: No more targets", __func__);
+        dd->nextcb = NULL;
+        return FALSE;
+    }
+
+    lr_add_target(dd, dtarget);
+    return TRUE;
+}
+
+static gboolean
+prepare_next_transfers(LrDownload *dd, GError **err)
+{
+    guint length = g_slist_length(dd->running_transfers);
+    guint free_slots = 0;
+
+    // The max could be lowered by the autotuning below the running ones
+    if (length < (guint) dd->max_parallel_connections)
+        free_slots = dd->max_parallel_connections - length;
+
+    lr_release_done_targets(dd);
+
+    while (free_slots > 0) {
+        gboolean candidatefound;
+        gboolean ret = prepare_next_transfer(dd, &candidatefound, err);
+        if (!ret)
+            return FALSE;
+        if (candidatefound)
+            free_slots--;
+        else if (!lr_pull_target(dd))
+            break;  // Nothing to start
+    }
+
+    // Connections of the remaining origins are not needed right now
+    if (dd->connection_affinity)
+        lr_forget_origins(dd);
+
+    // Set maximal speed for each target
+    if (dd->max_speed)
+        if (!set_max_speeds_to_transfers(dd, err))
+            return FALSE;
+
+    return TRUE;
+}
+
+static void
+verify_worker(gpointer data, gpointer user_data)
+{
+    LrTarget *target = data;
+    LrDownload *dd = user_data;
+    int fd = fileno(target->f);
+    gboolean matches = TRUE;
+
+    for (GSList *elem = target->target->checksums; elem; elem = g_slist_next(elem)) {
+        LrDownloadTargetChecksum *checksum = elem->data;
+
+        if (!checksum
+            || !checksum->value
+            || checksum->type == LR_CHECKSUM_UNKNOWN)
+        {
+            // Bad checksum
+            continue;
+        }
+
+        lseek(fd, 0, SEEK_SET);
+        gboolean ret = lr_checksum_fd_cmp(checksum->type,
+                                          fd,
+                                          checksum->value,
+                                          1,
+                                          &matches,
+                                          &target->checksum_err);
+        if (ret == FALSE) {
+            // Error while checksum calculation
+            break;
+        }
+
+        if (matches) {
+            // At least one checksum matches
+            g_debug("%s: Checksum (%s) %s is OK", __func__,
+                    lr_checksum_type_to_str(checksum->type),
+                    checksum->value);
+            break;
+        }
+    }
+
+    target->checksum_matches = matches;
+
+    // Hand the target back to the main loop and wake it up
+    g_async_queue_push(dd->verified_targets, target);
+    if (write(dd->verify_pipe[1], "v", 1) == -1)
+        g_debug("%s: Cannot wake up the main loop: %s",
+                __func__, strerror(errno));
+}
+
+/** Pass the finished transfer to a worker thread that verifies
+ * its checksum. Until the verification is done, the target stays
+ * in the LR_DS_VERIFYING state and its file must not be touched
+ * by the main loop.
+ */
+static gboolean
+lr_verify_target(LrDownload *dd,
+                 LrTarget *target,
+                 const char *effective_url,
+                 GError **err)
+{
+    GError *tmp_err = NULL;
+
+    assert(!err || *err == NULL);
+
+    if (!dd->verify_pool) {
+        // Prepare the workers
+        if (pipe(dd->verify_pipe) == -1) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                        "pipe() failed: %s", strerror(errno));
+            dd->verify_pipe[0] = dd->verify_pipe[1] = -1;
+            return FALSE;
+        }
+        fcntl(dd->verify_pipe[0], F_SETFL, O_NONBLOCK);
+
+        dd->verified_targets = g_async_queue_new();
+        dd->verify_pool = g_thread_pool_new(verify_worker,
+                                            dd,
+                                            MAX(dd->max_parallel_connections,
+                                                dd->autotune.state.max),
+                                            FALSE,
+                                            &tmp_err);
+        if (!dd->verify_pool) {
+            g_propagate_prefixed_error(err, tmp_err,
+                                       "Cannot create thread pool: ");
+            return FALSE;
+        }
+    }
+
+    fflush(target->f);
+
+    target->state = LR_DS_VERIFYING;
+    target->effective_url = g_strdup(effective_url);
+    target->checksum_matches = TRUE;
+    target->checksum_err = NULL;
+    dd->verifying_transfers = g_slist_append(dd->verifying_transfers, target);
+
+    g_debug("%s: Verifying: %s", __func__, target->target->path);
+
+    if (!g_thread_pool_push(dd->verify_pool, target, &tmp_err)) {
+        dd->verifying_transfers = g_slist_remove(dd->verifying_transfers,
+                                                 target);
+        g_free(target->effective_url);
+        target->effective_url = NULL;
+        g_propagate_prefixed_error(err, tmp_err,
+                                   "Cannot start checksum verification: ");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/** Record the result of the finished transfer into the statistics
+ * of the used mirror. Fatal errors are not caused by the mirror and
+ * they are not recorded.
+ */
+static void
+lr_record_mirrorstats(LrTarget *target,
+                      GError *transfer_err,
+                      gboolean fatal_error)
+{
+    if (!target->mirrorstats || !target->mirror)
+        return;
+
+    const char *url = target->mirror->mirror->url;
+
+    if (transfer_err) {
+        if (!fatal_error)
+            lr_mirrorstats_add_failure(target->mirrorstats, url);
+        return;
+    }
+
+    lr_mirrorstats_add_success(target->mirrorstats,
+                               url,
+                               target->writecb_recieved,
+                               target->transfer_time - target->transfer_ttfb,
+                               target->transfer_ttfb);
+}
+
+/** Check if the data received by the broken transfer are a part of
+ * the file (LRO_MIRRORRESUME). Only targets with a known checksum and
+ * size qualify, the checksum of the complete file decides in the end.
+ */
+static gboolean
+lr_can_resume_from_mirror(LrTarget *target,
+                          CURL *curl_handle,
+                          const char *effective_url)
+{
+    LrDownloadTarget *dtarget = target->target;
+    long code = 0;
+
+    if (!target->handle
+        || !target->handle->mirrorresume
+        || target->no_mirror_resume)
+        return FALSE;
+
+    if (!dtarget->checksums
+        || dtarget->expectedsize <= 0
+        || dtarget->byterangestart > 0
+        || dtarget->byterangeend > 0)
+        return FALSE;
+
+    if (target->writecb_recieved <= 0
+        || target->headercb_state == LR_HCS_INTERRUPTED)
+        return FALSE;
+
+    // Don't keep an error page
+    curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &code);
+    if (effective_url && g_str_has_prefix(effective_url, "http"))
+        return code == 200 || code == 206;
+    return code < 400;
+}
+
+/** Check if a successfully finished transfer delivered less data than
+ * the expected size of the target.
+ */
+static gboolean
+lr_transfer_incomplete(LrTarget *target)
+{
+    LrDownloadTarget *dtarget = target->target;
+
+    if (dtarget->expectedsize <= 0
+        || dtarget->byterangestart > 0
+        || dtarget->byterangeend > 0)
+        return FALSE;
+
+    return lr_transfer_offset(target) + target->writecb_recieved
+           < dtarget->expectedsize;
+}
 
-    // Set the state of header callback for this transfer
-    target->headercb_state = LR_HCS_DEFAULT;
-    g_free(target->headercb_interrupt_reason);
-    target->headercb_interrupt_reason = NULL;
+/** Keep the data received by the broken transfer of the target,
+ * the next mirror continues from their end.
+ */
+static gboolean
+lr_keep_partial(LrTarget *target, GError **err)
+{
+    struct stat buf;
+    int rc;
 
-    // Set mirror for the target
-    target->mirror = mirror;  // mirror could be NULL if baseurl is used
+    if (target->target->fn)
+        rc = stat(target->target->fn, &buf);
+    else
+        rc = fstat(target->target->fd, &buf);
 
-    // Save curl handle for the current transfer
-    target->curl_handle = h;
+    if (rc == -1) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "Cannot stat %s: %s",
+                    target->target->path, strerror(errno));
+        return FALSE;
+    }
 
-    // Add the transfer to the list of running transfers
-    dd->running_transfers = g_slist_append(dd->running_transfers, target);
+    if (buf.st_size <= lr_transfer_offset(target)
+        || buf.st_size >= target->target->expectedsize)
+        return TRUE;  // Nothing new or nothing to resume
 
+    g_debug("%s: Keeping %"G_GINT64_FORMAT" bytes of %s", __func__,
+            (gint64) buf.st_size, target->target->path);
+    target->mirror_offset = buf.st_size;
+    target->resumed_from_mirror = TRUE;
     return TRUE;
 }
 
+/** Finish the transfer of the target. If transfer_err is set, the next
+ * mirror is tried (if any) or the target is marked as failed. Otherwise
+ * the target is marked as finished.
+ * The transfer_err is consumed by this function.
+ */
 static gboolean
-set_max_speeds_to_transfers(LrDownload *dd, GError **err)
+finish_transfer(LrDownload *dd,
+                LrTarget *target,
+                GError *transfer_err,
+                gboolean fatal_error,
+                const char *effective_url,
+                GError **err)
 {
-    guint length;
-    gint64 single_target_speed;
+    assert(!err || *err == NULL);
 
-    if (!dd->max_speed)  // Nothing to do
-        return TRUE;
+    guint num_of_tried_mirrors = g_slist_length(target->tried_mirrors);
 
-    length = g_slist_length(dd->running_transfers);
-    if (!length)  // Nothing to do
-        return TRUE;
+    fclose(target->f);
+    target->f = NULL;
 
-    // Calculate a max speed (rounded up) per target
-    single_target_speed = (dd->max_speed + (length - 1)) / length;
+    lr_record_mirrorstats(target, transfer_err, fatal_error);
 
-    for (GSList *elem = dd->running_transfers; elem; elem = g_slist_next(elem)) {
-        LrTarget *ltarget = elem->data;
-        CURL *curl_handle = ltarget->curl_handle;
-        CURLcode code = curl_easy_setopt(curl_handle,
-                                         CURLOPT_MAX_RECV_SPEED_LARGE,
-                                         (curl_off_t) single_target_speed);
-        if (code != CURLE_OK) {
-            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURLSETOPT,
-                        "Cannot set CURLOPT_MAX_RECV_SPEED_LARGE option: %s",
-                        curl_easy_strerror(code));
+    GError *fail_fast_error = NULL;
+
+    if (transfer_err) {
+        // There was an error during transfer
+
+        g_debug("%s: Error during transfer: %s", __func__, transfer_err->message);
+
+        int complete_url_in_path = strstr(target->target->path, "://") ? 1 : 0;
+
+        // Call mirrorfailure callback
+        LrMirrorFailureCb mf_cb =  target->target->mirrorfailurecb;
+        if (mf_cb) {
+            // TODO: Break download if rc != 0
+            mf_cb(target->target->cbdata, transfer_err->message, effective_url);
+        }
+
+        if (target->resumed_from_mirror
+            && transfer_err->code == LRE_BADCHECKSUM)
+        {
+            // Some of the joined parts was bad, download the whole file
+            // again (from all the mirrors)
+            g_debug("%s: Resumed file is bad - Download it again", __func__);
+            target->resumed_from_mirror = FALSE;
+            target->no_mirror_resume = TRUE;
+            lr_arena_slist_free(dd->arena, target->tried_mirrors);
+            target->tried_mirrors = NULL;
+            num_of_tried_mirrors = 0;
+        }
+
+        if (!fatal_error &&
+            !complete_url_in_path
+            && !target->target->baseurl
+            && (dd->max_mirrors_to_try <= 0
+                || num_of_tried_mirrors < dd->max_mirrors_to_try))
+        {
+            // Try another mirror
+            g_debug("%s: Ignore error - Try another mirror", __func__);
+            target->state = LR_DS_WAITING;
+            g_error_free(transfer_err);  // Ignore the error
+
+            if (target->keep_partial && !lr_keep_partial(target, err))
+                return FALSE;
+        } else {
+            // No more retry (or baseurl used) => set target as failed
+            g_debug("%s: No more retries (tried: %d)",
+                    __func__, num_of_tried_mirrors);
+            target->state = LR_DS_FAILED;
+
+            // Call end callback
+            LrEndCb end_cb =  target->target->endcb;
+            if (end_cb)
+                end_cb(target->target->cbdata,
+                       LR_TRANSFER_ERROR,
+                       transfer_err->message);
+
+            lr_downloadtarget_set_error(target->target,
+                                        transfer_err->code,
+                                        "Download failed: %s",
+                                        transfer_err->message);
+            lr_fail_duplicates(dd, target);
+
+            if (target->decompressor) {
+                // Remove the incomplete decompressed file
+                lr_decompressor_free(target->decompressor);
+                target->decompressor = NULL;
+                unlink(target->target->decompressfn);
+            }
+            if (dd->failfast)
+                g_propagate_error(&fail_fast_error, transfer_err);
+            else
+                g_error_free(transfer_err);
+        }
+
+        // Truncate file - remove downloaded garbage (error html page etc.)
+        off_t original_offset;
+        if (target->state == LR_DS_WAITING && target->resumed_from_mirror)
+            // Keep the data from the previous mirrors for the next one
+            original_offset = target->mirror_offset;
+        else if (target->original_offset > -1)
+            // If resume enabled, truncate file to its original position
+            original_offset = target->original_offset;
+        else
+            // If no resume enabled, just truncate whole file
+            original_offset = 0;
+
+        int rc;
+        if (target->target->fn)
+            rc = truncate(target->target->fn, original_offset);
+        else
+            rc = ftruncate(target->target->fd, original_offset);
+
+        if (rc == -1) {
+            if (fail_fast_error)
+                g_error_free(fail_fast_error);
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                        "ftruncate() failed: %s", strerror(errno));
             return FALSE;
         }
+
+        if (!target->target->fn) {
+            // In case fd is used, seek to the original offset
+            off_t rc_offset = lseek(target->target->fd,
+                                    original_offset,
+                                    SEEK_SET);
+            if (rc_offset == -1) {
+                if (fail_fast_error)
+                    g_error_free(fail_fast_error);
+                g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                            "lseek() failed: %s", strerror(errno));
+                return FALSE;
+            }
+        }
+    } else {
+        // No error encountered, transfer finished successfully
+        target->state = LR_DS_FINISHED;
+        lr_decompressor_free(target->decompressor);
+        target->decompressor = NULL;
+        lr_downloadtarget_set_error(target->target, LRE_OK, NULL);
+        if (target->mirror)
+            lr_downloadtarget_set_usedmirror(target->target,
+                                             target->mirror->mirror->url);
+        lr_downloadtarget_set_effectiveurl(target->target,
+                                           effective_url);
+
+        // Call end callback
+        LrEndCb end_cb = target->target->endcb;
+        if (end_cb)
+            end_cb(target->target->cbdata,
+                   LR_TRANSFER_SUCCESSFUL,
+                   NULL);
+
+        if (!lr_finish_duplicates(dd, target, err))
+            return FALSE;
+    }
+
+    if (fail_fast_error) {
+        // A single download failed - interrupt whole downloading
+        g_propagate_error(err, fail_fast_error);
+        return FALSE;
     }
 
     return TRUE;
 }
 
+/** Process targets which checksum verification was finished by
+ * the worker threads.
+ */
 static gboolean
-prepare_next_transfers(LrDownload *dd, GError **err)
+check_verified_targets(LrDownload *dd, GError **err)
 {
-    guint length = g_slist_length(dd->running_transfers);
-    guint free_slots = dd->max_parallel_connections - length;
+    LrTarget *target;
 
-    gboolean candidatefound = TRUE;
-    while (free_slots > 0 && candidatefound) {
-        gboolean ret = prepare_next_transfer(dd, &candidatefound, err);
-        if (!ret)
+    assert(!err || *err == NULL);
+
+    if (!dd->verify_pool)
+        return TRUE;
+
+    // Drain the wake up pipe
+    char buf[64];
+    while (read(dd->verify_pipe[0], buf, sizeof(buf)) > 0)
+        ;
+
+    while ((target = g_async_queue_try_pop(dd->verified_targets))) {
+        GError *tmp_err = NULL;
+        gchar *effective_url = target->effective_url;
+
+        assert(target->state == LR_DS_VERIFYING);
+
+        target->effective_url = NULL;
+        dd->verifying_transfers = g_slist_remove(dd->verifying_transfers,
+                                                 target);
+
+        if (target->checksum_err) {
+            // Error while checksum calculation
+            g_propagate_prefixed_error(err, target->checksum_err,
+                    "Downloading from %s was successfull but error "
+                    "encountered while checksuming: ", effective_url);
+            target->checksum_err = NULL;
+            fclose(target->f);
+            target->f = NULL;
+            g_free(effective_url);
             return FALSE;
-        free_slots--;
-    }
+        }
 
-    // Set maximal speed for each target
-    if (dd->max_speed)
-        if (!set_max_speeds_to_transfers(dd, err))
+        if (!target->checksum_matches) {
+            // Checksums doesn't match
+            g_set_error(&tmp_err,
+                    LR_DOWNLOADER_ERROR,
+                    LRE_BADCHECKSUM,
+                    "Downloading successfull, but checksum doesn't match");
+        }
+
+        gboolean ret = finish_transfer(dd, target, tmp_err, FALSE,
+                                       effective_url, err);
+        g_free(effective_url);
+        if (!ret)
             return FALSE;
+    }
 
     return TRUE;
 }
@@ -825,6 +2688,10 @@ check_transfer_statuses(LrDownload *dd, GError **err)
     assert(dd);
     assert(!err || *err == NULL);
 
+    // Process targets verified by worker threads in meantime
+    if (!check_verified_targets(dd, err))
+        return FALSE;
+
     int freed_transfers = 0;
     int msgs_in_queue;
     CURLMsg *msg;
@@ -855,13 +2722,17 @@ check_transfer_statuses(LrDownload *dd, GError **err)
                           CURLINFO_EFFECTIVE_URL,
                           &effective_url);
 
-        effective_url = g_strdup(effective_url); // Make the effetive url
-                                                  // persistent to survive
-                                                  // the curl_easy_cleanup()
+        // Make the effective url persistent to survive
+        // the curl_easy_cleanup()
+        if (effective_url)
+            effective_url = g_string_assign(dd->effective_url,
+                                            effective_url)->str;
 
         g_debug("%s: Transfer finished: %s (Effective url: %s)",
                 __func__, target->target->path, effective_url);
 
+        target->keep_partial = FALSE;
+
         // Check status of finished transfer
         if (msg->data.result != CURLE_OK) {
             // There was an error that is reported by CURLcode
@@ -878,6 +2749,37 @@ check_transfer_statuses(LrDownload *dd, GError **err)
                         "was downloaded.", __func__,
                         target->target->byterangestart,
                         target->target->byterangeend);
+            } else if (msg->data.result == CURLE_WRITE_ERROR &&
+                       target->decompress_err)
+            {
+                // Download was interrupted by writecb because
+                // the data couldn't be decompressed.
+                // Corrupted data from this mirror - try another one
+                tmp_err = target->decompress_err;
+                target->decompress_err = NULL;
+            } else if (msg->data.result == CURLE_WRITE_ERROR &&
+                       target->writecb_interrupt_reason)
+            {
+                // Download was interrupted by writecb because
+                // the data can't be the expected file (e.g. an error
+                // page) - try another mirror
+                g_set_error(&tmp_err, LR_DOWNLOADER_ERROR, LRE_CURL,
+                            "Interrupted by write callback: %s for %s",
+                            target->writecb_interrupt_reason,
+                            effective_url);
+            } else if (msg->data.result == CURLE_ABORTED_BY_CALLBACK &&
+                       target->too_slow)
+            {
+                // Download was interrupted by progresscb because
+                // it was much slower than the other transfers.
+                // Not fatal - try another mirror
+                g_set_error(&tmp_err, LR_DOWNLOADER_ERROR, LRE_CURL,
+                            "Transfer too slow compared to the others: %s",
+                            effective_url);
+                target->keep_partial = lr_can_resume_from_mirror(
+                                                    target,
+                                                    msg->easy_handle,
+                                                    effective_url);
             } else if (target->headercb_state == LR_HCS_INTERRUPTED) {
                 // Download was interrupted by header callback
                 g_set_error(&tmp_err, LR_DOWNLOADER_ERROR, LRE_CURL,
@@ -888,8 +2790,23 @@ check_transfer_statuses(LrDownload *dd, GError **err)
                             "Curl error: %s for %s",
                             curl_easy_strerror(msg->data.result),
                             effective_url);
+                dd->autotune.errors++;
+
+                // The transfer was broken, but the received data
+                // could be still good
+                target->keep_partial = lr_can_resume_from_mirror(
+                                                    target,
+                                                    msg->easy_handle,
+                                                    effective_url);
 
                 switch (msg->data.result) {
+                case CURLE_SEND_ERROR:
+                case CURLE_RECV_ERROR:
+                    // E.g. a connection reset in the middle of the file,
+                    // the next mirror continues from the received data
+                    if (target->keep_partial)
+                        break;
+                    // fall through
                 case CURLE_NOT_BUILT_IN:
                 case CURLE_COULDNT_RESOLVE_PROXY:
                 case CURLE_WRITE_ERROR:
@@ -897,8 +2814,6 @@ check_transfer_statuses(LrDownload *dd, GError **err)
                 case CURLE_ABORTED_BY_CALLBACK:
                 case CURLE_BAD_FUNCTION_ARGUMENT:
                 case CURLE_INTERFACE_FAILED:
-                case CURLE_SEND_ERROR:
-                case CURLE_RECV_ERROR:
                 case CURLE_FILESIZE_EXCEEDED:
                 case CURLE_CONV_REQD:
                 case CURLE_SSL_CACERT_BADFILE:
@@ -944,190 +2859,92 @@ check_transfer_statuses(LrDownload *dd, GError **err)
                                 "Status code: %ld", code);
                 }
             }
+
+            if (!tmp_err && lr_transfer_incomplete(target)) {
+                // E.g. a file:// or ftp:// mirror with a truncated file
+                // (in the middle of a sync) - the received data could be
+                // still good
+                g_set_error(&tmp_err, LR_DOWNLOADER_ERROR, LRE_CURL,
+                            "Transfer ended after %"G_GINT64_FORMAT" of %"
+                            G_GINT64_FORMAT" bytes for %s",
+                            lr_transfer_offset(target)
+                                + target->writecb_recieved,
+                            target->target->expectedsize,
+                            effective_url);
+                target->keep_partial = lr_can_resume_from_mirror(
+                                                    target,
+                                                    msg->easy_handle,
+                                                    effective_url);
+            }
+        }
+
+        // Remember the times for the statistics of the mirror
+        target->transfer_time = 0.0;
+        target->transfer_ttfb = 0.0;
+        curl_easy_getinfo(msg->easy_handle,
+                          CURLINFO_TOTAL_TIME,
+                          &target->transfer_time);
+        curl_easy_getinfo(msg->easy_handle,
+                          CURLINFO_STARTTRANSFER_TIME,
+                          &target->transfer_ttfb);
+
+        if (!tmp_err && lr_adaptive_timeouts(target))
+            lr_observe_transfer(dd, target, msg->easy_handle);
+        lr_autotune_count(dd, target);
+
+        if (target->handle
+            && effective_url
+            && !g_str_has_prefix(effective_url, "file:"))
+        {
+            // Statistics of the connection reuse
+            long connects = 0;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_NUM_CONNECTS,
+                              &connects);
+            target->handle->transfers++;
+            if (connects == 0)
+                target->handle->reusedconnections++;
         }
 
+        if (dd->connection_affinity)
+            lr_remember_origin(dd, target);
+
         // Clean stuff after the current handle
         curl_multi_remove_handle(dd->multi_handle, target->curl_handle);
-        curl_easy_cleanup(target->curl_handle);
-        target->curl_handle = NULL;
+        lr_release_transfer_handle(dd, target);
         dd->running_transfers = g_slist_remove(dd->running_transfers,
                                                (gconstpointer) target);
-        target->tried_mirrors = g_slist_append(target->tried_mirrors,
-                                               target->mirror);
+        target->tried_mirrors = lr_arena_slist_prepend(dd->arena,
+                                                       target->tried_mirrors,
+                                                       target->mirror);
         g_free(target->headercb_interrupt_reason);
         target->headercb_interrupt_reason = NULL;
+        g_free(target->writecb_interrupt_reason);
+        target->writecb_interrupt_reason = NULL;
 
-        guint num_of_tried_mirrors = g_slist_length(target->tried_mirrors);
-
-        // Checksum checking
-        fflush(target->f);
-        int fd = fileno(target->f);
-        gboolean matches = TRUE;
-
-        GSList *elem = target->target->checksums;
-        for (; elem; elem = g_slist_next(elem)) {
-            if (tmp_err) {
-                // There was an error, checksum checking is meaningless
-                break;
-            }
-
-            LrDownloadTargetChecksum *checksum = elem->data;
-
-            if (!checksum
-                || !checksum->value
-                || checksum->type == LR_CHECKSUM_UNKNOWN)
-            {
-                // Bad checksum
-                continue;
-            }
+        if (!tmp_err && target->decompressor) {
+            // Check that the decompressed data are complete and valid
+            lr_decompressor_finish(target->decompressor, &tmp_err);
+        }
 
-            lseek(fd, 0, SEEK_SET);
-            gboolean ret = lr_checksum_fd_cmp(checksum->type,
-                                              fd,
-                                              checksum->value,
-                                              1,
-                                              &matches,
-                                              &tmp_err);
-            if (ret == FALSE) {
-                // Error while checksum calculation
-                g_propagate_prefixed_error(err, tmp_err, "Downloading from %s "
-                        "was successfull but error encountered while "
-                        "checksuming: ", effective_url);
+        if (!tmp_err && target->target->checksums) {
+            // Transfer looks fine, but the checksum must be verified.
+            // The verification is done by a worker thread so that the
+            // other transfers are not blocked by the checksum calculation.
+            if (!lr_verify_target(dd, target, effective_url, err)) {
                 fclose(target->f);
                 target->f = NULL;
-                lr_free(effective_url);
-                return FALSE;
-            }
-
-            if (matches) {
-                // At least one checksum matches
-                g_debug("%s: Checksum (%s) %s is OK", __func__,
-                        lr_checksum_type_to_str(checksum->type),
-                        checksum->value);
-                break;
-            }
-        }
-
-        if (!matches) {
-            // Checksums doesn't match
-            g_set_error(&tmp_err,
-                    LR_DOWNLOADER_ERROR,
-                    LRE_BADCHECKSUM,
-                    "Downloading successfull, but checksum doesn't match");
-        }
-
-        fclose(target->f);
-        target->f = NULL;
-
-        GError *fail_fast_error = NULL;
-
-        if (tmp_err) {
-            // There was an error during transfer
-
-            g_debug("%s: Error during transfer: %s", __func__, tmp_err->message);
-
-            int complete_url_in_path = strstr(target->target->path, "://") ? 1 : 0;
-
-            // Call mirrorfailure callback
-            LrMirrorFailureCb mf_cb =  target->target->mirrorfailurecb;
-            if (mf_cb) {
-                // TODO: Break download if rc != 0
-                mf_cb(target->target->cbdata, tmp_err->message, effective_url);
-            }
-
-            if (!fatal_error &&
-                !complete_url_in_path
-                && !target->target->baseurl
-                && (dd->max_mirrors_to_try <= 0
-                    || num_of_tried_mirrors < dd->max_mirrors_to_try))
-            {
-                // Try another mirror
-                g_debug("%s: Ignore error - Try another mirror", __func__);
-                target->state = LR_DS_WAITING;
-                g_error_free(tmp_err);  // Ignore the error
-            } else {
-                // No more retry (or baseurl used) => set target as failed
-                g_debug("%s: No more retries (tried: %d)",
-                        __func__, num_of_tried_mirrors);
-                target->state = LR_DS_FAILED;
-
-                // Call end callback
-                LrEndCb end_cb =  target->target->endcb;
-                if (end_cb)
-                    end_cb(target->target->cbdata,
-                           LR_TRANSFER_ERROR,
-                           tmp_err->message);
-
-                lr_downloadtarget_set_error(target->target,
-                                            tmp_err->code,
-                                            "Download failed: %s",
-                                            tmp_err->message);
-                if (dd->failfast)
-                    g_propagate_error(&fail_fast_error, tmp_err);
-                else
-                    g_error_free(tmp_err);
-            }
-
-            // Truncate file - remove downloaded garbage (error html page etc.)
-            off_t original_offset;
-            if (target->original_offset > -1)
-                // If resume enabled, truncate file to its original position
-                original_offset = target->original_offset;
-            else
-                // If no resume enabled, just truncate whole file
-                original_offset = 0;
-
-            int rc;
-            if (target->target->fn)
-                rc = truncate(target->target->fn, original_offset);
-            else
-                rc = ftruncate(target->target->fd, original_offset);
-
-            if (rc == -1) {
-                lr_free(effective_url);
-                g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
-                            "ftruncate() failed: %s", strerror(errno));
                 return FALSE;
             }
-
-            if (!target->target->fn) {
-                // In case fd is used, seek to the original offset
-                off_t rc_offset = lseek(target->target->fd,
-                                        original_offset,
-                                        SEEK_SET);
-                if (rc_offset == -1) {
-                    lr_free(effective_url);
-                    g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
-                                "lseek() failed: %s", strerror(errno));
-                    return FALSE;
-                }
-            }
-        } else {
-            // No error encountered, transfer finished successfully
-            target->state = LR_DS_FINISHED;
-            lr_downloadtarget_set_error(target->target, LRE_OK, NULL);
-            if (target->mirror)
-                lr_downloadtarget_set_usedmirror(target->target,
-                                                 target->mirror->mirror->url);
-            lr_downloadtarget_set_effectiveurl(target->target,
-                                               effective_url);
-
-            // Call end callback
-            LrEndCb end_cb = target->target->endcb;
-            if (end_cb)
-                end_cb(target->target->cbdata,
-                       LR_TRANSFER_SUCCESSFUL,
-                       NULL);
+            freed_transfers++;
+            continue;
         }
 
-        lr_free(effective_url);
+        gboolean ret = finish_transfer(dd, target, tmp_err, fatal_error,
+                                       effective_url, err);
         freed_transfers++;
 
-        if (fail_fast_error) {
-            // A single download failed - interrupt whole downloading
-            g_propagate_error(err, fail_fast_error);
+        if (!ret)
             return FALSE;
-        }
     }
 
     // At this point, after handles of finished transfers were removed
@@ -1155,7 +2972,10 @@ lr_perform(LrDownload *dd, GError **err)
         return FALSE;
     }
 
-    while (dd->running_transfers) {
+    // Start the probes of the fastest mirror detection
+    lr_perform_fastestmirror(dd);
+
+    while (dd->running_transfers || dd->verifying_transfers) {
         int rc;
         int maxfd = -1;
         long curl_timeout = -1;
@@ -1178,6 +2998,23 @@ lr_perform(LrDownload *dd, GError **err)
             return FALSE;
         }
 
+        // Wake up for the fastest mirror detection too
+        if (dd->fmdetection) {
+            GError *tmp_err = NULL;
+            if (!lr_fastestmirror_detection_fdset(dd->fmdetection,
+                                                  &fdread,
+                                                  &fdwrite,
+                                                  &fdexcep,
+                                                  &maxfd,
+                                                  &curl_timeout,
+                                                  &tmp_err)) {
+                g_warning("%s: Fastest mirror detection failed: %s",
+                          __func__, tmp_err->message);
+                g_error_free(tmp_err);
+                dd->fmdetection = NULL;
+            }
+        }
+
         if (curl_timeout >= 0) {
             timeout.tv_sec = curl_timeout / 1000;
             if (timeout.tv_sec > 1)
@@ -1186,6 +3023,13 @@ lr_perform(LrDownload *dd, GError **err)
                 timeout.tv_usec = (curl_timeout % 1000) * 1000;
         }
 
+        if (!still_running && !dd->verifying_transfers) {
+            // The transfers were finished by the last curl_multi_perform()
+            // (e.g. local files), there is nothing to wait for
+            timeout.tv_sec = 0;
+            timeout.tv_usec = 0;
+        }
+
         // Get file descriptors from the transfers
         cm_rc = curl_multi_fdset(dd->multi_handle, &fdread, &fdwrite,
                                  &fdexcep, &maxfd);
@@ -1196,6 +3040,13 @@ lr_perform(LrDownload *dd, GError **err)
             return FALSE;
         }
 
+        // Wake up when a worker thread finishes a checksum verification
+        if (dd->verifying_transfers) {
+            FD_SET(dd->verify_pipe[0], &fdread);
+            if (dd->verify_pipe[0] > maxfd)
+                maxfd = dd->verify_pipe[0];
+        }
+
         rc = select(maxfd+1, &fdread, &fdwrite, &fdexcep, &timeout);
         if (rc < 0) {
             if (errno == EINTR) {
@@ -1208,6 +3059,10 @@ lr_perform(LrDownload *dd, GError **err)
             }
         }
 
+        lr_perform_fastestmirror(dd);
+        lr_check_slow_transfers(dd);
+        lr_autotune(dd);
+
         // This do-while loop is important. Because if curl_multi_perform sets
         // still_running to 0, we need to check if there are any next
         // transfers available (we need to call check_transfer_statuses).
@@ -1250,12 +3105,31 @@ gboolean
 lr_download(GSList *targets,
             gboolean failfast,
             GError **err)
+{
+    return lr_download_with_fastestmirror(targets, failfast, NULL, err);
+}
+
+/** Download the targets. They are either passed at once in the targets
+ * list or pulled one by one by the nextcb (and handed over to the donecb
+ * when they are done).
+ */
+static gboolean
+lr_download_internal(GSList *targets,
+                     LrDownloadNextTargetCb nextcb,
+                     LrDownloadDoneTargetCb donecb,
+                     void *cbdata,
+                     gboolean failfast,
+                     LrFastestMirrorDetection *detection,
+                     GError **err)
 {
     gboolean ret = FALSE;
     LrDownload dd;             // dd stands for Download Data
     GError *tmp_err = NULL;
+    LrDownloadTarget *first;
 
     assert(!err || *err == NULL);
+    assert(!targets || !nextcb);
+    assert(!nextcb || donecb);
 
     if (lr_interrupt) {
         g_set_error(err, LR_DOWNLOADER_ERROR, LRE_INTERRUPTED,
@@ -1263,14 +3137,15 @@ lr_download(GSList *targets,
         return FALSE;
     }
 
-    if (!targets) {
+    first = targets ? targets->data : (nextcb ? nextcb(cbdata) : NULL);
+    if (!first) {
         g_debug("%s: No targets", __func__);
         return TRUE;
     }
 
     // XXX: Donwloader configuration (max parallel connections etc.)
     // is taken from the handle of the first target.
-    LrHandle *lr_handle = ((LrDownloadTarget *) targets->data)->handle;
+    LrHandle *lr_handle = first->handle;
 
     // Prepare download data
     dd.failfast = failfast;
@@ -1280,6 +3155,7 @@ lr_download(GSList *targets,
         dd.max_connection_per_host = lr_handle->maxdownloadspermirror;
         dd.max_mirrors_to_try = lr_handle->maxmirrortries;
         dd.max_speed = lr_handle->maxspeed;
+        dd.connection_affinity = lr_handle->connectionaffinity;
     } else {
         // No handle, this is allowed when a complete URL is passed
         // via relative_url param.
@@ -1287,6 +3163,7 @@ lr_download(GSList *targets,
         dd.max_connection_per_host = LRO_MAXDOWNLOADSPERMIRROR_DEFAULT;
         dd.max_mirrors_to_try = LRO_MAXMIRRORTRIES_DEFAULT;
         dd.max_speed = LRO_MAXSPEED_DEFAULT;
+        dd.connection_affinity = FALSE;
     }
 
     dd.multi_handle = curl_multi_init();
@@ -1294,39 +3171,60 @@ lr_download(GSList *targets,
         // Something went wrong
         g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURLM,
                     "curl_multi_init() call failed");
+        if (nextcb)
+            donecb(cbdata, first);
         return FALSE;
     }
 
     // Prepare list of LrTargets and LrHandleMirrors
+    dd.arena = lr_arena_new(0);
+    dd.url = g_string_sized_new(256);
+    dd.effective_url = g_string_sized_new(256);
+    dd.freed_origins = g_array_new(FALSE, FALSE, sizeof(LrConnectionOrigin));
     dd.handle_mirrors = NULL;
     dd.targets = NULL;
-    for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
-        LrDownloadTarget *dtarget = elem->data;
-
-        assert(dtarget);
-        assert(dtarget->path);
-        assert((dtarget->fd > 0 && !dtarget->fn) || (dtarget->fd < 0 && dtarget->fn));
-        g_debug("%s: Target: %s (%s)", __func__,
-                dtarget->path,
-                (dtarget->baseurl) ? dtarget->baseurl : "-");
-
-        LrTarget *target = lr_malloc0(sizeof(*target));
-        target->state           = LR_DS_WAITING;
-        target->target          = dtarget;
-        target->original_offset = -1;
-        target->target->rcode   = LRE_UNFINISHED;
-        target->target->err     = "Not finished";
-        target->handle          = dtarget->handle;
-        dd.targets = g_slist_append(dd.targets, target);
-        // Add list of handle internal mirrors to dd.handle_mirrors
-        // if doesn't exists yet and set the list reference
-        // to the target.
-        dd.handle_mirrors = lr_prepare_lrmirrors(dd.handle_mirrors,
-                                                 dtarget->handle,
-                                                 &target);
+    dd.n_targets = 0;
+    dd.free_targets = NULL;
+    dd.nextcb = nextcb;
+    dd.donecb = donecb;
+    dd.cbdata = cbdata;
+
+    if (nextcb) {
+        lr_add_target(&dd, first);
+    } else {
+        lr_add_targets(&dd, targets);
     }
 
     dd.running_transfers = NULL;
+    dd.verifying_transfers = NULL;
+    dd.verify_pool = NULL;
+    dd.verified_targets = NULL;
+    dd.verify_pipe[0] = -1;
+    dd.verify_pipe[1] = -1;
+    dd.fmdetection = detection;
+    dd.connect_time.srtt = 0.0;
+    dd.connect_time.rttvar = 0.0;
+    dd.n_rates = 0;
+    dd.last_slow_check = 0;
+
+    memset(&dd.autotune, 0, sizeof(dd.autotune));
+    if (lr_handle && lr_handle->autotune) {
+        // Start from the number chosen by the last download
+        int start = lr_handle->autotunedparalleldownloads;
+        if (start <= 0)
+            start = LRO_MAXPARALLELDOWNLOADS_DEFAULT;
+        dd.autotune.enabled = TRUE;
+        dd.autotune.state.max = lr_handle->maxparalleldownloads;
+        dd.autotune.state.min = MIN(lr_handle->minparalleldownloads,
+                                    dd.autotune.state.max);
+        dd.autotune.last_tick = g_get_monotonic_time();
+        dd.max_parallel_connections = CLAMP(start, dd.autotune.state.min,
+                                            dd.autotune.state.max);
+        dd.autotune.state.prev_limit = dd.max_parallel_connections;
+        g_debug("%s: Autotuning parallel downloads (%d-%d), starting with %d",
+                __func__, dd.autotune.state.min, dd.autotune.state.max,
+                dd.max_parallel_connections);
+    }
 
     // Prepare the first set of transfers
     if (!prepare_next_transfers(&dd, &tmp_err))
@@ -1338,6 +3236,9 @@ lr_download(GSList *targets,
 
     assert(ret || tmp_err);
 
+    if (dd.autotune.enabled)
+        lr_handle->autotunedparalleldownloads = dd.max_parallel_connections;
+
 lr_download_cleanup:
 
     if (tmp_err) {
@@ -1354,6 +3255,8 @@ lr_download_cleanup:
             target->f = NULL;
             g_free(target->headercb_interrupt_reason);
             target->headercb_interrupt_reason = NULL;
+            g_free(target->writecb_interrupt_reason);
+            target->writecb_interrupt_reason = NULL;
 
             // Call end callback
             LrEndCb end_cb =  target->target->endcb;
@@ -1373,38 +3276,121 @@ lr_download_cleanup:
 
         g_slist_free(dd.running_transfers);
         dd.running_transfers = NULL;
+    }
+
+    if (dd.verify_pool) {
+        // Wait for the verifications that are already in progress,
+        // the queued ones are dropped.
+        g_thread_pool_free(dd.verify_pool, TRUE, TRUE);
+        dd.verify_pool = NULL;
+    }
+
+    if (tmp_err) {
+        // Targets which were verified in time of the error
+        for (GSList *elem = dd.verifying_transfers; elem; elem = g_slist_next(elem)) {
+            LrTarget *target = elem->data;
+
+            fclose(target->f);
+            target->f = NULL;
+            g_free(target->effective_url);
+            target->effective_url = NULL;
+            g_clear_error(&target->checksum_err);
+
+            // Call end callback
+            LrEndCb end_cb =  target->target->endcb;
+            if (end_cb) {
+                gchar *msg = g_strdup_printf("Not finished - interrupted by "
+                                             "error: %s", tmp_err->message);
+                end_cb(target->target->cbdata,
+                     LR_TRANSFER_ERROR,
+                     msg);
+                g_free(msg);
+            }
+
+            lr_downloadtarget_set_error(target->target, LRE_UNFINISHED,
+                    "Not finished - interrupted by error: %s",
+                    tmp_err->message);
+        }
+
+        g_slist_free(dd.verifying_transfers);
+        dd.verifying_transfers = NULL;
 
         g_propagate_error(err, tmp_err);
     }
 
     assert(dd.running_transfers == NULL);
+    assert(dd.verifying_transfers == NULL);
+
+    if (dd.verified_targets)
+        g_async_queue_unref(dd.verified_targets);
+    if (dd.verify_pipe[0] != -1) {
+        close(dd.verify_pipe[0]);
+        close(dd.verify_pipe[1]);
+    }
 
     curl_multi_cleanup(dd.multi_handle);
 
     // Clean up dd.handle_mirrors
     for (GSList *elem = dd.handle_mirrors; elem; elem = g_slist_next(elem)) {
         LrHandleMirrors *handle_mirrors = elem->data;
-        for (GSList *el = handle_mirrors->lrmirrors; el; el = g_slist_next(el)) {
-            LrMirror *mirror = el->data;
-            lr_free(mirror);
+        for (GSList *h = handle_mirrors->curl_handles; h; h = g_slist_next(h))
+            curl_easy_cleanup(h->data);
+        if (handle_mirrors->handle)
+            g_debug("%s: Transfers: %ld (%ld reused a connection)", __func__,
+                    handle_mirrors->handle->transfers,
+                    handle_mirrors->handle->reusedconnections);
+        if (handle_mirrors->mirrorstats) {
+            GError *tmp_err = NULL;
+            if (!lr_mirrorstats_write(handle_mirrors->mirrorstats, &tmp_err)) {
+                g_debug("%s: Cannot write mirror statistics: %s",
+                        __func__, tmp_err->message);
+                g_error_free(tmp_err);
+            }
+            lr_mirrorstats_free(handle_mirrors->mirrorstats);
         }
-        g_slist_free(handle_mirrors->lrmirrors);
-        lr_free(handle_mirrors);
     }
-    g_slist_free(dd.handle_mirrors);
 
     for (GSList *elem = dd.targets; elem; elem = g_slist_next(elem)) {
         LrTarget *target = elem->data;
-        assert(target->curl_handle == NULL);
-        assert(target->f == NULL);
-        g_slist_free(target->tried_mirrors);
-        lr_free(target);
+        lr_cleanup_target(target);
+        if (donecb)
+            donecb(cbdata, target->target);
     }
-    g_slist_free(dd.targets);
+
+    // Targets, mirrors and their lists
+    lr_arena_free(dd.arena);
+    g_string_free(dd.url, TRUE);
+    g_string_free(dd.effective_url, TRUE);
+    lr_forget_origins(&dd);
+    g_array_free(dd.freed_origins, TRUE);
 
     return ret;
 }
 
+gboolean
+lr_download_with_fastestmirror(GSList *targets,
+                               gboolean failfast,
+                               LrFastestMirrorDetection *detection,
+                               GError **err)
+{
+    return lr_download_internal(targets, NULL, NULL, NULL,
+                                failfast, detection, err);
+}
+
+gboolean
+lr_download_stream(LrDownloadNextTargetCb nextcb,
+                   LrDownloadDoneTargetCb donecb,
+                   void *cbdata,
+                   gboolean failfast,
+                   GError **err)
+{
+    assert(nextcb);
+    assert(donecb);
+
+    return lr_download_internal(NULL, nextcb, donecb, cbdata,
+                                failfast, NULL, err);
+}
+
 gboolean
 lr_download_target(LrDownloadTarget *target,
                    GError **err)
@@ -55,10 +55,55 @@ lr_sigint_handler(int sig);
  *                  doesn't have to mean that all targets was
  *                  downloaded successfully - You have to check
  *                  status of all downloaded targets.
+ *
+ * Targets which are stored to a file (not to a file descriptor) and
+ * whose file has the same checksums, or the same URL if no checksum
+ * is specified, are downloaded only once. The other targets get a copy
+ * (a reflink if the filesystem supports it) and their end callbacks
+ * are called as usual. Targets with resume, byte range or decompression
+ * are always downloaded.
  */
 gboolean
 lr_download(GSList *targets, gboolean failfast, GError **err);
 
+/** Callback which provides the next target to download.
+ * @param cbdata    User data passed to ::lr_download_stream.
+ * @return          Next ::LrDownloadTarget or NULL if there are no more
+ *                  targets (the callback is not called again then).
+ */
+typedef LrDownloadTarget *(*LrDownloadNextTargetCb)(void *cbdata);
+
+/** Callback which takes over a target that is done. Librepo doesn't
+ * use the target after this call, so the callback may check its
+ * status and free it.
+ * @param cbdata    User data passed to ::lr_download_stream.
+ * @param target    The target (its rcode and err are set).
+ */
+typedef void (*LrDownloadDoneTargetCb)(void *cbdata, LrDownloadTarget *target);
+
+/** Same as ::lr_download but the targets are not passed at once.
+ * Whenever a transfer slot frees up, the next target is pulled from
+ * the nextcb, and every pulled target is passed to the donecb when it
+ * is done. The number of targets that are in progress at once is
+ * bounded (relative to LRO_MAXPARALLELDOWNLOADS), so the memory used
+ * doesn't depend on the total number of targets.
+ * The donecb is called exactly once for every pulled target before this
+ * function returns (even if an error occurs).
+ * Downloader configuration is taken from the handle of the first target.
+ * @param nextcb    Callback that provides the next target.
+ * @param donecb    Callback that takes over the targets that are done.
+ * @param cbdata    User data for the callbacks.
+ * @param failfast  See ::lr_download
+ * @param err       GError **
+ * @return          See ::lr_download
+ */
+gboolean
+lr_download_stream(LrDownloadNextTargetCb nextcb,
+                   LrDownloadDoneTargetCb donecb,
+                   void *cbdata,
+                   gboolean failfast,
+                   GError **err);
+
 /** Wrapper over ::lr_download that takes only single ::LrDownloadTarget.
  * Note: failfast is TRUE, so if download failed, then this function returns
  * FALSE (There is no need to check status of download itself).
@@ -0,0 +1,109 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2013  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+#ifndef LR_DOWNLOADER_INTERNAL_H
+#define LR_DOWNLOADER_INTERNAL_H
+
+#include <glib.h>
+
+#include "downloader.h"
+#include "fastestmirror_internal.h"
+
+G_BEGIN_DECLS
+
+/** The same as lr_download(), but the fastest mirror detection runs
+ * in the same event loop as the downloads. Whenever new results of
+ * the detection are available, the mirrors are re-ranked, so the
+ * targets which are started later use the faster mirrors.
+ * @param targets       List of LrDownloadTargets
+ * @param failfast      If TRUE, fail immediately when a transfer fails.
+ * @param detection     Fastest mirror detection or NULL.
+ * @param err           GError **
+ * @return              TRUE if everything is ok, FALSE if err is set.
+ */
+gboolean
+lr_download_with_fastestmirror(GSList *targets,
+                               gboolean failfast,
+                               LrFastestMirrorDetection *detection,
+                               GError **err);
+
+/** State of the tuning of the number of parallel downloads
+ * (LRO_AUTOTUNE), see lr_autotune_decide().
+ */
+typedef struct {
+    int min; /*!<
+        Minimal number of parallel downloads */
+    int max; /*!<
+        Maximal number of parallel downloads */
+    int prev_limit; /*!<
+        Number of parallel downloads before the last decision */
+    double prev_rate; /*!<
+        Total throughput (bytes per second) before the last decision */
+    int hold; /*!<
+        Number of decisions to skip growing after a back off */
+} LrAutotuneState;
+
+/** Choose the number of parallel downloads for the next interval
+ * of LRO_AUTOTUNE from the samples of the last one. The number grows
+ * by one while all the slots are used. If the throughput didn't rise
+ * by at least 10 % after a growth, the growth is reverted. Errors
+ * shrink the number by a quarter (at least by one, but never below
+ * the min). No growing for 5 intervals after a revert or a back off.
+ * @param state         State of the decisions (updated).
+ * @param limit         Number of parallel downloads in the last interval.
+ * @param running       Number of the transfers running now.
+ * @param rate          Total throughput of the last interval in bytes
+ *                      per second.
+ * @param errors        Number of transfers failed in the last interval.
+ * @return              Number of parallel downloads for the next interval.
+ */
+int
+lr_autotune_decide(LrAutotuneState *state,
+                   int limit,
+                   int running,
+                   double rate,
+                   int errors);
+
+/** Connect timeout for LRO_ADAPTIVETIMEOUTS derived from the smoothed
+ * connect time and its mean deviation: 4 * (srtt + 4 * rttvar), but at
+ * least 3 s and at most max_timeout.
+ * @param srtt          Smoothed connect time in seconds, 0 if nothing
+ *                      was observed yet.
+ * @param rttvar        Mean deviation of the connect time in seconds.
+ * @param max_timeout   Upper bound in ms (LRO_CONNECTTIMEOUT).
+ * @return              Timeout in ms (max_timeout if srtt is 0).
+ */
+long
+lr_adaptive_connect_timeout(double srtt, double rttvar, long max_timeout);
+
+/** Check if the rate of a transfer is much slower than the recently
+ * observed rates (LRO_ADAPTIVETIMEOUTS), i.e. below a tenth of their
+ * median. Nothing is too slow while there are less than 4 rates.
+ * @param rate          Rate of the transfer in bytes per second.
+ * @param rates         The recently observed rates (in any order).
+ * @param n_rates       Number of the rates (only the first 64 are used).
+ * @return              TRUE if the transfer is too slow.
+ */
+gboolean
+lr_rate_too_slow(double rate, const double *rates, guint n_rates);
+
+G_END_DECLS
+
+#endif
@@ -27,6 +27,8 @@
 #include "downloadtarget.h"
 #include "downloadtarget_internal.h"
 
+#define DOWNLOADTARGET_CHUNK_ROOM   256     // For strings set later
+
 LrDownloadTargetChecksum *
 lr_downloadtargetchecksum_new(LrChecksumType type, const gchar *value)
 {
@@ -44,6 +46,50 @@ lr_downloadtargetchecksum_free(LrDownloadTargetChecksum *dtch)
     g_free(dtch);
 }
 
+void
+lr_downloadtarget_init(LrDownloadTarget *target,
+                       GStringChunk *chunk,
+                       LrHandle *handle,
+                       const char *path,
+                       const char *baseurl,
+                       int fd,
+                       const char *fn,
+                       GSList *possiblechecksums,
+                       gint64 expectedsize,
+                       gboolean resume,
+                       LrProgressCb progresscb,
+                       void *cbdata,
+                       LrEndCb endcb,
+                       LrMirrorFailureCb mirrorfailurecb,
+                       void *userdata,
+                       gint64 byterangestart,
+                       gint64 byterangeend)
+{
+    assert(target);
+    assert(chunk);
+    assert(path);
+    assert((fd > 0 && !fn) || (fd < 0 && fn));
+
+    memset(target, 0, sizeof(*target));
+    target->handle          = handle;
+    target->chunk           = chunk;
+    target->path            = (char *) path;
+    target->baseurl         = (char *) baseurl;
+    target->fd              = fd;
+    target->fn              = (char *) fn;
+    target->checksums       = possiblechecksums;
+    target->expectedsize    = expectedsize;
+    target->resume          = resume;
+    target->progresscb      = progresscb;
+    target->cbdata          = cbdata;
+    target->endcb           = endcb;
+    target->mirrorfailurecb = mirrorfailurecb;
+    target->rcode           = LRE_UNFINISHED;
+    target->userdata        = userdata;
+    target->byterangestart  = byterangestart;
+    target->byterangeend    = byterangeend;
+}
+
 LrDownloadTarget *
 lr_downloadtarget_new(LrHandle *handle,
                       const char *path,
@@ -74,23 +120,34 @@ lr_downloadtarget_new(LrHandle *handle,
         return NULL;
     }
 
-    target->handle          = handle;
-    target->chunk           = g_string_chunk_new(0);
-    target->path            = g_string_chunk_insert(target->chunk, path);
-    target->baseurl         = lr_string_chunk_insert(target->chunk, baseurl);
-    target->fd              = fd;
-    target->fn              = lr_string_chunk_insert(target->chunk, fn);
-    target->checksums       = possiblechecksums;
-    target->expectedsize    = expectedsize;
-    target->resume          = resume;
-    target->progresscb      = progresscb;
-    target->cbdata          = cbdata;
-    target->endcb           = endcb;
-    target->mirrorfailurecb = mirrorfailurecb;
-    target->rcode           = LRE_UNFINISHED;
-    target->userdata        = userdata;
-    target->byterangestart  = byterangestart;
-    target->byterangeend    = byterangeend;
+    // Size the chunk so that the strings set during the download
+    // (used mirror, effective url, error message) fit into its first
+    // block too. A chunk of the default size allocates a separate
+    // block for every string.
+    gsize chunk_size = strlen(path) + 1 + DOWNLOADTARGET_CHUNK_ROOM;
+    if (baseurl)
+        chunk_size += strlen(baseurl) + 1;
+    if (fn)
+        chunk_size += strlen(fn) + 1;
+
+    GStringChunk *chunk = g_string_chunk_new(chunk_size);
+    lr_downloadtarget_init(target,
+                           chunk,
+                           handle,
+                           g_string_chunk_insert(chunk, path),
+                           lr_string_chunk_insert(chunk, baseurl),
+                           fd,
+                           lr_string_chunk_insert(chunk, fn),
+                           possiblechecksums,
+                           expectedsize,
+                           resume,
+                           progresscb,
+                           cbdata,
+                           endcb,
+                           mirrorfailurecb,
+                           userdata,
+                           byterangestart,
+                           byterangeend);
 
     return target;
 }
@@ -107,6 +164,22 @@ lr_downloadtarget_free(LrDownloadTarget *target)
     lr_free(target);
 }
 
+void
+lr_downloadtarget_set_decompress(LrDownloadTarget *target,
+                                 const char *fn,
+                                 LrChecksumType checksumtype,
+                                 const char *checksum,
+                                 gint64 expectedsize)
+{
+    assert(target);
+    assert(!fn || (target->byterangestart <= 0 && target->byterangeend <= 0));
+
+    target->decompressfn = lr_string_chunk_insert(target->chunk, fn);
+    target->decompresschecksumtype = checksumtype;
+    target->decompresschecksum = lr_string_chunk_insert(target->chunk, checksum);
+    target->decompressexpectedsize = expectedsize;
+}
+
 void
 lr_downloadtarget_set_error(LrDownloadTarget *target,
                             LrRc code,
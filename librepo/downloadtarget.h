@@ -129,6 +129,22 @@ typedef struct {
         User data - This data are not used by lr_downloader or touched
         by lr_downloadtarget_free. */
 
+    // Decompression (see lr_downloadtarget_set_decompress())
+
+    char *decompressfn; /*!<
+        If not NULL, the data (gzip, bzip2 or xz compressed) are
+        decompressed during the download and written to this file.
+        Could not be used together with a byte range. */
+
+    LrChecksumType decompresschecksumtype; /*!<
+        Type of the decompresschecksum. */
+
+    char *decompresschecksum; /*!<
+        Expected checksum of the decompressed data or NULL. */
+
+    gint64 decompressexpectedsize; /*!<
+        Expected size of the decompressed data or 0 if unknown. */
+
 } LrDownloadTarget;
 
 /** Create new empty ::LrDownloadTarget.
@@ -200,6 +216,23 @@ lr_downloadtarget_new(LrHandle *handle,
 void
 lr_downloadtarget_free(LrDownloadTarget *target);
 
+/** Decompress the target on the fly during the download.
+ * If the checksum or the size of the decompressed data doesn't match,
+ * the download is considered unsuccessful (and the next mirror is tried).
+ * @param target            Download target
+ * @param fn                File where the decompressed data are written
+ * @param checksumtype      Type of the checksum
+ * @param checksum          Expected checksum of the decompressed data
+ *                          or NULL
+ * @param expectedsize      Expected size of the decompressed data or 0
+ */
+void
+lr_downloadtarget_set_decompress(LrDownloadTarget *target,
+                                 const char *fn,
+                                 LrChecksumType checksumtype,
+                                 const char *checksum,
+                                 gint64 expectedsize);
+
 G_END_DECLS
 
 #endif
@@ -27,6 +27,34 @@
 
 G_BEGIN_DECLS
 
+/** Initialize a ::LrDownloadTarget allocated by the caller (e.g. from
+ * an arena). Unlike lr_downloadtarget_new(), the strings are not copied
+ * (they must outlive the target) and the strings set during the download
+ * are stored to the given chunk, which may be shared by many targets.
+ * Such target must not be freed by lr_downloadtarget_free().
+ * For the other params see lr_downloadtarget_new().
+ * @param target        Target to initialize.
+ * @param chunk         Chunk for the strings set during the download.
+ */
+void
+lr_downloadtarget_init(LrDownloadTarget *target,
+                       GStringChunk *chunk,
+                       LrHandle *handle,
+                       const char *path,
+                       const char *baseurl,
+                       int fd,
+                       const char *fn,
+                       GSList *possiblechecksums,
+                       gint64 expectedsize,
+                       gboolean resume,
+                       LrProgressCb progresscb,
+                       void *cbdata,
+                       LrEndCb endcb,
+                       LrMirrorFailureCb mirrorfailurecb,
+                       void *userdata,
+                       gint64 byterangestart,
+                       gint64 byterangeend);
+
 /** Helper function to comfortable setting of error to the ::LrDownloadTarget.
  */
 void
@@ -23,6 +23,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <float.h>
+#include <poll.h>
 #include <curl/curl.h>
 
 #include "util.h"
@@ -30,30 +31,41 @@
 #include "rcodes.h"
 #include "fastestmirror.h"
 #include "fastestmirror_internal.h"
+#include "fastestmirrorcache_internal.h"
 
 #define LENGT_OF_MEASUREMENT        2.0    // Number of seconds (float point!)
-#define HALF_OF_SECOND_IN_MICROS    500000
+#define POLL_INTERVAL_FOR_TOPK      10000  // Microseconds
+#define PROBE_TIMEOUT_MIN           250    // Milliseconds
 
-#define CACHE_GROUP_METADATA    ":_librepo_:"   // Group with metadata
-#define CACHE_KEY_TS            "ts"            // Timestamp
-#define CACHE_KEY_CONNECTTIME   "connectime"    // Time of reponse
-#define CACHE_KEY_VERSION       "version"       // Version of cache format
-
-#define CACHE_VERSION   1   // Current version of cache format
-
-#define CACHE_RECORD_MAX_AGE    (LRO_FASTESTMIRRORMAXAGE_DEFAULT * 6)
+#define THROUGHPUT_CANDIDATES       5      // Mirrors for throughput probe
+#define THROUGHPUT_PROBE_RANGE      "0-65535"
+#define THROUGHPUT_MIN_DURATION     0.001  // Seconds
+#define THROUGHPUT_REFERENCE_SIZE   1048576.0 // Size of a "typical" file
 
 typedef struct {
     gchar *url;                 // Points to string passed by the user
     CURL *curl;                 // Curl handle or NULL
     double plain_connect_time;  // Mirror connect time
     gboolean cached;            // Was connect time load from cache?
+    gboolean measured;          // Is the plain_connect_time known?
+    gint64 probe_start;         // Monotonic time when the probe started
+                                // or 0 if it wasn't started
+    gchar *probe_url;           // URL for the throughput probe or NULL
+    double ttfb;                // Time to first byte of the probe
+    double throughput;          // Throughput of the probe (bytes/sec)
+    gboolean throughput_measured; // Are ttfb and throughput known?
+    gboolean throughput_cached; // Were they loaded from cache?
 } LrFastestMirror;
 
-typedef struct {
-    gchar *path;
-    GKeyFile *keyfile;
-} LrFastestMirrorCache;
+static gint
+lr_fastestmirror_cmp_double(gconstpointer a, gconstpointer b)
+{
+    double da = *((const double *) a);
+    double db = *((const double *) b);
+    if (da < db) return -1;
+    if (da > db) return 1;
+    return 0;
+}
 
 static LrFastestMirror *
 lr_lrfastestmirror_new()
@@ -71,228 +83,22 @@ lr_lrfastestmirror_free(LrFastestMirror *mirror)
         return;
     if (mirror->curl)
         curl_easy_cleanup(mirror->curl);
+    lr_free(mirror->probe_url);
     g_free(mirror);
 }
 
-static gboolean
-lr_fastestmirrorcache_load(LrFastestMirrorCache **cache,
-                           gchar *path,
-                           LrFastestMirrorCb cb,
-                           void *cbdata,
-                           GError **err)
-{
-    assert(cache);
-    assert(!err || *err == NULL);
-
-    if (!path) {
-        // No cache file specified
-        *cache = NULL;
-        return TRUE;
-    }
-
-    cb(cbdata, LR_FMSTAGE_CACHELOADING, path);
-
-    GKeyFile *keyfile = g_key_file_new();
-
-    *cache = lr_malloc0(sizeof(LrFastestMirrorCache));
-    (*cache)->path = g_strdup(path);
-    (*cache)->keyfile = keyfile;
-
-    if (!g_file_test(path, G_FILE_TEST_EXISTS)) {
-        // Cache file doesn't exist
-        cb(cbdata, LR_FMSTAGE_CACHELOADINGSTATUS,
-           "Cache doesn't exist");
-    } else {
-        // Cache exists, try to load it
-
-        gboolean something_wrong = FALSE;
-        GError *tmp_err = NULL;
-        gboolean ret = g_key_file_load_from_file(keyfile,
-                                                 path,
-                                                 G_KEY_FILE_NONE,
-                                                 &tmp_err);
-        if (!ret) {
-            // Cannot parse cache file
-            char *msg = g_strdup_printf("Cannot parse fastestmirror "
-                                        "cache %s: %s", path, tmp_err->message);
-            g_debug("%s: %s", __func__, msg);
-            cb(cbdata, LR_FMSTAGE_CACHELOADINGSTATUS, msg);
-            something_wrong = TRUE;
-            g_free(msg);
-            g_error_free(tmp_err);
-        } else {
-            // File parsed successfully
-            if (!g_key_file_has_group(keyfile, CACHE_GROUP_METADATA)) {
-                // Not a fastestmirror cache
-                g_debug("%s: File %s is not a fastestmirror cache file",
-                          __func__, path);
-                cb(cbdata, LR_FMSTAGE_CACHELOADINGSTATUS,
-                   "File is not a fastestmirror cache");
-                something_wrong = TRUE;
-            } else {
-                int version = (int) g_key_file_get_integer(keyfile,
-                                                           CACHE_GROUP_METADATA,
-                                                           CACHE_KEY_VERSION,
-                                                           NULL);
-                if (version != CACHE_VERSION) {
-                    g_debug("%s: Old cache version %d vs %d",
-                            __func__, version, CACHE_VERSION);
-                    cb(cbdata, LR_FMSTAGE_CACHELOADINGSTATUS,
-                       "Old version of cache format");
-                    something_wrong = TRUE;
-                }
-            }
-        }
-
-        if (something_wrong) {
-            // Reinit keyfile
-            g_key_file_free(keyfile);
-            keyfile = g_key_file_new();
-            (*cache)->keyfile = keyfile;
-        } else {
-            gsize len;
-            gchar **array = g_key_file_get_groups(keyfile, &len);
-            g_debug("%s: Loaded: %"G_GSIZE_FORMAT" records", __func__, len);
-
-            // Remove really outdated records
-            gint64 current_time = g_get_real_time() / 1000000;
-            char **group, *groupname;
-            for (group=array; groupname=*group, groupname; group++) {
-                if (g_str_has_prefix(groupname, ":_"))
-                    continue;
-
-                gint64 ts = g_key_file_get_int64(keyfile,
-                                                 groupname,
-                                                 CACHE_KEY_TS,
-                                                 NULL);
-                if (ts < (current_time - CACHE_RECORD_MAX_AGE)) {
-                    // Record is too old, remove it
-                    g_debug("%s: Removing too old record from cache: %s "
-                            "(ts: %"G_GINT64_FORMAT")",
-                            __func__, groupname, ts);
-                    g_key_file_remove_group(keyfile, groupname, NULL);
-                }
-            }
-            g_strfreev(array);
-
-            cb(cbdata, LR_FMSTAGE_CACHELOADINGSTATUS, NULL);
-        }
-    }
-
-    // Set version of cache format
-    g_key_file_set_integer(keyfile,
-                           CACHE_GROUP_METADATA,
-                           CACHE_KEY_VERSION,
-                           CACHE_VERSION);
-
-    return TRUE;
-}
-
-static gboolean
-lr_fastestmirrorcache_lookup(LrFastestMirrorCache *cache,
-                             gchar *url,
-                             gint64 *ts,
-                             double *connecttime)
-{
-    if (!cache || !cache->keyfile || !url)
-        return FALSE;
-
-    GKeyFile *keyfile = cache->keyfile;
-
-    if (!g_key_file_has_group(keyfile, url))
-        return FALSE;
-
-    gint64 l_ts;
-    double l_connecttime;
-    GError *tmp_err = NULL;
-
-    // Get timestamp
-    l_ts = g_key_file_get_int64(keyfile, url, CACHE_KEY_TS, &tmp_err);
-    if (tmp_err) {
-        g_error_free(tmp_err);
-        return FALSE;
-    }
-
-    // Get connect time
-    l_connecttime = (double) g_key_file_get_double(keyfile,
-                                                   url,
-                                                   CACHE_KEY_CONNECTTIME,
-                                                   &tmp_err);
-    if (tmp_err) {
-        g_error_free(tmp_err);
-        return FALSE;
-    }
-
-    *ts = l_ts;
-    *connecttime = l_connecttime;
-
-    return TRUE;
-}
-
-static void
-lr_fastestmirrorcache_update(LrFastestMirrorCache *cache,
-                             gchar *url,
-                             gint64 ts,
-                             double connecttime)
-{
-    if (!cache || !cache->keyfile || !url)
-        return;
-
-    GKeyFile *keyfile = cache->keyfile;
-
-    g_key_file_set_int64(keyfile, url, CACHE_KEY_TS, ts);
-    g_key_file_set_double(keyfile, url, CACHE_KEY_CONNECTTIME, connecttime);
-}
-
-static gboolean
-lr_fastestmirrorcache_write(LrFastestMirrorCache *cache, GError **err)
-{
-    assert(!err || *err == NULL);
-
-    if (!cache || !cache->keyfile)
-        return TRUE;
-
-    // Gen cache content
-    GError *tmp_err = NULL;
-    gchar *content = g_key_file_to_data(cache->keyfile, NULL, &tmp_err);
-    if (tmp_err) {
-        g_propagate_error(err, tmp_err);
-        return FALSE;
-    }
-
-    // Write cache
-    FILE *f = fopen(cache->path, "w");
-    if (!f) {
-        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
-                    "Cannot open %s: %s", cache->path, strerror(errno));
-        return FALSE;
-    }
-
-    fputs(content, f);
-    fclose(f);
-    g_free(content);
-
-    return TRUE;
-}
-
-static void
-lr_fastestmirrorcache_free(LrFastestMirrorCache *cache)
-{
-    if (!cache)
-        return;
-
-    g_free(cache->path);
-    g_key_file_free(cache->keyfile);
-    g_free(cache);
-}
-
 /** Create list of LrFastestMirror based on input list of URLs.
+ * If probepath is specified, URL for the throughput probe is prepared
+ * for every mirror. The probepath is relative to the URL of the mirror
+ * (or to the URL from the baseurls table, if the table contains it).
  */
 static gboolean
 lr_fastestmirror_prepare(LrHandle *handle,
                          GSList *in_list,
                          GSList **out_list,
                          LrFastestMirrorCache *cache,
+                         GHashTable *baseurls,
+                         const char *probepath,
                          GError **err)
 {
     gboolean ret = TRUE;
@@ -313,24 +119,40 @@ lr_fastestmirror_prepare(LrHandle *handle,
 
     for (GSList *elem = in_list; elem; elem = g_slist_next(elem)) {
         gchar *url = elem->data;
+        gchar *probe_url = NULL;
         CURLcode curlcode;
         CURL *curlh;
 
+        if (probepath) {
+            const char *baseurl = NULL;
+            if (baseurls)
+                baseurl = g_hash_table_lookup(baseurls, url);
+            probe_url = lr_pathconcat(baseurl ? baseurl : url,
+                                      probepath, NULL);
+        }
+
         // TODO: For prefixed by "file://" - set plain_connect_time to zero
 
         // Try to find item in the cache
-        gint64 ts;
-        double connecttime;
-        if (lr_fastestmirrorcache_lookup(cache, url, &ts, &connecttime)) {
-            if (ts >= (current_time - maxage)) {
+        LrFastestMirrorCacheEntry entry;
+        if (lr_fastestmirrorcache_lookup(cache, url, &entry)) {
+            if (entry.ts >= (current_time - maxage)) {
                 // Use cached entry
                 g_debug("%s: Using cached connect time for: %s (%f)",
-                        __func__, url, connecttime);
+                        __func__, url, entry.connecttime);
                 LrFastestMirror *mirror = lr_lrfastestmirror_new();
                 mirror->url = url;
                 mirror->curl = NULL;
-                mirror->plain_connect_time = connecttime;
+                mirror->plain_connect_time = entry.connecttime;
                 mirror->cached = TRUE;
+                mirror->measured = TRUE;
+                mirror->probe_url = probe_url;
+                if (entry.throughput > 0.0) {
+                    mirror->ttfb = entry.ttfb;
+                    mirror->throughput = entry.throughput;
+                    mirror->throughput_measured = TRUE;
+                    mirror->throughput_cached = TRUE;
+                }
                 list = g_slist_append(list, mirror);
                 continue;
             } else {
@@ -348,13 +170,20 @@ lr_fastestmirror_prepare(LrHandle *handle,
         if (!curlh) {
             g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURL,
                         "Cannot create curl handle");
+            lr_free(probe_url);
             ret = FALSE;
             break;
         }
 
+        // Share DNS cache, TLS sessions and connections with the downloads
+        if (handle && handle->curl_share)
+            curl_easy_setopt(curlh, CURLOPT_SHARE, handle->curl_share);
+
         LrFastestMirror *mirror = lr_lrfastestmirror_new();
         mirror->url = url;
         mirror->curl = curlh;
+        mirror->probe_url = probe_url;
+        list = g_slist_append(list, mirror);
 
         curlcode = curl_easy_setopt(curlh, CURLOPT_URL, url);
         if (curlcode != CURLE_OK) {
@@ -373,8 +202,6 @@ lr_fastestmirror_prepare(LrHandle *handle,
             ret = FALSE;
             break;
         }
-
-        list = g_slist_append(list, mirror);
     }
 
     if (ret) {
@@ -388,268 +215,987 @@ lr_fastestmirror_prepare(LrHandle *handle,
     return ret;
 }
 
-static gboolean
-lr_fastestmirror_perform(GSList *list,
-                         LrFastestMirrorCb cb,
-                         void *cbdata,
-                         GError **err)
+/** Set plain_connect_time of the mirror from its finished (or
+ * interrupted) probe.
+ */
+static void
+lr_fastestmirror_measure(LrFastestMirror *mirror)
 {
-    assert(!err || *err == NULL);
+    CURL *curl = mirror->curl;
+    char *effective_url = NULL;
 
-    if (!list)
-        return TRUE;
+    assert(curl);
 
-    CURLM *multihandle = curl_multi_init();
-    if (!multihandle) {
-        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURL,
-                    "curl_multi_init() error");
-        return FALSE;
-    }
+    mirror->measured = TRUE;
 
-    // Add curl easy handles to multi handle
-    long handles_added = 0;
-    for (GSList *elem = list; elem; elem = g_slist_next(elem)) {
-        LrFastestMirror *mirror = elem->data;
-        if (mirror->curl) {
-            curl_multi_add_handle(multihandle, mirror->curl);
-            handles_added++;
+    curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &effective_url);
+
+    if (!effective_url) {
+        // No effective url is most likely an error
+        mirror->plain_connect_time = DBL_MAX;
+    } else if (g_str_has_prefix(effective_url, "file://")) {
+        // Local directories are considered to be the best mirrors
+        mirror->plain_connect_time = 0.0;
+    } else {
+        // Get connect time
+        double connect_time;
+        curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME, &connect_time);
+
+        if (connect_time == 0.0) {
+            // Zero connect time is most likely an error
+            connect_time = DBL_MAX;
         }
+
+        mirror->plain_connect_time = connect_time;
     }
+}
 
-    if (handles_added == 0) {
-        curl_multi_cleanup(multihandle);
-        return TRUE;
+/** Sockets and timer of the curl multi handle used by the probing loop.
+ */
+typedef struct {
+    GArray *pollfds;    /*!< Sockets watched by curl (struct pollfd) */
+    gint64 deadline;    /*!< Monotonic time when curl wants to be called
+                             because of its timeout or -1 */
+} LrFastestMirrorPoll;
+
+static int
+lr_fastestmirror_socketcb(G_GNUC_UNUSED CURL *easy,
+                          curl_socket_t s,
+                          int what,
+                          void *userp,
+                          G_GNUC_UNUSED void *socketp)
+{
+    LrFastestMirrorPoll *fmpoll = userp;
+    GArray *fds = fmpoll->pollfds;
+    guint x;
+
+    for (x = 0; x < fds->len; x++)
+        if (g_array_index(fds, struct pollfd, x).fd == s)
+            break;
+
+    if (what == CURL_POLL_REMOVE) {
+        if (x < fds->len)
+            g_array_remove_index_fast(fds, x);
+        return 0;
     }
 
-    cb(cbdata, LR_FMSTAGE_DETECTION, (void *) &handles_added);
+    if (x == fds->len) {
+        struct pollfd pfd = { .fd = s, .events = 0, .revents = 0 };
+        g_array_append_val(fds, pfd);
+    }
 
-    int still_running;
-    gdouble elapsed_time = 0.0;
-    GTimer *timer = g_timer_new();
-    g_timer_start(timer);
+    struct pollfd *pfd = &g_array_index(fds, struct pollfd, x);
+    pfd->events = 0;
+    if (what & CURL_POLL_IN)
+        pfd->events |= POLLIN;
+    if (what & CURL_POLL_OUT)
+        pfd->events |= POLLOUT;
 
-    do {
-        struct timeval timeout;
-        int rc, cm_rc;
-        int maxfd = -1;
-        long curl_timeout = -1;
-        fd_set fdread, fdwrite, fdexcep;
+    return 0;
+}
 
-        FD_ZERO(&fdread);
-        FD_ZERO(&fdwrite);
-        FD_ZERO(&fdexcep);
+static int
+lr_fastestmirror_timercb(G_GNUC_UNUSED CURLM *multi,
+                         long timeout_ms,
+                         void *userp)
+{
+    LrFastestMirrorPoll *fmpoll = userp;
 
-        // Set suitable timeout to play around with
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = HALF_OF_SECOND_IN_MICROS;
+    if (timeout_ms < 0)
+        fmpoll->deadline = -1;
+    else
+        fmpoll->deadline = g_get_monotonic_time() + timeout_ms * 1000;
 
-        cm_rc = curl_multi_timeout(multihandle, &curl_timeout);
-        if (cm_rc != CURLM_OK) {
-            g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURLM,
-                        "curl_multi_timeout() error: %s",
-                        curl_multi_strerror(cm_rc));
-            curl_multi_cleanup(multihandle);
-            return FALSE;
-        }
+    return 0;
+}
 
-        // Set timeout to a reasonable value
-        if (curl_timeout >= 0) {
-            timeout.tv_sec = curl_timeout / 1000;
-            if (timeout.tv_sec >= 1) {
-                timeout.tv_sec = 0;
-                timeout.tv_usec = HALF_OF_SECOND_IN_MICROS;
-            } else {
-                timeout.tv_usec = (curl_timeout % 1000) * 1000;
-                if (timeout.tv_usec > HALF_OF_SECOND_IN_MICROS)
-                    timeout.tv_usec = HALF_OF_SECOND_IN_MICROS;
-            }
-        }
+/** Return connect time of the K-th fastest measured mirror
+ * or DBL_MAX if less than K mirrors were measured successfully.
+ */
+static double
+lr_fastestmirror_kth_time(GSList *list, long topk)
+{
+    GArray *times = g_array_new(FALSE, FALSE, sizeof(double));
+    double kth = DBL_MAX;
 
-        // Get file descriptors from the transfers
-        cm_rc = curl_multi_fdset(multihandle, &fdread, &fdwrite,
-                                 &fdexcep, &maxfd);
-        if (cm_rc != CURLM_OK) {
-            g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURLM,
-                        "curl_multi_fdset() error: %s",
-                        curl_multi_strerror(cm_rc));
-            return FALSE;
-        }
+    for (GSList *elem = list; elem; elem = g_slist_next(elem)) {
+        LrFastestMirror *mirror = elem->data;
+        if (mirror->measured && mirror->plain_connect_time < DBL_MAX)
+            g_array_append_val(times, mirror->plain_connect_time);
+    }
 
-        rc = select(maxfd+1, &fdread, &fdwrite, &fdexcep, &timeout);
-        if (rc < 0) {
-            if (errno == EINTR) {
-                g_debug("%s: select() interrupted by signal", __func__);
-            } else {
-                g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_SELECT,
-                            "select() error: %s", strerror(errno));
-                return FALSE;
-            }
-        }
+    if (times->len >= (guint) topk) {
+        g_array_sort(times, lr_fastestmirror_cmp_double);
+        kth = g_array_index(times, double, topk - 1);
+    }
+
+    g_array_free(times, TRUE);
+    return kth;
+}
+
+/** Create a multi handle which reports its sockets and timer
+ * to the fmpoll.
+ */
+static CURLM *
+lr_fastestmirror_multi_new(LrFastestMirrorPoll *fmpoll, GError **err)
+{
+    CURLM *multihandle = curl_multi_init();
+    if (!multihandle) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURL,
+                    "curl_multi_init() error");
+        return NULL;
+    }
 
-        curl_multi_perform(multihandle, &still_running);
+    fmpoll->pollfds = g_array_new(FALSE, FALSE, sizeof(struct pollfd));
+    fmpoll->deadline = -1;
 
-        // Break loop after some reasonable amount of time
-        elapsed_time = g_timer_elapsed(timer, NULL);
+    curl_multi_setopt(multihandle, CURLMOPT_SOCKETFUNCTION,
+                      lr_fastestmirror_socketcb);
+    curl_multi_setopt(multihandle, CURLMOPT_SOCKETDATA, fmpoll);
+    curl_multi_setopt(multihandle, CURLMOPT_TIMERFUNCTION,
+                      lr_fastestmirror_timercb);
+    curl_multi_setopt(multihandle, CURLMOPT_TIMERDATA, fmpoll);
 
-    } while(still_running && elapsed_time < LENGT_OF_MEASUREMENT);
+    return multihandle;
+}
 
-    g_timer_destroy(timer);
+/** Wait for an activity on the sockets (but not after wakeup or
+ * the curl's timeout) and pass the events from the ready sockets
+ * (and the expired timeout) to the curl.
+ */
+static gboolean
+lr_fastestmirror_poll(CURLM *multihandle,
+                      LrFastestMirrorPoll *fmpoll,
+                      gint64 wakeup,
+                      GError **err)
+{
+    GArray *fds = fmpoll->pollfds;
+    CURLMcode cm_rc = CURLM_OK;
+    int running;
+
+    gint64 now = g_get_monotonic_time();
+    if (fmpoll->deadline >= 0 && fmpoll->deadline < wakeup)
+        wakeup = fmpoll->deadline;
+    int timeout = (int) ((MAX(wakeup - now, 0) + 999) / 1000);
+
+    int rc = poll((struct pollfd *) fds->data, fds->len, timeout);
+    if (rc < 0) {
+        if (errno == EINTR) {
+            g_debug("%s: poll() interrupted by signal", __func__);
+            return TRUE;
+        }
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_SELECT,
+                    "poll() error: %s", strerror(errno));
+        return FALSE;
+    }
 
-    // Remove curl easy handles from multi handle
-    // and calculate plain_connect_time
-    for (GSList *elem = list; elem; elem = g_slist_next(elem)) {
-        LrFastestMirror *mirror = elem->data;
-        CURL *curl = mirror->curl;
+    // The callbacks could modify the array, work on a copy
+    guint nfds = fds->len;
+    struct pollfd *ready = g_memdup(fds->data, nfds * sizeof(struct pollfd));
 
-        if (!curl)
+    for (guint x = 0; x < nfds && cm_rc == CURLM_OK; x++) {
+        int ev_bitmask = 0;
+        if (!ready[x].revents)
             continue;
+        if (ready[x].revents & POLLIN)
+            ev_bitmask |= CURL_CSELECT_IN;
+        if (ready[x].revents & POLLOUT)
+            ev_bitmask |= CURL_CSELECT_OUT;
+        if (ready[x].revents & (POLLERR|POLLHUP|POLLNVAL))
+            ev_bitmask |= CURL_CSELECT_ERR;
+        cm_rc = curl_multi_socket_action(multihandle, ready[x].fd,
+                                         ev_bitmask, &running);
+    }
 
-        // Remove handle
-        curl_multi_remove_handle(multihandle, curl);
-
-        // Calculate plain_connect_time
-        char *effective_url;
-        curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &effective_url);
+    g_free(ready);
 
-        if (!effective_url) {
-            // No effective url is most likely an error
-            mirror->plain_connect_time = DBL_MAX;
-        } else if (g_str_has_prefix(effective_url, "file://")) {
-            // Local directories are considered to be the best mirrors
-            mirror->plain_connect_time = 0.0;
-        } else {
-            // Get connect time
-            double namelookup_time;
-            double connect_time;
-            curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME, &namelookup_time);
-            curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME, &connect_time);
-
-            if (connect_time == 0.0) {
-                // Zero connect time is most likely an error
-                connect_time = DBL_MAX;
-            }
+    if (cm_rc == CURLM_OK
+        && fmpoll->deadline >= 0
+        && fmpoll->deadline <= g_get_monotonic_time())
+    {
+        fmpoll->deadline = -1;
+        cm_rc = curl_multi_socket_action(multihandle, CURL_SOCKET_TIMEOUT,
+                                         0, &running);
+    }
 
-            mirror->plain_connect_time = connect_time;
-            //g_debug("%s: name_lookup: %3.6f connect_time:  %3.6f (%3.6f) | %s",
-            //        __func__, namelookup_time, connect_time,
-            //        mirror->plain_connect_time, mirror->url);
-        }
+    if (cm_rc != CURLM_OK) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURLM,
+                    "curl_multi_socket_action() error: %s",
+                    curl_multi_strerror(cm_rc));
+        return FALSE;
     }
 
-    curl_multi_cleanup(multihandle);
     return TRUE;
 }
 
+/** Return connect timeout (ms) of a single probe.
+ * If not all mirrors could be probed at once, a single probe must
+ * not occupy its slot for the whole measurement.
+ */
+static long
+lr_fastestmirror_probe_timeout(long handles_to_probe, long maxparallel)
+{
+    long rounds = (handles_to_probe + maxparallel - 1) / maxparallel;
+    long probe_timeout = (long) (LENGT_OF_MEASUREMENT * 1000) / rounds;
+    return MAX(probe_timeout, PROBE_TIMEOUT_MIN);
+}
+
 static void
-null_cb(G_GNUC_UNUSED void *clientp,
-        G_GNUC_UNUSED LrFastestMirrorStages stage,
-        G_GNUC_UNUSED void *ptr)
+lr_fastestmirror_start_probe(CURLM *multihandle,
+                             LrFastestMirror *mirror,
+                             long probe_timeout,
+                             gint64 now)
 {
-    return;
+    curl_easy_setopt(mirror->curl, CURLOPT_PRIVATE, mirror);
+    curl_easy_setopt(mirror->curl, CURLOPT_CONNECTTIMEOUT_MS, probe_timeout);
+    curl_multi_add_handle(multihandle, mirror->curl);
+    mirror->probe_start = now;
 }
 
-gboolean
-lr_fastestmirror(LrHandle *handle,
-                 GSList **list,
-                 GError **err)
+static gboolean
+lr_fastestmirror_perform(GSList *list,
+                         long maxparallel,
+                         long topk,
+                         LrFastestMirrorCb cb,
+                         void *cbdata,
+                         GError **err)
 {
+    gboolean ret = TRUE;
+
     assert(!err || *err == NULL);
+    assert(maxparallel > 0);
 
-    char *fastestmirrorcache = NULL;
-    LrFastestMirrorCb cb = null_cb;
-    void *cbdata = NULL;
+    if (!list)
+        return TRUE;
 
-    if (handle) {
-        fastestmirrorcache = handle->fastestmirrorcache;
-        if (handle->fastestmirrorcb)
-            cb = handle->fastestmirrorcb;
-        cbdata = handle->fastestmirrordata;
+    long handles_to_probe = 0;
+    for (GSList *elem = list; elem; elem = g_slist_next(elem)) {
+        LrFastestMirror *mirror = elem->data;
+        if (mirror->curl)
+            handles_to_probe++;
     }
 
-    g_debug("%s: Fastest mirror determination in progress...", __func__);
-    cb(cbdata, LR_FMSTAGE_INIT, NULL);
-
-    if (!list || *list == NULL) {
-        cb(cbdata, LR_FMSTAGE_STATUS, NULL);
+    if (handles_to_probe == 0)
         return TRUE;
-    }
 
-    // Load cache
-    gboolean ret;
-    LrFastestMirrorCache *cache = NULL;
-    ret = lr_fastestmirrorcache_load(&cache,
-                                     fastestmirrorcache,
-                                     cb,
-                                     cbdata,
-                                     err);
-    if (!ret) {
-        cb(cbdata, LR_FMSTAGE_STATUS, "Cannot load cache");
+    LrFastestMirrorPoll fmpoll;
+    CURLM *multihandle = lr_fastestmirror_multi_new(&fmpoll, err);
+    if (!multihandle)
         return FALSE;
-    }
 
-    // Prepare list of LrFastestMirror elements
-    GSList *lrfastestmirrors;
-    ret = lr_fastestmirror_prepare(handle, *list, &lrfastestmirrors, cache, err);
-    if (!ret) {
-        cb(cbdata, LR_FMSTAGE_STATUS, "Error while lr_fastestmirror_prepare()");
-        g_debug("%s: Error while lr_fastestmirror_prepare()", __func__);
-        return FALSE;
-    }
+    cb(cbdata, LR_FMSTAGE_DETECTION, (void *) &handles_to_probe);
 
-    ret = lr_fastestmirror_perform(lrfastestmirrors, cb, cbdata, err);
-    if (!ret) {
-        cb(cbdata, LR_FMSTAGE_STATUS, "Error while detection");
-        g_debug("%s: Error while lr_fastestmirror_perform()", __func__);
-        g_slist_free_full(lrfastestmirrors,
-                          (GDestroyNotify)lr_lrfastestmirror_free);
-        return FALSE;
-    }
+    long probe_timeout = lr_fastestmirror_probe_timeout(handles_to_probe,
+                                                        maxparallel);
 
-    cb(cbdata, LR_FMSTAGE_FINISHING, NULL);
+    long running = 0;
+    GSList *next = list;    // Next mirror to probe
+    gint64 start = g_get_monotonic_time();
+    gint64 end = start + (gint64) (LENGT_OF_MEASUREMENT * 1000000);
 
-    // Sort the mirrors by the connection time
-    gint64 ts = g_get_real_time() / 1000000; // TimeStamp
-    GSList *new_list = NULL;
-    while (lrfastestmirrors) {
-        LrFastestMirror *mirror = lrfastestmirrors->data;
-        double min_value = mirror->plain_connect_time;
-
-        for (GSList *m=g_slist_next(lrfastestmirrors); m; m=g_slist_next(m)) {
-            LrFastestMirror *current_mirror = m->data;
-            if (current_mirror->plain_connect_time < min_value) {
-                min_value = current_mirror->plain_connect_time;
-                mirror = current_mirror;
-            }
+    while (1) {
+        gint64 now = g_get_monotonic_time();
+
+        // Start new probes
+        for (; next && running < maxparallel; next = g_slist_next(next)) {
+            LrFastestMirror *mirror = next->data;
+            if (!mirror->curl)
+                continue;
+            lr_fastestmirror_start_probe(multihandle, mirror,
+                                         probe_timeout, now);
+            running++;
         }
 
-        g_debug("%s: %3.6f : %s", __func__, min_value, mirror->url);
-        new_list = g_slist_append(new_list, mirror->url);
-        lrfastestmirrors = g_slist_remove(lrfastestmirrors, mirror);
+        if (!running)
+            break;  // All probes finished
 
-        // Update cache
-        if (mirror->cached == FALSE) {
-            lr_fastestmirrorcache_update(cache,
-                                         mirror->url,
-                                         ts,
-                                         mirror->plain_connect_time);
+        if (now >= end) {
+            g_debug("%s: Time for the measurement is over", __func__);
+            break;
         }
 
-        lr_lrfastestmirror_free(mirror);
-    }
+        if (topk > 0) {
+            // The K fastest mirrors are known if every running probe
+            // takes already longer than the K-th fastest measured mirror,
+            // because its connect time cannot be lower than that.
+            // Probes which were not started yet are not waited for.
+            double kth = lr_fastestmirror_kth_time(list, topk);
+            gboolean known = TRUE;
+            long abandoned = 0;
+
+            for (GSList *elem = list; elem; elem = g_slist_next(elem)) {
+                LrFastestMirror *mirror = elem->data;
+                if (!mirror->probe_start || mirror->measured)
+                    continue;
+                double elapsed = (now - mirror->probe_start) / 1000000.0;
+                if (elapsed < kth) {
+                    known = FALSE;
+                } else if (next) {
+                    // This mirror cannot be one of the K fastest,
+                    // give its slot to a mirror which wasn't probed yet
+                    curl_multi_remove_handle(multihandle, mirror->curl);
+                    mirror->probe_start = 0;
+                    running--;
+                    abandoned++;
+                }
+            }
 
-    assert(!lrfastestmirrors);
-    g_slist_free(*list);
-    *list = new_list;
+            if (known) {
+                g_debug("%s: %ld fastest mirrors are known after %f sec",
+                        __func__, topk, (now - start) / 1000000.0);
+                break;
+            }
 
-    lr_fastestmirrorcache_write(cache, NULL);
+            if (abandoned)
+                continue;
+        }
 
-    lr_fastestmirrorcache_free(cache);
+        // Wait for an activity on the sockets
+        gint64 wakeup = end;
+        if (topk > 0)
+            // Time itself can make the K fastest mirrors known
+            wakeup = MIN(wakeup, now + POLL_INTERVAL_FOR_TOPK);
+
+        if (!lr_fastestmirror_poll(multihandle, &fmpoll, wakeup, err)) {
+            ret = FALSE;
+            break;
+        }
+
+        // Collect results of the finished probes
+        CURLMsg *msg;
+        int msgs_in_queue;
+        while ((msg = curl_multi_info_read(multihandle, &msgs_in_queue))) {
+            LrFastestMirror *mirror = NULL;
+
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &mirror);
+            assert(mirror && mirror->curl == msg->easy_handle);
+
+            lr_fastestmirror_measure(mirror);
+            curl_multi_remove_handle(multihandle, mirror->curl);
+            running--;
+        }
+    }
+
+    // Remove the unfinished probes from the multi handle
+    for (GSList *elem = list; elem; elem = g_slist_next(elem)) {
+        LrFastestMirror *mirror = elem->data;
+
+        if (!mirror->probe_start || mirror->measured)
+            continue;
+
+        curl_multi_remove_handle(multihandle, mirror->curl);
+        if (ret && !next && g_get_monotonic_time() >= end) {
+            // All probes were started but this one didn't finish in time
+            lr_fastestmirror_measure(mirror);
+        }
+    }
+
+    curl_multi_cleanup(multihandle);
+    g_array_free(fmpoll.pollfds, TRUE);
+
+    return ret;
+}
+
+static size_t
+lr_fastestmirror_discardcb(G_GNUC_UNUSED char *ptr,
+                           size_t size,
+                           size_t nmemb,
+                           G_GNUC_UNUSED void *userdata)
+{
+    return size * nmemb;
+}
+
+/** Set ttfb and throughput of the mirror from its finished
+ * throughput probe.
+ */
+static void
+lr_fastestmirror_measure_throughput(LrFastestMirror *mirror,
+                                    CURLcode result)
+{
+    CURL *curl = mirror->curl;
+    long code = 0;
+    double ttfb = 0.0, total = 0.0;
+    curl_off_t size = 0;
+
+    if (result != CURLE_OK) {
+        g_debug("%s: Throughput probe of %s failed: %s",
+                __func__, mirror->probe_url, curl_easy_strerror(result));
+        return;
+    }
+
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+    if (code && code/100 != 2) {
+        g_debug("%s: Throughput probe of %s failed: Status code: %ld",
+                __func__, mirror->probe_url, code);
+        return;
+    }
+
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME, &ttfb);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &total);
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &size);
+
+    if (size <= 0)
+        return;
+
+    mirror->ttfb = ttfb;
+    mirror->throughput = (double) size / MAX(total - ttfb, THROUGHPUT_MIN_DURATION);
+    mirror->throughput_measured = TRUE;
+
+    g_debug("%s: ttfb: %f throughput: %.0f B/s | %s",
+            __func__, mirror->ttfb, mirror->throughput, mirror->url);
+}
+
+/** Download the beginning of the probe file (probe_url) from
+ * the mirrors in parallel and measure the time to first byte
+ * and the throughput of the transfers.
+ */
+static gboolean
+lr_fastestmirror_perform_throughput(LrHandle *handle,
+                                    GSList *list,
+                                    LrFastestMirrorCb cb,
+                                    void *cbdata,
+                                    GError **err)
+{
+    gboolean ret = TRUE;
+    long running = 0;
+
+    assert(!err || *err == NULL);
+
+    if (!list)
+        return TRUE;
+
+    LrFastestMirrorPoll fmpoll;
+    CURLM *multihandle = lr_fastestmirror_multi_new(&fmpoll, err);
+    if (!multihandle)
+        return FALSE;
+
+    for (GSList *elem = list; elem; elem = g_slist_next(elem)) {
+        LrFastestMirror *mirror = elem->data;
+        CURL *curlh;
+
+        assert(mirror->probe_url);
+
+        if (handle)
+            curlh = curl_easy_duphandle(handle->curl_handle);
+        else
+            curlh = lr_get_curl_handle();
+
+        if (!curlh) {
+            g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURL,
+                        "Cannot create curl handle");
+            ret = FALSE;
+            break;
+        }
+
+        // Share DNS cache, TLS sessions and connections with the downloads
+        if (handle && handle->curl_share)
+            curl_easy_setopt(curlh, CURLOPT_SHARE, handle->curl_share);
+
+        // Handle of the connect probe is not needed anymore
+        if (mirror->curl)
+            curl_easy_cleanup(mirror->curl);
+        mirror->curl = curlh;
+
+        CURLcode curlcode = curl_easy_setopt(curlh, CURLOPT_URL,
+                                             mirror->probe_url);
+        if (curlcode != CURLE_OK) {
+            g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURL,
+                        "curl_easy_setopt(_, CURLOPT_URL, %s) failed: %s",
+                        mirror->probe_url, curl_easy_strerror(curlcode));
+            ret = FALSE;
+            break;
+        }
+
+        curl_easy_setopt(curlh, CURLOPT_RANGE, THROUGHPUT_PROBE_RANGE);
+        curl_easy_setopt(curlh, CURLOPT_WRITEFUNCTION,
+                         lr_fastestmirror_discardcb);
+        curl_easy_setopt(curlh, CURLOPT_TIMEOUT_MS,
+                         (long) (LENGT_OF_MEASUREMENT * 1000));
+        curl_easy_setopt(curlh, CURLOPT_PRIVATE, mirror);
+        curl_multi_add_handle(multihandle, curlh);
+        running++;
+    }
+
+    if (ret)
+        cb(cbdata, LR_FMSTAGE_THROUGHPUT, (void *) &running);
+
+    gint64 end = g_get_monotonic_time()
+                 + (gint64) (LENGT_OF_MEASUREMENT * 1000000);
+
+    while (ret && running > 0 && g_get_monotonic_time() < end) {
+        if (!lr_fastestmirror_poll(multihandle, &fmpoll, end, err)) {
+            ret = FALSE;
+            break;
+        }
+
+        CURLMsg *msg;
+        int msgs_in_queue;
+        while ((msg = curl_multi_info_read(multihandle, &msgs_in_queue))) {
+            LrFastestMirror *mirror = NULL;
+
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &mirror);
+            assert(mirror && mirror->curl == msg->easy_handle);
+
+            lr_fastestmirror_measure_throughput(mirror, msg->data.result);
+            running--;
+        }
+    }
+
+    for (GSList *elem = list; elem; elem = g_slist_next(elem)) {
+        LrFastestMirror *mirror = elem->data;
+        if (mirror->curl)
+            curl_multi_remove_handle(multihandle, mirror->curl);
+    }
+
+    curl_multi_cleanup(multihandle);
+    g_array_free(fmpoll.pollfds, TRUE);
+
+    return ret;
+}
+
+/** Compare mirrors by the connect time.
+ */
+static gint
+lr_fastestmirror_cmp_connect_time(gconstpointer a, gconstpointer b)
+{
+    const LrFastestMirror *ma = a, *mb = b;
+    return lr_fastestmirror_cmp_double(&ma->plain_connect_time,
+                                       &mb->plain_connect_time);
+}
+
+/** Estimated time to download a file of THROUGHPUT_REFERENCE_SIZE
+ * from the mirror.
+ */
+static double
+lr_fastestmirror_score(const LrFastestMirror *mirror)
+{
+    if (!mirror->throughput_measured)
+        return DBL_MAX;
+    return mirror->ttfb + THROUGHPUT_REFERENCE_SIZE / mirror->throughput;
+}
+
+/** Compare mirrors by the results of the throughput probe.
+ */
+static gint
+lr_fastestmirror_cmp_score(gconstpointer a, gconstpointer b)
+{
+    double sa = lr_fastestmirror_score(a);
+    double sb = lr_fastestmirror_score(b);
+    return lr_fastestmirror_cmp_double(&sa, &sb);
+}
+
+/** Measure throughput of the first (fastest by connect time) mirrors
+ * and sort them by the results. The rest of the list is kept as is.
+ */
+static gboolean
+lr_fastestmirror_rank_by_throughput(LrHandle *handle,
+                                    GSList **list,
+                                    long candidates,
+                                    LrFastestMirrorCb cb,
+                                    void *cbdata,
+                                    GError **err)
+{
+    GSList *to_probe = NULL;
+    GSList *last = NULL;
+    long count = 0;
+
+    assert(!err || *err == NULL);
+
+    for (GSList *elem = *list; elem && count < candidates;
+         elem = g_slist_next(elem))
+    {
+        LrFastestMirror *mirror = elem->data;
+        if (mirror->plain_connect_time == DBL_MAX)
+            break;  // Unreachable or unmeasured mirrors are not candidates
+        if (!mirror->throughput_measured)
+            to_probe = g_slist_prepend(to_probe, mirror);
+        last = elem;
+        count++;
+    }
+
+    if (count < 2) {
+        // Nothing to rank
+        g_slist_free(to_probe);
+        return TRUE;
+    }
+
+    gboolean ret = lr_fastestmirror_perform_throughput(handle,
+                                                       to_probe,
+                                                       cb,
+                                                       cbdata,
+                                                       err);
+    g_slist_free(to_probe);
+    if (!ret)
+        return FALSE;
+
+    // Sort the candidates (stable sort keeps the mirrors
+    // without the results in the order by connect time)
+    GSList *rest = last->next;
+    last->next = NULL;
+    GSList *head = g_slist_sort(*list, lr_fastestmirror_cmp_score);
+    *list = g_slist_concat(head, rest);
+
+    return TRUE;
+}
+
+static void
+null_cb(G_GNUC_UNUSED void *clientp,
+        G_GNUC_UNUSED LrFastestMirrorStages stage,
+        G_GNUC_UNUSED void *ptr)
+{
+    return;
+}
+
+/** Load the fastestmirror cache (or return NULL if path is NULL).
+ * A broken cache is reported via the callback and an empty one is used.
+ */
+static LrFastestMirrorCache *
+lr_fastestmirror_load_cache(const char *path,
+                            LrFastestMirrorCb cb,
+                            void *cbdata)
+{
+    LrFastestMirrorCache *cache = NULL;
+    GError *tmp_err = NULL;
+
+    if (!path)
+        return NULL;
+
+    cb(cbdata, LR_FMSTAGE_CACHELOADING, (void *) path);
+
+    if (!lr_fastestmirrorcache_load(&cache, path, &tmp_err)) {
+        // Start with an empty cache, the file is rewritten at the end
+        g_debug("%s: %s", __func__, tmp_err->message);
+        cb(cbdata, LR_FMSTAGE_CACHELOADINGSTATUS, tmp_err->message);
+        g_error_free(tmp_err);
+    } else if (!g_file_test(path, G_FILE_TEST_EXISTS)) {
+        cb(cbdata, LR_FMSTAGE_CACHELOADINGSTATUS, "Cache doesn't exist");
+    } else {
+        cb(cbdata, LR_FMSTAGE_CACHELOADINGSTATUS, NULL);
+    }
+
+    return cache;
+}
+
+/** Store the new results of the mirrors to the cache and write it.
+ */
+static void
+lr_fastestmirror_save_cache(LrFastestMirrorCache *cache, GSList *mirrors)
+{
+    LrFastestMirrorCacheEntry entry;
+    GError *tmp_err = NULL;
+
+    if (!cache)
+        return;
+
+    entry.ts = g_get_real_time() / 1000000; // TimeStamp
+    for (GSList *m = mirrors; m; m = g_slist_next(m)) {
+        LrFastestMirror *mirror = m->data;
+
+        if ((mirror->cached == FALSE && mirror->measured)
+            || (mirror->throughput_measured && !mirror->throughput_cached))
+        {
+            entry.connecttime = mirror->plain_connect_time;
+            entry.ttfb = mirror->ttfb;
+            entry.throughput = mirror->throughput;
+            lr_fastestmirrorcache_update(cache, mirror->url, &entry);
+        }
+    }
+
+    if (!lr_fastestmirrorcache_write(cache, &tmp_err)) {
+        g_debug("%s: Cannot write cache: %s", __func__, tmp_err->message);
+        g_error_free(tmp_err);
+    }
+}
+
+/** Sort the list of URLs by the speed of the mirrors.
+ * @param handle        LrHandle or NULL
+ * @param list          Pointer to the GSList of urls.
+ * @param baseurls      Table mapping the urls from the list to the URLs
+ *                      of the mirrors (used for the throughput probe)
+ *                      or NULL if the urls are the URLs of the mirrors.
+ * @param err           GError **
+ * @return              TRUE if everything is ok, FALSE is err is set.
+ */
+static gboolean
+lr_fastestmirror_sort(LrHandle *handle,
+                      GSList **list,
+                      GHashTable *baseurls,
+                      GError **err)
+{
+    assert(!err || *err == NULL);
+
+    char *fastestmirrorcache = NULL;
+    char *probepath = NULL;
+    LrFastestMirrorCb cb = null_cb;
+    void *cbdata = NULL;
+    long maxparallel = LRO_FASTESTMIRRORMAXPARALLEL_DEFAULT;
+    long topk = LRO_FASTESTMIRRORTOPK_DEFAULT;
+
+    if (handle) {
+        fastestmirrorcache = handle->fastestmirrorcache;
+        probepath = handle->fastestmirrorprobepath;
+        maxparallel = handle->fastestmirrormaxparallel;
+        topk = handle->fastestmirrortopk;
+        if (handle->fastestmirrorcb)
+            cb = handle->fastestmirrorcb;
+        cbdata = handle->fastestmirrordata;
+    }
+
+    g_debug("%s: Fastest mirror determination in progress...", __func__);
+    cb(cbdata, LR_FMSTAGE_INIT, NULL);
+
+    if (!list || *list == NULL) {
+        cb(cbdata, LR_FMSTAGE_STATUS, NULL);
+        return TRUE;
+    }
+
+    // Load cache
+    gboolean ret;
+    LrFastestMirrorCache *cache;
+    cache = lr_fastestmirror_load_cache(fastestmirrorcache, cb, cbdata);
+
+    // Prepare list of LrFastestMirror elements
+    GSList *lrfastestmirrors;
+    ret = lr_fastestmirror_prepare(handle, *list, &lrfastestmirrors, cache,
+                                   baseurls, probepath, err);
+    if (!ret) {
+        cb(cbdata, LR_FMSTAGE_STATUS, "Error while lr_fastestmirror_prepare()");
+        g_debug("%s: Error while lr_fastestmirror_prepare()", __func__);
+        lr_fastestmirrorcache_free(cache);
+        return FALSE;
+    }
+
+    ret = lr_fastestmirror_perform(lrfastestmirrors,
+                                   maxparallel,
+                                   topk,
+                                   cb,
+                                   cbdata,
+                                   err);
+    if (!ret) {
+        cb(cbdata, LR_FMSTAGE_STATUS, "Error while detection");
+        g_debug("%s: Error while lr_fastestmirror_perform()", __func__);
+        g_slist_free_full(lrfastestmirrors,
+                          (GDestroyNotify)lr_lrfastestmirror_free);
+        lr_fastestmirrorcache_free(cache);
+        return FALSE;
+    }
+
+    // Sort the mirrors by the connection time
+    for (GSList *m = lrfastestmirrors; m; m = g_slist_next(m)) {
+        // Mirrors which were not measured (the detection was
+        // interrupted before their probe finished) go last
+        LrFastestMirror *mirror = m->data;
+        if (!mirror->measured)
+            mirror->plain_connect_time = DBL_MAX;
+    }
+
+    lrfastestmirrors = g_slist_sort(lrfastestmirrors,
+                                    lr_fastestmirror_cmp_connect_time);
+
+    if (probepath) {
+        // Rank the fastest mirrors by the throughput
+        ret = lr_fastestmirror_rank_by_throughput(
+                                        handle,
+                                        &lrfastestmirrors,
+                                        MAX(topk, THROUGHPUT_CANDIDATES),
+                                        cb,
+                                        cbdata,
+                                        err);
+        if (!ret) {
+            cb(cbdata, LR_FMSTAGE_STATUS, "Error while throughput detection");
+            g_debug("%s: Error while lr_fastestmirror_rank_by_throughput()",
+                    __func__);
+            g_slist_free_full(lrfastestmirrors,
+                              (GDestroyNotify)lr_lrfastestmirror_free);
+            lr_fastestmirrorcache_free(cache);
+            return FALSE;
+        }
+    }
+
+    cb(cbdata, LR_FMSTAGE_FINISHING, NULL);
+
+    GSList *new_list = NULL;
+    for (GSList *m = lrfastestmirrors; m; m = g_slist_next(m)) {
+        LrFastestMirror *mirror = m->data;
+
+        g_debug("%s: %3.6f : %s", __func__,
+                mirror->plain_connect_time, mirror->url);
+        new_list = g_slist_prepend(new_list, mirror->url);
+    }
+
+    lr_fastestmirror_save_cache(cache, lrfastestmirrors);
+
+    g_slist_free_full(lrfastestmirrors,
+                      (GDestroyNotify)lr_lrfastestmirror_free);
+    g_slist_free(*list);
+    *list = g_slist_reverse(new_list);
+
+    lr_fastestmirrorcache_free(cache);
 
     cb(cbdata, LR_FMSTAGE_STATUS, NULL);
 
     return TRUE;
 }
 
+/** Add the host of the url to the table and the list of the hosts
+ * if it is not there yet.
+ * @param hosts_ht      Table mapping the hosts to the URL of the first
+ *                      mirror on the host (used for the throughput probe).
+ * @param hosts         List of the hosts in the order of the first
+ *                      occurrence. The strings are owned by the hosts_ht.
+ * @param url           URL of a mirror
+ */
+static void
+lr_fastestmirror_add_host(GHashTable *hosts_ht, GSList **hosts, char *url)
+{
+    gchar *host = lr_url_host(url);
+    if (g_hash_table_lookup_extended(hosts_ht, host, NULL, NULL)) {
+        g_free(host);
+        return;
+    }
+    g_hash_table_insert(hosts_ht, host, url);
+    *hosts = g_slist_prepend(*hosts, host);
+}
+
+static gint
+lr_fastestmirror_cmp_rank(gconstpointer a, gconstpointer b, gpointer ranks)
+{
+    gint rank_a = GPOINTER_TO_INT(g_hash_table_lookup(ranks, a));
+    gint rank_b = GPOINTER_TO_INT(g_hash_table_lookup(ranks, b));
+    return (rank_a > rank_b) - (rank_a < rank_b);
+}
+
+/** Reorder the list by the sorted list of the hosts.
+ * The first item on every host gets the position of its host,
+ * the other items on the same host follow them in their original order.
+ * @param list          List of URLs or LrInternalMirrors
+ * @param hosts         Sorted list of the hosts (see lr_url_host())
+ * @param url_of        Returns the URL of the item of the list
+ * @return              The reordered list
+ */
+static GSList *
+lr_fastestmirror_sort_by_hosts(GSList *list,
+                               GSList *hosts,
+                               const char *(*url_of)(gconstpointer))
+{
+    GHashTable *host_ranks = g_hash_table_new(g_str_hash, g_str_equal);
+    GHashTable *ranks = g_hash_table_new(g_direct_hash, g_direct_equal);
+    gint rank = 0;
+
+    for (GSList *elem = hosts; elem; elem = g_slist_next(elem))
+        g_hash_table_insert(host_ranks, elem->data, GINT_TO_POINTER(++rank));
+
+    for (GSList *elem = list; elem; elem = g_slist_next(elem)) {
+        gchar *host = lr_url_host(url_of(elem->data));
+        gpointer host_rank = NULL;
+        // Only the first item on the host takes the rank of the host
+        if (g_hash_table_lookup_extended(host_ranks, host, NULL, &host_rank))
+            g_hash_table_insert(host_ranks, host, NULL);
+        if (!host_rank)
+            host_rank = GINT_TO_POINTER(++rank);
+        g_hash_table_insert(ranks, elem->data, host_rank);
+        g_free(host);
+    }
+
+    list = g_slist_sort_with_data(list, lr_fastestmirror_cmp_rank, ranks);
+
+    g_hash_table_destroy(ranks);
+    g_hash_table_destroy(host_ranks);
+    return list;
+}
+
+static const char *
+lr_fastestmirror_url_of_url(gconstpointer url)
+{
+    return url;
+}
+
+static const char *
+lr_fastestmirror_url_of_imirror(gconstpointer imirror)
+{
+    return ((const LrInternalMirror *) imirror)->url;
+}
+
+gboolean
+lr_fastestmirror(LrHandle *handle,
+                 GSList **list,
+                 GError **err)
+{
+    assert(!err || *err == NULL);
+
+    if (!list || *list == NULL)
+        return lr_fastestmirror_sort(handle, list, NULL, err);
+
+    // Every host is probed only once
+    GSList *hosts = NULL;
+    GHashTable *hosts_ht = g_hash_table_new_full(g_str_hash,
+                                                 g_str_equal,
+                                                 g_free,
+                                                 NULL);
+    for (GSList *elem = *list; elem; elem = g_slist_next(elem))
+        lr_fastestmirror_add_host(hosts_ht, &hosts, elem->data);
+    hosts = g_slist_reverse(hosts);
+
+    gboolean ret = lr_fastestmirror_sort(handle, &hosts, hosts_ht, err);
+    if (ret)
+        *list = lr_fastestmirror_sort_by_hosts(*list,
+                                               hosts,
+                                               lr_fastestmirror_url_of_url);
+
+    g_slist_free(hosts);
+    g_hash_table_destroy(hosts_ht);
+    return ret;
+}
+
+GHashTable *
+lr_fastestmirror_cached_connecttimes(LrHandle *handle, GSList *list)
+{
+    LrFastestMirrorCache *cache;
+    GError *tmp_err = NULL;
+
+    if (!handle->fastestmirrorcache)
+        return NULL;
+
+    if (!lr_fastestmirrorcache_load(&cache,
+                                    handle->fastestmirrorcache,
+                                    &tmp_err)) {
+        g_debug("%s: %s", __func__, tmp_err->message);
+        g_error_free(tmp_err);
+    }
+
+    gint64 min_ts = g_get_real_time() / 1000000 - handle->fastestmirrormaxage;
+    GHashTable *connecttimes = g_hash_table_new_full(g_str_hash,
+                                                     g_str_equal,
+                                                     g_free,
+                                                     g_free);
+
+    for (GSList *elem = list; elem; elem = g_slist_next(elem)) {
+        LrInternalMirror *imirror = elem->data;
+        LrFastestMirrorCacheEntry entry;
+        gchar *host = lr_url_host(imirror->url);
+
+        if (g_hash_table_contains(connecttimes, host)
+            || !lr_fastestmirrorcache_lookup(cache, host, &entry)
+            || entry.ts < min_ts) {
+            g_free(host);
+            continue;
+        }
+
+        double *connecttime = g_new(double, 1);
+        *connecttime = entry.connecttime;
+        g_hash_table_insert(connecttimes, host, connecttime);
+    }
+
+    lr_fastestmirrorcache_free(cache);
+    return connecttimes;
+}
+
 gboolean
 lr_fastestmirror_sort_internalmirrorlist(LrHandle *handle,
                                          GError **err)
@@ -662,36 +1208,32 @@ lr_fastestmirror_sort_internalmirrorlist(LrHandle *handle,
     return ret;
 }
 
-gboolean
-lr_fastestmirror_sort_internalmirrorlists(GSList *handles,
-                                          GError **err)
+/** Collect the hosts (see lr_url_host()) of the mirrors of the handles.
+ * @param handles       List of LrHandles
+ * @param hosts         List of the hosts (in the order of the first
+ *                      occurrence) is stored here. The strings are
+ *                      owned by the returned table.
+ * @return              Table mapping the hosts to the URL of the first
+ *                      mirror on the host (used for the throughput probe).
+ */
+static GHashTable *
+lr_fastestmirror_hosts(GSList *handles, GSList **hosts)
 {
-    assert(!err || *err == NULL);
-
-    if (!handles)
-        return TRUE;
-
-    GTimer *timer = g_timer_new();
-    g_timer_start(timer);
-
-    LrHandle *main_handle = handles->data;  // Network configuration for the
-                                            // test is used from the first
-                                            // handle
-
-    // Prepare list of hosts
+    LrHandle *main_handle = handles->data;
     gchar *fastestmirrorcache = main_handle->fastestmirrorcache;
     GHashTable *hosts_ht = g_hash_table_new_full(g_str_hash,
                                                  g_str_equal,
                                                  g_free,
                                                  NULL);
 
+    *hosts = NULL;
+
     for (GSList *ehandle = handles; ehandle; ehandle = g_slist_next(ehandle)) {
         LrHandle *handle = ehandle->data;
         GSList *mirrors = handle->internal_mirrorlist;
         for (GSList *elem = mirrors; elem; elem = g_slist_next(elem)) {
             LrInternalMirror *imirror = elem->data;
-            gchar *host = lr_url_without_path(imirror->url);
-            g_hash_table_insert(hosts_ht, host, NULL);
+            lr_fastestmirror_add_host(hosts_ht, hosts, imirror->url);
         }
 
         // Cache related warning
@@ -709,16 +1251,31 @@ lr_fastestmirror_sort_internalmirrorlists(GSList *handles,
         }
     }
 
-    GList *tmp_list_of_urls = g_hash_table_get_keys(hosts_ht);
+    *hosts = g_slist_reverse(*hosts);
+    return hosts_ht;
+}
+
+gboolean
+lr_fastestmirror_sort_internalmirrorlists(GSList *handles,
+                                          GError **err)
+{
+    assert(!err || *err == NULL);
+
+    if (!handles)
+        return TRUE;
+
+    GTimer *timer = g_timer_new();
+    g_timer_start(timer);
+
+    LrHandle *main_handle = handles->data;  // Network configuration for the
+                                            // test is used from the first
+                                            // handle
+
+    // Prepare list of hosts
     GSList *list_of_urls = NULL;
-    int number_of_mirrors = 0;
-    for (GList *elem = tmp_list_of_urls; elem; elem = g_list_next(elem)) {
-        list_of_urls = g_slist_prepend(list_of_urls, elem->data);
-        number_of_mirrors++;
-    }
-    g_list_free(tmp_list_of_urls);
+    GHashTable *hosts_ht = lr_fastestmirror_hosts(handles, &list_of_urls);
 
-    if (number_of_mirrors <= 1) {
+    if (g_hash_table_size(hosts_ht) <= 1) {
         // Nothing to do
         g_slist_free(list_of_urls);
         g_hash_table_destroy(hosts_ht);
@@ -727,9 +1284,10 @@ lr_fastestmirror_sort_internalmirrorlists(GSList *handles,
     }
 
     // Sort this list by the connection time
-    gboolean ret = lr_fastestmirror(main_handle,
-                                    &list_of_urls,
-                                    err);
+    gboolean ret = lr_fastestmirror_sort(main_handle,
+                                         &list_of_urls,
+                                         hosts_ht,
+                                         err);
     if (!ret) {
         g_debug("%s: lr_fastestmirror failed", __func__);
         g_slist_free(list_of_urls);
@@ -741,36 +1299,10 @@ lr_fastestmirror_sort_internalmirrorlists(GSList *handles,
     // Apply sorted order to each handle
     for (GSList *ehandle = handles; ehandle; ehandle = g_slist_next(ehandle)) {
         LrHandle *handle = ehandle->data;
-        GSList *mirrors = handle->internal_mirrorlist;
-        GSList *new_list = NULL;
-        for (GSList *elem = list_of_urls; elem; elem = g_slist_next(elem)) {
-            gchar *host = elem->data;
-            for (GSList *ime = mirrors; ime; ime = g_slist_next(ime)) {
-                LrInternalMirror *im = ime->data;
-                gchar *im_host = lr_url_without_path(im->url);
-                if (!g_strcmp0(im_host, host)) {
-                    new_list = g_slist_prepend(new_list, im);
-                    // XXX: Maybe convert GSList to GList to make
-                    // this delete more efficient
-                    mirrors = g_slist_delete_link(mirrors, ime);
-                    break;
-                }
-            }
-        }
-
-        // If multiple mirrors with the same lr_url_without_path(url)
-        // were present, only the first occurrence was inserted to the
-        // the new_list and removed from the mirrors list.
-        // The remaining occurences will be moved here.
-        for (GSList *elem = mirrors; elem; elem = g_slist_next(elem)) {
-            LrInternalMirror *im = elem->data;
-            new_list = g_slist_prepend(new_list, im);
-        }
-        g_slist_free(mirrors);
-
-        // Set sorted list to the handle (reversed, because the items
-        // of the new_list were prepended)
-        handle->internal_mirrorlist = g_slist_reverse(new_list);
+        handle->internal_mirrorlist = lr_fastestmirror_sort_by_hosts(
+                                            handle->internal_mirrorlist,
+                                            list_of_urls,
+                                            lr_fastestmirror_url_of_imirror);
     }
 
     g_slist_free(list_of_urls);
@@ -782,3 +1314,367 @@ lr_fastestmirror_sort_internalmirrorlists(GSList *handles,
 
     return TRUE;
 }
+
+struct _LrFastestMirrorDetection {
+    LrFastestMirrorCb cb;       // Status callback (never NULL)
+    void *cbdata;               // User data for the cb
+    LrFastestMirrorCache *cache;// Cache or NULL
+    GSList *handles;            // Handles which mirrorlists are ranked
+    GHashTable *hosts;          // Host -> URL of its first mirror
+                                // (owns the strings of the hosts)
+    GSList *mirrors;            // LrFastestMirror of every host
+    GHashTable *url_mirrors;    // URL of a mirror -> LrFastestMirror of
+                                // the host of the mirror
+    CURLM *multihandle;         // Multi handle of the probes or NULL
+    GSList *next;               // Next mirror to probe
+    long maxparallel;           // Maximal number of running probes
+    long probe_timeout;         // Connect timeout of a probe (ms)
+    long running;               // Number of running probes
+    gint64 end;                 // Monotonic time when the detection ends
+                                // or 0 if no probe was started yet
+    gboolean finished;          // Are the results final?
+};
+
+/** 0 - mirror with a known connect time, 1 - mirror not measured yet,
+ * 2 - unreachable mirror.
+ */
+static int
+lr_fastestmirror_rank_class(const LrFastestMirror *mirror)
+{
+    if (!mirror || !mirror->measured)
+        return 1;
+    if (mirror->plain_connect_time == DBL_MAX)
+        return 2;
+    return 0;
+}
+
+gint
+lr_fastestmirror_detection_cmp(LrFastestMirrorDetection *detection,
+                               const char *url_a,
+                               const char *url_b)
+{
+    const LrFastestMirror *a = g_hash_table_lookup(detection->url_mirrors,
+                                                   url_a);
+    const LrFastestMirror *b = g_hash_table_lookup(detection->url_mirrors,
+                                                   url_b);
+    int class_a = lr_fastestmirror_rank_class(a);
+    int class_b = lr_fastestmirror_rank_class(b);
+
+    if (class_a != class_b)
+        return (class_a < class_b) ? -1 : 1;
+    if (class_a != 0)
+        return 0;  // Keep the original order
+    return lr_fastestmirror_cmp_connect_time(a, b);
+}
+
+static gint
+lr_fastestmirror_detection_cmp_imirrors(gconstpointer a,
+                                        gconstpointer b,
+                                        gpointer detection)
+{
+    const LrInternalMirror *ima = a, *imb = b;
+    return lr_fastestmirror_detection_cmp(detection, ima->url, imb->url);
+}
+
+/** Sort the internal mirrorlists of the handles by the results
+ * known so far.
+ */
+static void
+lr_fastestmirror_detection_sort_handles(LrFastestMirrorDetection *detection)
+{
+    for (GSList *elem = detection->handles; elem; elem = g_slist_next(elem)) {
+        LrHandle *handle = elem->data;
+        handle->internal_mirrorlist = g_slist_sort_with_data(
+                                handle->internal_mirrorlist,
+                                lr_fastestmirror_detection_cmp_imirrors,
+                                detection);
+    }
+}
+
+LrFastestMirrorDetection *
+lr_fastestmirror_detection_new(GSList *handles, GError **err)
+{
+    assert(handles);
+    assert(!err || *err == NULL);
+
+    LrHandle *main_handle = handles->data;  // Configuration of the detection
+                                            // is used from the first handle
+    LrFastestMirrorDetection *detection = lr_malloc0(sizeof(*detection));
+    detection->cb = main_handle->fastestmirrorcb ? main_handle->fastestmirrorcb
+                                                 : null_cb;
+    detection->cbdata = main_handle->fastestmirrordata;
+    detection->handles = g_slist_copy(handles);
+    detection->maxparallel = main_handle->fastestmirrormaxparallel;
+    detection->url_mirrors = g_hash_table_new(g_str_hash, g_str_equal);
+
+    GSList *list_of_urls = NULL;
+    detection->hosts = lr_fastestmirror_hosts(handles, &list_of_urls);
+
+    if (g_hash_table_size(detection->hosts) <= 1) {
+        // Nothing to do
+        g_slist_free(list_of_urls);
+        detection->finished = TRUE;
+        return detection;
+    }
+
+    g_debug("%s: Fastest mirror determination started", __func__);
+    detection->cb(detection->cbdata, LR_FMSTAGE_INIT, NULL);
+
+    detection->cache = lr_fastestmirror_load_cache(
+                                        main_handle->fastestmirrorcache,
+                                        detection->cb,
+                                        detection->cbdata);
+
+    gboolean ret = lr_fastestmirror_prepare(main_handle,
+                                            list_of_urls,
+                                            &detection->mirrors,
+                                            detection->cache,
+                                            NULL,
+                                            NULL,
+                                            err);
+    g_slist_free(list_of_urls);
+    if (!ret) {
+        detection->cb(detection->cbdata, LR_FMSTAGE_STATUS,
+                      "Error while lr_fastestmirror_prepare()");
+        detection->finished = TRUE;
+        lr_fastestmirror_detection_free(detection);
+        return NULL;
+    }
+
+    // Map URLs of all mirrors to the probes of their hosts
+    GHashTable *host_mirrors = g_hash_table_new(g_str_hash, g_str_equal);
+    long handles_to_probe = 0;
+    for (GSList *elem = detection->mirrors; elem; elem = g_slist_next(elem)) {
+        LrFastestMirror *mirror = elem->data;
+        g_hash_table_insert(host_mirrors, mirror->url, mirror);
+        if (mirror->curl)
+            handles_to_probe++;
+    }
+
+    for (GSList *elem = handles; elem; elem = g_slist_next(elem)) {
+        LrHandle *handle = elem->data;
+        for (GSList *im = handle->internal_mirrorlist; im; im = g_slist_next(im)) {
+            LrInternalMirror *imirror = im->data;
+            gchar *host = lr_url_host(imirror->url);
+            g_hash_table_insert(detection->url_mirrors,
+                                imirror->url,
+                                g_hash_table_lookup(host_mirrors, host));
+            g_free(host);
+        }
+    }
+    g_hash_table_destroy(host_mirrors);
+
+    // Downloading starts with the cached results
+    lr_fastestmirror_detection_sort_handles(detection);
+
+    if (handles_to_probe == 0) {
+        // Everything is cached
+        detection->finished = TRUE;
+        detection->cb(detection->cbdata, LR_FMSTAGE_STATUS, NULL);
+        return detection;
+    }
+
+    detection->multihandle = curl_multi_init();
+    if (!detection->multihandle) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURL,
+                    "curl_multi_init() error");
+        detection->finished = TRUE;
+        lr_fastestmirror_detection_free(detection);
+        return NULL;
+    }
+
+    detection->next = detection->mirrors;
+    detection->probe_timeout = lr_fastestmirror_probe_timeout(
+                                                handles_to_probe,
+                                                detection->maxparallel);
+
+    detection->cb(detection->cbdata, LR_FMSTAGE_DETECTION,
+                  (void *) &handles_to_probe);
+
+    return detection;
+}
+
+/** Stop the probes, store the results to the cache and sort
+ * the mirrorlists of the handles.
+ */
+static void
+lr_fastestmirror_detection_finish(LrFastestMirrorDetection *detection)
+{
+    gint64 now = g_get_monotonic_time();
+
+    for (GSList *elem = detection->mirrors; elem; elem = g_slist_next(elem)) {
+        LrFastestMirror *mirror = elem->data;
+
+        if (!mirror->probe_start || mirror->measured)
+            continue;
+
+        curl_multi_remove_handle(detection->multihandle, mirror->curl);
+        if (!detection->next && now >= detection->end) {
+            // All probes were started but this one didn't finish in time
+            lr_fastestmirror_measure(mirror);
+        }
+    }
+
+    detection->running = 0;
+    detection->finished = TRUE;
+
+    detection->cb(detection->cbdata, LR_FMSTAGE_FINISHING, NULL);
+    lr_fastestmirror_save_cache(detection->cache, detection->mirrors);
+    lr_fastestmirror_detection_sort_handles(detection);
+    detection->cb(detection->cbdata, LR_FMSTAGE_STATUS, NULL);
+
+    g_debug("%s: Fastest mirror determination finished", __func__);
+}
+
+gboolean
+lr_fastestmirror_detection_fdset(LrFastestMirrorDetection *detection,
+                                 fd_set *read_fd_set,
+                                 fd_set *write_fd_set,
+                                 fd_set *exc_fd_set,
+                                 int *max_fd,
+                                 long *timeout_ms,
+                                 GError **err)
+{
+    CURLMcode cm_rc;
+    long curl_timeout = -1;
+    int maxfd = -1;
+
+    assert(!err || *err == NULL);
+
+    if (detection->finished)
+        return TRUE;
+
+    cm_rc = curl_multi_fdset(detection->multihandle, read_fd_set,
+                             write_fd_set, exc_fd_set, &maxfd);
+    if (cm_rc == CURLM_OK)
+        cm_rc = curl_multi_timeout(detection->multihandle, &curl_timeout);
+    if (cm_rc != CURLM_OK) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURLM,
+                    "curl_multi_fdset() error: %s",
+                    curl_multi_strerror(cm_rc));
+        return FALSE;
+    }
+
+    if (maxfd > *max_fd)
+        *max_fd = maxfd;
+
+    if (detection->end) {
+        // Do not oversleep the end of the detection
+        long remaining = (long) ((detection->end - g_get_monotonic_time()
+                                  + 999) / 1000);
+        remaining = MAX(remaining, 0);
+        if (curl_timeout < 0 || remaining < curl_timeout)
+            curl_timeout = remaining;
+    } else {
+        // Probes were not started yet
+        curl_timeout = 0;
+    }
+
+    if (curl_timeout >= 0 && (*timeout_ms < 0 || curl_timeout < *timeout_ms))
+        *timeout_ms = curl_timeout;
+
+    return TRUE;
+}
+
+gboolean
+lr_fastestmirror_detection_perform(LrFastestMirrorDetection *detection,
+                                   gboolean *changed,
+                                   GError **err)
+{
+    CURLMcode cm_rc;
+    int still_running;
+
+    assert(!err || *err == NULL);
+
+    *changed = FALSE;
+
+    if (detection->finished)
+        return TRUE;
+
+    gint64 now = g_get_monotonic_time();
+    if (!detection->end)
+        detection->end = now + (gint64) (LENGT_OF_MEASUREMENT * 1000000);
+
+    while (1) {
+        // Start new probes
+        for (; detection->next && detection->running < detection->maxparallel;
+             detection->next = g_slist_next(detection->next))
+        {
+            LrFastestMirror *mirror = detection->next->data;
+            if (!mirror->curl)
+                continue;
+            lr_fastestmirror_start_probe(detection->multihandle, mirror,
+                                         detection->probe_timeout, now);
+            detection->running++;
+        }
+
+        cm_rc = curl_multi_perform(detection->multihandle, &still_running);
+        if (cm_rc != CURLM_OK) {
+            g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURLM,
+                        "curl_multi_perform() error: %s",
+                        curl_multi_strerror(cm_rc));
+            return FALSE;
+        }
+
+        // Collect results of the finished probes
+        gboolean finished_probe = FALSE;
+        CURLMsg *msg;
+        int msgs_in_queue;
+        while ((msg = curl_multi_info_read(detection->multihandle,
+                                           &msgs_in_queue))) {
+            LrFastestMirror *mirror = NULL;
+
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &mirror);
+            assert(mirror && mirror->curl == msg->easy_handle);
+
+            lr_fastestmirror_measure(mirror);
+            curl_multi_remove_handle(detection->multihandle, mirror->curl);
+            detection->running--;
+            finished_probe = TRUE;
+            *changed = TRUE;
+
+            g_debug("%s: %3.6f : %s", __func__,
+                    mirror->plain_connect_time, mirror->url);
+        }
+
+        // Freed slots are given to the mirrors which wait for a probe
+        if (!finished_probe || !detection->next)
+            break;
+    }
+
+    if ((!detection->running && !detection->next) || now >= detection->end) {
+        lr_fastestmirror_detection_finish(detection);
+        *changed = TRUE;
+    }
+
+    return TRUE;
+}
+
+void
+lr_fastestmirror_detection_free(LrFastestMirrorDetection *detection)
+{
+    if (!detection)
+        return;
+
+    if (!detection->finished) {
+        // Downloading is done sooner than the detection, keep what
+        // is already known
+        g_debug("%s: Fastest mirror determination interrupted", __func__);
+        lr_fastestmirror_detection_finish(detection);
+    }
+
+    // All probes were already removed from the multi handle
+    g_slist_free_full(detection->mirrors,
+                      (GDestroyNotify)lr_lrfastestmirror_free);
+    if (detection->multihandle)
+        curl_multi_cleanup(detection->multihandle);
+
+    lr_fastestmirrorcache_free(detection->cache);
+    g_hash_table_destroy(detection->url_mirrors);
+    g_hash_table_destroy(detection->hosts);
+    g_slist_free(detection->handles);
+    lr_free(detection);
+}
@@ -30,6 +30,10 @@
 G_BEGIN_DECLS
 
 /** Sorts list or mirror URLs by its the connections times.
+ * Every server (scheme + host + port, see lr_url_host()) is probed only
+ * once, no matter how many URLs of the list point to it. The first URL
+ * of every server gets the position of the server, the other URLs
+ * of the same server follow at the end of the list.
  * @param handle        LrHandle or NULL
  * @param list          Pointer to the GSList of urls (char* or gchar*)
  *                      that will be sorted.
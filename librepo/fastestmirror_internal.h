@@ -21,6 +21,7 @@
 #define LR_FASTESTMIRROR_INTERNAL_H
 
 #include <glib.h>
+#include <sys/select.h>
 
 #include "handle.h"
 
@@ -37,6 +38,91 @@ gboolean
 lr_fastestmirror_sort_internalmirrorlists(GSList *handles,
                                           GError **err);
 
+/** Look up the connect times of the mirrors in the fastestmirror cache
+ * of the handle. Nothing is probed and records older than
+ * LRO_FASTESTMIRRORMAXAGE are ignored.
+ * @param handle        Handle
+ * @param list          Internal mirrorlist
+ * @return              Table mapping lr_url_host() of the mirrors to
+ *                      their connect times (double *) or NULL if the
+ *                      handle has no cache.
+ */
+GHashTable *
+lr_fastestmirror_cached_connecttimes(LrHandle *handle, GSList *list);
+
+/** Fastest mirror detection which runs in the event loop of
+ * the downloader, so the downloads don't have to wait for it.
+ */
+typedef struct _LrFastestMirrorDetection LrFastestMirrorDetection;
+
+/** Prepare the detection for the mirrors of the handles. The cache is
+ * loaded and the internal mirrorlists of the handles are immediately
+ * sorted by the cached connect times (mirrors without a cached record
+ * keep their order). No probe is started yet.
+ * @param handles       List of LrHandles. Configuration of the detection
+ *                      is used from the first one.
+ * @param err           GError **
+ * @return              New detection or NULL on error.
+ */
+LrFastestMirrorDetection *
+lr_fastestmirror_detection_new(GSList *handles, GError **err);
+
+/** Add the sockets of the running probes to the fd sets and lower
+ * the timeout if the detection needs lr_fastestmirror_detection_perform()
+ * to be called sooner.
+ * @param detection     Detection.
+ * @param read_fd_set   fd_set for reading
+ * @param write_fd_set  fd_set for writing
+ * @param exc_fd_set    fd_set for exceptions
+ * @param max_fd        Highest descriptor in the sets (updated)
+ * @param timeout_ms    Timeout in milliseconds (-1 means no timeout)
+ * @param err           GError **
+ * @return              TRUE if error is not set and FALSE if it is.
+ */
+gboolean
+lr_fastestmirror_detection_fdset(LrFastestMirrorDetection *detection,
+                                 fd_set *read_fd_set,
+                                 fd_set *write_fd_set,
+                                 fd_set *exc_fd_set,
+                                 int *max_fd,
+                                 long *timeout_ms,
+                                 GError **err);
+
+/** Start the waiting probes and process the finished ones.
+ * When the detection is over, the results are stored to the cache
+ * and the internal mirrorlists of the handles are sorted.
+ * @param detection     Detection.
+ * @param changed       Set to TRUE if new results are available
+ *                      (the order of the mirrors could change).
+ * @param err           GError **
+ * @return              TRUE if error is not set and FALSE if it is.
+ */
+gboolean
+lr_fastestmirror_detection_perform(LrFastestMirrorDetection *detection,
+                                   gboolean *changed,
+                                   GError **err);
+
+/** Compare two mirrors by the results known so far. Mirrors with
+ * a known connect time go first (the fastest first), then the mirrors
+ * which were not measured yet and then the unreachable ones.
+ * @param detection     Detection.
+ * @param url_a         URL of a mirror from an internal mirrorlist.
+ * @param url_b         URL of a mirror from an internal mirrorlist.
+ * @return              Negative value if url_a is better, positive if
+ *                      url_b is better and 0 if their order is kept.
+ */
+gint
+lr_fastestmirror_detection_cmp(LrFastestMirrorDetection *detection,
+                               const char *url_a,
+                               const char *url_b);
+
+/** Stop the detection and free it. Results of the already finished
+ * probes are stored to the cache.
+ * @param detection     Detection or NULL.
+ */
+void
+lr_fastestmirror_detection_free(LrFastestMirrorDetection *detection);
+
 G_END_DECLS
 
 #endif
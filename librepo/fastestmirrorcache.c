@@ -0,0 +1,654 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2013  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+#define _XOPEN_SOURCE   700 // Because of fchmod and pread
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#include "fastestmirrorcache_internal.h"
+#include "handle.h"
+#include "rcodes.h"
+#include "util.h"
+
+#define CACHE_MAGIC             "LRFMCACH"  // 8 bytes, without the trailing \0
+#define CACHE_VERSION           2           // Current version of cache format
+#define CACHE_MIN_BUCKETS       16
+#define CACHE_LOCK_SUFFIX       ".lock"
+
+#define CACHE_RECORD_MAX_AGE    (LRO_FASTESTMIRRORMAXAGE_DEFAULT * 6)
+
+// The old GKeyFile based format (version 1)
+#define KEYFILE_GROUP_METADATA  ":_librepo_:"   // Group with metadata
+#define KEYFILE_KEY_TS          "ts"            // Timestamp
+#define KEYFILE_KEY_CONNECTTIME "connectime"    // Time of reponse
+#define KEYFILE_KEY_TTFB        "ttfb"          // Time to first byte
+#define KEYFILE_KEY_THROUGHPUT  "throughput"    // Bytes per second
+#define KEYFILE_KEY_VERSION     "version"       // Version of cache format
+#define KEYFILE_VERSION         1
+
+/** The cache file is: LrFastestMirrorCacheHeader, bucket_count buckets
+ * (guint32), count records (LrFastestMirrorCacheRecord) and a pool
+ * of strings_len bytes with the NUL terminated URLs.
+ * A bucket and the next member of a record contain index of a record + 1
+ * (0 terminates the chain). Records of a bucket are chained by the next
+ * member. All values are in the host byte order - the cache is not
+ * intended to be shared between machines.
+ */
+typedef struct {
+    char magic[8];
+    guint32 version;
+    guint32 record_size;
+    guint32 bucket_count;   // Power of two
+    guint32 count;
+    guint64 strings_len;
+} LrFastestMirrorCacheHeader;
+
+typedef struct {
+    guint64 url_hash;       // lr_url_hash() of the URL
+    guint32 url_offset;     // Offset of the URL in the string pool
+    guint32 url_len;        // Length of the URL (without the trailing \0)
+    guint32 next;           // Next record in the bucket + 1 or 0
+    guint32 padding;
+    gint64 ts;
+    double connecttime;
+    double ttfb;
+    double throughput;
+} LrFastestMirrorCacheRecord;
+
+/** Validated mapping of a cache file. */
+typedef struct {
+    void *map;
+    size_t map_len;
+    const guint32 *buckets;
+    guint32 bucket_count;
+    const LrFastestMirrorCacheRecord *records;
+    guint32 count;
+    const char *strings;
+    guint64 strings_len;
+} LrFastestMirrorCacheMap;
+
+struct _LrFastestMirrorCache {
+    gchar *path;                // Path to the cache file
+    LrFastestMirrorCacheMap map;// Mmaped cache file (map.map may be NULL)
+    GHashTable *legacy;         // Records loaded from the old format
+    GHashTable *updates;        // New records (url -> entry)
+};
+
+/** FNV-1a */
+static guint64
+lr_url_hash(const char *url, size_t len)
+{
+    guint64 hash = G_GUINT64_CONSTANT(14695981039346656037);
+    for (size_t x = 0; x < len; x++) {
+        hash ^= (guint8) url[x];
+        hash *= G_GUINT64_CONSTANT(1099511628211);
+    }
+    return hash;
+}
+
+static void
+lr_fastestmirrorcache_unmap(LrFastestMirrorCacheMap *map)
+{
+    if (map->map)
+        munmap(map->map, map->map_len);
+    memset(map, 0, sizeof(*map));
+}
+
+/** Check if the file starts with the magic of the binary format.
+ */
+static gboolean
+lr_fastestmirrorcache_is_binary(int fd)
+{
+    char magic[sizeof(((LrFastestMirrorCacheHeader *) NULL)->magic)];
+
+    if (pread(fd, magic, sizeof(magic), 0) != sizeof(magic))
+        return FALSE;
+    return memcmp(magic, CACHE_MAGIC, sizeof(magic)) ? FALSE : TRUE;
+}
+
+/** Mmap the cache file and check its header.
+ * @param map       Result.
+ * @param fd        Opened cache file.
+ * @param path      Path to the file (for messages).
+ * @param err       GError **
+ * @return          TRUE if error is not set and FALSE if it is.
+ */
+static gboolean
+lr_fastestmirrorcache_map(LrFastestMirrorCacheMap *map,
+                          int fd,
+                          const char *path,
+                          GError **err)
+{
+    struct stat st;
+
+    assert(!err || *err == NULL);
+
+    memset(map, 0, sizeof(*map));
+
+    if (fstat(fd, &st) != 0) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
+                    "Cannot stat %s: %s", path, strerror(errno));
+        return FALSE;
+    }
+
+    if (st.st_size == 0)
+        return TRUE;  // Empty file is an empty cache
+
+    if (st.st_size < (off_t) sizeof(LrFastestMirrorCacheHeader)) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
+                    "%s is not a fastestmirror cache", path);
+        return FALSE;
+    }
+
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
+                    "Cannot mmap %s: %s", path, strerror(errno));
+        return FALSE;
+    }
+
+    const LrFastestMirrorCacheHeader *hdr = addr;
+    if (memcmp(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic))) {
+        munmap(addr, st.st_size);
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
+                    "%s is not a fastestmirror cache", path);
+        return FALSE;
+    }
+
+    guint64 expected = sizeof(LrFastestMirrorCacheHeader)
+                       + (guint64) hdr->bucket_count * sizeof(guint32)
+                       + (guint64) hdr->count
+                                   * sizeof(LrFastestMirrorCacheRecord)
+                       + hdr->strings_len;
+
+    if (hdr->version != CACHE_VERSION
+        || hdr->record_size != sizeof(LrFastestMirrorCacheRecord)
+        || hdr->bucket_count == 0
+        || (hdr->bucket_count & (hdr->bucket_count - 1))
+        || hdr->strings_len > (guint64) st.st_size
+        || expected != (guint64) st.st_size)
+    {
+        munmap(addr, st.st_size);
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
+                    "%s is not a compatible fastestmirror cache "
+                    "(version %u)", path, hdr->version);
+        return FALSE;
+    }
+
+    const char *data = (const char *) addr + sizeof(LrFastestMirrorCacheHeader);
+    map->map = addr;
+    map->map_len = st.st_size;
+    map->bucket_count = hdr->bucket_count;
+    map->buckets = (const guint32 *) data;
+    data += hdr->bucket_count * sizeof(guint32);
+    map->count = hdr->count;
+    map->records = (const LrFastestMirrorCacheRecord *) data;
+    data += hdr->count * sizeof(LrFastestMirrorCacheRecord);
+    map->strings = data;
+    map->strings_len = hdr->strings_len;
+
+    return TRUE;
+}
+
+/** Return URL of the record or NULL if the record is broken. */
+static const char *
+lr_fastestmirrorcache_map_url(const LrFastestMirrorCacheMap *map,
+                              const LrFastestMirrorCacheRecord *rec)
+{
+    if ((guint64) rec->url_offset + rec->url_len >= map->strings_len
+        || map->strings[rec->url_offset + rec->url_len] != '\0')
+        return NULL;
+    return map->strings + rec->url_offset;
+}
+
+static const LrFastestMirrorCacheRecord *
+lr_fastestmirrorcache_map_lookup(const LrFastestMirrorCacheMap *map,
+                                 const char *url)
+{
+    if (!map->map || !map->count)
+        return NULL;
+
+    size_t len = strlen(url);
+    guint64 hash = lr_url_hash(url, len);
+    guint32 idx = map->buckets[hash & (map->bucket_count - 1)];
+
+    // The number of steps is limited to survive a corrupted chain
+    for (guint32 steps = 0; idx && steps < map->count; steps++) {
+        if (idx > map->count)
+            return NULL;
+        const LrFastestMirrorCacheRecord *rec = &map->records[idx - 1];
+        if (rec->url_hash == hash && rec->url_len == len) {
+            const char *rec_url = lr_fastestmirrorcache_map_url(map, rec);
+            if (rec_url && !memcmp(rec_url, url, len))
+                return rec;
+        }
+        idx = rec->next;
+    }
+
+    return NULL;
+}
+
+static void
+lr_fastestmirrorcache_entry_from_record(LrFastestMirrorCacheEntry *entry,
+                                        const LrFastestMirrorCacheRecord *rec)
+{
+    entry->ts           = rec->ts;
+    entry->connecttime  = rec->connecttime;
+    entry->ttfb         = rec->ttfb;
+    entry->throughput   = rec->throughput;
+}
+
+static GHashTable *
+lr_fastestmirrorcache_table_new(void)
+{
+    return g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+}
+
+/** Put the entry into the table unless the table has a newer one. */
+static void
+lr_fastestmirrorcache_table_merge(GHashTable *table,
+                                  const char *url,
+                                  const LrFastestMirrorCacheEntry *entry)
+{
+    LrFastestMirrorCacheEntry *old = g_hash_table_lookup(table, url);
+    if (old && old->ts > entry->ts)
+        return;
+    g_hash_table_replace(table,
+                         g_strdup(url),
+                         g_memdup(entry, sizeof(*entry)));
+}
+
+/** Load records of the old GKeyFile based cache.
+ */
+static gboolean
+lr_fastestmirrorcache_load_keyfile(GHashTable *table,
+                                   const char *path,
+                                   GError **err)
+{
+    GKeyFile *keyfile = g_key_file_new();
+    GError *tmp_err = NULL;
+
+    assert(!err || *err == NULL);
+
+    if (!g_key_file_load_from_file(keyfile, path, G_KEY_FILE_NONE, &tmp_err)) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
+                    "Cannot parse fastestmirror cache %s: %s",
+                    path, tmp_err->message);
+        g_error_free(tmp_err);
+        g_key_file_free(keyfile);
+        return FALSE;
+    }
+
+    if (!g_key_file_has_group(keyfile, KEYFILE_GROUP_METADATA)) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
+                    "File %s is not a fastestmirror cache", path);
+        g_key_file_free(keyfile);
+        return FALSE;
+    }
+
+    int version = (int) g_key_file_get_integer(keyfile,
+                                               KEYFILE_GROUP_METADATA,
+                                               KEYFILE_KEY_VERSION,
+                                               NULL);
+    if (version != KEYFILE_VERSION) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
+                    "Old version of cache format %d in %s", version, path);
+        g_key_file_free(keyfile);
+        return FALSE;
+    }
+
+    gchar **groups = g_key_file_get_groups(keyfile, NULL);
+    for (gchar **group = groups; *group; group++) {
+        LrFastestMirrorCacheEntry entry;
+
+        if (g_str_has_prefix(*group, ":_"))
+            continue;
+
+        entry.ts = g_key_file_get_int64(keyfile, *group,
+                                        KEYFILE_KEY_TS, &tmp_err);
+        if (!tmp_err)
+            entry.connecttime = g_key_file_get_double(keyfile, *group,
+                                                      KEYFILE_KEY_CONNECTTIME,
+                                                      &tmp_err);
+        if (tmp_err) {
+            g_clear_error(&tmp_err);
+            continue;
+        }
+
+        // Results of the throughput probe are optional
+        entry.ttfb = g_key_file_get_double(keyfile, *group,
+                                           KEYFILE_KEY_TTFB, &tmp_err);
+        if (!tmp_err)
+            entry.throughput = g_key_file_get_double(keyfile, *group,
+                                                     KEYFILE_KEY_THROUGHPUT,
+                                                     &tmp_err);
+        if (tmp_err) {
+            g_clear_error(&tmp_err);
+            entry.ttfb = 0.0;
+            entry.throughput = 0.0;
+        }
+
+        lr_fastestmirrorcache_table_merge(table, *group, &entry);
+    }
+    g_strfreev(groups);
+    g_key_file_free(keyfile);
+
+    return TRUE;
+}
+
+gboolean
+lr_fastestmirrorcache_load(LrFastestMirrorCache **cache,
+                           const char *path,
+                           GError **err)
+{
+    assert(cache);
+    assert(path);
+    assert(!err || *err == NULL);
+
+    *cache = lr_malloc0(sizeof(LrFastestMirrorCache));
+    (*cache)->path = g_strdup(path);
+    (*cache)->legacy = lr_fastestmirrorcache_table_new();
+    (*cache)->updates = lr_fastestmirrorcache_table_new();
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        if (errno == ENOENT)
+            return TRUE;
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
+                    "Cannot open %s: %s", path, strerror(errno));
+        return FALSE;
+    }
+
+    gboolean ret;
+    if (lr_fastestmirrorcache_is_binary(fd)) {
+        ret = lr_fastestmirrorcache_map(&(*cache)->map, fd, path, err);
+        if (ret)
+            g_debug("%s: Loaded %u records from %s",
+                    __func__, (*cache)->map.count, path);
+    } else {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size == 0) {
+            // Empty file is an empty cache
+            ret = TRUE;
+        } else {
+            // Old GKeyFile based format
+            ret = lr_fastestmirrorcache_load_keyfile((*cache)->legacy,
+                                                     path, err);
+            if (ret)
+                g_debug("%s: Loaded %u records from old format cache %s",
+                        __func__, g_hash_table_size((*cache)->legacy), path);
+        }
+    }
+
+    close(fd);
+    return ret;
+}
+
+gboolean
+lr_fastestmirrorcache_lookup(LrFastestMirrorCache *cache,
+                             const char *url,
+                             LrFastestMirrorCacheEntry *entry)
+{
+    LrFastestMirrorCacheEntry *found;
+
+    if (!cache || !url)
+        return FALSE;
+
+    found = g_hash_table_lookup(cache->updates, url);
+    if (!found)
+        found = g_hash_table_lookup(cache->legacy, url);
+    if (found) {
+        *entry = *found;
+        return TRUE;
+    }
+
+    const LrFastestMirrorCacheRecord *rec;
+    rec = lr_fastestmirrorcache_map_lookup(&cache->map, url);
+    if (!rec)
+        return FALSE;
+
+    lr_fastestmirrorcache_entry_from_record(entry, rec);
+    return TRUE;
+}
+
+void
+lr_fastestmirrorcache_update(LrFastestMirrorCache *cache,
+                             const char *url,
+                             const LrFastestMirrorCacheEntry *entry)
+{
+    if (!cache || !url)
+        return;
+
+    LrFastestMirrorCacheEntry *new = g_memdup(entry, sizeof(*entry));
+    if (new->throughput <= 0.0) {
+        // Do not keep outdated values
+        new->ttfb = 0.0;
+        new->throughput = 0.0;
+    }
+    g_hash_table_replace(cache->updates, g_strdup(url), new);
+}
+
+/** Serialize the records into the binary format.
+ */
+static gchar *
+lr_fastestmirrorcache_serialize(GHashTable *records, size_t *len)
+{
+    guint32 count = g_hash_table_size(records);
+    guint32 bucket_count = CACHE_MIN_BUCKETS;
+    guint64 strings_len = 0;
+    GHashTableIter iter;
+    gpointer key, value;
+
+    while (bucket_count < count * 2)
+        bucket_count *= 2;
+
+    g_hash_table_iter_init(&iter, records);
+    while (g_hash_table_iter_next(&iter, &key, NULL))
+        strings_len += strlen(key) + 1;
+
+    *len = sizeof(LrFastestMirrorCacheHeader)
+           + bucket_count * sizeof(guint32)
+           + count * sizeof(LrFastestMirrorCacheRecord)
+           + strings_len;
+
+    gchar *buf = g_malloc0(*len);
+    LrFastestMirrorCacheHeader *hdr = (LrFastestMirrorCacheHeader *) buf;
+    guint32 *buckets = (guint32 *) (buf + sizeof(*hdr));
+    LrFastestMirrorCacheRecord *recs = (LrFastestMirrorCacheRecord *)
+                                       (buckets + bucket_count);
+    char *strings = (char *) (recs + count);
+
+    memcpy(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic));
+    hdr->version = CACHE_VERSION;
+    hdr->record_size = sizeof(LrFastestMirrorCacheRecord);
+    hdr->bucket_count = bucket_count;
+    hdr->count = count;
+    hdr->strings_len = strings_len;
+
+    guint32 idx = 0;
+    guint32 offset = 0;
+    g_hash_table_iter_init(&iter, records);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        const LrFastestMirrorCacheEntry *entry = value;
+        LrFastestMirrorCacheRecord *rec = &recs[idx];
+        size_t url_len = strlen(key);
+
+        memcpy(strings + offset, key, url_len + 1);
+        rec->url_hash       = lr_url_hash(key, url_len);
+        rec->url_offset     = offset;
+        rec->url_len        = (guint32) url_len;
+        rec->ts             = entry->ts;
+        rec->connecttime    = entry->connecttime;
+        rec->ttfb           = entry->ttfb;
+        rec->throughput     = entry->throughput;
+
+        guint32 *bucket = &buckets[rec->url_hash & (bucket_count - 1)];
+        rec->next = *bucket;
+        *bucket = ++idx;
+
+        offset += url_len + 1;
+    }
+
+    return buf;
+}
+
+gboolean
+lr_fastestmirrorcache_write(LrFastestMirrorCache *cache, GError **err)
+{
+    assert(!err || *err == NULL);
+
+    if (!cache
+        || (!g_hash_table_size(cache->updates)
+            && !g_hash_table_size(cache->legacy)))
+        return TRUE;  // Nothing to do
+
+    // Serialize writers - a record written by another process between
+    // our load and write must not be lost
+    gchar *lock_path = g_strconcat(cache->path, CACHE_LOCK_SUFFIX, NULL);
+    int lock_fd = open(lock_path, O_RDWR|O_CREAT, 0644);
+    if (lock_fd == -1) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
+                    "Cannot open %s: %s", lock_path, strerror(errno));
+        g_free(lock_path);
+        return FALSE;
+    }
+
+    if (flock(lock_fd, LOCK_EX) == -1) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
+                    "Cannot lock %s: %s", lock_path, strerror(errno));
+        close(lock_fd);
+        g_free(lock_path);
+        return FALSE;
+    }
+
+    g_free(lock_path);
+
+    // Merge the current content of the file with our records,
+    // the newest record of every URL wins
+    GHashTable *records = lr_fastestmirrorcache_table_new();
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, cache->legacy);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+        lr_fastestmirrorcache_table_merge(records, key, value);
+
+    int fd = open(cache->path, O_RDONLY);
+    if (fd != -1) {
+        LrFastestMirrorCacheMap map;
+        if (lr_fastestmirrorcache_map(&map, fd, cache->path, NULL)) {
+            for (guint32 x = 0; x < map.count; x++) {
+                const LrFastestMirrorCacheRecord *rec = &map.records[x];
+                const char *url = lr_fastestmirrorcache_map_url(&map, rec);
+                LrFastestMirrorCacheEntry entry;
+                if (!url)
+                    continue;
+                lr_fastestmirrorcache_entry_from_record(&entry, rec);
+                lr_fastestmirrorcache_table_merge(records, url, &entry);
+            }
+            lr_fastestmirrorcache_unmap(&map);
+        }
+        close(fd);
+    }
+
+    g_hash_table_iter_init(&iter, cache->updates);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+        g_hash_table_replace(records,
+                             g_strdup(key),
+                             g_memdup(value, sizeof(LrFastestMirrorCacheEntry)));
+
+    // Remove really outdated records
+    gint64 min_ts = g_get_real_time() / 1000000 - CACHE_RECORD_MAX_AGE;
+    g_hash_table_iter_init(&iter, records);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        if (((LrFastestMirrorCacheEntry *) value)->ts < min_ts) {
+            g_debug("%s: Removing too old record from cache: %s",
+                    __func__, (char *) key);
+            g_hash_table_iter_remove(&iter);
+        }
+    }
+
+    size_t len;
+    gchar *buf = lr_fastestmirrorcache_serialize(records, &len);
+    guint count = g_hash_table_size(records);
+    g_hash_table_destroy(records);
+
+    // Write to a temporary file and atomically replace the old one
+    gboolean ret = TRUE;
+    gchar *tmp_path = g_strconcat(cache->path, ".XXXXXX", NULL);
+    fd = g_mkstemp(tmp_path);
+    if (fd == -1) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
+                    "Cannot create %s: %s", tmp_path, strerror(errno));
+        ret = FALSE;
+    } else {
+        if (write(fd, buf, len) != (ssize_t) len) {
+            g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
+                        "Cannot write %s: %s", tmp_path, strerror(errno));
+            ret = FALSE;
+        }
+
+        fchmod(fd, 0644);
+        close(fd);
+
+        if (ret && rename(tmp_path, cache->path) == -1) {
+            g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
+                        "Cannot rename %s to %s: %s",
+                        tmp_path, cache->path, strerror(errno));
+            ret = FALSE;
+        }
+
+        if (!ret)
+            unlink(tmp_path);
+        else
+            g_debug("%s: Written %u records to %s",
+                    __func__, count, cache->path);
+    }
+
+    close(lock_fd);  // Releases the lock
+    g_free(tmp_path);
+    g_free(buf);
+
+    return ret;
+}
+
+void
+lr_fastestmirrorcache_free(LrFastestMirrorCache *cache)
+{
+    if (!cache)
+        return;
+
+    lr_fastestmirrorcache_unmap(&cache->map);
+    g_hash_table_destroy(cache->legacy);
+    g_hash_table_destroy(cache->updates);
+    g_free(cache->path);
+    g_free(cache);
+}
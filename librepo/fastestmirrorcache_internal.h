@@ -0,0 +1,102 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2013  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+#ifndef LR_FASTESTMIRRORCACHE_INTERNAL_H
+#define LR_FASTESTMIRRORCACHE_INTERNAL_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/** Persistent cache of the fastest mirror measurements.
+ *
+ * The cache file has a binary format with a hash index keyed by URL,
+ * so it is mmaped and a lookup doesn't need to parse the whole file.
+ * Writers take an exclusive flock() of the "<path>.lock" file, merge
+ * their records with the current content of the file and atomically
+ * replace it (write to a temporary file and rename), so concurrent
+ * processes don't lose each other's records. Readers don't lock at all.
+ *
+ * The old GKeyFile based format is still readable, it is converted
+ * to the binary format by the next write.
+ */
+typedef struct _LrFastestMirrorCache LrFastestMirrorCache;
+
+/** Measurement of a mirror stored in the cache.
+ */
+typedef struct {
+    gint64 ts;              /*!< Time of the measurement (secs since epoch) */
+    double connecttime;     /*!< Connect time */
+    double ttfb;            /*!< Time to first byte of the throughput probe */
+    double throughput;      /*!< Throughput (bytes/sec) or 0 if unknown */
+} LrFastestMirrorCacheEntry;
+
+/** Load the cache.
+ * @param cache     Pointer where the new cache is stored. It is set even
+ *                  if FALSE is returned (the cache is empty then).
+ * @param path      Path to the cache file.
+ * @param err       GError ** - Set if the file exists but it is not
+ *                  a compatible fastestmirror cache.
+ * @return          TRUE if error is not set and FALSE if it is.
+ */
+gboolean
+lr_fastestmirrorcache_load(LrFastestMirrorCache **cache,
+                           const char *path,
+                           GError **err);
+
+/** Lookup a record for the URL.
+ * @param cache     Cache or NULL.
+ * @param url       URL of the mirror.
+ * @param entry     Where the record is stored.
+ * @return          TRUE if the record was found.
+ */
+gboolean
+lr_fastestmirrorcache_lookup(LrFastestMirrorCache *cache,
+                             const char *url,
+                             LrFastestMirrorCacheEntry *entry);
+
+/** Add or replace the record for the URL.
+ * @param cache     Cache or NULL.
+ * @param url       URL of the mirror.
+ * @param entry     The record.
+ */
+void
+lr_fastestmirrorcache_update(LrFastestMirrorCache *cache,
+                             const char *url,
+                             const LrFastestMirrorCacheEntry *entry);
+
+/** Write the updated records to the cache file.
+ * Records written by other processes in the meantime are preserved.
+ * @param cache     Cache or NULL.
+ * @param err       GError **
+ * @return          TRUE if error is not set and FALSE if it is.
+ */
+gboolean
+lr_fastestmirrorcache_write(LrFastestMirrorCache *cache, GError **err);
+
+/** Free the cache. Unwritten changes are lost.
+ * @param cache     Cache or NULL.
+ */
+void
+lr_fastestmirrorcache_free(LrFastestMirrorCache *cache);
+
+G_END_DECLS
+
+#endif
@@ -45,6 +45,7 @@
 #include "url_substitution.h"
 #include "downloader.h"
 #include "fastestmirror_internal.h"
+#include "mirrorstats_internal.h"
 
 CURL *
 lr_get_curl_handle()
@@ -62,6 +63,25 @@ lr_get_curl_handle()
     return h;
 }
 
+CURLSH *
+lr_get_curl_share()
+{
+    CURLSH *share;
+
+    lr_global_init();
+
+    share = curl_share_init();
+    if (!share)
+        return NULL;
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+    // Shared connection cache is available since libcurl 7.57.0
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+    return share;
+}
+
 void
 lr_handle_free_list(char ***list)
 {
@@ -90,13 +110,18 @@ lr_handle_init()
 
     handle = lr_malloc0(sizeof(LrHandle));
     handle->curl_handle = curl;
+    handle->curl_share = lr_get_curl_share();
     handle->fastestmirrormaxage = LRO_FASTESTMIRRORMAXAGE_DEFAULT;
+    handle->fastestmirrormaxparallel = LRO_FASTESTMIRRORMAXPARALLEL_DEFAULT;
+    handle->fastestmirrortopk = LRO_FASTESTMIRRORTOPK_DEFAULT;
     handle->mirrorlist_fd = -1;
     handle->metalink_fd = -1;
     handle->checks |= LR_CHECK_CHECKSUM;
     handle->maxparalleldownloads = LRO_MAXPARALLELDOWNLOADS_DEFAULT;
     handle->maxdownloadspermirror = LRO_MAXDOWNLOADSPERMIRROR_DEFAULT;
+    handle->minparalleldownloads = LRO_MINPARALLELDOWNLOADS_DEFAULT;
     handle->lowspeedlimit = LRO_LOWSPEEDLIMIT_DEFAULT;
+    handle->connecttimeout = LRO_CONNECTTIMEOUT_DEFAULT;
 
     return handle;
 }
@@ -108,12 +133,17 @@ lr_handle_free(LrHandle *handle)
         return;
     if (handle->curl_handle)
         curl_easy_cleanup(handle->curl_handle);
+    if (handle->curl_share)
+        curl_share_cleanup(handle->curl_share);
     if (handle->mirrorlist_fd != -1)
         close(handle->mirrorlist_fd);
     if (handle->metalink_fd != -1)
         close(handle->metalink_fd);
     lr_handle_free_list(&handle->urls);
     lr_free(handle->fastestmirrorcache);
+    lr_free(handle->checksumcache);
+    lr_free(handle->fastestmirrorprobepath);
+    lr_free(handle->mirrorstats);
     lr_free(handle->mirrorlist);
     lr_free(handle->mirrorlisturl);
     lr_free(handle->metalinkurl);
@@ -128,6 +158,7 @@ lr_handle_free(LrHandle *handle)
     lr_metalink_free(handle->metalink);
     lr_handle_free_list(&handle->yumdlist);
     lr_handle_free_list(&handle->yumblist);
+    lr_handle_free_list(&handle->mirrorlocations);
     lr_urlvars_free(handle->urlvars);
     lr_free(handle);
 }
@@ -343,7 +374,8 @@ lr_handle_setopt(LrHandle *handle,
         break;
 
     case LRO_CONNECTTIMEOUT:
-        c_rc = curl_easy_setopt(c_h, CURLOPT_CONNECTTIMEOUT, va_arg(arg, long));
+        handle->connecttimeout = va_arg(arg, long);
+        c_rc = curl_easy_setopt(c_h, CURLOPT_CONNECTTIMEOUT, handle->connecttimeout);
         break;
 
     case LRO_IGNOREMISSING:
@@ -378,7 +410,8 @@ lr_handle_setopt(LrHandle *handle,
 
     case LRO_URLS:
     case LRO_YUMDLIST:
-    case LRO_YUMBLIST: {
+    case LRO_YUMBLIST:
+    case LRO_MIRRORLOCATIONS: {
         int size = 0;
         char **list = va_arg(arg, char **);
         char ***handle_list = NULL;
@@ -388,6 +421,8 @@ lr_handle_setopt(LrHandle *handle,
             lr_handle_remote_sources_changed(handle, LR_REMOTESOURCE_URLS);
         } else if (option == LRO_YUMDLIST) {
             handle_list = &handle->yumdlist;
+        } else if (option == LRO_MIRRORLOCATIONS) {
+            handle_list = &handle->mirrorlocations;
         } else {
             handle_list = &handle->yumblist;
         }
@@ -497,6 +532,97 @@ lr_handle_setopt(LrHandle *handle,
 
         break;
 
+    case LRO_FASTESTMIRRORPROBEPATH: {
+        char *probepath = va_arg(arg, char *);
+        if (handle->fastestmirrorprobepath)
+            lr_free(handle->fastestmirrorprobepath);
+        handle->fastestmirrorprobepath = g_strdup(probepath);
+        break;
+    }
+
+    case LRO_FASTESTMIRRORMAXPARALLEL:
+        val_long = va_arg(arg, long);
+
+        if (val_long < LRO_FASTESTMIRRORMAXPARALLEL_MIN) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Value of LRO_FASTESTMIRRORMAXPARALLEL is too low.");
+            ret = FALSE;
+        } else {
+            handle->fastestmirrormaxparallel = val_long;
+        }
+
+        break;
+
+    case LRO_FASTESTMIRRORTOPK:
+        val_long = va_arg(arg, long);
+
+        if (val_long < LRO_FASTESTMIRRORTOPK_MIN) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Value of LRO_FASTESTMIRRORTOPK is too low.");
+            ret = FALSE;
+        } else {
+            handle->fastestmirrortopk = val_long;
+        }
+
+        break;
+
+    case LRO_FASTESTMIRRORASYNC:
+        handle->fastestmirrorasync = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_MIRRORRANKING:
+        val_long = va_arg(arg, long);
+
+        if (val_long < LR_MIRRORRANKING_NONE
+            || val_long > LR_MIRRORRANKING_STATS) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Bad LRO_MIRRORRANKING value");
+            ret = FALSE;
+        } else {
+            handle->mirrorranking = val_long;
+        }
+
+        break;
+
+    case LRO_MIRRORSTATS:
+        if (handle->mirrorstats) lr_free(handle->mirrorstats);
+        handle->mirrorstats = g_strdup(va_arg(arg, char *));
+        break;
+
+    case LRO_MIRRORRESUME:
+        handle->mirrorresume = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_ADAPTIVETIMEOUTS:
+        handle->adaptivetimeouts = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_AUTOTUNE:
+        handle->autotune = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_CONNECTIONAFFINITY:
+        handle->connectionaffinity = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_CHECKMAGIC:
+        handle->checkmagic = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_MINPARALLELDOWNLOADS:
+        val_long = va_arg(arg, long);
+
+        if (val_long < LRO_MAXPARALLELDOWNLOADS_MIN ||
+            val_long > LRO_MAXPARALLELDOWNLOADS_MAX) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Bad value of LRO_MINPARALLELDOWNLOADS.");
+            ret = FALSE;
+        } else {
+            handle->minparalleldownloads = val_long;
+        }
+
+        break;
+
     case LRO_FASTESTMIRRORCB:
         handle->fastestmirrorcb = va_arg(arg, LrFastestMirrorCb);
         break;
@@ -538,6 +664,17 @@ lr_handle_setopt(LrHandle *handle,
 
         break;
 
+    case LRO_CHECKSUMCACHE: {
+        char *checksumcache = va_arg(arg, char *);
+        if (handle->checksumcache) lr_free(handle->checksumcache);
+        handle->checksumcache = g_strdup(checksumcache);
+        break;
+    }
+
+    case LRO_DECOMPRESS:
+        handle->decompress = va_arg(arg, long) ? 1 : 0;
+        break;
+
     default:
         g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
                     "Unknown option");
@@ -575,6 +712,9 @@ lr_handle_prepare_urls(LrHandle *handle, GError **err)
 {
     assert(!handle->urls_mirrors);
 
+    // All the urls are appended at once
+    GPtrArray *final_urls = g_ptr_array_new_with_free_func(g_free);
+
     int x = 0;
     while (handle->urls[x]) {
         gchar *url = handle->urls[x];
@@ -596,6 +736,7 @@ lr_handle_prepare_urls(LrHandle *handle, GError **err)
                     g_set_error(err, LR_HANDLE_ERROR, LRE_BADURL,
                                 "realpath(%s) error: %s",
                                 url, strerror(errno));
+                    g_ptr_array_free(final_urls, TRUE);
                     return FALSE;
                 }
                 final_url = g_strconcat("file://", resolved_path, NULL);
@@ -603,17 +744,19 @@ lr_handle_prepare_urls(LrHandle *handle, GError **err)
             }
         }
 
-        if (final_url) {
-            handle->urls_mirrors = lr_lrmirrorlist_append_url(
-                                                handle->urls_mirrors,
-                                                final_url,
-                                                handle->urlvars);
-            lr_free(final_url);
-        }
+        if (final_url)
+            g_ptr_array_add(final_urls, final_url);
 
         x++;
     }
 
+    g_ptr_array_add(final_urls, NULL);
+    handle->urls_mirrors = lr_lrmirrorlist_append_urls(
+                                        handle->urls_mirrors,
+                                        (char **) final_urls->pdata,
+                                        handle->urlvars);
+    g_ptr_array_free(final_urls, TRUE);
+
     return TRUE;
 }
 
@@ -920,6 +1063,29 @@ lr_handle_prepare_internal_mirrorlist(LrHandle *handle,
                                                 handle->internal_mirrorlist,
                                                 handle->metalink_mirrors);
 
+    // If enabled, rank the mirrors by their location, preference
+    // and cached connect times or download statistics
+    // (the LRO_MIRRORRANKING option)
+    if (handle->mirrorranking != LR_MIRRORRANKING_NONE) {
+        GHashTable *costs = NULL;
+
+        g_debug("%s: Ranking internal mirrorlist", __func__);
+        if (handle->mirrorranking == LR_MIRRORRANKING_LATENCY)
+            costs = lr_fastestmirror_cached_connecttimes(
+                                            handle,
+                                            handle->internal_mirrorlist);
+        else if (handle->mirrorstats)
+            costs = lr_mirrorstats_costs(handle->mirrorstats,
+                                         handle->internal_mirrorlist);
+
+        handle->internal_mirrorlist = lr_lrmirrorlist_rank(
+                                            handle->internal_mirrorlist,
+                                            handle->mirrorlocations,
+                                            costs);
+        if (costs)
+            g_hash_table_destroy(costs);
+    }
+
     // If enabled, sort internal mirrorlist by the connection
     // speed (the LRO_FASTESTMIRROR option)
     if (usefastestmirror) {
@@ -1137,7 +1303,8 @@ lr_handle_getinfo(LrHandle *handle,
 
     case LRI_URLS:
     case LRI_YUMDLIST:
-    case LRI_YUMBLIST: {
+    case LRI_YUMBLIST:
+    case LRI_MIRRORLOCATIONS: {
         char **source_list;
         char ***strlist = va_arg(arg, char ***);
 
@@ -1145,6 +1312,8 @@ lr_handle_getinfo(LrHandle *handle,
             source_list = handle->urls;
         else if (option == LRI_YUMDLIST)
             source_list = handle->yumdlist;
+        else if (option == LRI_MIRRORLOCATIONS)
+            source_list = handle->mirrorlocations;
         else
             source_list = handle->yumblist;
 
@@ -1226,6 +1395,81 @@ lr_handle_getinfo(LrHandle *handle,
         *lnum = (long) handle->fastestmirrormaxage;
         break;
 
+    case LRI_FASTESTMIRRORMAXPARALLEL:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->fastestmirrormaxparallel;
+        break;
+
+    case LRI_FASTESTMIRRORTOPK:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->fastestmirrortopk;
+        break;
+
+    case LRI_FASTESTMIRRORPROBEPATH:
+        str = va_arg(arg, char **);
+        *str = handle->fastestmirrorprobepath;
+        break;
+
+    case LRI_FASTESTMIRRORASYNC:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->fastestmirrorasync;
+        break;
+
+    case LRI_MIRRORRANKING:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->mirrorranking;
+        break;
+
+    case LRI_MIRRORSTATS:
+        str = va_arg(arg, char **);
+        *str = handle->mirrorstats;
+        break;
+
+    case LRI_MIRRORRESUME:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->mirrorresume;
+        break;
+
+    case LRI_ADAPTIVETIMEOUTS:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->adaptivetimeouts;
+        break;
+
+    case LRI_AUTOTUNE:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->autotune;
+        break;
+
+    case LRI_AUTOTUNEDPARALLELDOWNLOADS:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->autotunedparalleldownloads;
+        break;
+
+    case LRI_CONNECTIONAFFINITY:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->connectionaffinity;
+        break;
+
+    case LRI_TRANSFERS:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->transfers;
+        break;
+
+    case LRI_REUSEDCONNECTIONS:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->reusedconnections;
+        break;
+
+    case LRI_CHECKMAGIC:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->checkmagic;
+        break;
+
+    case LRI_CHECKSUMCACHE:
+        str = va_arg(arg, char **);
+        *str = handle->checksumcache;
+        break;
+
     default:
         rc = FALSE;
         g_set_error(err, LR_HANDLE_ERROR, LRE_UNKNOWNOPT,
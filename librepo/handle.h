@@ -42,6 +42,21 @@ typedef struct _LrHandle LrHandle;
 /** LRO_FASTESTMIRRORMAXAGE minimal allowed value */
 #define LRO_FASTESTMIRRORMAXAGE_MIN         0
 
+/** LRO_FASTESTMIRRORMAXPARALLEL default value */
+#define LRO_FASTESTMIRRORMAXPARALLEL_DEFAULT    32
+
+/** LRO_FASTESTMIRRORMAXPARALLEL minimal allowed value */
+#define LRO_FASTESTMIRRORMAXPARALLEL_MIN        1
+
+/** LRO_FASTESTMIRRORTOPK default value */
+#define LRO_FASTESTMIRRORTOPK_DEFAULT           0
+
+/** LRO_FASTESTMIRRORTOPK minimal allowed value */
+#define LRO_FASTESTMIRRORTOPK_MIN               0
+
+/** LRO_MIRRORRANKING default value */
+#define LRO_MIRRORRANKING_DEFAULT           LR_MIRRORRANKING_NONE
+
 /** LRO_PROXYPORT default value */
 #define LRO_PROXYPORT_DEFAULT               1080
 
@@ -69,6 +84,9 @@ typedef struct _LrHandle LrHandle;
 /** LRO_MAXPARALLELDOWNLOADS maximal allowed value */
 #define LRO_MAXPARALLELDOWNLOADS_MAX        20
 
+/** LRO_MINPARALLELDOWNLOADS default value */
+#define LRO_MINPARALLELDOWNLOADS_DEFAULT    1
+
 /** LRO_MAXDOWNLOADSPERMIRROR default value */
 #define LRO_MAXDOWNLOADSPERMIRROR_DEFAULT   2
 
@@ -196,7 +214,11 @@ typedef enum {
     LRO_FASTESTMIRRORCACHE, /*!< (char *)
         Path to the fastestmirror's cache file.
         Used when LRO_FASTESTMIRROR is enabled.
-        If it doesn't exists, it will be created. */
+        If it doesn't exists, it will be created.
+        The cache can be safely shared by concurrently running processes.
+        Caches in the old (text) format are converted automatically.
+        Records are keyed by the server (scheme + host + port) of the
+        mirrors. */
 
     LRO_FASTESTMIRRORMAXAGE, /*< (long)
         Maximum age of a record in cache (seconds).
@@ -237,6 +259,133 @@ typedef enum {
         Do not download this specified records from repomd (blacklist).
         Note: Last element of the list must be NULL! */
 
+    /* Download options, appended to keep the values of the options
+     * above */
+
+    LRO_CHECKSUMCACHE, /*!< (char *)
+        Path to the checksum cache index file. The cache is used to
+        avoid repeated checksum calculation of already downloaded packages
+        (lr_download_packages() and lr_check_packages()) on file systems
+        which don't support user extended attributes. Every package
+        uses the cache of its own handle. The file can be safely shared
+        by concurrently running processes.
+        If it doesn't exists, it will be created. */
+
+    LRO_DECOMPRESS, /*!< (long 1 or 0)
+        Decompress the gzip, bzip2 and xz compressed metadata files
+        during the download. The decompressed files are stored next
+        to the compressed ones (without the suffix) and their checksums
+        (checksum_open from repomd.xml) are verified. See
+        lr_yum_repo_decompressed_path(). */
+
+    LRO_FASTESTMIRRORMAXPARALLEL, /*!< (long)
+        Maximum number of mirrors probed in parallel during
+        the fastest mirror detection (LRO_FASTESTMIRROR).
+        Default: 32 */
+
+    LRO_FASTESTMIRRORTOPK, /*!< (long)
+        Stop the fastest mirror detection as soon as the K fastest
+        mirrors are known. I.e. at least K probes have finished and
+        all still running probes take longer than the K-th fastest
+        mirror. Mirrors which were not measured are placed behind
+        the measured ones (in their original order) and they are
+        not stored in the cache.
+        0 means probe all mirrors. Default: 0 */
+
+    LRO_FASTESTMIRRORPROBEPATH, /*!< (char *)
+        Path (relative to the mirror URL) of a file which is partially
+        downloaded from the fastest mirrors (by connect time) during
+        the fastest mirror detection, e.g. "repodata/repomd.xml".
+        Time to first byte and throughput of these transfers are then
+        used to rank the mirrors. NULL (default) disables this phase. */
+
+    LRO_FASTESTMIRRORASYNC, /*!< (long 1 or 0)
+        Do not wait for the fastest mirror detection in
+        lr_download_packages(). Downloading starts immediately with
+        mirrors ordered by the cached connect times (mirrors without
+        a cached record keep their original order, e.g. the metalink
+        preference) and the mirrors are probed in the same event loop.
+        As the probes finish, the mirrors are re-ranked, so the targets
+        which are started later use the faster mirrors. The throughput
+        phase (LRO_FASTESTMIRRORPROBEPATH) is not performed in this mode.
+        Used when LRO_FASTESTMIRROR is enabled. Disabled by default. */
+
+    LRO_MIRRORRANKING, /*!< (LrMirrorRanking)
+        Rank the mirrors without any probing. Mirrors are ordered by
+        the position of their metalink location in LRO_MIRRORLOCATIONS
+        (mirrors from other or unknown locations go last), then by
+        their cost weighted by their metalink preference (mirrors with
+        unknown cost follow the other ones in the order of their
+        preference). The cost is the connect time from
+        LRO_FASTESTMIRRORCACHE (LR_MIRRORRANKING_LATENCY) or the expected
+        download time computed from LRO_MIRRORSTATS
+        (LR_MIRRORRANKING_STATS). The order is used as it is or as
+        the starting point of LRO_FASTESTMIRROR.
+        Default: LR_MIRRORRANKING_NONE. */
+
+    LRO_MIRRORLOCATIONS, /*!< (char ** NULL-terminated)
+        Locations of the client for LRO_MIRRORRANKING. ISO 3166-1
+        alpha-2 country codes (as used by metalinks) in the order of
+        preference, e.g. the country of the client followed by
+        the countries of its region: {"CZ", "SK", "DE", "AT", NULL}. */
+
+    LRO_MIRRORSTATS, /*!< (char *)
+        Path to the file with statistics of the mirrors (throughput,
+        time to first byte and failure rate of the real downloads).
+        The statistics are updated by every download done with
+        the handle and their values decay with a half-life of a week.
+        A good place is next to the LRO_FASTESTMIRRORCACHE.
+        The file can be safely shared by concurrently running processes.
+        Used by LR_MIRRORRANKING_STATS. NULL (default) disables it. */
+
+    LRO_MIRRORRESUME, /*!< (long 1 or 0)
+        Keep the data received by a transfer which failed in the middle
+        (e.g. connection reset, LRO_LOWSPEEDLIMIT or a truncated file on
+        a local or FTP mirror) and let the next mirror continue from
+        there by a range request instead of downloading the whole file
+        again. Used only for targets with a known checksum and expected
+        size. If the checksum of the resumed file doesn't match, the file
+        is downloaded again from scratch. Disabled by default. */
+
+    LRO_ADAPTIVETIMEOUTS, /*!< (long 1 or 0)
+        Derive the connect timeout of each transfer from the connect
+        times observed for its mirror (never longer than
+        LRO_CONNECTTIMEOUT) and abort transfers which are much slower
+        than the other transfers of the download, so they can continue
+        from another mirror (see LRO_MIRRORRESUME). Unlike
+        LRO_LOWSPEEDLIMIT, the slowness is relative to the observed
+        rates, not an absolute limit. Disabled by default. */
+
+    LRO_AUTOTUNE, /*!< (long 1 or 0)
+        Tune the number of parallel downloads while downloading.
+        It grows while the total throughput keeps rising and
+        shrinks on transfer errors and timeouts or when the throughput
+        stops rising. Stays between LRO_MINPARALLELDOWNLOADS and
+        LRO_MAXPARALLELDOWNLOADS. The number chosen by the last download
+        is available as LRI_AUTOTUNEDPARALLELDOWNLOADS and the next
+        download starts from it. Disabled by default. */
+
+    LRO_MINPARALLELDOWNLOADS, /*!< (long)
+        Minimum number of parallel downloads used by LRO_AUTOTUNE.
+        Default is 1. */
+
+    LRO_CONNECTIONAFFINITY, /*!< (long 1 or 0)
+        When a transfer finishes, start next a waiting target which
+        would be downloaded from the same mirror (or base url), even if
+        it is not the next one in the list. The open connection is
+        reused then instead of being left idle while a new connection
+        is opened elsewhere. See LRI_TRANSFERS and
+        LRI_REUSEDCONNECTIONS for the effect. Disabled by default. */
+
+    LRO_CHECKMAGIC, /*!< (long 1 or 0)
+        Interrupt a transfer as soon as its first bytes don't match
+        the magic of the file type given by the suffix of the path
+        (.rpm, .gz, .xz, .bz2, .zst, .xml), e.g. when a mirror serves
+        an error page with a success status code. The next mirror is
+        tried right away instead of after the whole page is downloaded
+        and its checksum doesn't match. Used only for targets with
+        a checksum. Disabled by default. */
+
     LRO_SENTINEL,    /*!< Sentinel */
 
 } LrHandleOption; /*!< Handle config options */
@@ -285,6 +434,30 @@ typedef enum {
     LRI_FASTESTMIRROR,          /*!< (long *) */
     LRI_FASTESTMIRRORCACHE,     /*!< (char **) */
     LRI_FASTESTMIRRORMAXAGE,    /*!< (long *) */
+    LRI_CHECKSUMCACHE,          /*!< (char **) */
+    LRI_FASTESTMIRRORMAXPARALLEL, /*!< (long *) */
+    LRI_FASTESTMIRRORTOPK,      /*!< (long *) */
+    LRI_FASTESTMIRRORPROBEPATH, /*!< (char **) */
+    LRI_FASTESTMIRRORASYNC,     /*!< (long *) */
+    LRI_MIRRORRANKING,          /*!< (long *) */
+    LRI_MIRRORLOCATIONS,        /*!< (char ***)
+        Caller is responsible for the list deallocation */
+    LRI_MIRRORSTATS,            /*!< (char **) */
+    LRI_MIRRORRESUME,           /*!< (long *) */
+    LRI_ADAPTIVETIMEOUTS,       /*!< (long *) */
+    LRI_AUTOTUNE,               /*!< (long *) */
+    LRI_AUTOTUNEDPARALLELDOWNLOADS, /*!< (long *)
+        Number of parallel downloads chosen by LRO_AUTOTUNE at the end
+        of the last download with the handle, 0 if none was tuned yet. */
+    LRI_CONNECTIONAFFINITY,     /*!< (long *) */
+    LRI_TRANSFERS,              /*!< (long *)
+        Number of the network transfers done for the targets of
+        the handle in the last download. */
+    LRI_REUSEDCONNECTIONS,      /*!< (long *)
+        Number of those transfers which reused an already open
+        connection. Divided by LRI_TRANSFERS it is the connection
+        reuse ratio. */
+    LRI_CHECKMAGIC,             /*!< (long *) */
     LRI_SENTINEL,
 } LrHandleInfoOption; /*!< Handle info options */
 
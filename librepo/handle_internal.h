@@ -37,6 +37,12 @@ struct _LrHandle {
     CURL *curl_handle; /*!<
         CURL handle */
 
+    CURLSH *curl_share; /*!<
+        CURL share with DNS cache, TLS sessions and connections.
+        Used by all CURL handles of the handle, so the connections
+        warmed by the fastest mirror detection are reused by
+        the downloads. */
+
     int update; /*!<
         Just update existing repo */
 
@@ -58,6 +64,42 @@ struct _LrHandle {
     long fastestmirrormaxage; /*!<
         Maximum age of a record in cache (seconds). */
 
+    long fastestmirrormaxparallel; /*!<
+        Maximum number of mirrors probed in parallel. */
+
+    long fastestmirrortopk; /*!<
+        Stop the probing when the K fastest mirrors are known
+        (0 means probe all mirrors). */
+
+    char *fastestmirrorprobepath; /*!<
+        Path of the file used to measure throughput of the mirrors
+        or NULL. */
+
+    int fastestmirrorasync; /*!<
+        Do not wait for the fastest mirror detection before
+        lr_download_packages() starts downloading. */
+
+    LrMirrorRanking mirrorranking; /*!<
+        How to rank the mirrors by their location, preference and
+        costs. */
+
+    char **mirrorlocations; /*!<
+        NULL-terminated list of the country codes of the client
+        in the order of preference or NULL. */
+
+    char *mirrorstats; /*!<
+        Path to the statistics of the mirrors or NULL. */
+
+    int mirrorresume; /*!<
+        Continue a failed transfer from another mirror. */
+
+    int adaptivetimeouts; /*!<
+        Adapt the connect timeouts to the mirrors and abort
+        the transfers much slower than the others. */
+
+    long connecttimeout; /*!<
+        Max time in seconds for the connection phase (LRO_CONNECTTIMEOUT). */
+
     LrFastestMirrorCb fastestmirrorcb; /*!<
         Fastest mirror detection status callback */
 
@@ -149,6 +191,28 @@ struct _LrHandle {
     long maxdownloadspermirror; /* !<
         Maximum number of parallel downloads per a single mirror. */
 
+    int autotune; /*!<
+        Tune the number of parallel downloads. */
+
+    long minparalleldownloads; /*!<
+        Minimum number of parallel downloads (used by autotune). */
+
+    long autotunedparalleldownloads; /*!<
+        Number of parallel downloads chosen by autotune in the last
+        download, 0 if none. */
+
+    int connectionaffinity; /*!<
+        Prefer the targets which could reuse a just freed connection. */
+
+    long transfers; /*!<
+        Number of network transfers in the last download. */
+
+    long reusedconnections; /*!<
+        Number of the transfers which reused an open connection. */
+
+    int checkmagic; /*!<
+        Check the magic at the start of the downloaded files. */
+
     LrUrlVars *urlvars; /*!<
         List with url substitutions */
 
@@ -159,6 +223,12 @@ struct _LrHandle {
 
     gint64 maxspeed; /*!<
         Max speed in bytes per sec */
+
+    char *checksumcache; /*!<
+        Path to the checksum cache index file. */
+
+    int decompress; /*!<
+        Decompress compressed metadata during the download. */
 };
 
 /** Return new CURL easy handle with some default options setted.
@@ -166,6 +236,12 @@ struct _LrHandle {
 CURL *
 lr_get_curl_handle();
 
+/** Return new CURL share which shares DNS cache, TLS sessions and
+ * (if supported by the libcurl) connections.
+ */
+CURLSH *
+lr_get_curl_share();
+
 /**
  * Create (if do not exists) internal mirrorlist. Insert baseurl (if
  * specified) and download, parse and insert mirrors from mirrorlist url.
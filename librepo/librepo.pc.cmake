@@ -6,7 +6,7 @@ Name: librepo
 Description: Repodata downloading library.
 Version: @VERSION@
 Requires: glib-2.0
-Requires.private: libcurl openssl
+Requires.private: libcurl openssl zlib liblzma
 Libs: -L${libdir} -lrepo
-Libs.private: -lexpat -gpgme -gpg-error
+Libs.private: -lexpat -gpgme -gpg-error -lbz2
 Cflags: -I${includedir} -D_FILE_OFFSET_BITS=64
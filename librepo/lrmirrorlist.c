@@ -18,6 +18,7 @@
  */
 
 #include <assert.h>
+#include <float.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -45,12 +46,12 @@ lr_detect_protocol(const char *url)
 }
 
 static LrInternalMirror *
-lr_lrmirror_new(const char *url, LrUrlVars *urlvars)
+lr_lrmirror_new(const char *url, LrUrlVarsIndex *index)
 {
     LrInternalMirror *mirror;
 
     mirror = lr_malloc0(sizeof(*mirror));
-    mirror->url = lr_url_substitute(url, urlvars);
+    mirror->url = lr_url_substitute_index(url, index);
     return mirror;
 }
 
@@ -59,6 +60,7 @@ lr_lrmirror_free(void *data)
 {
     LrInternalMirror *mirror = data;
     lr_free(mirror->url);
+    lr_free(mirror->location);
     lr_free(mirror);
 }
 
@@ -71,21 +73,112 @@ lr_lrmirrorlist_free(LrInternalMirrorlist *list)
     g_slist_free_full(list, lr_lrmirror_free);
 }
 
+/** Appends mirrors to a list in linear time. It remembers the last
+ * element of the list and indexes the URLs already present in the list,
+ * so the mirrors with duplicate URLs are skipped in O(1).
+ */
+typedef struct {
+    LrInternalMirrorlist *list;     // Start of the list
+    LrInternalMirrorlist *last;     // Last element of the list
+    GHashTable *urls;               // URL -> LrInternalMirror
+} LrMirrorAppender;
+
+static void
+lr_mirrorappender_init(LrMirrorAppender *app, LrInternalMirrorlist *list)
+{
+    app->list = list;
+    app->last = NULL;
+    app->urls = g_hash_table_new(g_str_hash, g_str_equal);
+
+    for (LrInternalMirrorlist *elem = list; elem; elem = g_slist_next(elem)) {
+        LrInternalMirror *mirror = elem->data;
+        if (!g_hash_table_contains(app->urls, mirror->url))
+            g_hash_table_insert(app->urls, mirror->url, mirror);
+        app->last = elem;
+    }
+}
+
+/** Append the mirror to the list unless a mirror with the same URL
+ * is already there. In that case the mirror is freed.
+ * @return      The mirror from the list with the URL.
+ */
+static LrInternalMirror *
+lr_mirrorappender_add(LrMirrorAppender *app, LrInternalMirror *mirror)
+{
+    LrInternalMirror *existing = g_hash_table_lookup(app->urls, mirror->url);
+    if (existing) {
+        lr_lrmirror_free(mirror);
+        return existing;
+    }
+
+    LrInternalMirrorlist *elem = g_slist_alloc();
+    elem->data = mirror;
+    if (app->last)
+        app->last->next = elem;
+    else
+        app->list = elem;
+    app->last = elem;
+
+    g_hash_table_insert(app->urls, mirror->url, mirror);
+    return mirror;
+}
+
+static LrInternalMirrorlist *
+lr_mirrorappender_finish(LrMirrorAppender *app)
+{
+    g_hash_table_destroy(app->urls);
+    return app->list;
+}
+
 LrInternalMirrorlist *
 lr_lrmirrorlist_append_url(LrInternalMirrorlist *list,
                            const char *url,
                            LrUrlVars *urlvars)
 {
+    LrMirrorAppender app;
+
     if (!url || !strlen(url))
         return list;
 
-    LrInternalMirror *mirror = lr_lrmirror_new(url, urlvars);
+    LrUrlVarsIndex *index = lr_urlvars_index_new(urlvars);
+    LrInternalMirror *mirror = lr_lrmirror_new(url, index);
     mirror->preference = 100;
     mirror->protocol = lr_detect_protocol(mirror->url);
+    lr_urlvars_index_free(index);
 
     //g_debug("%s: Appending URL: %s", __func__, mirror->url);
 
-    return g_slist_append(list, mirror);
+    lr_mirrorappender_init(&app, list);
+    lr_mirrorappender_add(&app, mirror);
+    return lr_mirrorappender_finish(&app);
+}
+
+LrInternalMirrorlist *
+lr_lrmirrorlist_append_urls(LrInternalMirrorlist *list,
+                            char **urls,
+                            LrUrlVars *urlvars)
+{
+    LrMirrorAppender app;
+
+    if (!urls || !urls[0])
+        return list;
+
+    // Variables are compiled once for all the urls
+    LrUrlVarsIndex *index = lr_urlvars_index_new(urlvars);
+    lr_mirrorappender_init(&app, list);
+
+    for (char **url = urls; *url; url++) {
+        if (!strlen(*url))
+            continue;
+
+        LrInternalMirror *mirror = lr_lrmirror_new(*url, index);
+        mirror->preference = 100;
+        mirror->protocol = lr_detect_protocol(mirror->url);
+        lr_mirrorappender_add(&app, mirror);
+    }
+
+    lr_urlvars_index_free(index);
+    return lr_mirrorappender_finish(&app);
 }
 
 LrInternalMirrorlist *
@@ -93,24 +186,31 @@ lr_lrmirrorlist_append_mirrorlist(LrInternalMirrorlist *list,
                                   LrMirrorlist *mirrorlist,
                                   LrUrlVars *urlvars)
 {
+    LrMirrorAppender app;
+
     if (!mirrorlist || !mirrorlist->urls)
         return list;
 
+    // Variables are compiled once for all the urls
+    LrUrlVarsIndex *index = lr_urlvars_index_new(urlvars);
+    lr_mirrorappender_init(&app, list);
+
     for (GSList *elem = mirrorlist->urls; elem; elem = g_slist_next(elem)) {
         char *url = elem->data;
 
         if (!url || !strlen(url))
             continue;
 
-        LrInternalMirror *mirror = lr_lrmirror_new(url, urlvars);
+        LrInternalMirror *mirror = lr_lrmirror_new(url, index);
         mirror->preference = 100;
         mirror->protocol = lr_detect_protocol(mirror->url);
-        list = g_slist_append(list, mirror);
+        lr_mirrorappender_add(&app, mirror);
 
         //g_debug("%s: Appending URL: %s", __func__, mirror->url);
     }
 
-    return list;
+    lr_urlvars_index_free(index);
+    return lr_mirrorappender_finish(&app);
 }
 
 LrInternalMirrorlist *
@@ -119,6 +219,7 @@ lr_lrmirrorlist_append_metalink(LrInternalMirrorlist *list,
                                 const char *suffix,
                                 LrUrlVars *urlvars)
 {
+    LrMirrorAppender app;
     size_t suffix_len = 0;
 
     if (!metalink || !metalink->urls)
@@ -127,6 +228,10 @@ lr_lrmirrorlist_append_metalink(LrInternalMirrorlist *list,
     if (suffix)
         suffix_len = strlen(suffix);
 
+    // Variables are compiled once for all the urls
+    LrUrlVarsIndex *index = lr_urlvars_index_new(urlvars);
+    lr_mirrorappender_init(&app, list);
+
     for (GSList *elem = metalink->urls; elem; elem = g_slist_next(elem)) {
         LrMetalinkUrl *metalinkurl = elem->data;
         assert(metalinkurl);
@@ -152,34 +257,123 @@ lr_lrmirrorlist_append_metalink(LrInternalMirrorlist *list,
         if (!url_copy)
             url_copy = g_strdup(url);
 
-        LrInternalMirror *mirror = lr_lrmirror_new(url_copy, urlvars);
+        LrInternalMirror *mirror = lr_lrmirror_new(url_copy, index);
         mirror->preference = metalinkurl->preference;
         mirror->protocol = lr_detect_protocol(mirror->url);
+        mirror->location = g_strdup(metalinkurl->location);
         lr_free(url_copy);
-        list = g_slist_append(list, mirror);
+
+        // A mirror listed more than once keeps its best preference
+        int preference = mirror->preference;
+        mirror = lr_mirrorappender_add(&app, mirror);
+        mirror->preference = MAX(mirror->preference, preference);
 
         //g_debug("%s: Appending URL: %s", __func__, mirror->url);
     }
 
-    return list;
+    lr_urlvars_index_free(index);
+    return lr_mirrorappender_finish(&app);
 }
 
 LrInternalMirrorlist *
 lr_lrmirrorlist_append_lrmirrorlist(LrInternalMirrorlist *list,
                                     LrInternalMirrorlist *other)
 {
+    LrMirrorAppender app;
+
     if (!other)
         return list;
 
+    lr_mirrorappender_init(&app, list);
+
     for (LrInternalMirrorlist *elem = other; elem; elem = g_slist_next(elem)) {
         LrInternalMirror *oth = elem->data;
         LrInternalMirror *mirror = lr_lrmirror_new(oth->url, NULL);
         mirror->preference = oth->preference;
         mirror->protocol = oth->protocol;
-        list = g_slist_append(list, mirror);
+        mirror->location = g_strdup(oth->location);
+        lr_mirrorappender_add(&app, mirror);
         //g_debug("%s: Appending URL: %s", __func__, mirror->url);
     }
 
+    return lr_mirrorappender_finish(&app);
+}
+
+typedef struct {
+    int tier;       // Position of the location in the list of locations
+    int class;      // 0 - known cost, 1 - unknown, 2 - unreachable
+    double score;   // Lower is better
+    int position;   // Original position in the list
+} LrMirrorRank;
+
+static gint
+lr_lrmirror_cmp_rank(gconstpointer a, gconstpointer b, gpointer ranks)
+{
+    const LrMirrorRank *ra = g_hash_table_lookup(ranks, a);
+    const LrMirrorRank *rb = g_hash_table_lookup(ranks, b);
+
+    if (ra->tier != rb->tier)
+        return (ra->tier < rb->tier) ? -1 : 1;
+    if (ra->class != rb->class)
+        return (ra->class < rb->class) ? -1 : 1;
+    if (ra->score != rb->score)
+        return (ra->score < rb->score) ? -1 : 1;
+    return (ra->position > rb->position) - (ra->position < rb->position);
+}
+
+LrInternalMirrorlist *
+lr_lrmirrorlist_rank(LrInternalMirrorlist *list,
+                     char **locations,
+                     GHashTable *costs)
+{
+    if (!list)
+        return list;
+
+    int n_locations = locations ? (int) g_strv_length(locations) : 0;
+    int position = 0;
+    GHashTable *ranks = g_hash_table_new_full(g_direct_hash,
+                                              g_direct_equal,
+                                              NULL,
+                                              g_free);
+
+    for (LrInternalMirrorlist *elem = list; elem; elem = g_slist_next(elem)) {
+        LrInternalMirror *mirror = elem->data;
+        LrMirrorRank *rank = g_new0(LrMirrorRank, 1);
+        int preference = CLAMP(mirror->preference, 0, 100);
+
+        rank->position = position++;
+
+        rank->tier = n_locations;
+        for (int x = 0; mirror->location && x < n_locations; x++) {
+            if (!g_ascii_strcasecmp(mirror->location, locations[x])) {
+                rank->tier = x;
+                break;
+            }
+        }
+
+        double *cost = NULL;
+        if (costs) {
+            gchar *host = lr_url_host(mirror->url);
+            cost = g_hash_table_lookup(costs, host);
+            g_free(host);
+        }
+
+        if (!cost) {
+            rank->class = 1;
+            rank->score = -preference;
+        } else if (*cost == DBL_MAX) {
+            rank->class = 2;
+            rank->score = -preference;
+        } else {
+            rank->class = 0;
+            rank->score = *cost * (200 - preference) / 100.0;
+        }
+
+        g_hash_table_insert(ranks, mirror, rank);
+    }
+
+    list = g_slist_sort_with_data(list, lr_lrmirror_cmp_rank, ranks);
+    g_hash_table_destroy(ranks);
     return list;
 }
 
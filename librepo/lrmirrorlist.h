@@ -41,8 +41,15 @@ typedef struct {
     char *url;           /*!< URL of the mirror */
     int preference;      /*!< Integer number 1-100 - higher is better */
     LrProtocol protocol; /*!< Protocol of this mirror */
+    char *location;      /*!< ISO 3166-1 alpha-2 code of the country
+                              of the mirror (from metalink) or NULL */
 } LrInternalMirror;
 
+/** List of mirrors (LrInternalMirror *). The lr_lrmirrorlist_append_*()
+ * functions never add a mirror with an URL that is already in the list
+ * and their time is linear in the size of the list and the appended
+ * mirrors.
+ */
 typedef GSList LrInternalMirrorlist;
 
 /** Detect URL protocol.
@@ -63,6 +70,18 @@ lr_lrmirrorlist_append_url(LrInternalMirrorlist *list,
                            const char *url,
                            LrUrlVars *urlvars);
 
+/** Append urls to the mirrorlist. Unlike repeated calls of
+ * lr_lrmirrorlist_append_url() it takes linear time.
+ * @param list          a LrInternalMirrorlist or NULL
+ * @param urls          NULL-terminated list of urls or NULL
+ * @param urlvars       a LrUrlVars or NULL
+ * @return              the new start of the LrInternalMirrorlist
+ */
+LrInternalMirrorlist *
+lr_lrmirrorlist_append_urls(LrInternalMirrorlist *list,
+                            char **urls,
+                            LrUrlVars *urlvars);
+
 /** Append mirrors from mirrorlist to the internal mirrorlist.
  * @param iml           Internal mirrorlist or NULL
  * @param mirrorlist    Mirrorlist
@@ -75,6 +94,7 @@ lr_lrmirrorlist_append_mirrorlist(LrInternalMirrorlist *list,
                                   LrUrlVars *urlvars);
 
 /** Append mirrors from metalink to the internal mirrorlist.
+ * A mirror listed more than once keeps its highest preference.
  * @param iml           Internal mirrorlist or NULL
  * @param metalink      Metalink
  * @param suffix        Suffix that shoud be removed from the metalink urls
@@ -96,6 +116,27 @@ LrInternalMirrorlist *
 lr_lrmirrorlist_append_lrmirrorlist(LrInternalMirrorlist *list,
                                     LrInternalMirrorlist *other);
 
+/** Rank the mirrors. The mirrors are ordered by:
+ * 1) The position of their location in the locations list. Mirrors
+ *    with other or unknown location follow.
+ * 2) The cost from the costs multiplied by a factor from 1.0
+ *    (preference 100) to 2.0 (preference 0). Mirrors without a cost
+ *    follow in the order of their preference and unreachable mirrors
+ *    (cost DBL_MAX) go last.
+ * 3) Their original order.
+ * @param list          a LrInternalMirrorlist
+ * @param locations     NULL-terminated list of ISO 3166-1 alpha-2
+ *                      country codes in the order of preference or NULL
+ * @param costs         Table mapping lr_url_host() of the mirrors
+ *                      to their costs, e.g. connect times in seconds
+ *                      (double *) or NULL
+ * @return              the new start of the LrInternalMirrorlist
+ */
+LrInternalMirrorlist *
+lr_lrmirrorlist_rank(LrInternalMirrorlist *list,
+                     char **locations,
+                     GHashTable *costs);
+
 /** Return mirror on the given position.
  * @param list          a LrInternalMirrorlist
  * @param nth           the position of the mirror
@@ -37,14 +37,19 @@
 #define CHUNK_SIZE              8192
 #define CONTENT_REALLOC_STEP    256
 
-/* Metalink object manipulation helpers */
+/* Metalink object manipulation helpers
+ *
+ * Items are prepended (a metalink could list thousands of urls)
+ * and all lists are reversed to the document order by
+ * lr_metalink_reverse_lists() when the parsing is done.
+ */
 
 static LrMetalinkHash *
 lr_new_metalinkhash(LrMetalink *m)
 {
     assert(m);
     LrMetalinkHash *hash = lr_malloc0(sizeof(*hash));
-    m->hashes = g_slist_append(m->hashes, hash);
+    m->hashes = g_slist_prepend(m->hashes, hash);
     return hash;
 }
 
@@ -53,7 +58,7 @@ lr_new_metalinkalternate_hash(LrMetalinkAlternate *ma)
 {
     assert(ma);
     LrMetalinkHash *hash = lr_malloc0(sizeof(*hash));
-    ma->hashes = g_slist_append(ma->hashes, hash);
+    ma->hashes = g_slist_prepend(ma->hashes, hash);
     return hash;
 }
 
@@ -62,7 +67,7 @@ lr_new_metalinkurl(LrMetalink *m)
 {
     assert(m);
     LrMetalinkUrl *url = lr_malloc0(sizeof(*url));
-    m->urls = g_slist_append(m->urls, url);
+    m->urls = g_slist_prepend(m->urls, url);
     return url;
 }
 
@@ -71,10 +76,22 @@ lr_new_metalinkalternate(LrMetalink *m)
 {
     assert(m);
     LrMetalinkAlternate *alternate = lr_malloc0(sizeof(*alternate));
-    m->alternates = g_slist_append(m->alternates, alternate);
+    m->alternates = g_slist_prepend(m->alternates, alternate);
     return alternate;
 }
 
+static void
+lr_metalink_reverse_lists(LrMetalink *m)
+{
+    m->hashes = g_slist_reverse(m->hashes);
+    m->urls = g_slist_reverse(m->urls);
+    m->alternates = g_slist_reverse(m->alternates);
+    for (GSList *elem = m->alternates; elem; elem = g_slist_next(elem)) {
+        LrMetalinkAlternate *ma = elem->data;
+        ma->hashes = g_slist_reverse(ma->hashes);
+    }
+}
+
 static void
 lr_free_metalinkhash(LrMetalinkHash *metalinkhash)
 {
@@ -506,6 +523,8 @@ lr_metalink_parse_file(LrMetalink *metalink,
     if (tmp_err)
         g_propagate_error(err, tmp_err);
 
+    lr_metalink_reverse_lists(metalink);
+
     // Clean up
 
     if (!pd->found) {
@@ -17,11 +17,12 @@
  * USA.
  */
 
-#define _POSIX_SOURCE
+#define _POSIX_C_SOURCE 200809L    // Because of getline()
 
 #include <errno.h>
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -29,8 +30,6 @@
 #include "util.h"
 #include "mirrorlist.h"
 
-#define BUF_LEN 4096
-
 LrMirrorlist *
 lr_mirrorlist_init()
 {
@@ -52,7 +51,10 @@ lr_mirrorlist_parse_file(LrMirrorlist *mirrorlist, int fd, GError **err)
 {
     FILE *f;
     int fd_dup;
-    char buf[BUF_LEN], *p;
+    char *line = NULL, *p;
+    size_t line_len = 0;
+    GSList *urls = NULL;
+    GHashTable *seen;
 
     assert(mirrorlist);
     assert(fd >= 0);
@@ -74,9 +76,16 @@ lr_mirrorlist_parse_file(LrMirrorlist *mirrorlist, int fd, GError **err)
         return FALSE;
     }
 
-    while ((p = fgets(buf, BUF_LEN, f))) {
+    // URLs are prepended and the list is reversed at the end
+    // (a mirrorlist could list thousands of mirrors), duplicates are
+    // skipped. Lines are not limited in length.
+    seen = g_hash_table_new(g_str_hash, g_str_equal);
+
+    while (getline(&line, &line_len, f) != -1) {
         int l;
 
+        p = line;
+
         /* Skip leading white characters */
         while (*p == ' ' || *p == '\t')
             p++;
@@ -94,10 +103,18 @@ lr_mirrorlist_parse_file(LrMirrorlist *mirrorlist, int fd, GError **err)
             continue;
 
         /* Append URL */
-        if (p[0] != '\0' && (strstr(p, "://") || p[0] == '/'))
-            mirrorlist->urls = g_slist_append(mirrorlist->urls, g_strdup(p));
+        if (p[0] != '\0' && (strstr(p, "://") || p[0] == '/')
+            && !g_hash_table_contains(seen, p))
+        {
+            char *url = g_strdup(p);
+            g_hash_table_add(seen, url);
+            urls = g_slist_prepend(urls, url);
+        }
     }
 
+    mirrorlist->urls = g_slist_concat(mirrorlist->urls, g_slist_reverse(urls));
+    g_hash_table_destroy(seen);
+    free(line);
     fclose(f);
 
     return TRUE;
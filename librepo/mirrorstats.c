@@ -0,0 +1,465 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2013  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+#include <glib.h>
+#include <assert.h>
+#include <errno.h>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+
+#include "mirrorstats_internal.h"
+#include "lrmirrorlist.h"
+#include "rcodes.h"
+#include "util.h"
+
+#define STATS_HALF_LIFE         (7 * 24 * 3600)     // Seconds
+#define STATS_MIN_WEIGHT        0.01    // Lighter records are removed
+#define STATS_REFERENCE_SIZE    (1024.0 * 1024.0)   // Size used by the cost
+#define STATS_LOCK_SUFFIX       ".lock"
+
+#define KEYFILE_GROUP_METADATA  ":_librepo_:"   // Group with metadata
+#define KEYFILE_KEY_VERSION     "version"       // Version of the format
+#define KEYFILE_KEY_TS          "ts"
+#define KEYFILE_KEY_SUCCESSES   "successes"
+#define KEYFILE_KEY_FAILURES    "failures"
+#define KEYFILE_KEY_BYTES       "bytes"
+#define KEYFILE_KEY_SECONDS     "seconds"
+#define KEYFILE_KEY_TTFB        "ttfb"
+#define KEYFILE_VERSION         1
+
+struct _LrMirrorStats {
+    gchar *path;            // Path to the statistics file
+    GHashTable *records;    // Loaded records (host -> LrMirrorStatsEntry)
+    GHashTable *updates;    // New observations (host -> LrMirrorStatsEntry)
+};
+
+static gint64
+lr_mirrorstats_now(void)
+{
+    return g_get_real_time() / 1000000;
+}
+
+static GHashTable *
+lr_mirrorstats_table_new(void)
+{
+    return g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+}
+
+/** Decay the values of the entry to the time now. */
+static void
+lr_mirrorstats_decay(LrMirrorStatsEntry *entry, gint64 now)
+{
+    if (now <= entry->ts)
+        return;
+
+    double factor = exp2(-(double) (now - entry->ts) / STATS_HALF_LIFE);
+    entry->successes    *= factor;
+    entry->failures     *= factor;
+    entry->bytes        *= factor;
+    entry->seconds      *= factor;
+    entry->ttfb         *= factor;
+    entry->ts = now;
+}
+
+/** Add the values of the src to the dst (both are decayed to now). */
+static void
+lr_mirrorstats_sum(LrMirrorStatsEntry *dst,
+                   const LrMirrorStatsEntry *src,
+                   gint64 now)
+{
+    LrMirrorStatsEntry tmp = *src;
+
+    lr_mirrorstats_decay(dst, now);
+    lr_mirrorstats_decay(&tmp, now);
+    dst->successes  += tmp.successes;
+    dst->failures   += tmp.failures;
+    dst->bytes      += tmp.bytes;
+    dst->seconds    += tmp.seconds;
+    dst->ttfb       += tmp.ttfb;
+}
+
+static gboolean
+lr_mirrorstats_load_keyfile(GHashTable *records,
+                            const char *path,
+                            GError **err)
+{
+    GKeyFile *keyfile = g_key_file_new();
+    GError *tmp_err = NULL;
+
+    assert(!err || *err == NULL);
+
+    if (!g_key_file_load_from_file(keyfile, path, G_KEY_FILE_NONE, &tmp_err)) {
+        if (g_error_matches(tmp_err, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+            // Statistics don't exist yet
+            g_error_free(tmp_err);
+            g_key_file_free(keyfile);
+            return TRUE;
+        }
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
+                    "Cannot parse mirror statistics %s: %s",
+                    path, tmp_err->message);
+        g_error_free(tmp_err);
+        g_key_file_free(keyfile);
+        return FALSE;
+    }
+
+    int version = (int) g_key_file_get_integer(keyfile,
+                                               KEYFILE_GROUP_METADATA,
+                                               KEYFILE_KEY_VERSION,
+                                               NULL);
+    if (version != KEYFILE_VERSION) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
+                    "%s is not a compatible mirror statistics file "
+                    "(version %d)", path, version);
+        g_key_file_free(keyfile);
+        return FALSE;
+    }
+
+    gchar **groups = g_key_file_get_groups(keyfile, NULL);
+    for (gchar **group = groups; *group; group++) {
+        LrMirrorStatsEntry entry;
+
+        if (g_str_has_prefix(*group, ":_"))
+            continue;
+
+        entry.ts = g_key_file_get_int64(keyfile, *group,
+                                        KEYFILE_KEY_TS, &tmp_err);
+        if (!tmp_err)
+            entry.successes = g_key_file_get_double(keyfile, *group,
+                                                    KEYFILE_KEY_SUCCESSES,
+                                                    &tmp_err);
+        if (!tmp_err)
+            entry.failures = g_key_file_get_double(keyfile, *group,
+                                                   KEYFILE_KEY_FAILURES,
+                                                   &tmp_err);
+        if (!tmp_err)
+            entry.bytes = g_key_file_get_double(keyfile, *group,
+                                                KEYFILE_KEY_BYTES,
+                                                &tmp_err);
+        if (!tmp_err)
+            entry.seconds = g_key_file_get_double(keyfile, *group,
+                                                  KEYFILE_KEY_SECONDS,
+                                                  &tmp_err);
+        if (!tmp_err)
+            entry.ttfb = g_key_file_get_double(keyfile, *group,
+                                               KEYFILE_KEY_TTFB,
+                                               &tmp_err);
+        if (tmp_err) {
+            g_debug("%s: Ignoring broken record %s in %s: %s",
+                    __func__, *group, path, tmp_err->message);
+            g_clear_error(&tmp_err);
+            continue;
+        }
+
+        g_hash_table_replace(records,
+                             g_strdup(*group),
+                             g_memdup(&entry, sizeof(entry)));
+    }
+    g_strfreev(groups);
+    g_key_file_free(keyfile);
+
+    return TRUE;
+}
+
+gboolean
+lr_mirrorstats_load(LrMirrorStats **stats, const char *path, GError **err)
+{
+    assert(stats);
+    assert(path);
+    assert(!err || *err == NULL);
+
+    *stats = lr_malloc0(sizeof(LrMirrorStats));
+    (*stats)->path = g_strdup(path);
+    (*stats)->records = lr_mirrorstats_table_new();
+    (*stats)->updates = lr_mirrorstats_table_new();
+
+    if (!lr_mirrorstats_load_keyfile((*stats)->records, path, err))
+        return FALSE;
+
+    g_debug("%s: Loaded %u records from %s", __func__,
+            g_hash_table_size((*stats)->records), path);
+    return TRUE;
+}
+
+gboolean
+lr_mirrorstats_lookup(LrMirrorStats *stats,
+                      const char *url,
+                      LrMirrorStatsEntry *entry)
+{
+    if (!stats || !url)
+        return FALSE;
+
+    gint64 now = lr_mirrorstats_now();
+    gchar *host = lr_url_host(url);
+    LrMirrorStatsEntry *record = g_hash_table_lookup(stats->records, host);
+    LrMirrorStatsEntry *update = g_hash_table_lookup(stats->updates, host);
+    g_free(host);
+
+    if (!record && !update)
+        return FALSE;
+
+    memset(entry, 0, sizeof(*entry));
+    entry->ts = now;
+    if (record)
+        lr_mirrorstats_sum(entry, record, now);
+    if (update)
+        lr_mirrorstats_sum(entry, update, now);
+
+    return TRUE;
+}
+
+/** Return the entry for the new observations of the server of the url
+ * decayed to now.
+ */
+static LrMirrorStatsEntry *
+lr_mirrorstats_update_entry(LrMirrorStats *stats, const char *url, gint64 now)
+{
+    gchar *host = lr_url_host(url);
+    LrMirrorStatsEntry *entry = g_hash_table_lookup(stats->updates, host);
+
+    if (entry) {
+        g_free(host);
+        lr_mirrorstats_decay(entry, now);
+    } else {
+        entry = g_new0(LrMirrorStatsEntry, 1);
+        entry->ts = now;
+        g_hash_table_insert(stats->updates, host, entry);
+    }
+
+    return entry;
+}
+
+void
+lr_mirrorstats_add_success(LrMirrorStats *stats,
+                           const char *url,
+                           gint64 bytes,
+                           double seconds,
+                           double ttfb)
+{
+    if (!stats || !url)
+        return;
+
+    LrMirrorStatsEntry *entry;
+    entry = lr_mirrorstats_update_entry(stats, url, lr_mirrorstats_now());
+    entry->successes    += 1.0;
+    entry->bytes        += (double) MAX(bytes, 0);
+    entry->seconds      += MAX(seconds, 0.0);
+    entry->ttfb         += MAX(ttfb, 0.0);
+}
+
+void
+lr_mirrorstats_add_failure(LrMirrorStats *stats, const char *url)
+{
+    if (!stats || !url)
+        return;
+
+    LrMirrorStatsEntry *entry;
+    entry = lr_mirrorstats_update_entry(stats, url, lr_mirrorstats_now());
+    entry->failures += 1.0;
+}
+
+double
+lr_mirrorstats_cost(const LrMirrorStatsEntry *entry)
+{
+    if (entry->successes < 0.5) {
+        // Repeatedly failing mirror
+        if (entry->failures >= 2.0)
+            return DBL_MAX;
+        return -1.0;
+    }
+
+    double success_rate = entry->successes
+                          / (entry->successes + entry->failures);
+    double time = entry->ttfb / entry->successes;
+
+    if (entry->bytes > 0.0)
+        time += STATS_REFERENCE_SIZE * entry->seconds / entry->bytes;
+
+    return time / success_rate;
+}
+
+GHashTable *
+lr_mirrorstats_costs(const char *path, GSList *list)
+{
+    LrMirrorStats *stats;
+    GError *tmp_err = NULL;
+
+    if (!lr_mirrorstats_load(&stats, path, &tmp_err)) {
+        g_debug("%s: %s", __func__, tmp_err->message);
+        g_error_free(tmp_err);
+    }
+
+    GHashTable *costs = g_hash_table_new_full(g_str_hash,
+                                              g_str_equal,
+                                              g_free,
+                                              g_free);
+
+    for (GSList *elem = list; elem; elem = g_slist_next(elem)) {
+        LrInternalMirror *imirror = elem->data;
+        LrMirrorStatsEntry entry;
+        gchar *host = lr_url_host(imirror->url);
+        double cost = -1.0;
+
+        if (!g_hash_table_contains(costs, host)
+            && lr_mirrorstats_lookup(stats, host, &entry))
+            cost = lr_mirrorstats_cost(&entry);
+
+        if (cost < 0.0) {
+            g_free(host);
+            continue;
+        }
+
+        double *value = g_new(double, 1);
+        *value = cost;
+        g_hash_table_insert(costs, host, value);
+    }
+
+    lr_mirrorstats_free(stats);
+    return costs;
+}
+
+/** Lock the statistics file.
+ * @return      File descriptor of the lock (closing it releases the lock)
+ *              or -1 if err is set.
+ */
+static int
+lr_mirrorstats_lock(const char *path, GError **err)
+{
+    gchar *lock_path = g_strconcat(path, STATS_LOCK_SUFFIX, NULL);
+    int lock_fd = open(lock_path, O_RDWR|O_CREAT, 0644);
+
+    if (lock_fd == -1) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
+                    "Cannot open %s: %s", lock_path, strerror(errno));
+    } else if (flock(lock_fd, LOCK_EX) == -1) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
+                    "Cannot lock %s: %s", lock_path, strerror(errno));
+        close(lock_fd);
+        lock_fd = -1;
+    }
+
+    g_free(lock_path);
+    return lock_fd;
+}
+
+gboolean
+lr_mirrorstats_write(LrMirrorStats *stats, GError **err)
+{
+    assert(!err || *err == NULL);
+
+    if (!stats || !g_hash_table_size(stats->updates))
+        return TRUE;  // Nothing to do
+
+    int lock_fd = lr_mirrorstats_lock(stats->path, err);
+    if (lock_fd == -1)
+        return FALSE;
+
+    // Add our observations to the current content of the file,
+    // other processes could have written theirs in the meantime
+    GHashTable *records = lr_mirrorstats_table_new();
+    GError *tmp_err = NULL;
+    if (!lr_mirrorstats_load_keyfile(records, stats->path, &tmp_err)) {
+        g_debug("%s: Overwriting broken statistics: %s",
+                __func__, tmp_err->message);
+        g_clear_error(&tmp_err);
+    }
+
+    gint64 now = lr_mirrorstats_now();
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, stats->updates);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        LrMirrorStatsEntry *record = g_hash_table_lookup(records, key);
+        if (!record) {
+            record = g_new0(LrMirrorStatsEntry, 1);
+            record->ts = now;
+            g_hash_table_insert(records, g_strdup(key), record);
+        }
+        lr_mirrorstats_sum(record, value, now);
+    }
+
+    GKeyFile *keyfile = g_key_file_new();
+    g_key_file_set_integer(keyfile, KEYFILE_GROUP_METADATA,
+                           KEYFILE_KEY_VERSION, KEYFILE_VERSION);
+
+    g_hash_table_iter_init(&iter, records);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        LrMirrorStatsEntry *record = value;
+
+        lr_mirrorstats_decay(record, now);
+        if (record->successes + record->failures < STATS_MIN_WEIGHT) {
+            // Mirror which was not used for a long time
+            g_hash_table_iter_remove(&iter);
+            continue;
+        }
+
+        g_key_file_set_int64(keyfile, key, KEYFILE_KEY_TS, record->ts);
+        g_key_file_set_double(keyfile, key, KEYFILE_KEY_SUCCESSES,
+                              record->successes);
+        g_key_file_set_double(keyfile, key, KEYFILE_KEY_FAILURES,
+                              record->failures);
+        g_key_file_set_double(keyfile, key, KEYFILE_KEY_BYTES, record->bytes);
+        g_key_file_set_double(keyfile, key, KEYFILE_KEY_SECONDS,
+                              record->seconds);
+        g_key_file_set_double(keyfile, key, KEYFILE_KEY_TTFB, record->ttfb);
+    }
+
+    // g_file_set_contents() atomically replaces the file
+    gsize len;
+    gchar *data = g_key_file_to_data(keyfile, &len, NULL);
+    gboolean ret = g_file_set_contents(stats->path, data, len, &tmp_err);
+    if (!ret) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
+                    "Cannot write mirror statistics %s: %s",
+                    stats->path, tmp_err->message);
+        g_error_free(tmp_err);
+        g_hash_table_destroy(records);
+    } else {
+        g_debug("%s: Written %u records to %s", __func__,
+                g_hash_table_size(records), stats->path);
+        // The observations are in the records now
+        g_hash_table_destroy(stats->records);
+        stats->records = records;
+        g_hash_table_remove_all(stats->updates);
+    }
+
+    close(lock_fd);  // Releases the lock
+    g_free(data);
+    g_key_file_free(keyfile);
+
+    return ret;
+}
+
+void
+lr_mirrorstats_free(LrMirrorStats *stats)
+{
+    if (!stats)
+        return;
+
+    g_hash_table_destroy(stats->records);
+    g_hash_table_destroy(stats->updates);
+    g_free(stats->path);
+    g_free(stats);
+}
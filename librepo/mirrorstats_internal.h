@@ -0,0 +1,136 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2013  Tomas Mlcoch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+#ifndef LR_MIRRORSTATS_INTERNAL_H
+#define LR_MIRRORSTATS_INTERNAL_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/** Persistent statistics of the mirrors collected from the real downloads.
+ *
+ * Every server (see lr_url_host()) has a record with the numbers
+ * of successful and failed transfers, the downloaded bytes, the time
+ * spent by receiving them and the sum of the times to first byte.
+ * All the values decay exponentially with the age (half-life
+ * is a week), so the recent behaviour of the mirror matters most.
+ *
+ * Only the new observations are kept in memory. They are added to
+ * the current content of the file under an exclusive flock() of
+ * the "<path>.lock" file, so concurrently running processes don't
+ * lose each other's observations.
+ */
+typedef struct _LrMirrorStats LrMirrorStats;
+
+/** Statistics of a mirror.
+ */
+typedef struct {
+    gint64 ts;              /*!< Time the values are decayed to
+                                 (secs since epoch) */
+    double successes;       /*!< Successful transfers */
+    double failures;        /*!< Failed transfers */
+    double bytes;           /*!< Downloaded bytes */
+    double seconds;         /*!< Time spent by receiving the bytes */
+    double ttfb;            /*!< Sum of the times to first byte */
+} LrMirrorStatsEntry;
+
+/** Load the statistics.
+ * @param stats     Pointer where the new statistics are stored. It is
+ *                  set even if FALSE is returned (they are empty then).
+ * @param path      Path to the statistics file.
+ * @param err       GError ** - Set if the file exists but it cannot
+ *                  be parsed.
+ * @return          TRUE if error is not set and FALSE if it is.
+ */
+gboolean
+lr_mirrorstats_load(LrMirrorStats **stats, const char *path, GError **err);
+
+/** Get the statistics of the server of the URL (including the not yet
+ * written observations) decayed to the current time.
+ * @param stats     Statistics or NULL.
+ * @param url       URL of a mirror.
+ * @param entry     Where the statistics are stored.
+ * @return          TRUE if the server has a record.
+ */
+gboolean
+lr_mirrorstats_lookup(LrMirrorStats *stats,
+                      const char *url,
+                      LrMirrorStatsEntry *entry);
+
+/** Record a successful transfer.
+ * @param stats     Statistics or NULL.
+ * @param url       URL of the mirror.
+ * @param bytes     Downloaded bytes.
+ * @param seconds   Time spent by receiving the bytes.
+ * @param ttfb      Time to first byte.
+ */
+void
+lr_mirrorstats_add_success(LrMirrorStats *stats,
+                           const char *url,
+                           gint64 bytes,
+                           double seconds,
+                           double ttfb);
+
+/** Record a failed transfer.
+ * @param stats     Statistics or NULL.
+ * @param url       URL of the mirror.
+ */
+void
+lr_mirrorstats_add_failure(LrMirrorStats *stats, const char *url);
+
+/** Estimate the time needed to download a package from the mirror.
+ * The time of a 1 MiB transfer (time to first byte + transfer time)
+ * is divided by the success rate of the mirror.
+ * @param entry     Statistics of the mirror.
+ * @return          Estimated time in seconds, DBL_MAX if the mirror
+ *                  doesn't work at all or -1.0 if there is not enough
+ *                  data for the estimate.
+ */
+double
+lr_mirrorstats_cost(const LrMirrorStatsEntry *entry);
+
+/** Get the costs (see lr_mirrorstats_cost()) of the servers
+ * of the mirrors from the statistics file.
+ * @param path      Path to the statistics file.
+ * @param list      List of LrInternalMirror.
+ * @return          Table mapping lr_url_host() of the mirrors with enough
+ *                  data to their costs (double *).
+ */
+GHashTable *
+lr_mirrorstats_costs(const char *path, GSList *list);
+
+/** Add the recorded observations to the statistics file.
+ * @param stats     Statistics or NULL.
+ * @param err       GError **
+ * @return          TRUE if error is not set and FALSE if it is.
+ */
+gboolean
+lr_mirrorstats_write(LrMirrorStats *stats, GError **err);
+
+/** Free the statistics. Unwritten observations are lost.
+ * @param stats     Statistics or NULL.
+ */
+void
+lr_mirrorstats_free(LrMirrorStats *stats);
+
+G_END_DECLS
+
+#endif
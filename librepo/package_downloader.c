@@ -33,7 +33,13 @@
 #include "package_downloader.h"
 #include "handle_internal.h"
 #include "downloader.h"
+#include "downloader_internal.h"
 #include "fastestmirror_internal.h"
+#include "checksumcache_internal.h"
+#include "arena_internal.h"
+#include "downloadtarget_internal.h"
+
+#define CHECK_BATCH_SIZE    256  // Max number of files checksumed at once
 
 /* Do NOT use resume on successfully downloaded files - download will fail */
 
@@ -165,6 +171,323 @@ lr_packagetarget_free(LrPackageTarget *target)
     g_free(target);
 }
 
+/** Create a table of the checksum caches used by a single call.
+ * Every handle uses the cache given by its LRO_CHECKSUMCACHE, the caches
+ * are keyed by their paths. Targets without a handle and handles without
+ * LRO_CHECKSUMCACHE share a cache with no index file (only extended
+ * attributes are used then).
+ */
+static GHashTable *
+checksumcaches_new(void)
+{
+    return g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                 (GDestroyNotify) lr_checksumcache_free);
+}
+
+/** Return the checksum cache of the handle, load it if it is used
+ * for the first time.
+ */
+static LrChecksumCache *
+checksumcaches_get(GHashTable *caches, LrHandle *handle)
+{
+    const char *path = "";
+
+    if (handle && handle->checksumcache)
+        path = handle->checksumcache;
+
+    LrChecksumCache *cache = g_hash_table_lookup(caches, path);
+    if (!cache) {
+        cache = lr_checksumcache_load(*path ? path : NULL);
+        g_hash_table_insert(caches, g_strdup(path), cache);
+    }
+
+    return cache;
+}
+
+/** Write the checksum caches and free them.
+ * The caches are not essential, so an error is only logged.
+ */
+static void
+save_checksumcaches(GHashTable *caches)
+{
+    GHashTableIter iter;
+    gpointer value;
+
+    g_hash_table_iter_init(&iter, caches);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        GError *tmp_err = NULL;
+        if (!lr_checksumcache_write(value, &tmp_err)) {
+            g_debug("%s: Cannot write checksum cache: %s",
+                    __func__, tmp_err->message);
+            g_error_free(tmp_err);
+        }
+    }
+
+    g_hash_table_destroy(caches);
+}
+
+/** Check that the handle can be used by the package downloader.
+ * @param handle        Handle or NULL.
+ * @param interruptible Set to TRUE if the handle is interruptible.
+ * @param err           GError **
+ * @return              TRUE if everything is ok, FALSE if err is set.
+ */
+static gboolean
+check_handle(LrHandle *handle, gboolean *interruptible, GError **err)
+{
+    if (!handle)
+        return TRUE;
+
+    if (handle->interruptible)
+        *interruptible = TRUE;
+
+    // Check repotype
+    // Note: Checked because lr_handle_prepare_internal_mirrorlist
+    // support only LR_YUMREPO yet
+    if (handle->repotype != LR_YUMREPO) {
+        g_debug("%s: Bad repo type", __func__);
+        g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_BADFUNCARG,
+                    "Bad repo type");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/** Install own SIGINT handler if interruptible.
+ * @return              TRUE if everything is ok, FALSE if err is set.
+ */
+static gboolean
+setup_sigint_handler(gboolean interruptible,
+                     struct sigaction *old_sigact,
+                     GError **err)
+{
+    if (!interruptible)
+        return TRUE;
+
+    g_debug("%s: Using own SIGINT handler", __func__);
+    struct sigaction sigact;
+    sigact.sa_handler = lr_sigint_handler;
+    sigaddset(&sigact.sa_mask, SIGINT);
+    sigact.sa_flags = SA_RESTART;
+    if (sigaction(SIGINT, &sigact, old_sigact) == -1) {
+        g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_SIGACTION,
+                    "Cannot set Librepo SIGINT handler");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/** Restore the original SIGINT handler if interruptible.
+ * @return              FALSE if the download was interrupted (err
+ *                      is replaced then), TRUE otherwise.
+ */
+static gboolean
+restore_sigint_handler(gboolean interruptible,
+                       struct sigaction *old_sigact,
+                       GError **err)
+{
+    if (!interruptible)
+        return TRUE;
+
+    g_debug("%s: Restoring an old SIGINT handler", __func__);
+    sigaction(SIGINT, old_sigact, NULL);
+    if (lr_interrupt) {
+        if (err && *err != NULL)
+            g_clear_error(err);
+        g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_INTERRUPTED,
+                    "Insterupted by a SIGINT signal");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/** Prepare the package for downloading. Its local_path is set (to
+ * the packagetarget->chunk) and if the package is already downloaded,
+ * the end callback is called.
+ * @param packagetarget Package target.
+ * @param checksumcache Checksum cache.
+ * @param fmr_handles   List of handles for the fastest mirror resolving.
+ * @param downloaded    Set to TRUE if the package is already downloaded
+ *                      (its err is not set by this function).
+ * @param doresume      Set to TRUE if the download should be resumed.
+ * @param err           GError **
+ * @return              TRUE if everything is ok, FALSE if err is set.
+ */
+static gboolean
+prepare_packagetarget(LrPackageTarget *packagetarget,
+                      LrChecksumCache *checksumcache,
+                      GSList **fmr_handles,
+                      gboolean *downloaded,
+                      gboolean *doresume,
+                      GError **err)
+{
+    gboolean ret;
+    gchar *local_path;
+    gint64 realsize = -1;
+
+    *downloaded = FALSE;
+    *doresume = packagetarget->resume;
+
+    // Prepare destination filename
+    if (packagetarget->dest) {
+        if (g_file_test(packagetarget->dest, G_FILE_TEST_IS_DIR)) {
+            // Dir specified
+            gchar *file_basename = g_path_get_basename(packagetarget->relative_url);
+            local_path = g_build_filename(packagetarget->dest,
+                                          file_basename,
+                                          NULL);
+            g_free(file_basename);
+        } else {
+            local_path = g_strdup(packagetarget->dest);
+        }
+    } else {
+        // No destination path specified
+        local_path = g_path_get_basename(packagetarget->relative_url);
+    }
+
+    packagetarget->local_path = g_string_chunk_insert(packagetarget->chunk,
+                                                      local_path);
+    g_free(local_path);
+
+    // Check expected size and real size if the file exists
+    if (*doresume
+        && g_access(packagetarget->local_path, R_OK) == 0
+        && packagetarget->expectedsize > 0)
+    {
+        struct stat buf;
+        if (stat(packagetarget->local_path, &buf)) {
+            g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_IO,
+                    "Cannot stat %s: %s", packagetarget->local_path,
+                    strerror(errno));
+            return FALSE;
+        }
+
+        realsize = buf.st_size;
+
+        if (packagetarget->expectedsize < realsize)
+            // Existing file is bigger then the one that is expected,
+            // disable resuming
+            *doresume = FALSE;
+    }
+
+    if (g_access(packagetarget->local_path, R_OK) == 0
+        && packagetarget->checksum
+        && packagetarget->checksum_type != LR_CHECKSUM_UNKNOWN)
+    {
+        /* If the file exists and checksum is ok, then is pointless to
+         * download the file again.
+         * Moreover, if the resume is enabled and the file is already
+         * completely downloaded, then the download is going to fail.
+         */
+        int fd_r = open(packagetarget->local_path, O_RDONLY);
+        if (fd_r != -1) {
+            gboolean matches;
+            ret = lr_checksumcache_fd_cmp(checksumcache,
+                                          packagetarget->checksum_type,
+                                          fd_r,
+                                          packagetarget->checksum,
+                                          &matches,
+                                          NULL);
+            close(fd_r);
+            if (ret && matches) {
+                // Checksum calculation was ok and checksum matches
+                g_debug("%s: Package %s is already downloaded (checksum matches)",
+                        __func__, packagetarget->local_path);
+                *downloaded = TRUE;
+            } else if (ret) {
+                // Checksum calculation was ok but checksum doesn't match
+                if (realsize != -1 && realsize == packagetarget->expectedsize)
+                    // File size is the same as the expected one
+                    // Don't try to resume
+                    *doresume = FALSE;
+            }
+        }
+    }
+
+    if (!*downloaded
+        && *doresume
+        && realsize != -1
+        && realsize == packagetarget->expectedsize)
+    {
+        // File's size matches the expected one, the resume is enabled and
+        // no checksum is known => expect that the file is
+        // the one the user wants
+        g_debug("%s: Package %s is already downloaded (size matches)",
+                __func__, packagetarget->local_path);
+        *downloaded = TRUE;
+    }
+
+    if (*downloaded) {
+        // Call end callback
+        LrEndCb end_cb = packagetarget->endcb;
+        if (end_cb)
+            end_cb(packagetarget->cbdata,
+                   LR_TRANSFER_ALREDYEXISTS,
+                   "Already downloaded");
+        return TRUE;
+    }
+
+    if (packagetarget->handle) {
+        ret = lr_handle_prepare_internal_mirrorlist(packagetarget->handle,
+                                                    FALSE,
+                                                    err);
+        if (!ret)
+            return FALSE;
+
+        if (packagetarget->handle->fastestmirror) {
+            if (!g_slist_find(*fmr_handles, packagetarget->handle))
+                *fmr_handles = g_slist_prepend(*fmr_handles,
+                                               packagetarget->handle);
+        }
+    }
+
+    return TRUE;
+}
+
+/** Do the fastest mirror resolving and download the targets.
+ * @param downloadtargets   List of LrDownloadTargets.
+ * @param fmr_handles       List of handles for the fastest mirror
+ *                          resolving (freed by this function).
+ * @param failfast          Fail fast.
+ * @param err               GError **
+ * @return                  TRUE if everything is ok, FALSE if err is set.
+ */
+static gboolean
+download_targets(GSList *downloadtargets,
+                 GSList *fmr_handles,
+                 gboolean failfast,
+                 GError **err)
+{
+    gboolean ret;
+    LrFastestMirrorDetection *fmdetection = NULL;
+
+    // Do Fastest Mirror resolving for all handles in one shot
+    if (fmr_handles) {
+        fmr_handles = g_slist_reverse(fmr_handles);
+        if (((LrHandle *) fmr_handles->data)->fastestmirrorasync) {
+            // Mirrors are ranked while the downloads already run
+            fmdetection = lr_fastestmirror_detection_new(fmr_handles, err);
+            ret = fmdetection != NULL;
+        } else {
+            ret = lr_fastestmirror_sort_internalmirrorlists(fmr_handles, err);
+        }
+        g_slist_free(fmr_handles);
+
+        if (!ret)
+            return FALSE;
+    }
+
+    // Start downloading
+    ret = lr_download_with_fastestmirror(downloadtargets, failfast,
+                                         fmdetection, err);
+    lr_fastestmirror_detection_free(fmdetection);
+
+    return ret;
+}
+
 gboolean
 lr_download_packages(GSList *targets,
                      LrPackageDownloadFlag flags,
@@ -184,179 +507,42 @@ lr_download_packages(GSList *targets,
     // Check targets
     for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
         LrPackageTarget *packagetarget = elem->data;
-
-        if (!packagetarget->handle) {
-            continue;
-            /*
-            g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_BADFUNCARG,
-                        "Package target %s doesn't have specified a handle",
-                        packagetarget->relative_url);
+        if (!check_handle(packagetarget->handle, &interruptible, err))
             return FALSE;
-            */
-        }
-
-        if (packagetarget->handle->interruptible)
-            interruptible = TRUE;
-
-        // Check repotype
-        // Note: Checked because lr_handle_prepare_internal_mirrorlist
-        // support only LR_YUMREPO yet
-        if (packagetarget->handle->repotype != LR_YUMREPO) {
-            g_debug("%s: Bad repo type", __func__);
-            g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_BADFUNCARG,
-                        "Bad repo type");
-            return FALSE;
-        }
     }
 
     // Setup sighandler
-    if (interruptible) {
-        g_debug("%s: Using own SIGINT handler", __func__);
-        struct sigaction sigact;
-        sigact.sa_handler = lr_sigint_handler;
-        sigaddset(&sigact.sa_mask, SIGINT);
-        sigact.sa_flags = SA_RESTART;
-        if (sigaction(SIGINT, &sigact, &old_sigact) == -1) {
-            g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_SIGACTION,
-                        "Cannot set Librepo SIGINT handler");
-            return FALSE;
-        }
-    }
+    if (!setup_sigint_handler(interruptible, &old_sigact, err))
+        return FALSE;
 
     // List of handles for fastest mirror resolving
     GSList *fmr_handles = NULL;
 
+    GHashTable *checksumcaches = checksumcaches_new();
+
     // Prepare targets
     for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
-        gchar *local_path;
         LrPackageTarget *packagetarget = elem->data;
         LrDownloadTarget *downloadtarget;
-        gint64 realsize = -1;
-        gboolean doresume = packagetarget->resume;
-
-        // Prepare destination filename
-        if (packagetarget->dest) {
-            if (g_file_test(packagetarget->dest, G_FILE_TEST_IS_DIR)) {
-                // Dir specified
-                gchar *file_basename = g_path_get_basename(packagetarget->relative_url);
-                local_path = g_build_filename(packagetarget->dest,
-                                              file_basename,
-                                              NULL);
-                g_free(file_basename);
-            } else {
-                local_path = g_strdup(packagetarget->dest);
-            }
-        } else {
-            // No destination path specified
-            local_path = g_path_get_basename(packagetarget->relative_url);
-        }
+        gboolean downloaded, doresume;
+        LrChecksumCache *checksumcache;
 
-        packagetarget->local_path = g_string_chunk_insert(packagetarget->chunk,
-                                                          local_path);
-        g_free(local_path);
-
-        // Check expected size and real size if the file exists
-        if (doresume
-            && g_access(packagetarget->local_path, R_OK) == 0
-            && packagetarget->expectedsize > 0)
-        {
-            struct stat buf;
-            if (stat(packagetarget->local_path, &buf)) {
-                g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_IO,
-                        "Cannot stat %s: %s", packagetarget->local_path,
-                        strerror(errno));
-                return FALSE;
-            }
-
-            realsize = buf.st_size;
-
-            if (packagetarget->expectedsize < realsize)
-                // Existing file is bigger then the one that is expected,
-                // disable resuming
-                doresume = FALSE;
-        }
-
-        if (g_access(packagetarget->local_path, R_OK) == 0
-            && packagetarget->checksum
-            && packagetarget->checksum_type != LR_CHECKSUM_UNKNOWN)
-        {
-            /* If the file exists and checksum is ok, then is pointless to
-             * download the file again.
-             * Moreover, if the resume is enabled and the file is already
-             * completely downloaded, then the download is going to fail.
-             */
-            int fd_r = open(packagetarget->local_path, O_RDONLY);
-            if (fd_r != -1) {
-                gboolean matches;
-                ret = lr_checksum_fd_cmp(packagetarget->checksum_type,
-                                         fd_r,
-                                         packagetarget->checksum,
-                                         1,
-                                         &matches,
-                                         NULL);
-                close(fd_r);
-                if (ret && matches) {
-                    // Checksum calculation was ok and checksum matches
-                    g_debug("%s: Package %s is already downloaded (checksum matches)",
-                            __func__, packagetarget->local_path);
-
-                    packagetarget->err = g_string_chunk_insert(
-                                                packagetarget->chunk,
-                                                "Already downloaded");
-
-                    // Call end callback
-                    LrEndCb end_cb = packagetarget->endcb;
-                    if (end_cb)
-                        end_cb(packagetarget->cbdata,
-                               LR_TRANSFER_ALREDYEXISTS,
-                               "Already downloaded");
-
-                    continue;
-                } else if (ret) {
-                    // Checksum calculation was ok but checksum doesn't match
-                    if (realsize != -1 && realsize == packagetarget->expectedsize)
-                        // File size is the same as the expected one
-                        // Don't try to resume
-                        doresume = FALSE;
-                }
-            }
+        checksumcache = checksumcaches_get(checksumcaches,
+                                           packagetarget->handle);
+        ret = prepare_packagetarget(packagetarget, checksumcache, &fmr_handles,
+                                    &downloaded, &doresume, err);
+        if (!ret) {
+            g_hash_table_destroy(checksumcaches);
+            g_slist_free(fmr_handles);
+            goto cleanup;
         }
 
-        if (doresume && realsize != -1 && realsize == packagetarget->expectedsize) {
-            // File's size matches the expected one, the resume is enabled and
-            // no checksum is known => expect that the file is
-            // the one the user wants
-            g_debug("%s: Package %s is already downloaded (size matches)",
-                    __func__, packagetarget->local_path);
-
-            packagetarget->err = g_string_chunk_insert(
-                                        packagetarget->chunk,
-                                        "Already downloaded");
-
-            // Call end callback
-            LrEndCb end_cb = packagetarget->endcb;
-            if (end_cb)
-                end_cb(packagetarget->cbdata,
-                       LR_TRANSFER_ALREDYEXISTS,
-                       "Already downloaded");
-
+        if (downloaded) {
+            packagetarget->err = g_string_chunk_insert(packagetarget->chunk,
+                                                       "Already downloaded");
             continue;
         }
 
-        if (packagetarget->handle) {
-            ret = lr_handle_prepare_internal_mirrorlist(packagetarget->handle,
-                                                        FALSE,
-                                                        err);
-            if (!ret)
-                goto cleanup;
-
-            if (packagetarget->handle->fastestmirror) {
-                if (!g_slist_find(fmr_handles, packagetarget->handle))
-                    fmr_handles = g_slist_prepend(fmr_handles,
-                                                  packagetarget->handle);
-            }
-        }
-
         GSList *checksums = NULL;
         LrDownloadTargetChecksum *checksum;
         checksum = lr_downloadtargetchecksum_new(packagetarget->checksum_type,
@@ -379,22 +565,14 @@ lr_download_packages(GSList *targets,
                                                packagetarget->byterangestart,
                                                packagetarget->byterangeend);
 
-        downloadtargets = g_slist_append(downloadtargets, downloadtarget);
+        downloadtargets = g_slist_prepend(downloadtargets, downloadtarget);
     }
+    downloadtargets = g_slist_reverse(downloadtargets);
 
-    // Do Fastest Mirror resolving for all handles in one shot
-    if (fmr_handles) {
-        fmr_handles = g_slist_reverse(fmr_handles);
-        ret = lr_fastestmirror_sort_internalmirrorlists(fmr_handles, err);
-        g_slist_free(fmr_handles);
+    // Save checksums calculated for already existing files
+    save_checksumcaches(checksumcaches);
 
-        if (!ret) {
-            return FALSE;
-        }
-    }
-
-    // Start downloading
-    ret = lr_download(downloadtargets, failfast, err);
+    ret = download_targets(downloadtargets, fmr_handles, failfast, err);
 
 cleanup:
 
@@ -411,17 +589,510 @@ cleanup:
     g_slist_free_full(downloadtargets, (GDestroyNotify)lr_downloadtarget_free);
 
     // Restore original signal handler
-    if (interruptible) {
-        g_debug("%s: Restoring an old SIGINT handler", __func__);
-        sigaction(SIGINT, &old_sigact, NULL);
-        if (lr_interrupt) {
-            if (err && *err != NULL)
-                g_clear_error(err);
-            g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_INTERRUPTED,
-                        "Insterupted by a SIGINT signal");
+    if (!restore_sigint_handler(interruptible, &old_sigact, err))
+        return FALSE;
+
+    return ret;
+}
+
+/** State of lr_download_packages_stream() */
+typedef struct {
+    LrPackageNextTargetCb nextcb; /*!< User's callback */
+    LrPackageDoneTargetCb donecb; /*!< User's callback */
+    void *cbdata; /*!< User's data for the callbacks */
+    GHashTable *checksumcaches; /*!< Checksum caches of the handles */
+    GSList *handles; /*!< Already checked handles */
+    GSList *fmr_handles; /*!< Handles with already sorted mirrors */
+    gboolean interruptible; /*!< Own SIGINT handler is installed */
+    struct sigaction old_sigact; /*!< Original SIGINT handler */
+    GError *err; /*!< Error which stopped pulling of the packages */
+} LrPackageStream;
+
+/** Prepare a package pulled by lr_download_packages_stream().
+ * Handles are checked when they are seen for the first time and
+ * their mirrors are sorted before their first download (the fastest
+ * mirror detection is never done asynchronously here).
+ * @return              TRUE if everything is ok, FALSE if err is set.
+ */
+static gboolean
+packagestream_prepare(LrPackageStream *stream,
+                      LrPackageTarget *packagetarget,
+                      gboolean *downloaded,
+                      gboolean *doresume,
+                      GError **err)
+{
+    LrHandle *handle = packagetarget->handle;
+
+    if (!g_slist_find(stream->handles, handle)) {
+        gboolean interruptible = FALSE;
+
+        if (!check_handle(handle, &interruptible, err))
+            return FALSE;
+        stream->handles = g_slist_prepend(stream->handles, handle);
+
+        if (interruptible && !stream->interruptible) {
+            if (!setup_sigint_handler(TRUE, &stream->old_sigact, err))
+                return FALSE;
+            stream->interruptible = TRUE;
+        }
+    }
+
+    LrChecksumCache *checksumcache = checksumcaches_get(stream->checksumcaches,
+                                                        handle);
+
+    GSList *fmr_handles = stream->fmr_handles;
+    if (!prepare_packagetarget(packagetarget, checksumcache,
+                               &stream->fmr_handles, downloaded, doresume,
+                               err))
+        return FALSE;
+
+    if (stream->fmr_handles != fmr_handles) {
+        // A new handle for the fastest mirror resolving
+        GSList *new_handle = g_slist_prepend(NULL, stream->fmr_handles->data);
+        gboolean ret = lr_fastestmirror_sort_internalmirrorlists(new_handle,
+                                                                 err);
+        g_slist_free(new_handle);
+        if (!ret)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/** LrDownloadNextTargetCb of lr_download_packages_stream() */
+static LrDownloadTarget *
+packagestream_next(void *data)
+{
+    LrPackageStream *stream = data;
+    LrPackageTarget *packagetarget;
+
+    while (!stream->err && (packagetarget = stream->nextcb(stream->cbdata))) {
+        gboolean downloaded, doresume;
+
+        if (!packagestream_prepare(stream, packagetarget, &downloaded,
+                                   &doresume, &stream->err)) {
+            // Stop pulling, the error is reported at the end
+            packagetarget->err = g_string_chunk_insert(packagetarget->chunk,
+                                                       stream->err->message);
+            stream->donecb(stream->cbdata, packagetarget);
+            return NULL;
+        }
+
+        if (downloaded) {
+            packagetarget->err = g_string_chunk_insert(packagetarget->chunk,
+                                                       "Already downloaded");
+            stream->donecb(stream->cbdata, packagetarget);
+            continue;
+        }
+
+        GSList *checksums = NULL;
+        LrDownloadTargetChecksum *checksum;
+        checksum = lr_downloadtargetchecksum_new(packagetarget->checksum_type,
+                                                 packagetarget->checksum);
+        checksums = g_slist_prepend(checksums, checksum);
+
+        return lr_downloadtarget_new(packagetarget->handle,
+                                     packagetarget->relative_url,
+                                     packagetarget->base_url,
+                                     -1,
+                                     packagetarget->local_path,
+                                     checksums,
+                                     packagetarget->expectedsize,
+                                     doresume,
+                                     packagetarget->progresscb,
+                                     packagetarget->cbdata,
+                                     packagetarget->endcb,
+                                     packagetarget->mirrorfailurecb,
+                                     packagetarget,
+                                     packagetarget->byterangestart,
+                                     packagetarget->byterangeend);
+    }
+
+    return NULL;
+}
+
+/** LrDownloadDoneTargetCb of lr_download_packages_stream() */
+static void
+packagestream_done(void *data, LrDownloadTarget *downloadtarget)
+{
+    LrPackageStream *stream = data;
+    LrPackageTarget *packagetarget = downloadtarget->userdata;
+
+    if (downloadtarget->err)
+        packagetarget->err = g_string_chunk_insert(packagetarget->chunk,
+                                                   downloadtarget->err);
+    lr_downloadtarget_free(downloadtarget);
+
+    stream->donecb(stream->cbdata, packagetarget);
+}
+
+gboolean
+lr_download_packages_stream(LrPackageNextTargetCb nextcb,
+                            LrPackageDoneTargetCb donecb,
+                            void *cbdata,
+                            LrPackageDownloadFlag flags,
+                            GError **err)
+{
+    gboolean ret;
+    gboolean failfast = flags & LR_PACKAGEDOWNLOAD_FAILFAST;
+    LrPackageStream stream;
+
+    assert(nextcb);
+    assert(donecb);
+    assert(!err || *err == NULL);
+
+    memset(&stream, 0, sizeof(stream));
+    stream.nextcb = nextcb;
+    stream.donecb = donecb;
+    stream.cbdata = cbdata;
+    stream.checksumcaches = checksumcaches_new();
+
+    ret = lr_download_stream(packagestream_next, packagestream_done, &stream,
+                             failfast, err);
+
+    if (stream.err) {
+        if (ret)
+            g_propagate_error(err, stream.err);
+        else
+            g_error_free(stream.err);
+        ret = FALSE;
+    }
+
+    // Save checksums calculated for already existing files
+    save_checksumcaches(stream.checksumcaches);
+
+    g_slist_free(stream.handles);
+    g_slist_free(stream.fmr_handles);
+
+    // Restore original signal handler
+    if (!restore_sigint_handler(stream.interruptible, &stream.old_sigact, err))
+        return FALSE;
+
+    return ret;
+}
+
+struct _LrPackageBatch {
+    GStringChunk *chunk;        /*!< All strings of the batch. The dests,
+                                     base urls and errors are interned. */
+    GPtrArray *handles;         /*!< Handles used by the packages */
+    LrProgressCb progresscb;    /*!< Progress callback */
+    LrEndCb endcb;              /*!< End callback */
+    LrMirrorFailureCb mirrorfailurecb; /*!< Mirror failure callback */
+
+    // Columns, one element per package
+    GArray *handle;             /*!< guint16 - Index to handles */
+    GArray *relative_url;       /*!< char * */
+    GArray *dest;               /*!< char * - Interned */
+    GArray *base_url;           /*!< char * - Interned */
+    GArray *checksum_type;      /*!< guint8 - LrChecksumType */
+    GArray *checksum;           /*!< char * */
+    GArray *expectedsize;       /*!< gint64 */
+    GArray *resume;             /*!< guint8 - gboolean */
+    GArray *cbdata;             /*!< void * */
+    GArray *local_path;         /*!< char * - Filled by download */
+    GArray *err;                /*!< char * - Interned, filled by download */
+};
+
+#define PACKAGEBATCH_CHUNK_SIZE     (64 * 1024)
+#define PACKAGEBATCH_MAX_HANDLES    G_MAXUINT16
+
+static GArray *
+packagebatch_column_new(guint element_size, guint reserved_size)
+{
+    return g_array_sized_new(FALSE, TRUE, element_size, reserved_size);
+}
+
+LrPackageBatch *
+lr_packagebatch_new(guint reserved_size)
+{
+    LrPackageBatch *batch = lr_malloc0(sizeof(*batch));
+
+    batch->chunk         = g_string_chunk_new(PACKAGEBATCH_CHUNK_SIZE);
+    batch->handles       = g_ptr_array_new();
+    batch->handle        = packagebatch_column_new(sizeof(guint16), reserved_size);
+    batch->relative_url  = packagebatch_column_new(sizeof(char *), reserved_size);
+    batch->dest          = packagebatch_column_new(sizeof(char *), reserved_size);
+    batch->base_url      = packagebatch_column_new(sizeof(char *), reserved_size);
+    batch->checksum_type = packagebatch_column_new(sizeof(guint8), reserved_size);
+    batch->checksum      = packagebatch_column_new(sizeof(char *), reserved_size);
+    batch->expectedsize  = packagebatch_column_new(sizeof(gint64), reserved_size);
+    batch->resume        = packagebatch_column_new(sizeof(guint8), reserved_size);
+    batch->cbdata        = packagebatch_column_new(sizeof(void *), reserved_size);
+    batch->local_path    = packagebatch_column_new(sizeof(char *), reserved_size);
+    batch->err           = packagebatch_column_new(sizeof(char *), reserved_size);
+
+    return batch;
+}
+
+void
+lr_packagebatch_set_callbacks(LrPackageBatch *batch,
+                              LrProgressCb progresscb,
+                              LrEndCb endcb,
+                              LrMirrorFailureCb mirrorfailurecb)
+{
+    assert(batch);
+
+    batch->progresscb = progresscb;
+    batch->endcb = endcb;
+    batch->mirrorfailurecb = mirrorfailurecb;
+}
+
+static char *
+packagebatch_intern(LrPackageBatch *batch, const char *str)
+{
+    return str ? g_string_chunk_insert_const(batch->chunk, str) : NULL;
+}
+
+gboolean
+lr_packagebatch_add(LrPackageBatch *batch,
+                    LrHandle *handle,
+                    const char *relative_url,
+                    const char *dest,
+                    LrChecksumType checksum_type,
+                    const char *checksum,
+                    gint64 expectedsize,
+                    const char *base_url,
+                    gboolean resume,
+                    void *cbdata,
+                    GError **err)
+{
+    guint handle_index;
+    char *str;
+    guint8 byte;
+
+    assert(batch);
+    assert(relative_url);
+    assert(!err || *err == NULL);
+
+    // Intern the handle (the last added one is the most likely)
+    for (handle_index = batch->handles->len; handle_index > 0; handle_index--)
+        if (g_ptr_array_index(batch->handles, handle_index - 1) == handle)
+            break;
+
+    if (handle_index > 0) {
+        handle_index--;
+    } else {
+        if (batch->handles->len >= PACKAGEBATCH_MAX_HANDLES) {
+            g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_BADFUNCARG,
+                        "Too many handles in the batch (max %d)",
+                        PACKAGEBATCH_MAX_HANDLES);
+            return FALSE;
+        }
+        handle_index = batch->handles->len;
+        g_ptr_array_add(batch->handles, handle);
+    }
+
+    guint16 handle_index16 = (guint16) handle_index;
+    g_array_append_val(batch->handle, handle_index16);
+    str = g_string_chunk_insert(batch->chunk, relative_url);
+    g_array_append_val(batch->relative_url, str);
+    str = packagebatch_intern(batch, dest);
+    g_array_append_val(batch->dest, str);
+    str = packagebatch_intern(batch, base_url);
+    g_array_append_val(batch->base_url, str);
+    byte = (guint8) checksum_type;
+    g_array_append_val(batch->checksum_type, byte);
+    str = lr_string_chunk_insert(batch->chunk, checksum);
+    g_array_append_val(batch->checksum, str);
+    g_array_append_val(batch->expectedsize, expectedsize);
+    byte = resume ? 1 : 0;
+    g_array_append_val(batch->resume, byte);
+    g_array_append_val(batch->cbdata, cbdata);
+    g_array_set_size(batch->local_path, batch->relative_url->len);
+    g_array_set_size(batch->err, batch->relative_url->len);
+
+    return TRUE;
+}
+
+guint
+lr_packagebatch_length(LrPackageBatch *batch)
+{
+    assert(batch);
+    return batch->relative_url->len;
+}
+
+const char *
+lr_packagebatch_local_path(LrPackageBatch *batch, guint index)
+{
+    assert(batch);
+    assert(index < batch->local_path->len);
+    return g_array_index(batch->local_path, char *, index);
+}
+
+const char *
+lr_packagebatch_error(LrPackageBatch *batch, guint index)
+{
+    assert(batch);
+    assert(index < batch->err->len);
+    return g_array_index(batch->err, char *, index);
+}
+
+void
+lr_packagebatch_free(LrPackageBatch *batch)
+{
+    if (!batch)
+        return;
+
+    g_array_free(batch->handle, TRUE);
+    g_array_free(batch->relative_url, TRUE);
+    g_array_free(batch->dest, TRUE);
+    g_array_free(batch->base_url, TRUE);
+    g_array_free(batch->checksum_type, TRUE);
+    g_array_free(batch->checksum, TRUE);
+    g_array_free(batch->expectedsize, TRUE);
+    g_array_free(batch->resume, TRUE);
+    g_array_free(batch->cbdata, TRUE);
+    g_array_free(batch->local_path, TRUE);
+    g_array_free(batch->err, TRUE);
+    g_ptr_array_free(batch->handles, TRUE);
+    g_string_chunk_free(batch->chunk);
+    lr_free(batch);
+}
+
+/** Fill the LrPackageTarget with the attributes of a package of the batch.
+ * The strings are not copied and the chunk of the batch is used.
+ */
+static void
+packagebatch_get_target(LrPackageBatch *batch,
+                        guint index,
+                        LrPackageTarget *target)
+{
+    guint16 handle_index = g_array_index(batch->handle, guint16, index);
+
+    memset(target, 0, sizeof(*target));
+    target->handle = g_ptr_array_index(batch->handles, handle_index);
+    target->relative_url = g_array_index(batch->relative_url, char *, index);
+    target->dest = g_array_index(batch->dest, char *, index);
+    target->base_url = g_array_index(batch->base_url, char *, index);
+    target->checksum_type = g_array_index(batch->checksum_type, guint8, index);
+    target->checksum = g_array_index(batch->checksum, char *, index);
+    target->expectedsize = g_array_index(batch->expectedsize, gint64, index);
+    target->resume = g_array_index(batch->resume, guint8, index);
+    target->progresscb = batch->progresscb;
+    target->cbdata = g_array_index(batch->cbdata, void *, index);
+    target->endcb = batch->endcb;
+    target->mirrorfailurecb = batch->mirrorfailurecb;
+    target->chunk = batch->chunk;
+}
+
+gboolean
+lr_download_packagebatch(LrPackageBatch *batch,
+                         LrPackageDownloadFlag flags,
+                         GError **err)
+{
+    gboolean ret;
+    gboolean failfast = flags & LR_PACKAGEDOWNLOAD_FAILFAST;
+    struct sigaction old_sigact;
+    GSList *downloadtargets = NULL;
+    gboolean interruptible = FALSE;
+
+    assert(batch);
+    assert(!err || *err == NULL);
+
+    if (lr_packagebatch_length(batch) == 0)
+        return TRUE;
+
+    // Check handles
+    for (guint x = 0; x < batch->handles->len; x++) {
+        LrHandle *handle = g_ptr_array_index(batch->handles, x);
+        if (!check_handle(handle, &interruptible, err))
             return FALSE;
+    }
+
+    // Setup sighandler
+    if (!setup_sigint_handler(interruptible, &old_sigact, err))
+        return FALSE;
+
+    // List of handles for fastest mirror resolving
+    GSList *fmr_handles = NULL;
+
+    GHashTable *checksumcaches = checksumcaches_new();
+
+    // The download targets, their checksums and the strings set during
+    // the download live only until the end of this function
+    LrArena *arena = lr_arena_new(0);
+    GStringChunk *chunk = g_string_chunk_new(PACKAGEBATCH_CHUNK_SIZE);
+
+    // Prepare targets
+    for (guint x = 0; x < lr_packagebatch_length(batch); x++) {
+        LrPackageTarget packagetarget;
+        gboolean downloaded, doresume;
+
+        packagebatch_get_target(batch, x, &packagetarget);
+        g_array_index(batch->err, char *, x) = NULL;
+
+        LrChecksumCache *checksumcache = checksumcaches_get(
+                                                checksumcaches,
+                                                packagetarget.handle);
+        ret = prepare_packagetarget(&packagetarget, checksumcache,
+                                    &fmr_handles, &downloaded, &doresume, err);
+        g_array_index(batch->local_path, char *, x) = packagetarget.local_path;
+        if (!ret) {
+            g_hash_table_destroy(checksumcaches);
+            g_slist_free(fmr_handles);
+            goto cleanup;
+        }
+
+        if (downloaded) {
+            g_array_index(batch->err, char *, x) =
+                    packagebatch_intern(batch, "Already downloaded");
+            continue;
         }
+
+        LrDownloadTargetChecksum *checksum;
+        checksum = lr_arena_alloc0(arena, sizeof(*checksum));
+        checksum->type = packagetarget.checksum_type;
+        checksum->value = packagetarget.checksum;
+
+        LrDownloadTarget *downloadtarget;
+        downloadtarget = lr_arena_alloc0(arena, sizeof(*downloadtarget));
+        lr_downloadtarget_init(downloadtarget,
+                               chunk,
+                               packagetarget.handle,
+                               packagetarget.relative_url,
+                               packagetarget.base_url,
+                               -1,
+                               packagetarget.local_path,
+                               lr_arena_slist_prepend(arena, NULL, checksum),
+                               packagetarget.expectedsize,
+                               doresume,
+                               packagetarget.progresscb,
+                               packagetarget.cbdata,
+                               packagetarget.endcb,
+                               packagetarget.mirrorfailurecb,
+                               GUINT_TO_POINTER(x),
+                               0,
+                               0);
+
+        downloadtargets = lr_arena_slist_prepend(arena,
+                                                 downloadtargets,
+                                                 downloadtarget);
     }
+    downloadtargets = g_slist_reverse(downloadtargets);
+
+    // Save checksums calculated for already existing files
+    save_checksumcaches(checksumcaches);
+
+    ret = download_targets(downloadtargets, fmr_handles, failfast, err);
+
+cleanup:
+
+    // Copy download statuses from downloadtargets to the batch
+    for (GSList *elem = downloadtargets; elem; elem = g_slist_next(elem)) {
+        LrDownloadTarget *downloadtarget = elem->data;
+        guint x = GPOINTER_TO_UINT(downloadtarget->userdata);
+        if (downloadtarget->err)
+            g_array_index(batch->err, char *, x) =
+                    packagebatch_intern(batch, downloadtarget->err);
+    }
+
+    // Free the download targets
+    g_string_chunk_free(chunk);
+    lr_arena_free(arena);
+
+    // Restore original signal handler
+    if (!restore_sigint_handler(interruptible, &old_sigact, err))
+        return FALSE;
 
     return ret;
 }
@@ -514,44 +1185,97 @@ lr_check_packages(GSList *targets,
         }
     }
 
-    for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
-        gchar *local_path;
-        LrPackageTarget *packagetarget = elem->data;
+    GHashTable *checksumcaches = checksumcaches_new();
+
+    // Worker threads are shared by all chunks
+    LrChecksumPool *pool = lr_checksum_pool_new();
+
+    // Files are checked in chunks - checksums of all files of a chunk
+    // are calculated at once and the number of simultaneously opened
+    // files stays reasonable
+    LrChecksumBatchItem items[CHECK_BATCH_SIZE];
+    LrPackageTarget *item_targets[CHECK_BATCH_SIZE];
+    GSList *elem = targets;
+
+    while (elem && ret) {
+        size_t nitems = 0;
+        GSList *chunk = elem;
+
+        // All files of a chunk use the same checksum cache
+        LrChecksumCache *checksumcache = checksumcaches_get(
+                                checksumcaches,
+                                ((LrPackageTarget *) elem->data)->handle);
+
+        // Open files of the chunk
+        for (; elem && nitems < CHECK_BATCH_SIZE; elem = g_slist_next(elem)) {
+            gchar *local_path;
+            LrPackageTarget *packagetarget = elem->data;
 
-        // Prepare destination filename
-        if (packagetarget->dest) {
-            if (g_file_test(packagetarget->dest, G_FILE_TEST_IS_DIR)) {
-                // Dir specified
-                gchar *file_basename = g_path_get_basename(packagetarget->relative_url);
-                local_path = g_build_filename(packagetarget->dest,
-                                              file_basename,
-                                              NULL);
-                g_free(file_basename);
+            if (checksumcaches_get(checksumcaches, packagetarget->handle)
+                    != checksumcache)
+                break;
+
+            // Prepare destination filename
+            if (packagetarget->dest) {
+                if (g_file_test(packagetarget->dest, G_FILE_TEST_IS_DIR)) {
+                    // Dir specified
+                    gchar *file_basename = g_path_get_basename(packagetarget->relative_url);
+                    local_path = g_build_filename(packagetarget->dest,
+                                                  file_basename,
+                                                  NULL);
+                    g_free(file_basename);
+                } else {
+                    local_path = g_strdup(packagetarget->dest);
+                }
             } else {
-                local_path = g_strdup(packagetarget->dest);
+                // No destination path specified
+                local_path = g_path_get_basename(packagetarget->relative_url);
             }
-        } else {
-            // No destination path specified
-            local_path = g_path_get_basename(packagetarget->relative_url);
+
+            packagetarget->local_path = g_string_chunk_insert(packagetarget->chunk,
+                                                              local_path);
+            g_free(local_path);
+
+            int fd_r = -1;
+            if (g_access(packagetarget->local_path, R_OK) == 0)
+                fd_r = open(packagetarget->local_path, O_RDONLY);
+            if (fd_r == -1) {
+                if (failfast) {
+                    // The check fails on this file anyway, don't
+                    // calculate checksums of the files behind it
+                    elem = g_slist_next(elem);
+                    break;
+                }
+                continue;
+            }
+
+            memset(&items[nitems], 0, sizeof(items[nitems]));
+            items[nitems].fd = fd_r;
+            items[nitems].type = packagetarget->checksum_type;
+            items[nitems].expected = packagetarget->checksum;
+            item_targets[nitems] = packagetarget;
+            nitems++;
         }
 
-        packagetarget->local_path = g_string_chunk_insert(packagetarget->chunk,
-                                                          local_path);
+        // Errors are evaluated per item below
+        lr_checksumcache_pool_fd(checksumcache, pool, items, nitems,
+                                 failfast, NULL);
+
+        // Evaluate results in the order of targets
+        size_t x = 0;
+        for (GSList *e = chunk; e != elem; e = g_slist_next(e)) {
+            LrPackageTarget *packagetarget = e->data;
 
-        if (g_access(packagetarget->local_path, R_OK) == 0) {
-            // If the file exists check its checksum
-            int fd_r = open(packagetarget->local_path, O_RDONLY);
-            if (fd_r != -1) {
+            if (x < nitems && item_targets[x] == packagetarget) {
                 // File was successfully opened
-                gboolean matches;
-                ret = lr_checksum_fd_cmp(packagetarget->checksum_type,
-                                         fd_r,
-                                         packagetarget->checksum,
-                                         1,
-                                         &matches,
-                                         NULL);
-                close(fd_r);
-                if (ret && matches) {
+                LrChecksumBatchItem *item = &items[x++];
+                if (!ret) {
+                    // Failfast error already occured, skip the rest
+                } else if (g_error_matches(item->err, LR_CHECKSUM_ERROR,
+                                           LRE_INTERRUPTED)) {
+                    // Skipped by the pool because of a failure of another
+                    // file of the chunk, which is evaluated later
+                } else if (!item->err && item->matches) {
                     // Checksum is ok
                     packagetarget->err = NULL;
                     g_debug("%s: Package %s is already downloaded (checksum matches)",
@@ -566,10 +1290,12 @@ lr_check_packages(GSList *targets,
                         g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR,
                                     LRE_BADCHECKSUM,
                                     "File with nonmatching checksum found");
-                        break;
                     }
                 }
-            } else {
+                close(item->fd);
+            } else if (!ret) {
+                // Failfast error already occured, skip the rest
+            } else if (g_access(packagetarget->local_path, R_OK) == 0) {
                 // Cannot open the file
                 packagetarget->err = g_string_chunk_insert(packagetarget->chunk,
                                        "Cannot be opened");
@@ -577,22 +1303,25 @@ lr_check_packages(GSList *targets,
                     ret = FALSE;
                     g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_IO,
                                 "Cannot open %s", packagetarget->local_path);
-                    break;
                 }
-            }
-        } else {
-            // File doesn't exists
-            packagetarget->err = g_string_chunk_insert(packagetarget->chunk,
-                                       "Doesn't exist");
-            if (failfast) {
-                ret = FALSE;
-                g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_IO,
-                            "File %s doesn't exists", packagetarget->local_path);
-                break;
+            } else {
+                // File doesn't exists
+                packagetarget->err = g_string_chunk_insert(packagetarget->chunk,
+                                           "Doesn't exist");
+                if (failfast) {
+                    ret = FALSE;
+                    g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_IO,
+                                "File %s doesn't exists", packagetarget->local_path);
+                }
             }
         }
+
+        lr_checksum_batch_clear(items, nitems);
     }
 
+    lr_checksum_pool_free(pool);
+    save_checksumcaches(checksumcaches);
+
     // Restore original signal handler
     if (interruptible) {
         g_debug("%s: Restoring an old SIGINT handler", __func__);
@@ -262,6 +262,9 @@ typedef enum {
 } LrPackageDownloadFlag;
 
 /** Download all LrPackageTargets at the targets GSList.
+ * A package requested by several targets (the same checksum, or the same
+ * URL if no checksum is specified) is downloaded only once and copied
+ * to the other destinations, see lr_download().
  * @param targets           GSList where each element is a ::LrPackageTarget
  *                          object
  * @param flags             Bitfield with flags to download
@@ -273,6 +276,147 @@ lr_download_packages(GSList *targets,
                      LrPackageDownloadFlag flags,
                      GError **err);
 
+/** Callback which provides the next package to download.
+ * @param cbdata            User data passed to
+ *                          lr_download_packages_stream().
+ * @return                  Next ::LrPackageTarget or NULL if there are
+ *                          no more packages.
+ */
+typedef LrPackageTarget *(*LrPackageNextTargetCb)(void *cbdata);
+
+/** Callback which takes over a package that is done (downloaded,
+ * failed or already downloaded before). Librepo doesn't use the
+ * target after this call, so the callback may check its err
+ * and free it.
+ * @param cbdata            User data passed to
+ *                          lr_download_packages_stream().
+ * @param target            The package target.
+ */
+typedef void (*LrPackageDoneTargetCb)(void *cbdata, LrPackageTarget *target);
+
+/** Same as lr_download_packages() but the packages are pulled one by one
+ * from the nextcb whenever a transfer slot frees up, and every pulled
+ * package is passed to the donecb when it is done. Only a few packages
+ * per LRO_MAXPARALLELDOWNLOADS are in progress at once, so the memory
+ * used doesn't depend on the total number of packages.
+ * Mirrors of the handles with LRO_FASTESTMIRROR are sorted before
+ * the first download from the handle (LRO_FASTESTMIRRORASYNC is not
+ * used).
+ * @param nextcb            Callback that provides the next package.
+ * @param donecb            Callback that takes over the packages
+ *                          that are done.
+ * @param cbdata            User data for the callbacks.
+ * @param flags             Bitfield with flags to download
+ * @param err               GError **
+ * @return                  If FALSE then err is set.
+ */
+gboolean
+lr_download_packages_stream(LrPackageNextTargetCb nextcb,
+                            LrPackageDoneTargetCb donecb,
+                            void *cbdata,
+                            LrPackageDownloadFlag flags,
+                            GError **err);
+
+/** Batch of packages to download.
+ *
+ * A compact alternative to a GSList of ::LrPackageTarget objects meant
+ * for very large batches (e.g. a whole repository). The batch doesn't
+ * keep an object per package. The attributes of the packages are
+ * stored column by column and the handles, destinations and base URLs
+ * are stored only once and shared by all packages that use them.
+ * The callbacks are common to all packages of the batch; only
+ * their cbdata differ.
+ * Packages are referred to by their index (the order of addition).
+ */
+typedef struct _LrPackageBatch LrPackageBatch;
+
+/** Create a new empty batch.
+ * @param reserved_size     Expected number of packages (used to allocate
+ *                          the columns at once) or 0.
+ * @return                  New batch.
+ */
+LrPackageBatch *
+lr_packagebatch_new(guint reserved_size);
+
+/** Set callbacks of the packages in the batch.
+ * @param batch             Batch.
+ * @param progresscb        Progress callback or NULL.
+ * @param endcb             Callback called when transfer of a package
+ *                          is done or NULL.
+ * @param mirrorfailurecb   Called when download from a mirror failed
+ *                          or NULL.
+ */
+void
+lr_packagebatch_set_callbacks(LrPackageBatch *batch,
+                              LrProgressCb progresscb,
+                              LrEndCb endcb,
+                              LrMirrorFailureCb mirrorfailurecb);
+
+/** Add a package to the batch.
+ * For params see lr_packagetarget_new().
+ * @param batch             Batch.
+ * @param err               GError **
+ * @return                  TRUE if everything is ok, FALSE if err is set.
+ */
+gboolean
+lr_packagebatch_add(LrPackageBatch *batch,
+                    LrHandle *handle,
+                    const char *relative_url,
+                    const char *dest,
+                    LrChecksumType checksum_type,
+                    const char *checksum,
+                    gint64 expectedsize,
+                    const char *base_url,
+                    gboolean resume,
+                    void *cbdata,
+                    GError **err);
+
+/** Number of packages in the batch.
+ * @param batch             Batch.
+ * @return                  Number of packages.
+ */
+guint
+lr_packagebatch_length(LrPackageBatch *batch);
+
+/** Local path of the package.
+ * @param batch             Batch.
+ * @param index             Index of the package.
+ * @return                  Local path or NULL if the batch wasn't
+ *                          downloaded yet. Filled by
+ *                          lr_download_packagebatch().
+ */
+const char *
+lr_packagebatch_local_path(LrPackageBatch *batch, guint index);
+
+/** Error of the package.
+ * @param batch             Batch.
+ * @param index             Index of the package.
+ * @return                  Error message or NULL (no error). Filled by
+ *                          lr_download_packagebatch().
+ */
+const char *
+lr_packagebatch_error(LrPackageBatch *batch, guint index);
+
+/** Free the batch.
+ * @param batch             Batch or NULL.
+ */
+void
+lr_packagebatch_free(LrPackageBatch *batch);
+
+/** Download all packages of the batch.
+ * Same as lr_download_packages() but for a ::LrPackageBatch.
+ * Results are available via lr_packagebatch_local_path()
+ * and lr_packagebatch_error().
+ * @param batch             Batch.
+ * @param flags             Bitfield with flags to download
+ * @param err               GError **
+ * @return                  If FALSE then err is set.
+ */
+gboolean
+lr_download_packagebatch(LrPackageBatch *batch,
+                         LrPackageDownloadFlag flags,
+                         GError **err);
+
 typedef enum {
     LR_PACKAGECHECK_FAILFAST    = 1 << 0, /*!<
         If TRUE, then whole check is stoped immediately when any
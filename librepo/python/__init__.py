@@ -227,6 +227,119 @@ Constants
     the transfer should be below during LRO_LOWSPEEDTIME seconds for
     the library to consider it too slow and abort. Default: 1000 (byte/s)
 
+.. data:: LRO_CHECKSUMCACHE
+
+    *String or None*. Path to the checksum cache index file. Checksums
+    of already downloaded packages are cached in extended file attributes,
+    this file is used as a fallback on file systems without their support.
+    If it doesn't exist, it will be created.
+
+.. data:: LRO_DECOMPRESS
+
+    *Boolean*. If True, gzip, bzip2 and xz compressed metadata files are
+    decompressed during the download. The decompressed files are stored
+    next to the compressed ones (without the suffix) and their checksums
+    are verified against the open checksums from repomd.xml.
+
+.. data:: LRO_FASTESTMIRRORMAXPARALLEL
+
+    *Integer or None*. Maximum number of mirrors probed in parallel
+    during the fastest mirror detection. None sets the default value.
+
+.. data:: LRO_FASTESTMIRRORTOPK
+
+    *Integer or None*. Stop the fastest mirror detection as soon as
+    the K fastest mirrors are known. Mirrors which were not measured
+    are placed behind the measured ones. 0 (default) means probe all
+    mirrors. None sets the default value.
+
+.. data:: LRO_FASTESTMIRRORPROBEPATH
+
+    *String or None*. Path (relative to the mirror URL) of a file
+    which is partially downloaded from the fastest mirrors (by connect
+    time) during the fastest mirror detection,
+    e.g. "repodata/repomd.xml". Time to first byte and throughput
+    of the transfers are then used to rank the mirrors.
+    None (default) disables this phase.
+
+.. data:: LRO_FASTESTMIRRORASYNC
+
+    *Boolean*. If enabled, :func:`~librepo.download_packages` doesn't wait
+    for the fastest mirror detection, the downloads start immediately
+    and the mirrors are re-ranked as the probes finish.
+
+.. data:: LRO_MIRRORRANKING
+
+    *Integer or None*. Rank the mirrors by their metalink location
+    (:data:`.LRO_MIRRORLOCATIONS`), their metalink preference and
+    their costs. Nothing is probed. See :ref:`mirrorranking-constants-label`.
+    None sets the default value (no ranking).
+
+.. data:: LRO_MIRRORLOCATIONS
+
+    *List of strings*. ISO 3166-1 alpha-2 country codes of the client
+    and its region (in the order of preference) used by
+    :data:`.LRO_MIRRORRANKING`. E.g. ``["CZ", "SK", "DE"]``.
+
+.. data:: LRO_MIRRORSTATS
+
+    *String or None*. Path to the file with statistics of the mirrors
+    (throughput, time to first byte and failure rate of the real
+    downloads). The file is updated by every download done with
+    the handle and it can be shared by concurrently running processes.
+    Used by :data:`.MIRRORRANKING_STATS`. None (default) disables it.
+
+.. data:: LRO_MIRRORRESUME
+
+    *Boolean*. If enabled, the data received by a transfer which failed
+    in the middle (e.g. connection reset, :data:`.LRO_LOWSPEEDLIMIT` or
+    a truncated file on a local or FTP mirror) are kept and the next
+    mirror continues from there instead of downloading the whole file
+    again. Used only for targets with a known checksum and expected size.
+    If the checksum of the resumed file doesn't match, the file is
+    downloaded again from scratch. Disabled by default.
+
+.. data:: LRO_ADAPTIVETIMEOUTS
+
+    *Boolean*. If enabled, the connect timeout of each transfer is derived
+    from the connect times observed for its mirror (never longer than
+    :data:`.LRO_CONNECTTIMEOUT`) and the transfers which are much slower
+    than the other transfers of the download are aborted, so they can
+    continue from another mirror (see :data:`.LRO_MIRRORRESUME`).
+    Unlike :data:`.LRO_LOWSPEEDLIMIT`, the slowness is relative to
+    the observed rates. Disabled by default.
+
+.. data:: LRO_AUTOTUNE
+
+    *Boolean*. If enabled, the number of parallel downloads is tuned while
+    downloading. It grows while the total throughput keeps rising and
+    shrinks on transfer errors or when the throughput stops rising.
+    It stays between :data:`.LRO_MINPARALLELDOWNLOADS` and
+    :data:`.LRO_MAXPARALLELDOWNLOADS`. The number chosen by the last
+    download is available as :data:`.LRI_AUTOTUNEDPARALLELDOWNLOADS`
+    and the next download starts from it. Disabled by default.
+
+.. data:: LRO_MINPARALLELDOWNLOADS
+
+    *Integer or None*. Minimum number of parallel downloads used by
+    :data:`.LRO_AUTOTUNE`. None sets the default value (1).
+
+.. data:: LRO_CONNECTIONAFFINITY
+
+    *Boolean*. If enabled, a finished transfer is followed by a waiting
+    target which would be downloaded from the same mirror (or base url),
+    so the open connection is reused instead of being left idle.
+    See :data:`.LRI_TRANSFERS` and :data:`.LRI_REUSEDCONNECTIONS` for
+    the effect. Disabled by default.
+
+.. data:: LRO_CHECKMAGIC
+
+    *Boolean*. If enabled, a transfer of a target with a checksum is
+    interrupted as soon as its first bytes don't match the magic of
+    the file type given by the suffix of the path (.rpm, .gz, .xz,
+    .bz2, .zst, .xml), e.g. when a mirror serves an error page, and
+    the next mirror is tried right away. Disabled by default.
+
 .. data:: LRO_GPGCHECK
 
     *Boolean*. Set True to enable gpg check (if available) of downloaded repo.
@@ -284,6 +397,22 @@ Constants
 .. data:: LRI_FASTESTMIRROR
 .. data:: LRI_FASTESTMIRRORCACHE
 .. data:: LRI_FASTESTMIRRORMAXAGE
+.. data:: LRI_CHECKSUMCACHE
+.. data:: LRI_FASTESTMIRRORMAXPARALLEL
+.. data:: LRI_FASTESTMIRRORTOPK
+.. data:: LRI_FASTESTMIRRORPROBEPATH
+.. data:: LRI_FASTESTMIRRORASYNC
+.. data:: LRI_MIRRORRANKING
+.. data:: LRI_MIRRORLOCATIONS
+.. data:: LRI_MIRRORSTATS
+.. data:: LRI_MIRRORRESUME
+.. data:: LRI_ADAPTIVETIMEOUTS
+.. data:: LRI_AUTOTUNE
+.. data:: LRI_AUTOTUNEDPARALLELDOWNLOADS
+.. data:: LRI_CONNECTIONAFFINITY
+.. data:: LRI_TRANSFERS
+.. data:: LRI_REUSEDCONNECTIONS
+.. data:: LRI_CHECKMAGIC
 
 .. _proxy-type-label:
 
@@ -297,6 +426,23 @@ Proxy type constants
 .. data:: PROXY_SOCKS4A (LR_PROXY_SOCKS4A)
 .. data:: PROXY_SOCKS5_HOSTNAME (LR_PROXY_SOCKS5_HOSTNAME)
 
+.. _mirrorranking-constants-label:
+
+Mirror ranking constants
+------------------------
+
+.. data:: MIRRORRANKING_NONE (LR_MIRRORRANKING_NONE)
+
+    Keep the order of the mirrors.
+
+.. data:: MIRRORRANKING_LATENCY (LR_MIRRORRANKING_LATENCY)
+
+    Use connect times from the fastestmirror cache.
+
+.. data:: MIRRORRANKING_STATS (LR_MIRRORRANKING_STATS)
+
+    Use statistics of the real downloads (:data:`.LRO_MIRRORSTATS`).
+
 .. _repotype-constants-label:
 
 Repo type constants
@@ -383,6 +529,12 @@ Values used by fastest mirror callback (:data:`~.LRO_FASTESTMIRRORCB`):
         If fastest mirror detection was successfull *data*,
         otherwise *data* contain string with error message.
 
+.. data:: FMSTAGE_THROUGHPUT
+
+    (6) Throughput of the fastest mirrors is measured
+    (see :data:`.LRO_FASTESTMIRRORPROBEPATH`). Comes after the detection
+    stage. *data* is number of mirrors that will be measured.
+
 Error codes
 -----------
 
@@ -617,6 +769,21 @@ LRO_FASTESTMIRRORCB         = _librepo.LRO_FASTESTMIRRORCB
 LRO_FASTESTMIRRORDATA       = _librepo.LRO_FASTESTMIRRORDATA
 LRO_LOWSPEEDTIME            = _librepo.LRO_LOWSPEEDTIME
 LRO_LOWSPEEDLIMIT           = _librepo.LRO_LOWSPEEDLIMIT
+LRO_CHECKSUMCACHE           = _librepo.LRO_CHECKSUMCACHE
+LRO_DECOMPRESS              = _librepo.LRO_DECOMPRESS
+LRO_FASTESTMIRRORMAXPARALLEL = _librepo.LRO_FASTESTMIRRORMAXPARALLEL
+LRO_FASTESTMIRRORTOPK       = _librepo.LRO_FASTESTMIRRORTOPK
+LRO_FASTESTMIRRORPROBEPATH  = _librepo.LRO_FASTESTMIRRORPROBEPATH
+LRO_FASTESTMIRRORASYNC      = _librepo.LRO_FASTESTMIRRORASYNC
+LRO_MIRRORRANKING           = _librepo.LRO_MIRRORRANKING
+LRO_MIRRORLOCATIONS         = _librepo.LRO_MIRRORLOCATIONS
+LRO_MIRRORSTATS             = _librepo.LRO_MIRRORSTATS
+LRO_MIRRORRESUME            = _librepo.LRO_MIRRORRESUME
+LRO_ADAPTIVETIMEOUTS        = _librepo.LRO_ADAPTIVETIMEOUTS
+LRO_AUTOTUNE                = _librepo.LRO_AUTOTUNE
+LRO_MINPARALLELDOWNLOADS    = _librepo.LRO_MINPARALLELDOWNLOADS
+LRO_CONNECTIONAFFINITY      = _librepo.LRO_CONNECTIONAFFINITY
+LRO_CHECKMAGIC              = _librepo.LRO_CHECKMAGIC
 LRO_GPGCHECK                = _librepo.LRO_GPGCHECK
 LRO_CHECKSUM                = _librepo.LRO_CHECKSUM
 LRO_YUMDLIST                = _librepo.LRO_YUMDLIST
@@ -658,6 +825,21 @@ ATTR_TO_LRO = {
     "fastestmirrordata":    LRO_FASTESTMIRRORDATA,
     "lowspeedtime":         LRO_LOWSPEEDTIME,
     "lowspeedlimit":        LRO_LOWSPEEDLIMIT,
+    "checksumcache":        LRO_CHECKSUMCACHE,
+    "decompress":           LRO_DECOMPRESS,
+    "fastestmirrormaxparallel": LRO_FASTESTMIRRORMAXPARALLEL,
+    "fastestmirrortopk":    LRO_FASTESTMIRRORTOPK,
+    "fastestmirrorprobepath": LRO_FASTESTMIRRORPROBEPATH,
+    "fastestmirrorasync":   LRO_FASTESTMIRRORASYNC,
+    "mirrorranking":        LRO_MIRRORRANKING,
+    "mirrorlocations":      LRO_MIRRORLOCATIONS,
+    "mirrorstats":          LRO_MIRRORSTATS,
+    "mirrorresume":         LRO_MIRRORRESUME,
+    "adaptivetimeouts":     LRO_ADAPTIVETIMEOUTS,
+    "autotune":             LRO_AUTOTUNE,
+    "minparalleldownloads": LRO_MINPARALLELDOWNLOADS,
+    "connectionaffinity":   LRO_CONNECTIONAFFINITY,
+    "checkmagic":           LRO_CHECKMAGIC,
     "gpgcheck":             LRO_GPGCHECK,
     "checksum":             LRO_CHECKSUM,
     "yumdlist":             LRO_YUMDLIST,
@@ -685,6 +867,22 @@ LRI_METALINK            = _librepo.LRI_METALINK
 LRI_FASTESTMIRROR       = _librepo.LRI_FASTESTMIRROR
 LRI_FASTESTMIRRORCACHE  = _librepo.LRI_FASTESTMIRRORCACHE
 LRI_FASTESTMIRRORMAXAGE = _librepo.LRI_FASTESTMIRRORMAXAGE
+LRI_CHECKSUMCACHE       = _librepo.LRI_CHECKSUMCACHE
+LRI_FASTESTMIRRORMAXPARALLEL = _librepo.LRI_FASTESTMIRRORMAXPARALLEL
+LRI_FASTESTMIRRORTOPK   = _librepo.LRI_FASTESTMIRRORTOPK
+LRI_FASTESTMIRRORPROBEPATH = _librepo.LRI_FASTESTMIRRORPROBEPATH
+LRI_FASTESTMIRRORASYNC  = _librepo.LRI_FASTESTMIRRORASYNC
+LRI_MIRRORRANKING       = _librepo.LRI_MIRRORRANKING
+LRI_MIRRORLOCATIONS     = _librepo.LRI_MIRRORLOCATIONS
+LRI_MIRRORSTATS         = _librepo.LRI_MIRRORSTATS
+LRI_MIRRORRESUME        = _librepo.LRI_MIRRORRESUME
+LRI_ADAPTIVETIMEOUTS    = _librepo.LRI_ADAPTIVETIMEOUTS
+LRI_AUTOTUNE            = _librepo.LRI_AUTOTUNE
+LRI_AUTOTUNEDPARALLELDOWNLOADS = _librepo.LRI_AUTOTUNEDPARALLELDOWNLOADS
+LRI_CONNECTIONAFFINITY  = _librepo.LRI_CONNECTIONAFFINITY
+LRI_TRANSFERS           = _librepo.LRI_TRANSFERS
+LRI_REUSEDCONNECTIONS   = _librepo.LRI_REUSEDCONNECTIONS
+LRI_CHECKMAGIC          = _librepo.LRI_CHECKMAGIC
 
 ATTR_TO_LRI = {
     "update":               LRI_UPDATE,
@@ -708,6 +906,22 @@ ATTR_TO_LRI = {
     "fastestmirror":        LRI_FASTESTMIRROR,
     "fastestmirrorcache":   LRI_FASTESTMIRRORCACHE,
     "fastestmirrormaxage":  LRI_FASTESTMIRRORMAXAGE,
+    "checksumcache":        LRI_CHECKSUMCACHE,
+    "fastestmirrormaxparallel": LRI_FASTESTMIRRORMAXPARALLEL,
+    "fastestmirrortopk":    LRI_FASTESTMIRRORTOPK,
+    "fastestmirrorprobepath": LRI_FASTESTMIRRORPROBEPATH,
+    "fastestmirrorasync":   LRI_FASTESTMIRRORASYNC,
+    "mirrorranking":        LRI_MIRRORRANKING,
+    "mirrorlocations":      LRI_MIRRORLOCATIONS,
+    "mirrorstats":          LRI_MIRRORSTATS,
+    "mirrorresume":         LRI_MIRRORRESUME,
+    "adaptivetimeouts":     LRI_ADAPTIVETIMEOUTS,
+    "autotune":             LRI_AUTOTUNE,
+    "autotunedparalleldownloads": LRI_AUTOTUNEDPARALLELDOWNLOADS,
+    "connectionaffinity":   LRI_CONNECTIONAFFINITY,
+    "transfers":            LRI_TRANSFERS,
+    "reusedconnections":    LRI_REUSEDCONNECTIONS,
+    "checkmagic":           LRI_CHECKMAGIC,
 }
 
 LR_CHECK_GPG        = _librepo.LR_CHECK_GPG
@@ -738,6 +952,14 @@ PROXY_SOCKS5             = _librepo.LR_PROXY_SOCKS5
 PROXY_SOCKS4A            = _librepo.LR_PROXY_SOCKS4A
 PROXY_SOCKS5_HOSTNAME    = _librepo.LR_PROXY_SOCKS5_HOSTNAME
 
+LR_MIRRORRANKING_NONE       = _librepo.LR_MIRRORRANKING_NONE
+LR_MIRRORRANKING_LATENCY    = _librepo.LR_MIRRORRANKING_LATENCY
+LR_MIRRORRANKING_STATS      = _librepo.LR_MIRRORRANKING_STATS
+
+MIRRORRANKING_NONE       = _librepo.LR_MIRRORRANKING_NONE
+MIRRORRANKING_LATENCY    = _librepo.LR_MIRRORRANKING_LATENCY
+MIRRORRANKING_STATS      = _librepo.LR_MIRRORRANKING_STATS
+
 LR_YUM_FULL         = None
 LR_YUM_REPOMDONLY   = [None]
 LR_YUM_BASEXML      = ["primary", "filelists", "other", None]
@@ -834,6 +1056,7 @@ FMSTAGE_CACHELOADINGSTATUS  = _librepo.FMSTAGE_CACHELOADINGSTATUS
 FMSTAGE_DETECTION           = _librepo.FMSTAGE_DETECTION
 FMSTAGE_FINISHING           = _librepo.FMSTAGE_FINISHING
 FMSTAGE_STATUS              = _librepo.FMSTAGE_STATUS
+FMSTAGE_THROUGHPUT          = _librepo.FMSTAGE_THROUGHPUT
 
 def checksum_str_to_type(name):
     name = name.lower()
@@ -999,6 +1222,66 @@ class Handle(_librepo.Handle):
 
         See: :data:`.LRO_LOWSPEEDLIMIT`
 
+    .. attribute:: checksumcache:
+
+        See: :data:`.LRO_CHECKSUMCACHE`
+
+    .. attribute:: decompress:
+
+        See: :data:`.LRO_DECOMPRESS`
+
+    .. attribute:: fastestmirrormaxparallel:
+
+        See: :data:`.LRO_FASTESTMIRRORMAXPARALLEL`
+
+    .. attribute:: fastestmirrortopk:
+
+        See: :data:`.LRO_FASTESTMIRRORTOPK`
+
+    .. attribute:: fastestmirrorprobepath:
+
+        See: :data:`.LRO_FASTESTMIRRORPROBEPATH`
+
+    .. attribute:: fastestmirrorasync:
+
+        See: :data:`.LRO_FASTESTMIRRORASYNC`
+
+    .. attribute:: mirrorranking:
+
+        See: :data:`.LRO_MIRRORRANKING`
+
+    .. attribute:: mirrorlocations:
+
+        See: :data:`.LRO_MIRRORLOCATIONS`
+
+    .. attribute:: mirrorstats:
+
+        See: :data:`.LRO_MIRRORSTATS`
+
+    .. attribute:: mirrorresume:
+
+        See: :data:`.LRO_MIRRORRESUME`
+
+    .. attribute:: adaptivetimeouts:
+
+        See: :data:`.LRO_ADAPTIVETIMEOUTS`
+
+    .. attribute:: autotune:
+
+        See: :data:`.LRO_AUTOTUNE`
+
+    .. attribute:: minparalleldownloads:
+
+        See: :data:`.LRO_MINPARALLELDOWNLOADS`
+
+    .. attribute:: connectionaffinity:
+
+        See: :data:`.LRO_CONNECTIONAFFINITY`
+
+    .. attribute:: checkmagic:
+
+        See: :data:`.LRO_CHECKMAGIC`
+
     .. attribute:: gpgcheck:
 
         See: :data:`.LRO_GPGCHECK`
@@ -127,6 +127,7 @@ fastestmirror_callback(void *data, LrFastestMirrorStages stage, void *ptr)
             pydata = PyStringOrNone_FromString((char *) ptr);
             break;
         case LR_FMSTAGE_DETECTION:
+        case LR_FMSTAGE_THROUGHPUT:
             pydata = PyLong_FromLong(*((long *) ptr));
             break;
         default:
@@ -222,6 +223,9 @@ setopt(_HandleObject *self, PyObject *args)
     case LRO_DESTDIR:
     case LRO_USERAGENT:
     case LRO_FASTESTMIRRORCACHE:
+    case LRO_CHECKSUMCACHE:
+    case LRO_FASTESTMIRRORPROBEPATH:
+    case LRO_MIRRORSTATS:
     {
         char *str = NULL, *alloced = NULL;
 
@@ -259,6 +263,13 @@ setopt(_HandleObject *self, PyObject *args)
     case LRO_INTERRUPTIBLE:
     case LRO_FETCHMIRRORS:
     case LRO_FASTESTMIRROR:
+    case LRO_DECOMPRESS:
+    case LRO_FASTESTMIRRORASYNC:
+    case LRO_MIRRORRESUME:
+    case LRO_ADAPTIVETIMEOUTS:
+    case LRO_AUTOTUNE:
+    case LRO_CONNECTIONAFFINITY:
+    case LRO_CHECKMAGIC:
     {
         long d;
 
@@ -286,6 +297,10 @@ setopt(_HandleObject *self, PyObject *args)
     case LRO_FASTESTMIRRORMAXAGE:
     case LRO_LOWSPEEDTIME:
     case LRO_LOWSPEEDLIMIT:
+    case LRO_FASTESTMIRRORMAXPARALLEL:
+    case LRO_FASTESTMIRRORTOPK:
+    case LRO_MIRRORRANKING:
+    case LRO_MINPARALLELDOWNLOADS:
     {
         int badarg = 0;
         long d;
@@ -311,6 +326,18 @@ setopt(_HandleObject *self, PyObject *args)
             case LRO_FASTESTMIRRORMAXAGE:
                 d = LRO_FASTESTMIRRORMAXAGE_DEFAULT;
                 break;
+            case LRO_FASTESTMIRRORMAXPARALLEL:
+                d = LRO_FASTESTMIRRORMAXPARALLEL_DEFAULT;
+                break;
+            case LRO_FASTESTMIRRORTOPK:
+                d = LRO_FASTESTMIRRORTOPK_DEFAULT;
+                break;
+            case LRO_MIRRORRANKING:
+                d = LRO_MIRRORRANKING_DEFAULT;
+                break;
+            case LRO_MINPARALLELDOWNLOADS:
+                d = LRO_MINPARALLELDOWNLOADS_DEFAULT;
+                break;
             default:
                 badarg = 1;
             }
@@ -410,7 +437,8 @@ setopt(_HandleObject *self, PyObject *args)
      */
     case LRO_URLS:
     case LRO_YUMDLIST:
-    case LRO_YUMBLIST: {
+    case LRO_YUMBLIST:
+    case LRO_MIRRORLOCATIONS: {
         Py_ssize_t len = 0;
 
         if (!PyList_Check(obj) && obj != Py_None) {
@@ -694,6 +722,9 @@ getinfo(_HandleObject *self, PyObject *args)
     case LRI_DESTDIR:
     case LRI_USERAGENT:
     case LRI_FASTESTMIRRORCACHE:
+    case LRI_FASTESTMIRRORPROBEPATH:
+    case LRI_CHECKSUMCACHE:
+    case LRI_MIRRORSTATS:
         res = lr_handle_getinfo(self->handle,
                                 &tmp_err,
                                 (LrHandleInfoOption)option,
@@ -710,6 +741,18 @@ getinfo(_HandleObject *self, PyObject *args)
     case LRI_MAXMIRRORTRIES:
     case LRI_FASTESTMIRROR:
     case LRI_FASTESTMIRRORMAXAGE:
+    case LRI_FASTESTMIRRORMAXPARALLEL:
+    case LRI_FASTESTMIRRORTOPK:
+    case LRI_FASTESTMIRRORASYNC:
+    case LRI_MIRRORRANKING:
+    case LRI_MIRRORRESUME:
+    case LRI_ADAPTIVETIMEOUTS:
+    case LRI_AUTOTUNE:
+    case LRI_AUTOTUNEDPARALLELDOWNLOADS:
+    case LRI_CONNECTIONAFFINITY:
+    case LRI_TRANSFERS:
+    case LRI_REUSEDCONNECTIONS:
+    case LRI_CHECKMAGIC:
         res = lr_handle_getinfo(self->handle,
                                 &tmp_err,
                                 (LrHandleInfoOption)option,
@@ -759,6 +802,7 @@ getinfo(_HandleObject *self, PyObject *args)
     case LRI_URLS:
     case LRI_YUMDLIST:
     case LRI_YUMBLIST:
+    case LRI_MIRRORLOCATIONS:
     case LRI_MIRRORS: {
         PyObject *list;
         char **strlist;
@@ -255,6 +255,21 @@ init_librepo(void)
     PyModule_AddIntConstant(m, "LRO_FASTESTMIRRORDATA", LRO_FASTESTMIRRORDATA);
     PyModule_AddIntConstant(m, "LRO_LOWSPEEDTIME", LRO_LOWSPEEDTIME);
     PyModule_AddIntConstant(m, "LRO_LOWSPEEDLIMIT", LRO_LOWSPEEDLIMIT);
+    PyModule_AddIntConstant(m, "LRO_CHECKSUMCACHE", LRO_CHECKSUMCACHE);
+    PyModule_AddIntConstant(m, "LRO_DECOMPRESS", LRO_DECOMPRESS);
+    PyModule_AddIntConstant(m, "LRO_FASTESTMIRRORMAXPARALLEL", LRO_FASTESTMIRRORMAXPARALLEL);
+    PyModule_AddIntConstant(m, "LRO_FASTESTMIRRORTOPK", LRO_FASTESTMIRRORTOPK);
+    PyModule_AddIntConstant(m, "LRO_FASTESTMIRRORPROBEPATH", LRO_FASTESTMIRRORPROBEPATH);
+    PyModule_AddIntConstant(m, "LRO_FASTESTMIRRORASYNC", LRO_FASTESTMIRRORASYNC);
+    PyModule_AddIntConstant(m, "LRO_MIRRORRANKING", LRO_MIRRORRANKING);
+    PyModule_AddIntConstant(m, "LRO_MIRRORLOCATIONS", LRO_MIRRORLOCATIONS);
+    PyModule_AddIntConstant(m, "LRO_MIRRORSTATS", LRO_MIRRORSTATS);
+    PyModule_AddIntConstant(m, "LRO_MIRRORRESUME", LRO_MIRRORRESUME);
+    PyModule_AddIntConstant(m, "LRO_ADAPTIVETIMEOUTS", LRO_ADAPTIVETIMEOUTS);
+    PyModule_AddIntConstant(m, "LRO_AUTOTUNE", LRO_AUTOTUNE);
+    PyModule_AddIntConstant(m, "LRO_MINPARALLELDOWNLOADS", LRO_MINPARALLELDOWNLOADS);
+    PyModule_AddIntConstant(m, "LRO_CONNECTIONAFFINITY", LRO_CONNECTIONAFFINITY);
+    PyModule_AddIntConstant(m, "LRO_CHECKMAGIC", LRO_CHECKMAGIC);
     PyModule_AddIntConstant(m, "LRO_GPGCHECK", LRO_GPGCHECK);
     PyModule_AddIntConstant(m, "LRO_CHECKSUM", LRO_CHECKSUM);
     PyModule_AddIntConstant(m, "LRO_YUMDLIST", LRO_YUMDLIST);
@@ -283,6 +298,22 @@ init_librepo(void)
     PyModule_AddIntConstant(m, "LRI_FASTESTMIRROR", LRI_FASTESTMIRROR);
     PyModule_AddIntConstant(m, "LRI_FASTESTMIRRORCACHE", LRI_FASTESTMIRRORCACHE);
     PyModule_AddIntConstant(m, "LRI_FASTESTMIRRORMAXAGE", LRI_FASTESTMIRRORMAXAGE);
+    PyModule_AddIntConstant(m, "LRI_CHECKSUMCACHE", LRI_CHECKSUMCACHE);
+    PyModule_AddIntConstant(m, "LRI_FASTESTMIRRORMAXPARALLEL", LRI_FASTESTMIRRORMAXPARALLEL);
+    PyModule_AddIntConstant(m, "LRI_FASTESTMIRRORTOPK", LRI_FASTESTMIRRORTOPK);
+    PyModule_AddIntConstant(m, "LRI_FASTESTMIRRORPROBEPATH", LRI_FASTESTMIRRORPROBEPATH);
+    PyModule_AddIntConstant(m, "LRI_FASTESTMIRRORASYNC", LRI_FASTESTMIRRORASYNC);
+    PyModule_AddIntConstant(m, "LRI_MIRRORRANKING", LRI_MIRRORRANKING);
+    PyModule_AddIntConstant(m, "LRI_MIRRORLOCATIONS", LRI_MIRRORLOCATIONS);
+    PyModule_AddIntConstant(m, "LRI_MIRRORSTATS", LRI_MIRRORSTATS);
+    PyModule_AddIntConstant(m, "LRI_MIRRORRESUME", LRI_MIRRORRESUME);
+    PyModule_AddIntConstant(m, "LRI_ADAPTIVETIMEOUTS", LRI_ADAPTIVETIMEOUTS);
+    PyModule_AddIntConstant(m, "LRI_AUTOTUNE", LRI_AUTOTUNE);
+    PyModule_AddIntConstant(m, "LRI_AUTOTUNEDPARALLELDOWNLOADS", LRI_AUTOTUNEDPARALLELDOWNLOADS);
+    PyModule_AddIntConstant(m, "LRI_CONNECTIONAFFINITY", LRI_CONNECTIONAFFINITY);
+    PyModule_AddIntConstant(m, "LRI_TRANSFERS", LRI_TRANSFERS);
+    PyModule_AddIntConstant(m, "LRI_REUSEDCONNECTIONS", LRI_REUSEDCONNECTIONS);
+    PyModule_AddIntConstant(m, "LRI_CHECKMAGIC", LRI_CHECKMAGIC);
 
     // Check options
     PyModule_AddIntConstant(m, "LR_CHECK_GPG", LR_CHECK_GPG);
@@ -301,6 +332,11 @@ init_librepo(void)
     PyModule_AddIntConstant(m, "LR_PROXY_SOCKS4A", LR_PROXY_SOCKS4A);
     PyModule_AddIntConstant(m, "LR_PROXY_SOCKS5_HOSTNAME", LR_PROXY_SOCKS5_HOSTNAME);
 
+    // Mirror ranking modes
+    PyModule_AddIntConstant(m, "LR_MIRRORRANKING_NONE", LR_MIRRORRANKING_NONE);
+    PyModule_AddIntConstant(m, "LR_MIRRORRANKING_LATENCY", LR_MIRRORRANKING_LATENCY);
+    PyModule_AddIntConstant(m, "LR_MIRRORRANKING_STATS", LR_MIRRORRANKING_STATS);
+
     // Return codes
     PyModule_AddIntConstant(m, "LRE_OK", LRE_OK);
     PyModule_AddIntConstant(m, "LRE_BADFUNCARG", LRE_BADFUNCARG);
@@ -367,6 +403,7 @@ init_librepo(void)
     PyModule_AddIntConstant(m, "FMSTAGE_DETECTION", LR_FMSTAGE_DETECTION);
     PyModule_AddIntConstant(m, "FMSTAGE_FINISHING", LR_FMSTAGE_FINISHING);
     PyModule_AddIntConstant(m, "FMSTAGE_STATUS", LR_FMSTAGE_STATUS);
+    PyModule_AddIntConstant(m, "FMSTAGE_THROUGHPUT", LR_FMSTAGE_THROUGHPUT);
 
 #if PY_MAJOR_VERSION >= 3
     return m;
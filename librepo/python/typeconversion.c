@@ -61,6 +61,26 @@ PyObject_FromYumRepo(LrYumRepo *repo)
                              PyStringOrNone_FromString(yumrepopath->path));
     }
 
+    if (repo->decompressed_paths) {
+        PyObject *decompressed;
+
+        if ((decompressed = PyDict_New()) == NULL) {
+            Py_DECREF(dict);
+            return NULL;
+        }
+
+        for (GSList *elem = repo->decompressed_paths; elem; elem = g_slist_next(elem)) {
+            LrYumRepoPath *yumrepopath = elem->data;
+            if (!yumrepopath || !yumrepopath->type) continue;
+            PyDict_SetItemString(decompressed,
+                                 yumrepopath->type,
+                                 PyStringOrNone_FromString(yumrepopath->path));
+        }
+
+        PyDict_SetItemString(dict, "decompressed", decompressed);
+        Py_DECREF(decompressed);
+    }
+
     return dict;
 }
 
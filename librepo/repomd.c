@@ -79,7 +79,8 @@ lr_yum_repomd_set_record(LrYumRepoMd *repomd,
                          LrYumRepoMdRecord *record)
 {
     if (!repomd || !record) return;
-    repomd->records = g_slist_append(repomd->records, record);
+    // Prepended, see lr_yum_repomd_parse_file()
+    repomd->records = g_slist_prepend(repomd->records, record);
 }
 
 static void
@@ -523,6 +524,9 @@ lr_yum_repomd_parse_file(LrYumRepoMd *repomd,
     if (tmp_err)
         g_propagate_error(err, tmp_err);
 
+    // Records were prepended to keep the parsing linear
+    repomd->records = g_slist_reverse(repomd->records);
+
     // Check of results
 
     if (!tmp_err && !pd->repomdfound) {
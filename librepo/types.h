@@ -56,6 +56,15 @@ typedef enum {
     LR_PROXY_SOCKS5_HOSTNAME,   /*!< SOCKS5 proxy */
 } LrProxyType;
 
+/** Mirror ranking modes (LRO_MIRRORRANKING). */
+typedef enum {
+    LR_MIRRORRANKING_NONE,      /*!< Keep the order of the mirrors (Default) */
+    LR_MIRRORRANKING_LATENCY,   /*!< Location, preference and connect times
+                                     from the fastestmirror cache */
+    LR_MIRRORRANKING_STATS,     /*!< Location, preference and statistics
+                                     of the real downloads (LRO_MIRRORSTATS) */
+} LrMirrorRanking;
+
 /* Some common used arrays for LRO_YUMDLIST */
 
 /** Predefined value for LRO_YUMDLIST option - Download whole repo. */
@@ -143,6 +152,14 @@ typedef enum {
         If fastest mirror detection was successfull ptr is NULL,
         otherwise ptr contain (char *) string with error message.
         (Do not modify or free the string) */
+
+    LR_FMSTAGE_THROUGHPUT, /*!<
+        Measurement of throughput of the fastest mirrors
+        (see LRO_FASTESTMIRRORPROBEPATH) is in progress.
+        This stage comes after LR_FMSTAGE_DETECTION and it is skiped
+        if the values were loaded from cache.
+        ptr is pointer to long. This is the number of mirrors
+        to measure. */
 } LrFastestMirrorStages;
 
 /** Fastest mirror status callback
@@ -85,55 +85,252 @@ lr_urlvars_free(LrUrlVars *list)
     g_slist_free(list);
 }
 
-char *
-lr_url_substitute(const char *url, LrUrlVars *list)
-{
-    const char *cur = url;
-    const char *p = url;
-    char *tmp_res, *res;
+typedef struct {
+    LrVar *var;     // The variable
+    size_t len;     // Length of its name
+    int position;   // Position in the list
+} LrUrlVarEntry;
 
-    if (!url)
-        return NULL;
+struct _LrUrlVarsIndex {
+    LrUrlVarEntry *entries;     // Variables in the order of the list
+    GSList *buckets[256];       // First character of a name -> entries
+    LrUrlVarEntry *empty;       // The first variable with empty name
+                                // (it matches everywhere) or NULL
+};
+
+typedef struct {
+    const char *str;    // Literal part of the url or NULL
+    size_t len;         // Length of the literal part
+    LrVar *var;         // Variable if str is NULL
+} LrUrlSegment;
 
+struct _LrUrlTemplate {
+    char *url;                  // Copy of the url (segments point there)
+    size_t n_segments;          // Number of segments
+    LrUrlSegment segments[];    // Literal parts and variables
+};
+
+LrUrlVarsIndex *
+lr_urlvars_index_new(LrUrlVars *list)
+{
     if (!list)
-        return g_strdup(url);
-
-    res = g_strdup("");
-
-    while (*cur != '\0') {
-        if (*cur == '$') {
-            if (cur-p) {
-                char *tmp = g_strndup(p, cur-p);
-                tmp_res = g_strconcat(res, tmp, NULL);
-                lr_free(tmp);
-                lr_free(res);
-                res = tmp_res;
-                p = cur;
-            }
+        return NULL;
+
+    LrUrlVarsIndex *index = lr_malloc0(sizeof(*index));
+    index->entries = lr_malloc0(g_slist_length(list) * sizeof(LrUrlVarEntry));
+
+    int x = 0;
+    for (LrUrlVars *elem = list; elem; elem = g_slist_next(elem), x++) {
+        LrUrlVarEntry *entry = &index->entries[x];
+        entry->var = elem->data;
+        entry->len = strlen(entry->var->var);
+        entry->position = x;
+
+        if (entry->len) {
+            guchar c = (guchar) entry->var->var[0];
+            index->buckets[c] = g_slist_prepend(index->buckets[c], entry);
+        } else if (!index->empty) {
+            index->empty = entry;
+        }
+    }
+
+    // Keep the order of the list (the first matching variable wins)
+    for (int c = 0; c < 256; c++)
+        if (index->buckets[c])
+            index->buckets[c] = g_slist_reverse(index->buckets[c]);
+
+    return index;
+}
+
+void
+lr_urlvars_index_free(LrUrlVarsIndex *index)
+{
+    if (!index)
+        return;
+
+    for (int c = 0; c < 256; c++)
+        if (index->buckets[c])
+            g_slist_free(index->buckets[c]);
+    lr_free(index->entries);
+    lr_free(index);
+}
+
+/** Find the first variable which name is a prefix of the string. */
+static LrVar *
+lr_urlvars_index_lookup(LrUrlVarsIndex *index, const char *str, size_t *len)
+{
+    for (GSList *elem = index->buckets[(guchar) *str];
+         elem;
+         elem = g_slist_next(elem))
+    {
+        LrUrlVarEntry *entry = elem->data;
+        if (index->empty && index->empty->position < entry->position)
+            break;
+        if (!strncmp(entry->var->var, str, entry->len)) {
+            *len = entry->len;
+            return entry->var;
+        }
+    }
+
+    if (index->empty) {
+        *len = 0;
+        return index->empty->var;
+    }
+
+    return NULL;
+}
+
+/** Find the first variable which name is a prefix of the string. */
+static LrVar *
+lr_urlvars_lookup(LrUrlVars *list, const char *str, size_t *len)
+{
+    for (LrUrlVars *elem = list; elem; elem = g_slist_next(elem)) {
+        LrVar *var = elem->data;
+        size_t var_len = strlen(var->var);
+        if (!strncmp(var->var, str, var_len)) {
+            *len = var_len;
+            return var;
+        }
+    }
+
+    return NULL;
+}
+
+/** Parse the url. The variables are looked up in the index if it is
+ * not NULL, otherwise in the list.
+ */
+static LrUrlTemplate *
+lr_urltemplate_compile(const char *url,
+                       LrUrlVarsIndex *index,
+                       LrUrlVars *list)
+{
+    size_t url_len, n_dollars = 0;
+
+    assert(url);
+
+    url_len = strlen(url);
+    for (const char *c = url; (c = strchr(c, '$')); c++)
+        n_dollars++;
 
-            // Try to substitute the variable
-            for (LrUrlVars *elem = list; elem; elem = g_slist_next(elem)) {
-                LrVar *var_val = elem->data;
-                size_t len = strlen(var_val->var);
-                if (!strncmp(var_val->var, (cur+1), len)) {
-                    cur = cur + len;
-                    p = cur + 1;
-                    tmp_res = g_strconcat(res, var_val->val, NULL);
-                    lr_free(res);
-                    res = tmp_res;
-                    break;
-                }
+    // Every '$' adds at most a literal part and a variable
+    size_t max_segments = 2 * n_dollars + 1;
+    size_t size = sizeof(LrUrlTemplate) + max_segments * sizeof(LrUrlSegment);
+
+    // The template, its segments and the copy of the url are allocated
+    // at once
+    LrUrlTemplate *tmpl = lr_malloc(size + url_len + 1);
+    tmpl->url = (char *) tmpl + size;
+    tmpl->n_segments = 0;
+    memcpy(tmpl->url, url, url_len + 1);
+
+    const char *cur = tmpl->url;
+    const char *p = tmpl->url;
+
+    while ((index || list) && (cur = strchr(cur, '$'))) {
+        size_t len = 0;
+        LrVar *var = index ? lr_urlvars_index_lookup(index, cur + 1, &len)
+                           : lr_urlvars_lookup(list, cur + 1, &len);
+
+        if (var) {
+            if (cur > p) {
+                LrUrlSegment *literal = &tmpl->segments[tmpl->n_segments++];
+                literal->str = p;
+                literal->len = cur - p;
+                literal->var = NULL;
             }
+
+            LrUrlSegment *variable = &tmpl->segments[tmpl->n_segments++];
+            variable->str = NULL;
+            variable->len = 0;
+            variable->var = var;
+
+            cur += len;
+            p = cur + 1;
         }
 
         ++cur;
     }
 
     if (*p != '\0') {
-        tmp_res = g_strconcat(res, p, NULL);
-        lr_free(res);
-        res = tmp_res;
+        LrUrlSegment *literal = &tmpl->segments[tmpl->n_segments++];
+        literal->str = p;
+        literal->len = strlen(p);
+        literal->var = NULL;
+    }
+
+    return tmpl;
+}
+
+LrUrlTemplate *
+lr_urltemplate_new(const char *url, LrUrlVarsIndex *index)
+{
+    return lr_urltemplate_compile(url, index, NULL);
+}
+
+char *
+lr_urltemplate_render(const LrUrlTemplate *tmpl)
+{
+    size_t len = 0;
+
+    assert(tmpl);
+
+    for (size_t x = 0; x < tmpl->n_segments; x++) {
+        const LrUrlSegment *segment = &tmpl->segments[x];
+        len += segment->str ? segment->len : strlen(segment->var->val);
     }
 
+    char *res = lr_malloc(len + 1);
+    char *dst = res;
+
+    for (size_t x = 0; x < tmpl->n_segments; x++) {
+        const LrUrlSegment *segment = &tmpl->segments[x];
+        if (segment->str) {
+            memcpy(dst, segment->str, segment->len);
+            dst += segment->len;
+        } else {
+            size_t val_len = strlen(segment->var->val);
+            memcpy(dst, segment->var->val, val_len);
+            dst += val_len;
+        }
+    }
+    *dst = '\0';
+
+    return res;
+}
+
+void
+lr_urltemplate_free(LrUrlTemplate *tmpl)
+{
+    lr_free(tmpl);
+}
+
+char *
+lr_url_substitute_index(const char *url, LrUrlVarsIndex *index)
+{
+    if (!url)
+        return NULL;
+
+    if (!index || !strchr(url, '$'))
+        return g_strdup(url);  // Nothing to substitute
+
+    LrUrlTemplate *tmpl = lr_urltemplate_new(url, index);
+    char *res = lr_urltemplate_render(tmpl);
+    lr_urltemplate_free(tmpl);
+    return res;
+}
+
+char *
+lr_url_substitute(const char *url, LrUrlVars *list)
+{
+    if (!url)
+        return NULL;
+
+    if (!list || !strchr(url, '$'))
+        return g_strdup(url);  // Nothing to substitute
+
+    // A single url is not worth of the LrUrlVarsIndex
+    LrUrlTemplate *tmpl = lr_urltemplate_compile(url, NULL, list);
+    char *res = lr_urltemplate_render(tmpl);
+    lr_urltemplate_free(tmpl);
     return res;
 }
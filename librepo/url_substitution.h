@@ -64,6 +64,61 @@ lr_urlvars_free(LrUrlVars *list);
 char *
 lr_url_substitute(const char *url, LrUrlVars *list);
 
+/** LrUrlVars compiled for a fast lookup of the variables.
+ * Variables are indexed by the first character of their name.
+ * Use it when many urls are substituted with the same variables.
+ */
+typedef struct _LrUrlVarsIndex LrUrlVarsIndex;
+
+/** Compile the variables. The index refers to the LrVar elements of
+ * the list, it must not be used after a variable is added to
+ * or removed from the list (changed values are fine).
+ * @param list          a list of variables and its substitutions or NULL
+ * @return              a new index or NULL if the list is NULL
+ */
+LrUrlVarsIndex *
+lr_urlvars_index_new(LrUrlVars *list);
+
+/** Free the index.
+ * @param index         a LrUrlVarsIndex or NULL
+ */
+void
+lr_urlvars_index_free(LrUrlVarsIndex *index);
+
+/** Url parsed into literal parts and variables. */
+typedef struct _LrUrlTemplate LrUrlTemplate;
+
+/** Parse the url. Substitutes the same variables as
+ * lr_url_substitute() would.
+ * @param url           a url
+ * @param index         a LrUrlVarsIndex or NULL
+ * @return              a new template (the url is copied)
+ */
+LrUrlTemplate *
+lr_urltemplate_new(const char *url, LrUrlVarsIndex *index);
+
+/** Render the template with the current values of the variables.
+ * @param tmpl          a template
+ * @return              a newly allocated string with substituted url
+ */
+char *
+lr_urltemplate_render(const LrUrlTemplate *tmpl);
+
+/** Free the template.
+ * @param tmpl          a LrUrlTemplate or NULL
+ */
+void
+lr_urltemplate_free(LrUrlTemplate *tmpl);
+
+/** Substitute variables in the url. Same as lr_url_substitute()
+ * but with the compiled variables.
+ * @param url           a url
+ * @param index         a LrUrlVarsIndex or NULL
+ * @return              a newly allocated string with substituted url
+ */
+char *
+lr_url_substitute_index(const char *url, LrUrlVarsIndex *index);
+
 /** @} */
 
 G_END_DECLS
@@ -372,3 +372,67 @@ lr_url_without_path(const char *url)
 
     return host;
 }
+
+gchar *
+lr_url_host(const char *url)
+{
+    if (!url) return NULL;
+
+    GString *host = g_string_new(NULL);
+    const char *scheme_end = strstr(url, "://");
+    const char *ptr = url;
+
+    if (scheme_end) {
+        g_string_append_len(host, url, scheme_end - url);
+        for (gsize x = 0; x < host->len; x++)
+            host->str[x] = g_ascii_tolower(host->str[x]);
+        g_string_append(host, "://");
+        ptr = scheme_end + 3;
+    }
+
+    // The authority part ends with the path, the query or the fragment
+    const char *end = ptr + strcspn(ptr, "/?#");
+
+    // Skip the user info
+    for (const char *c = ptr; c < end; c++)
+        if (*c == '@')
+            ptr = c + 1;
+
+    // Host name (an IPv6 address is enclosed in brackets)
+    const char *port = NULL;
+    const char *c = ptr;
+    if (*c == '[') {
+        while (c < end && *c != ']')
+            c++;
+        if (c < end)
+            c++;
+    }
+    while (c < end && *c != ':')
+        c++;
+    for (const char *h = ptr; h < c; h++)
+        g_string_append_c(host, g_ascii_tolower(*h));
+    if (c < end)
+        port = c + 1;
+
+    // The port is omitted if it is the default one of the scheme
+    if (port && port < end) {
+        gsize port_len = end - port;
+        const char *default_port = NULL;
+        if (!g_ascii_strncasecmp(url, "http://", 7))
+            default_port = "80";
+        else if (!g_ascii_strncasecmp(url, "https://", 8))
+            default_port = "443";
+        else if (!g_ascii_strncasecmp(url, "ftp://", 6))
+            default_port = "21";
+
+        if (!default_port
+            || strlen(default_port) != port_len
+            || strncmp(port, default_port, port_len))
+        {
+            g_string_append_c(host, ':');
+            g_string_append_len(host, port, port_len);
+        }
+    }
+
+    return g_string_free(host, FALSE);
+}
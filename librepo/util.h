@@ -149,6 +149,17 @@ lr_best_checksum(GSList *list, LrChecksumType *type, gchar **value);
 gchar *
 lr_url_without_path(const char *url);
 
+/** Return malloced string identifying the server of the url.
+ * Unlike lr_url_without_path() the result is normalized, the scheme and
+ * the hostname are lowercased, the user info is removed and the port
+ * is omitted if it is the default one of the scheme. URLs which point
+ * to the same server (scheme + host + port) get the same string.
+ * @param url       URL
+ * @return          Malloced "scheme://host[:port]" or NULL if url is NULL
+ */
+gchar *
+lr_url_host(const char *url);
+
 /** @} */
 
 G_END_DECLS
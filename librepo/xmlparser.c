@@ -17,12 +17,16 @@
  * USA.
  */
 
+#define _XOPEN_SOURCE   700 // Because of posix_madvise()
 #include <glib.h>
 #include <glib/gprintf.h>
 #include <assert.h>
 #include <errno.h>
 #include <expat.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "xmlparser.h"
 #include "xmlparser_internal.h"
 #include "rcodes.h"
@@ -52,7 +56,6 @@ void XMLCALL
 lr_char_handler(void *pdata, const XML_Char *s, int len)
 {
     int l;
-    char *c;
     LrParserData *pd = pdata;
 
     if (pd->err)
@@ -63,15 +66,15 @@ lr_char_handler(void *pdata, const XML_Char *s, int len)
 
     l = pd->lcontent + len + 1;
     if (l > pd->acontent) {
-        pd->acontent = l + CONTENT_REALLOC_STEP;
-        pd->content = realloc(pd->content, pd->acontent);
+        /* Grow geometrically, expat could deliver a long text
+         * in many small pieces */
+        pd->acontent = MAX(l, pd->acontent * 2);
+        pd->content = g_realloc(pd->content, pd->acontent);
     }
 
-    c = pd->content + pd->lcontent;
+    memcpy(pd->content + pd->lcontent, s, len);
     pd->lcontent += len;
-    while (len-- > 0)
-        *c++ = *s++;
-    *c = '\0';
+    pd->content[pd->lcontent] = '\0';
 }
 
 int
@@ -139,6 +142,84 @@ lr_xml_parser_strtoll(LrParserData *pd,
     return val;
 }
 
+static gboolean
+lr_xml_parser_check(XML_Parser parser,
+                    LrParserData *pd,
+                    enum XML_Status status,
+                    GError **err)
+{
+    if (status == XML_STATUS_ERROR) {
+        g_debug("%s: Parse error at line: %d (%s)",
+                    __func__,
+                    (int) XML_GetCurrentLineNumber(parser),
+                    (char *) XML_ErrorString(XML_GetErrorCode(parser)));
+        g_set_error(err, LR_XML_PARSER_ERROR, LRE_XMLPARSER,
+                    "Parse error at line: %d (%s)",
+                    (int) XML_GetCurrentLineNumber(parser),
+                    (char *) XML_ErrorString(XML_GetErrorCode(parser)));
+        return FALSE;
+    }
+
+    if (pd->err) {
+        g_propagate_error(err, pd->err);
+        pd->err = NULL;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/** Parse the rest of a regular file directly from its memory mapping.
+ * @return      TRUE if the file was parsed (successfully or not - see
+ *              the err), FALSE if the file cannot be mapped and
+ *              the read() based parsing should be used instead.
+ */
+static gboolean
+lr_xml_parser_generic_mmap(XML_Parser parser,
+                           LrParserData *pd,
+                           int fd,
+                           gboolean *ret,
+                           GError **err)
+{
+    struct stat st;
+    off_t offset;
+    char *map;
+
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
+        return FALSE;
+
+    offset = lseek(fd, 0, SEEK_CUR);
+    if (offset == -1 || st.st_size - offset < XML_MMAP_MIN_SIZE)
+        return FALSE;  // Small files are cheaper to read
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        g_debug("%s: mmap failed (%s), reading the file instead",
+                __func__, strerror(errno));
+        return FALSE;
+    }
+
+    posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+
+    // Usual repomd and metalink files are passed in a single call,
+    // there are no read() syscalls and no 8 KiB round trips. Expat still
+    // copies the chunk into its own buffer (XML_CONTEXT_BYTES), so bigger
+    // files are split to keep the buffer size reasonable.
+    *ret = TRUE;
+    for (off_t pos = offset; *ret && pos < st.st_size;) {
+        int len = (int) MIN(st.st_size - pos, XML_MMAP_MAX_CHUNK);
+        gboolean last = (pos + len == st.st_size);
+        enum XML_Status status = XML_Parse(parser, map + pos, len, last);
+        *ret = lr_xml_parser_check(parser, pd, status, err);
+        pos += len;
+    }
+
+    munmap(map, st.st_size);
+    lseek(fd, 0, SEEK_END);
+
+    return TRUE;
+}
+
 gboolean
 lr_xml_parser_generic(XML_Parser parser,
                       LrParserData *pd,
@@ -154,6 +235,9 @@ lr_xml_parser_generic(XML_Parser parser,
     assert(fd >= 0);
     assert(!err || *err == NULL);
 
+    if (lr_xml_parser_generic_mmap(parser, pd, fd, &ret, err))
+        return ret;
+
     while (1) {
         int len;
         void *buf = XML_GetBuffer(parser, XML_BUFFER_SIZE);
@@ -174,22 +258,10 @@ lr_xml_parser_generic(XML_Parser parser,
             break;
         }
 
-        if (!XML_ParseBuffer(parser, len, len == 0)) {
-            ret = FALSE;
-            g_debug("%s: Parse error at line: %d (%s)",
-                        __func__,
-                        (int) XML_GetCurrentLineNumber(parser),
-                        (char *) XML_ErrorString(XML_GetErrorCode(parser)));
-            g_set_error(err, LR_XML_PARSER_ERROR, LRE_XMLPARSER,
-                        "Parse error at line: %d (%s)",
-                        (int) XML_GetCurrentLineNumber(parser),
-                        (char *) XML_ErrorString(XML_GetErrorCode(parser)));
-            break;
-        }
-
-        if (pd->err) {
+        if (!lr_xml_parser_check(parser, pd,
+                                 XML_ParseBuffer(parser, len, len == 0),
+                                 err)) {
             ret = FALSE;
-            g_propagate_error(err, pd->err);
             break;
         }
 
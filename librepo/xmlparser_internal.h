@@ -35,6 +35,8 @@ G_BEGIN_DECLS
 
 #define XML_BUFFER_SIZE         8192
 #define CONTENT_REALLOC_STEP    256
+#define XML_MMAP_MIN_SIZE       (64*1024)   /*!< Smaller files are read() */
+#define XML_MMAP_MAX_CHUNK      (16*1024*1024) /*!< Max bytes per XML_Parse() */
 
 /** Structure used for elements in the state switches in XML parsers
  */
@@ -38,6 +38,7 @@
 #include "repomd.h"
 #include "downloader.h"
 #include "checksum.h"
+#include "checksumcache_internal.h"
 #include "handle_internal.h"
 #include "result_internal.h"
 #include "yum_internal.h"
@@ -51,13 +52,10 @@ lr_yum_repo_init()
     return lr_malloc0(sizeof(LrYumRepo));
 }
 
-void
-lr_yum_repo_free(LrYumRepo *repo)
+static void
+lr_yum_repopath_list_free(GSList *paths)
 {
-    if (!repo)
-        return;
-
-    for (GSList *elem = repo->paths; elem; elem = g_slist_next(elem)) {
+    for (GSList *elem = paths; elem; elem = g_slist_next(elem)) {
         LrYumRepoPath *yumrepopath = elem->data;
         assert(yumrepopath);
         lr_free(yumrepopath->type);
@@ -65,7 +63,17 @@ lr_yum_repo_free(LrYumRepo *repo)
         lr_free(yumrepopath);
     }
 
-    g_slist_free(repo->paths);
+    g_slist_free(paths);
+}
+
+void
+lr_yum_repo_free(LrYumRepo *repo)
+{
+    if (!repo)
+        return;
+
+    lr_yum_repopath_list_free(repo->paths);
+    lr_yum_repopath_list_free(repo->decompressed_paths);
     lr_free(repo->repomd);
     lr_free(repo->url);
     lr_free(repo->destdir);
@@ -75,11 +83,10 @@ lr_yum_repo_free(LrYumRepo *repo)
     lr_free(repo);
 }
 
-const char *
-lr_yum_repo_path(LrYumRepo *repo, const char *type)
+static const char *
+lr_yum_repopath_list_get(GSList *paths, const char *type)
 {
-    assert(repo);
-    for (GSList *elem = repo->paths; elem; elem = g_slist_next(elem)) {
+    for (GSList *elem = paths; elem; elem = g_slist_next(elem)) {
         LrYumRepoPath *yumrepopath = elem->data;
         assert(yumrepopath);
         if (!strcmp(yumrepopath->type, type))
@@ -88,6 +95,50 @@ lr_yum_repo_path(LrYumRepo *repo, const char *type)
     return NULL;
 }
 
+const char *
+lr_yum_repo_path(LrYumRepo *repo, const char *type)
+{
+    assert(repo);
+    return lr_yum_repopath_list_get(repo->paths, type);
+}
+
+const char *
+lr_yum_repo_decompressed_path(LrYumRepo *repo, const char *type)
+{
+    assert(repo);
+    return lr_yum_repopath_list_get(repo->decompressed_paths, type);
+}
+
+/** Set path of the type in the list of paths. If the type is already
+ * present, its path is replaced, otherwise a new item is appended.
+ * @param paths         List of ::LrYumRepoPath*s.
+ * @param type          Type of file. E.g. "primary", "filelists", ...
+ * @param path          Path to the file.
+ * @return              The list.
+ */
+static GSList *
+lr_yum_repopath_list_update(GSList *paths, const char *type, const char *path)
+{
+    assert(type);
+    assert(path);
+
+    for (GSList *elem = paths; elem; elem = g_slist_next(elem)) {
+        LrYumRepoPath *yumrepopath = elem->data;
+        assert(yumrepopath);
+
+        if (!strcmp(yumrepopath->type, type)) {
+            lr_free(yumrepopath->path);
+            yumrepopath->path = g_strdup(path);
+            return paths;
+        }
+    }
+
+    LrYumRepoPath *yumrepopath = lr_malloc(sizeof(LrYumRepoPath));
+    yumrepopath->type = g_strdup(type);
+    yumrepopath->path = g_strdup(path);
+    return g_slist_append(paths, yumrepopath);
+}
+
 /** Append path to the repository object.
  * @param repo          Yum repo object.
  * @param type          Type of file. E.g. "primary", "filelists", ...
@@ -110,21 +161,25 @@ static void
 lr_yum_repo_update(LrYumRepo *repo, const char *type, const char *path)
 {
     assert(repo);
-    assert(type);
-    assert(path);
+    repo->paths = lr_yum_repopath_list_update(repo->paths, type, path);
+}
 
-    for (GSList *elem = repo->paths; elem; elem = g_slist_next(elem)) {
-        LrYumRepoPath *yumrepopath = elem->data;
-        assert(yumrepopath);
+/** If the record is compressed by a compression supported by
+ * the decompressor, return path for its decompressed version.
+ * @param path          Path to the compressed file.
+ * @return              Newly allocated path or NULL.
+ */
+static char *
+lr_yum_decompressed_path(const char *path)
+{
+    static const char *suffixes[] = { ".gz", ".bz2", ".xz", NULL };
 
-        if (!strcmp(yumrepopath->type, type)) {
-            lr_free(yumrepopath->path);
-            yumrepopath->path = g_strdup(path);
-            return;
-        }
+    for (int x = 0; suffixes[x]; x++) {
+        if (g_str_has_suffix(path, suffixes[x]))
+            return g_strndup(path, strlen(path) - strlen(suffixes[x]));
     }
 
-    lr_yum_repo_append(repo, type, path);
+    return NULL;
 }
 
 /* main bussines logic */
@@ -254,6 +309,7 @@ lr_yum_download_repo(LrHandle *handle,
     gboolean ret = TRUE;
     char *destdir;  /* Destination dir */
     GSList *targets = NULL;
+    GHashTable *record_types = NULL; /* Decompressed target -> record type */
     GError *tmp_err = NULL;
 
     destdir = handle->destdir;
@@ -281,6 +337,8 @@ lr_yum_download_repo(LrHandle *handle,
                         "Cannot create/open %s: %s", path, strerror(errno));
             lr_free(path);
             g_slist_free_full(targets, (GDestroyNotify) lr_downloadtarget_free);
+            if (record_types)
+                g_hash_table_destroy(record_types);
             return FALSE;
         }
 
@@ -310,6 +368,33 @@ lr_yum_download_repo(LrHandle *handle,
                                        0,
                                        0);
 
+        char *decompressed_path = NULL;
+        if (handle->decompress)
+            decompressed_path = lr_yum_decompressed_path(path);
+
+        if (decompressed_path) {
+            LrChecksumType checksum_type = LR_CHECKSUM_UNKNOWN;
+            const char *checksum = NULL;
+
+            if (handle->checks & LR_CHECK_CHECKSUM && record->checksum_open) {
+                checksum_type = lr_checksum_type(record->checksum_open_type);
+                if (checksum_type != LR_CHECKSUM_UNKNOWN)
+                    checksum = record->checksum_open;
+            }
+
+            lr_downloadtarget_set_decompress(target,
+                                             decompressed_path,
+                                             checksum_type,
+                                             checksum,
+                                             record->size_open);
+            // Used to record the decompressed path after the download
+            if (!record_types)
+                record_types = g_hash_table_new(g_direct_hash,
+                                                g_direct_equal);
+            g_hash_table_insert(record_types, target, record->type);
+            lr_free(decompressed_path);
+        }
+
         targets = g_slist_append(targets, target);
 
         /* Because path may already exists in repo (while update) */
@@ -366,27 +451,51 @@ lr_yum_download_repo(LrHandle *handle,
             g_set_error(err, LR_DOWNLOADER_ERROR, code,
                         "Downloading error(s): %s", error_summary);
             g_free(error_summary);
+        } else {
+            // Remember the files decompressed during the download
+            for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
+                LrDownloadTarget *target = elem->data;
+                if (!target->decompressfn)
+                    continue;
+                const char *type = g_hash_table_lookup(record_types, target);
+                repo->decompressed_paths = lr_yum_repopath_list_update(
+                                                    repo->decompressed_paths,
+                                                    type,
+                                                    target->decompressfn);
+            }
         }
     }
 
     g_slist_free_full(targets, (GDestroyNotify)lr_downloadtarget_free);
+    if (record_types)
+        g_hash_table_destroy(record_types);
 
     return ret;
 }
 
+/** Prepare checksum check of a repomd record.
+ * @param rec       Repomd record.
+ * @param path      Path to the local file of the record.
+ * @param item      Batch item which is filled if the check is needed.
+ * @param err       GError **
+ * @return          TRUE if error is not set and FALSE if it is.
+ *                  item->fd is -1 if there is nothing to check.
+ */
 static gboolean
-lr_yum_check_checksum_of_md_record(LrYumRepoMdRecord *rec,
-                                   const char *path,
-                                   GError **err)
+lr_yum_prepare_checksum_of_md_record(LrYumRepoMdRecord *rec,
+                                     const char *path,
+                                     LrChecksumBatchItem *item,
+                                     GError **err)
 {
     int fd;
     char *expected_checksum;
     LrChecksumType checksum_type;
-    gboolean ret, matches;
-    GError *tmp_err = NULL;
 
     assert(!err || *err == NULL);
 
+    memset(item, 0, sizeof(*item));
+    item->fd = -1;
+
     if (!rec || !path)
         return TRUE;
 
@@ -418,32 +527,41 @@ lr_yum_check_checksum_of_md_record(LrYumRepoMdRecord *rec,
         return FALSE;
     }
 
-    ret = lr_checksum_fd_cmp(checksum_type,
-                             fd,
-                             expected_checksum,
-                             1,
-                             &matches,
-                             &tmp_err);
+    item->fd = fd;
+    item->type = checksum_type;
+    item->expected = expected_checksum;
 
-    close(fd);
+    return TRUE;
+}
 
-    assert(ret || tmp_err);
+/** Evaluate result of a checksum check prepared by
+ * lr_yum_prepare_checksum_of_md_record().
+ */
+static gboolean
+lr_yum_check_checksum_of_md_record(LrChecksumBatchItem *item,
+                                   const char *path,
+                                   GError **err)
+{
+    assert(!err || *err == NULL);
 
-    if (!ret) {
+    if (item->err) {
         // Checksum calculation error
         g_debug("%s: Checksum check %s - Error: %s",
-                __func__, path, tmp_err->message);
-        g_propagate_prefixed_error(err, tmp_err,
+                __func__, path, item->err->message);
+        g_propagate_prefixed_error(err, g_error_copy(item->err),
                                    "Checksum error %s: ", path);
         return FALSE;
-    } else if (!matches) {
+    } else if (!item->matches) {
         g_debug("%s: Checksum check %s - Mismatch", __func__, path);
         g_set_error(err, LR_YUM_ERROR, LRE_BADCHECKSUM,
                     "Checksum mismatch %s", path);
         return FALSE;
     }
 
-    g_debug("%s: Checksum check - Passed", __func__);
+    if (!item->cached)
+        lr_checksumcache_store_legacy(item->fd, item->checksum);
+
+    g_debug("%s: Checksum check %s - Passed", __func__, path);
 
     return TRUE;
 }
@@ -453,21 +571,45 @@ lr_yum_check_repo_checksums(LrYumRepo *repo,
                             LrYumRepoMd *repomd,
                             GError **err)
 {
+    gboolean ret = TRUE;
+    guint count = g_slist_length(repomd->records);
+    guint nitems = 0;
+    LrChecksumBatchItem *items = g_new0(LrChecksumBatchItem, count);
+    const char **paths = g_new0(const char *, count);
+
     assert(!err || *err == NULL);
 
+    // Open all files, then calculate all their checksums at once
     for (GSList *elem = repomd->records; elem; elem = g_slist_next(elem)) {
-        gboolean ret;
         LrYumRepoMdRecord *record = elem->data;
 
         assert(record);
 
         const char *path = lr_yum_repo_path(repo, record->type);
-        ret = lr_yum_check_checksum_of_md_record(record, path, err);
+        ret = lr_yum_prepare_checksum_of_md_record(record, path,
+                                                   &items[nitems], err);
         if (!ret)
-            return FALSE;
+            break;
+        if (items[nitems].fd < 0)
+            continue;  // Nothing to check
+        paths[nitems++] = path;
     }
 
-    return TRUE;
+    if (ret) {
+        LrChecksumPool *pool = lr_checksum_pool_new();
+        lr_checksumcache_pool_fd(NULL, pool, items, nitems, FALSE, NULL);
+        lr_checksum_pool_free(pool);
+        for (guint x = 0; ret && x < nitems; x++)
+            ret = lr_yum_check_checksum_of_md_record(&items[x], paths[x], err);
+    }
+
+    for (guint x = 0; x < nitems; x++)
+        close(items[x].fd);
+    lr_checksum_batch_clear(items, nitems);
+    g_free(items);
+    g_free(paths);
+
+    return ret;
 }
 
 static gboolean
@@ -49,6 +49,9 @@ typedef struct {
                              was enabled during repo downloading) */
     char *mirrorlist;   /*!< Mirrolist filename */
     char *metalink;     /*!< Metalink filename */
+    GSList *decompressed_paths; /*!< Paths to the files decompressed
+                                     during the download (LRO_DECOMPRESS).
+                                     List of ::LrYumRepoPath*s */
 } LrYumRepo;
 
 /** Allocate new yum repo object.
@@ -71,6 +74,16 @@ lr_yum_repo_free(LrYumRepo *repo);
 const char *
 lr_yum_repo_path(LrYumRepo *repo, const char *type);
 
+/** Retruns path for the decompressed version of the file from repository.
+ * Available only if LRO_DECOMPRESS was enabled and the file was
+ * compressed by gzip, bzip2 or xz.
+ * @param repo          Yum repo object.
+ * @param type          Type of path. E.g. "primary", "filelists", ...
+ * @return              Path or NULL.
+ */
+const char *
+lr_yum_repo_decompressed_path(LrYumRepo *repo, const char *type);
+
 /** @} */
 
 G_END_DECLS
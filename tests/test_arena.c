@@ -0,0 +1,73 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "librepo/arena_internal.h"
+
+#include "testsys.h"
+#include "test_arena.h"
+
+START_TEST(test_arena)
+{
+    LrArena *arena = lr_arena_new(1024);
+    GSList *list = NULL;
+
+    fail_if(!arena);
+    fail_if(lr_arena_blocks(arena) != 0);
+
+    // Small allocations share a block, are zeroed and aligned
+    for (int x = 0; x < 10; x++) {
+        char *mem = lr_arena_alloc0(arena, 3);
+        fail_if(!mem);
+        fail_if(mem[0] || mem[1] || mem[2]);
+        fail_if(((uintptr_t) mem) % sizeof(void *));
+        memset(mem, 'x', 3);
+    }
+    fail_if(lr_arena_blocks(arena) != 1);
+
+    // Oversized allocation gets its own block
+    char *large = lr_arena_alloc0(arena, 4096);
+    fail_if(!large);
+    memset(large, 'x', 4096);
+    fail_if(lr_arena_blocks(arena) != 2);
+
+    // Strings
+    fail_if(lr_arena_strdup(arena, NULL));
+    ck_assert_str_eq(lr_arena_strdup(arena, ""), "");
+    ck_assert_str_eq(lr_arena_strdup(arena, "foo"), "foo");
+
+    // Lists
+    for (long x = 0; x < 1000; x++)
+        list = lr_arena_slist_prepend(arena, list, (gpointer) x);
+    list = g_slist_reverse(list);
+    fail_if(g_slist_length(list) != 1000);
+    fail_if(g_slist_nth_data(list, 0) != (gpointer) 0);
+    fail_if(g_slist_nth_data(list, 999) != (gpointer) 999);
+    fail_if(lr_arena_blocks(arena) < 3);
+
+    // Freed nodes are reused
+    guint blocks = lr_arena_blocks(arena);
+    for (int x = 0; x < 100; x++) {
+        lr_arena_slist_free(arena, list);
+        list = NULL;
+        for (long y = 0; y < 1000; y++)
+            list = lr_arena_slist_prepend(arena, list, (gpointer) y);
+    }
+    fail_if(g_slist_length(list) != 1000);
+    fail_if(lr_arena_blocks(arena) != blocks);
+    lr_arena_slist_free(arena, NULL);
+
+    lr_arena_free(arena);
+    lr_arena_free(NULL);
+}
+END_TEST
+
+Suite *
+arena_suite(void)
+{
+    Suite *s = suite_create("arena");
+    TCase *tc = tcase_create("Main");
+    tcase_add_test(tc, test_arena);
+    suite_add_tcase(s, tc);
+    return s;
+}
@@ -8,8 +8,10 @@
 #include <fcntl.h>
 #include <attr/xattr.h>
 
+#include "librepo/rcodes.h"
 #include "librepo/util.h"
 #include "librepo/checksum.h"
+#include "librepo/checksumcache_internal.h"
 
 #include "fixtures.h"
 #include "testsys.h"
@@ -169,6 +171,237 @@ exit_label:
 }
 END_TEST
 
+START_TEST(test_checksumcache)
+{
+    FILE *f;
+    int fd;
+    gboolean ret, matches;
+    char *filename, *indexfn, *checksum;
+    static char *expected = "d78931fcf2660108eec0d6674ecb4e02401b5256a6b5ee82527766ef6d198c67";
+    LrChecksumCache *cache;
+    GError *tmp_err = NULL;
+
+    filename = lr_pathconcat(test_globals.tmpdir, "/test_checksumcache", NULL);
+    indexfn = lr_pathconcat(test_globals.tmpdir, "/checksumcache.idx", NULL);
+    f = fopen(filename, "w");
+    fwrite("foo\nbar\n", 1, 8, f);
+    fclose(f);
+
+    fd = open(filename, O_RDONLY);
+    fail_if(fd < 0);
+
+    // Nothing cached yet
+    cache = lr_checksumcache_load(indexfn);
+    fail_if(!cache);
+    fail_if(lr_checksumcache_lookup(cache, fd, LR_CHECKSUM_SHA256));
+
+    // Calculate and cache
+    ret = lr_checksumcache_fd_cmp(cache, LR_CHECKSUM_SHA256, fd, expected,
+                                  &matches, &tmp_err);
+    fail_if(tmp_err);
+    fail_if(!ret);
+    fail_if(!matches);
+
+    // Cached value is used (in xattr or in the index)
+    checksum = lr_checksumcache_lookup(cache, fd, LR_CHECKSUM_SHA256);
+    fail_if(!checksum);
+    fail_if(strcmp(checksum, expected));
+    lr_free(checksum);
+
+    // Record for a different checksum type must not exist
+    fail_if(lr_checksumcache_lookup(cache, fd, LR_CHECKSUM_SHA1));
+
+    // Record survives writing and reloading of the cache
+    ret = lr_checksumcache_write(cache, &tmp_err);
+    fail_if(tmp_err);
+    fail_if(!ret);
+    lr_checksumcache_free(cache);
+
+    cache = lr_checksumcache_load(indexfn);
+    checksum = lr_checksumcache_lookup(cache, fd, LR_CHECKSUM_SHA256);
+    fail_if(!checksum);
+    fail_if(strcmp(checksum, expected));
+    lr_free(checksum);
+    close(fd);
+
+    // Modified file invalidates the record
+    f = fopen(filename, "a");
+    fwrite("baz\n", 1, 4, f);
+    fclose(f);
+    fd = open(filename, O_RDONLY);
+    fail_if(fd < 0);
+    fail_if(lr_checksumcache_lookup(cache, fd, LR_CHECKSUM_SHA256));
+    ret = lr_checksumcache_fd_cmp(cache, LR_CHECKSUM_SHA256, fd, expected,
+                                  &matches, &tmp_err);
+    fail_if(tmp_err);
+    fail_if(!ret);
+    fail_if(matches);
+    close(fd);
+
+    lr_checksumcache_free(cache);
+    unlink(indexfn);
+    unlink(filename);
+    lr_free(indexfn);
+    lr_free(filename);
+}
+END_TEST
+
+START_TEST(test_checksumcache_concurrent_writers)
+{
+    int fd_null, fd_zero;
+    gboolean ret;
+    char *indexfn, *checksum;
+    LrChecksumCache *cache_a, *cache_b;
+    GError *tmp_err = NULL;
+
+    indexfn = lr_pathconcat(test_globals.tmpdir, "/checksumcache_merge.idx",
+                            NULL);
+
+    // Device files cannot have user extended attributes,
+    // their records are always stored in the index file
+    fd_null = open("/dev/null", O_RDONLY);
+    fd_zero = open("/dev/zero", O_RDONLY);
+    fail_if(fd_null < 0 || fd_zero < 0);
+
+    // Two processes load the same index and both write their records
+    cache_a = lr_checksumcache_load(indexfn);
+    cache_b = lr_checksumcache_load(indexfn);
+    lr_checksumcache_store(cache_a, fd_null, LR_CHECKSUM_SHA256, "aa");
+    lr_checksumcache_store(cache_b, fd_zero, LR_CHECKSUM_SHA256, "bb");
+
+    ret = lr_checksumcache_write(cache_a, &tmp_err);
+    fail_if(tmp_err);
+    fail_if(!ret);
+    ret = lr_checksumcache_write(cache_b, &tmp_err);
+    fail_if(tmp_err);
+    fail_if(!ret);
+    lr_checksumcache_free(cache_a);
+    lr_checksumcache_free(cache_b);
+
+    // Records of both writers are kept
+    cache_a = lr_checksumcache_load(indexfn);
+    checksum = lr_checksumcache_lookup(cache_a, fd_null, LR_CHECKSUM_SHA256);
+    fail_if(!checksum);
+    ck_assert_str_eq(checksum, "aa");
+    lr_free(checksum);
+    checksum = lr_checksumcache_lookup(cache_a, fd_zero, LR_CHECKSUM_SHA256);
+    fail_if(!checksum);
+    ck_assert_str_eq(checksum, "bb");
+    lr_free(checksum);
+    lr_checksumcache_free(cache_a);
+
+    close(fd_null);
+    close(fd_zero);
+    unlink(indexfn);
+    lr_free(indexfn);
+}
+END_TEST
+
+START_TEST(test_checksum_pool_fd)
+{
+    char *file0, *file1;
+    GError *tmp_err = NULL;
+    LrChecksumPool *pool;
+    LrChecksumBatchItem items[4];
+    LrChecksumBatchItem failfast_items[64];
+    const char *expected[] = { CHKS_VAL_00_SHA256, CHKS_VAL_01_SHA1,
+                               CHKS_VAL_00_SHA512, CHKS_VAL_01_MD5 };
+    LrChecksumType types[] = { LR_CHECKSUM_SHA256, LR_CHECKSUM_SHA1,
+                               LR_CHECKSUM_SHA512, LR_CHECKSUM_MD5 };
+
+    file0 = lr_pathconcat(test_globals.tmpdir, "/test_batch_0", NULL);
+    file1 = lr_pathconcat(test_globals.tmpdir, "/test_batch_1", NULL);
+    build_test_file(file0, CHKS_CONTENT_00);
+    build_test_file(file1, CHKS_CONTENT_01);
+
+    memset(items, 0, sizeof(items));
+    for (int x = 0; x < 4; x++) {
+        items[x].fd = open((x % 2) ? file1 : file0, O_RDONLY);
+        fail_if(items[x].fd < 0);
+        items[x].type = types[x];
+        items[x].expected = expected[x];
+    }
+
+    // Last item doesn't match
+    items[3].expected = CHKS_VAL_00_MD5;
+
+    pool = lr_checksum_pool_new();
+    fail_if(!pool);
+
+    fail_if(!lr_checksum_pool_fd(pool, items, 4, FALSE, &tmp_err));
+    fail_if(tmp_err);
+    for (int x = 0; x < 4; x++) {
+        fail_if(items[x].err);
+        fail_if(strcmp(items[x].checksum, expected[x]),
+            "Checksum is %s instead of %s", items[x].checksum, expected[x]);
+        fail_if(items[x].matches != (x != 3));
+        fail_if(items[x].cached);
+    }
+    lr_checksum_batch_clear(items, 4);
+
+    // Unknown checksum type fails only its own item
+    items[1].type = LR_CHECKSUM_UNKNOWN;
+    fail_if(lr_checksum_pool_fd(pool, items, 4, FALSE, &tmp_err));
+    fail_if(!tmp_err);
+    g_error_free(tmp_err);
+    tmp_err = NULL;
+    fail_if(!items[1].err);
+    fail_if(items[1].checksum);
+    fail_if(!items[0].matches || !items[2].matches);
+    lr_checksum_batch_clear(items, 4);
+
+    // Failfast - items not started before the first failure are skipped
+    memset(failfast_items, 0, sizeof(failfast_items));
+    for (int x = 0; x < 64; x++) {
+        failfast_items[x].fd = open(file0, O_RDONLY);
+        fail_if(failfast_items[x].fd < 0);
+        failfast_items[x].type = LR_CHECKSUM_SHA256;
+        failfast_items[x].expected = CHKS_VAL_00_SHA256;
+    }
+    failfast_items[0].type = LR_CHECKSUM_UNKNOWN;
+
+    fail_if(lr_checksum_pool_fd(pool, failfast_items, 64, TRUE, &tmp_err));
+    fail_if(!tmp_err);
+    g_error_free(tmp_err);
+    tmp_err = NULL;
+    fail_if(!failfast_items[0].err);
+    fail_if(g_error_matches(failfast_items[0].err, LR_CHECKSUM_ERROR,
+                            LRE_INTERRUPTED));
+    int skipped = 0;
+    for (int x = 1; x < 64; x++) {
+        LrChecksumBatchItem *item = &failfast_items[x];
+        if (item->err) {
+            fail_if(!g_error_matches(item->err, LR_CHECKSUM_ERROR,
+                                     LRE_INTERRUPTED));
+            fail_if(item->checksum);
+            skipped++;
+        } else {
+            fail_if(!item->matches);
+        }
+    }
+    fail_if(skipped == 0, "No item was skipped after the failure");
+    lr_checksum_batch_clear(failfast_items, 64);
+
+    // The pool is reusable after a failfast call
+    fail_if(!lr_checksum_pool_fd(pool, failfast_items + 1, 63, TRUE, &tmp_err));
+    fail_if(tmp_err);
+    for (int x = 1; x < 64; x++)
+        fail_if(!failfast_items[x].matches);
+    lr_checksum_batch_clear(failfast_items, 64);
+
+    lr_checksum_pool_free(pool);
+
+    for (int x = 0; x < 64; x++)
+        close(failfast_items[x].fd);
+    for (int x = 0; x < 4; x++)
+        close(items[x].fd);
+    unlink(file0);
+    unlink(file1);
+    lr_free(file0);
+    lr_free(file1);
+}
+END_TEST
+
 Suite *
 checksum_suite(void)
 {
@@ -176,6 +409,9 @@ checksum_suite(void)
     TCase *tc = tcase_create("Main");
     tcase_add_test(tc, test_checksum_fd);
     tcase_add_test(tc, test_cached_checksum);
+    tcase_add_test(tc, test_checksumcache);
+    tcase_add_test(tc, test_checksumcache_concurrent_writers);
+    tcase_add_test(tc, test_checksum_pool_fd);
     suite_add_tcase(s, tc);
     return s;
 }
@@ -0,0 +1,177 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "librepo/rcodes.h"
+#include "librepo/util.h"
+#include "librepo/decompressor_internal.h"
+
+#include "fixtures.h"
+#include "testsys.h"
+#include "test_decompressor.h"
+
+#define REPO_01     "repo_yum_01/repodata/"
+#define PRIMARY_GZ  "4543ad62e4d86337cd1949346f9aec976b847b58-primary.xml.gz"
+#define PRIMARY_GZ_OPEN_SHA1    "68457ceb8e20bda004d46e0a4dfa4a69ce71db48"
+#define PRIMARY_GZ_OPEN_SIZE    3385
+#define PRIMARY_BZ2 "735cd6294df08bdf28e2ba113915ca05a151118e-primary.sqlite.bz2"
+#define PRIMARY_BZ2_OPEN_SHA1   "ba636386312e1b597fc4feb182d04c059b2a77d5"
+
+/* "foo\nbar\n\n" compressed by xz */
+static const unsigned char xz_data[] = {
+  0xfd, 0x37, 0x7a, 0x58, 0x5a, 0x00, 0x00, 0x04, 0xe6, 0xd6, 0xb4, 0x46,
+  0x04, 0xc0, 0x0d, 0x09, 0x21, 0x01, 0x16, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x5f, 0x4f, 0x33, 0xe4, 0x01, 0x00, 0x08, 0x66,
+  0x6f, 0x6f, 0x0a, 0x62, 0x61, 0x72, 0x0a, 0x0a, 0x00, 0x00, 0x00, 0x00,
+  0x83, 0x87, 0xb2, 0x61, 0x64, 0x39, 0x73, 0x44, 0x00, 0x01, 0x29, 0x09,
+  0x64, 0x92, 0x1c, 0x1d, 0x1f, 0xb6, 0xf3, 0x7d, 0x01, 0x00, 0x00, 0x00,
+  0x00, 0x04, 0x59, 0x5a
+};
+
+/* sha1 of "foo\nbar\n\nfoo\nbar\n\n" */
+#define XZ_TWICE_SHA1   "270ef7714c55ab553ccadfa7c6e46042b63d352c"
+
+/* Pass the data to the decompressor in small pieces */
+static gboolean
+feed(LrDecompressor *d, const char *data, size_t len, size_t step,
+     GError **err)
+{
+    for (size_t x = 0; x < len; x += step)
+        if (!lr_decompressor_write(d, data + x, MIN(step, len - x), err))
+            return FALSE;
+    return TRUE;
+}
+
+static void
+check_file(const char *path, LrChecksumType type, const char *checksum,
+           size_t step)
+{
+    gchar *data;
+    gsize len;
+    gboolean ret;
+    GError *tmp_err = NULL;
+    char *outfn = lr_pathconcat(test_globals.tmpdir, "decompressed", NULL);
+
+    fail_if(!g_file_get_contents(path, &data, &len, NULL));
+
+    LrDecompressor *d = lr_decompressor_new(outfn, type, checksum, 0, &tmp_err);
+    fail_if(!d);
+    fail_if(tmp_err);
+    ret = feed(d, data, len, step, &tmp_err);
+    fail_if(!ret, "Error: %s", tmp_err ? tmp_err->message : "");
+    ret = lr_decompressor_finish(d, &tmp_err);
+    fail_if(!ret, "Error: %s", tmp_err ? tmp_err->message : "");
+    lr_decompressor_free(d);
+
+    unlink(outfn);
+    lr_free(outfn);
+    g_free(data);
+}
+
+START_TEST(test_decompressor_gz_bz2)
+{
+    char *path;
+
+    path = lr_pathconcat(test_globals.testdata_dir, REPO_01, PRIMARY_GZ, NULL);
+    check_file(path, LR_CHECKSUM_SHA1, PRIMARY_GZ_OPEN_SHA1, 1);
+    check_file(path, LR_CHECKSUM_SHA1, PRIMARY_GZ_OPEN_SHA1, 4096);
+    lr_free(path);
+
+    path = lr_pathconcat(test_globals.testdata_dir, REPO_01, PRIMARY_BZ2, NULL);
+    check_file(path, LR_CHECKSUM_SHA1, PRIMARY_BZ2_OPEN_SHA1, 7);
+    check_file(path, LR_CHECKSUM_SHA1, PRIMARY_BZ2_OPEN_SHA1, 100000);
+    lr_free(path);
+}
+END_TEST
+
+START_TEST(test_decompressor_xz_concatenated)
+{
+    gboolean ret;
+    GError *tmp_err = NULL;
+    char *outfn = lr_pathconcat(test_globals.tmpdir, "decompressed", NULL);
+    gchar *content;
+    gsize len;
+
+    LrDecompressor *d = lr_decompressor_new(outfn, LR_CHECKSUM_SHA1,
+                                            XZ_TWICE_SHA1, 18, &tmp_err);
+    fail_if(!d);
+
+    // Two concatenated streams
+    for (int x = 0; x < 2; x++) {
+        ret = feed(d, (const char *) xz_data, sizeof(xz_data), 3, &tmp_err);
+        fail_if(!ret);
+    }
+    ret = lr_decompressor_finish(d, &tmp_err);
+    fail_if(!ret, "Error: %s", tmp_err ? tmp_err->message : "");
+    lr_decompressor_free(d);
+
+    fail_if(!g_file_get_contents(outfn, &content, &len, NULL));
+    fail_if(len != 18);
+    fail_if(strcmp(content, "foo\nbar\n\nfoo\nbar\n\n"));
+    g_free(content);
+
+    unlink(outfn);
+    lr_free(outfn);
+}
+END_TEST
+
+START_TEST(test_decompressor_errors)
+{
+    gboolean ret;
+    GError *tmp_err = NULL;
+    char *outfn = lr_pathconcat(test_globals.tmpdir, "decompressed", NULL);
+    const char *garbage = "<html>Not found</html>";
+
+    LrDecompressor *d = lr_decompressor_new(outfn, LR_CHECKSUM_SHA1,
+                                            XZ_TWICE_SHA1, 0, &tmp_err);
+    fail_if(!d);
+
+    // Not compressed data
+    ret = lr_decompressor_write(d, garbage, strlen(garbage), &tmp_err);
+    fail_if(ret);
+    fail_if(!tmp_err);
+    fail_if(tmp_err->code != LRE_BADCHECKSUM);
+    g_clear_error(&tmp_err);
+
+    // Incomplete data
+    fail_if(!lr_decompressor_reset(d, &tmp_err));
+    ret = lr_decompressor_write(d, (const char *) xz_data,
+                                sizeof(xz_data) - 10, &tmp_err);
+    fail_if(!ret);
+    ret = lr_decompressor_finish(d, &tmp_err);
+    fail_if(ret);
+    fail_if(!tmp_err);
+    g_clear_error(&tmp_err);
+
+    // Checksum mismatch
+    fail_if(!lr_decompressor_reset(d, &tmp_err));
+    ret = lr_decompressor_write(d, (const char *) xz_data,
+                                sizeof(xz_data), &tmp_err);
+    fail_if(!ret);
+    ret = lr_decompressor_finish(d, &tmp_err);
+    fail_if(ret);
+    fail_if(!tmp_err);
+    fail_if(tmp_err->code != LRE_BADCHECKSUM);
+    g_clear_error(&tmp_err);
+
+    lr_decompressor_free(d);
+    unlink(outfn);
+    lr_free(outfn);
+}
+END_TEST
+
+Suite *
+decompressor_suite(void)
+{
+    Suite *s = suite_create("decompressor");
+    TCase *tc = tcase_create("Main");
+    tcase_add_test(tc, test_decompressor_gz_bz2);
+    tcase_add_test(tc, test_decompressor_xz_concatenated);
+    tcase_add_test(tc, test_decompressor_errors);
+    suite_add_tcase(s, tc);
+    return s;
+}
@@ -0,0 +1,8 @@
+#ifndef LR_TEST_DECOMPRESSOR_H
+#define LR_TEST_DECOMPRESSOR_H
+
+#include <check.h>
+
+Suite *decompressor_suite(void);
+
+#endif
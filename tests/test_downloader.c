@@ -7,11 +7,18 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include "librepo/librepo.h"
 #include "librepo/rcodes.h"
 #include "librepo/util.h"
 #include "librepo/downloader.h"
+#include "librepo/downloader_internal.h"
 #include "librepo/handle_internal.h"
 
 #include "fixtures.h"
@@ -290,6 +297,816 @@ START_TEST(test_downloader_three_files_with_error)
 }
 END_TEST
 
+START_TEST(test_downloader_checksum)
+{
+    int ret;
+    GSList *list = NULL;
+    GError *err = NULL;
+    int fd1, fd2;
+    char *tmpfn1, *tmpfn2, *baseurl;
+    LrDownloadTarget *t1, *t2;
+    GSList *checksums1 = NULL, *checksums2 = NULL;
+
+    // Prepare list of download targets
+    // Checksums of finished transfers are verified by worker threads
+
+    baseurl = lr_pathconcat("file://", test_globals.testdata_dir,
+                            "repo_yum_01/", NULL);
+    tmpfn1 = lr_pathconcat(test_globals.tmpdir, "checksum_1_XXXXXX", NULL);
+    tmpfn2 = lr_pathconcat(test_globals.tmpdir, "checksum_2_XXXXXX", NULL);
+
+    mktemp(tmpfn1);
+    mktemp(tmpfn2);
+    fd1 = open(tmpfn1, O_RDWR|O_CREAT|O_TRUNC, 0666);
+    fd2 = open(tmpfn2, O_RDWR|O_CREAT|O_TRUNC, 0666);
+    lr_free(tmpfn1);
+    lr_free(tmpfn2);
+    fail_if(fd1 < 0);
+    fail_if(fd2 < 0);
+
+    checksums1 = g_slist_append(checksums1, lr_downloadtargetchecksum_new(
+                        LR_CHECKSUM_SHA1,
+                        "4543ad62e4d86337cd1949346f9aec976b847b58"));
+    t1 = lr_downloadtarget_new(NULL,
+                "repodata/4543ad62e4d86337cd1949346f9aec976b847b58-primary.xml.gz",
+                baseurl, fd1, NULL, checksums1, 0, 0, NULL, NULL, NULL,
+                NULL, NULL, 0, 0);
+    fail_if(!t1);
+
+    checksums2 = g_slist_append(checksums2, lr_downloadtargetchecksum_new(
+                        LR_CHECKSUM_SHA1,
+                        "0000000000000000000000000000000000000000"));
+    t2 = lr_downloadtarget_new(NULL,
+                "repodata/a8977cdaa0b14321d9acfab81ce8a85e869eee32-other.xml.gz",
+                baseurl, fd2, NULL, checksums2, 0, 0, NULL, NULL, NULL,
+                NULL, NULL, 0, 0);
+    fail_if(!t2);
+
+    list = g_slist_append(list, t1);
+    list = g_slist_append(list, t2);
+
+    // Download
+
+    ret = lr_download(list, FALSE, &err);
+    fail_if(!ret);
+    fail_if(err);
+
+    // Check results
+
+    fail_if(t1->rcode != LRE_OK);
+    fail_if(t1->err);
+    fail_if(t2->rcode != LRE_BADCHECKSUM);
+    fail_if(!t2->err);
+
+    lr_free(baseurl);
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+}
+END_TEST
+
+START_TEST(test_downloader_reused_curl_handle)
+{
+    int ret;
+    GSList *list = NULL;
+    GError *err = NULL;
+    LrHandle *handle;
+    char *srcfn, *resumefn, *fullfn, *baseurl, *content = NULL;
+    LrDownloadTarget *t1, *t2;
+
+    // One parallel download, so the second transfer reuses the curl
+    // handle of the first one, which must not resume it
+
+    handle = lr_handle_init();
+    fail_if(!handle);
+    fail_if(!lr_handle_setopt(handle, NULL, LRO_MAXPARALLELDOWNLOADS, 1L));
+
+    srcfn = lr_pathconcat(test_globals.tmpdir, "reused_src", NULL);
+    resumefn = lr_pathconcat(test_globals.tmpdir, "reused_resume", NULL);
+    fullfn = lr_pathconcat(test_globals.tmpdir, "reused_full", NULL);
+    fail_if(!g_file_set_contents(srcfn, "0123456789", -1, NULL));
+    fail_if(!g_file_set_contents(resumefn, "01234", -1, NULL));
+    baseurl = lr_pathconcat("file://", test_globals.tmpdir, NULL);
+
+    t1 = lr_downloadtarget_new(handle, "reused_src", baseurl, -1, resumefn,
+                               NULL, 0, TRUE, NULL, NULL, NULL, NULL, NULL,
+                               0, 0);
+    t2 = lr_downloadtarget_new(handle, "reused_src", baseurl, -1, fullfn,
+                               NULL, 0, FALSE, NULL, NULL, NULL, NULL, NULL,
+                               0, 0);
+    list = g_slist_append(list, t1);
+    list = g_slist_append(list, t2);
+
+    ret = lr_download(list, FALSE, &err);
+    fail_if(!ret);
+    fail_if(err);
+    fail_if(t1->err);
+    fail_if(t2->err);
+
+    fail_if(!g_file_get_contents(resumefn, &content, NULL, NULL));
+    ck_assert_str_eq(content, "0123456789");
+    g_free(content);
+    fail_if(!g_file_get_contents(fullfn, &content, NULL, NULL));
+    ck_assert_str_eq(content, "0123456789");
+    g_free(content);
+
+    unlink(srcfn);
+    unlink(resumefn);
+    unlink(fullfn);
+    lr_free(srcfn);
+    lr_free(resumefn);
+    lr_free(fullfn);
+    lr_free(baseurl);
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    lr_handle_free(handle);
+}
+END_TEST
+
+static int
+garbage_mirrorfailurecb(void *clientp,
+                        const char *msg,
+                        G_GNUC_UNUSED const char *url)
+{
+    int *interrupted = clientp;
+    if (strstr(msg, "Interrupted by write callback"))
+        (*interrupted)++;
+    return 0;
+}
+
+START_TEST(test_downloader_garbage)
+{
+    int ret;
+    GSList *list = NULL;
+    GError *err = NULL;
+    LrHandle *handle;
+    char *badmirror, *goodmirror, *rpmfn, *binfn, *content = NULL;
+    LrDownloadTarget *t1, *t2;
+    GSList *checksums = NULL;
+    int interrupted = 0;
+
+    // The first mirror serves an error page instead of the rpm and
+    // a longer file than expected. Both transfers are interrupted
+    // by the write callback and continue from the second mirror.
+
+    badmirror = lr_pathconcat(test_globals.tmpdir, "garbage_bad", NULL);
+    goodmirror = lr_pathconcat(test_globals.tmpdir, "garbage_good", NULL);
+    fail_if(mkdir(badmirror, 0777) && errno != EEXIST);
+    fail_if(mkdir(goodmirror, 0777) && errno != EEXIST);
+
+    rpmfn = lr_pathconcat(badmirror, "pkg.rpm", NULL);
+    fail_if(!g_file_set_contents(rpmfn, "<html>Log in first</html>", -1, NULL));
+    lr_free(rpmfn);
+    rpmfn = lr_pathconcat(badmirror, "data.bin", NULL);
+    fail_if(!g_file_set_contents(rpmfn, "0123456789ABCDEF", -1, NULL));
+    lr_free(rpmfn);
+    rpmfn = lr_pathconcat(goodmirror, "pkg.rpm", NULL);
+    fail_if(!g_file_set_contents(rpmfn, "\xed\xab\xee\xdbrpm content", -1, NULL));
+    lr_free(rpmfn);
+    rpmfn = lr_pathconcat(goodmirror, "data.bin", NULL);
+    fail_if(!g_file_set_contents(rpmfn, "0123456789", -1, NULL));
+    lr_free(rpmfn);
+
+    // Local mirrors (the paths are turned into file:// urls)
+    char *urls[] = {badmirror, goodmirror, NULL};
+
+    handle = lr_handle_init();
+    fail_if(!handle);
+    fail_if(!lr_handle_setopt(handle, NULL, LRO_URLS, urls));
+    fail_if(!lr_handle_setopt(handle, NULL, LRO_REPOTYPE, LR_YUMREPO));
+    fail_if(!lr_handle_setopt(handle, NULL, LRO_CHECKMAGIC, 1L));
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &err);
+    fail_if(err);
+
+    rpmfn = lr_pathconcat(test_globals.tmpdir, "garbage_pkg.rpm", NULL);
+    binfn = lr_pathconcat(test_globals.tmpdir, "garbage_data.bin", NULL);
+
+    checksums = g_slist_append(checksums, lr_downloadtargetchecksum_new(
+                    LR_CHECKSUM_SHA256,
+                    "75c17e3b987b73317afb397fc1f979a4af0f19e35c4bf610ddef1249a75174aa"));
+    t1 = lr_downloadtarget_new(handle, "pkg.rpm", NULL, -1, rpmfn, checksums,
+                               0, FALSE, NULL, &interrupted, NULL,
+                               garbage_mirrorfailurecb, NULL, 0, 0);
+    t2 = lr_downloadtarget_new(handle, "data.bin", NULL, -1, binfn, NULL,
+                               10, FALSE, NULL, &interrupted, NULL,
+                               garbage_mirrorfailurecb, NULL, 0, 0);
+    list = g_slist_append(list, t1);
+    list = g_slist_append(list, t2);
+
+    ret = lr_download(list, FALSE, &err);
+    fail_if(!ret);
+    fail_if(err);
+    fail_if(t1->err);
+    fail_if(t2->err);
+    ck_assert_int_eq(interrupted, 2);
+
+    fail_if(!g_file_get_contents(binfn, &content, NULL, NULL));
+    ck_assert_str_eq(content, "0123456789");
+    g_free(content);
+
+    unlink(rpmfn);
+    unlink(binfn);
+    lr_free(rpmfn);
+    lr_free(binfn);
+    lr_free(badmirror);
+    lr_free(goodmirror);
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    lr_handle_free(handle);
+}
+END_TEST
+
+static int
+resume_mirrorfailurecb(void *clientp,
+                       G_GNUC_UNUSED const char *msg,
+                       G_GNUC_UNUSED const char *url)
+{
+    int *failures = clientp;
+    (*failures)++;
+    return 0;
+}
+
+START_TEST(test_downloader_mirror_resume)
+{
+    int ret;
+    GSList *list = NULL;
+    GError *err = NULL;
+    LrHandle *handle;
+    char *truncmirror, *fullmirror, *fn, *resumefn, *badresumefn;
+    char *content = NULL;
+    LrDownloadTarget *t1, *t2;
+    GSList *checksums1 = NULL, *checksums2 = NULL;
+    int failures1 = 0, failures2 = 0;
+
+    // The first mirror serves truncated files. The second mirror serves
+    // resume.bin with a different beginning, so only a download resumed
+    // from the data of the first mirror passes the checksum. The data of
+    // badresume.bin from the first mirror are bad, the resumed file fails
+    // the checksum and the whole file is downloaded again from all
+    // the mirrors.
+
+    truncmirror = lr_pathconcat(test_globals.tmpdir, "resume_trunc", NULL);
+    fullmirror = lr_pathconcat(test_globals.tmpdir, "resume_full", NULL);
+    fail_if(mkdir(truncmirror, 0777) && errno != EEXIST);
+    fail_if(mkdir(fullmirror, 0777) && errno != EEXIST);
+
+    fn = lr_pathconcat(truncmirror, "resume.bin", NULL);
+    fail_if(!g_file_set_contents(fn, "01234", -1, NULL));
+    lr_free(fn);
+    fn = lr_pathconcat(truncmirror, "badresume.bin", NULL);
+    fail_if(!g_file_set_contents(fn, "abcde", -1, NULL));
+    lr_free(fn);
+    fn = lr_pathconcat(fullmirror, "resume.bin", NULL);
+    fail_if(!g_file_set_contents(fn, "XXXXX56789", -1, NULL));
+    lr_free(fn);
+    fn = lr_pathconcat(fullmirror, "badresume.bin", NULL);
+    fail_if(!g_file_set_contents(fn, "9876543210", -1, NULL));
+    lr_free(fn);
+
+    // Local mirrors (the paths are turned into file:// urls)
+    char *urls[] = {truncmirror, fullmirror, NULL};
+
+    handle = lr_handle_init();
+    fail_if(!handle);
+    fail_if(!lr_handle_setopt(handle, NULL, LRO_URLS, urls));
+    fail_if(!lr_handle_setopt(handle, NULL, LRO_REPOTYPE, LR_YUMREPO));
+    fail_if(!lr_handle_setopt(handle, NULL, LRO_MIRRORRESUME, 1L));
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &err);
+    fail_if(err);
+
+    resumefn = lr_pathconcat(test_globals.tmpdir, "resume_resume.bin", NULL);
+    badresumefn = lr_pathconcat(test_globals.tmpdir, "resume_badresume.bin",
+                                NULL);
+
+    checksums1 = g_slist_append(checksums1, lr_downloadtargetchecksum_new(
+                    LR_CHECKSUM_SHA256,
+                    "84d89877f0d4041efb6bf91a16f0248f2fd573e6af05c19f96bedb9f882f7882"));
+    checksums2 = g_slist_append(checksums2, lr_downloadtargetchecksum_new(
+                    LR_CHECKSUM_SHA256,
+                    "7619ee8cea49187f309616e30ecf54be072259b43760f1f550a644945d5572f2"));
+    t1 = lr_downloadtarget_new(handle, "resume.bin", NULL, -1, resumefn,
+                               checksums1, 10, FALSE, NULL, &failures1, NULL,
+                               resume_mirrorfailurecb, NULL, 0, 0);
+    t2 = lr_downloadtarget_new(handle, "badresume.bin", NULL, -1, badresumefn,
+                               checksums2, 10, FALSE, NULL, &failures2, NULL,
+                               resume_mirrorfailurecb, NULL, 0, 0);
+    list = g_slist_append(list, t1);
+    list = g_slist_append(list, t2);
+
+    ret = lr_download(list, FALSE, &err);
+    fail_if(!ret);
+    fail_if(err);
+    fail_if(t1->err, "%s", t1->err);
+    fail_if(t2->err, "%s", t2->err);
+
+    // Truncated file, resumed from the second mirror
+    ck_assert_int_eq(failures1, 1);
+    fail_if(!g_file_get_contents(resumefn, &content, NULL, NULL));
+    ck_assert_str_eq(content, "0123456789");
+    g_free(content);
+
+    // Truncated file, bad checksum of the resumed file, truncated file
+    // again (without resuming) and the complete file from the second mirror
+    ck_assert_int_eq(failures2, 3);
+    fail_if(!g_file_get_contents(badresumefn, &content, NULL, NULL));
+    ck_assert_str_eq(content, "9876543210");
+    g_free(content);
+
+    unlink(resumefn);
+    unlink(badresumefn);
+    lr_free(resumefn);
+    lr_free(badresumefn);
+    lr_free(truncmirror);
+    lr_free(fullmirror);
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    lr_handle_free(handle);
+}
+END_TEST
+
+START_TEST(test_downloader_adaptive_connect_timeout)
+{
+    // Nothing observed yet
+    ck_assert_int_eq(lr_adaptive_connect_timeout(0.0, 0.0, 30000), 30000);
+
+    // 4 * (srtt + 4 * rttvar)
+    ck_assert_int_eq(lr_adaptive_connect_timeout(0.5, 0.125, 30000), 4000);
+    ck_assert_int_eq(lr_adaptive_connect_timeout(1.0, 0.5, 30000), 12000);
+
+    // Clamped to 3 s at least
+    ck_assert_int_eq(lr_adaptive_connect_timeout(0.01, 0.005, 30000), 3000);
+
+    // Never more than the max timeout (LRO_CONNECTTIMEOUT)
+    ck_assert_int_eq(lr_adaptive_connect_timeout(5.0, 2.0, 30000), 30000);
+    ck_assert_int_eq(lr_adaptive_connect_timeout(0.01, 0.005, 2000), 2000);
+}
+END_TEST
+
+START_TEST(test_downloader_rate_too_slow)
+{
+    double rates[64];
+
+    // Not enough rates to judge
+    rates[0] = rates[1] = rates[2] = 1000000.0;
+    fail_if(lr_rate_too_slow(1.0, rates, 3));
+
+    // Median of 100, 1000, 1000, 5000, 1000000 (in any order) is 1000
+    rates[0] = 1000000.0;
+    rates[1] = 1000.0;
+    rates[2] = 100.0;
+    rates[3] = 5000.0;
+    rates[4] = 1000.0;
+    fail_if(!lr_rate_too_slow(99.0, rates, 5));
+    fail_if(lr_rate_too_slow(100.0, rates, 5));
+    fail_if(lr_rate_too_slow(1000.0, rates, 5));
+
+    // The order of the rates is kept
+    ck_assert(rates[0] == 1000000.0 && rates[2] == 100.0);
+
+    // A wrapped ring buffer of the downloader holds the last 64 rates
+    for (int x = 0; x < 64; x++)
+        rates[x] = 10000.0;
+    fail_if(!lr_rate_too_slow(999.0, rates, 100));
+    fail_if(lr_rate_too_slow(1000.0, rates, 100));
+}
+END_TEST
+
+START_TEST(test_downloader_autotune_decide)
+{
+    LrAutotuneState state = { .min = 2, .max = 8, .prev_limit = 4, };
+    int limit = 4;
+
+    // Not all slots are used - no growing
+    limit = lr_autotune_decide(&state, limit, 3, 1000.0, 0);
+    ck_assert_int_eq(limit, 4);
+
+    // All slots are used - grow by one
+    limit = lr_autotune_decide(&state, limit, 4, 1000.0, 0);
+    ck_assert_int_eq(limit, 5);
+
+    // The throughput rose by 10 % - grow again
+    limit = lr_autotune_decide(&state, limit, 5, 1100.0, 0);
+    ck_assert_int_eq(limit, 6);
+
+    // The throughput rose by less than 10 % - revert the growth
+    limit = lr_autotune_decide(&state, limit, 6, 1200.0, 0);
+    ck_assert_int_eq(limit, 5);
+
+    // Hold for 5 intervals even if all slots are used
+    for (int x = 0; x < 5; x++) {
+        limit = lr_autotune_decide(&state, limit, limit, 1200.0, 0);
+        ck_assert_int_eq(limit, 5);
+    }
+    limit = lr_autotune_decide(&state, limit, limit, 1200.0, 0);
+    ck_assert_int_eq(limit, 6);
+
+    // Back off on errors by a quarter (at least by one), then hold
+    state.prev_limit = limit = 8;
+    limit = lr_autotune_decide(&state, limit, limit, 5000.0, 1);
+    ck_assert_int_eq(limit, 6);
+    limit = lr_autotune_decide(&state, limit, limit, 5000.0, 2);
+    ck_assert_int_eq(limit, 5);
+    for (int x = 0; x < 5; x++) {
+        limit = lr_autotune_decide(&state, limit, limit, 5000.0, 0);
+        ck_assert_int_eq(limit, 5);
+    }
+    limit = lr_autotune_decide(&state, limit, limit, 5000.0, 0);
+    ck_assert_int_eq(limit, 6);
+
+    // Never below the min
+    limit = 2;
+    limit = lr_autotune_decide(&state, limit, limit, 5000.0, 3);
+    ck_assert_int_eq(limit, 2);
+
+    // Never above the max
+    state.hold = 0;
+    state.prev_limit = limit = 8;
+    limit = lr_autotune_decide(&state, limit, limit, 5000.0, 0);
+    ck_assert_int_eq(limit, 8);
+}
+END_TEST
+
+/** Handler of a request to the test HTTP server.
+ * @param fd            The connection
+ * @param server        Index of the port the request came to
+ * @param path          Requested path
+ * @param from          Start of the requested range or 0
+ * @return              FALSE to close the connection
+ */
+typedef gboolean (*HttpHandler)(int fd,
+                                int server,
+                                const char *path,
+                                gint64 from);
+
+/** Send the range of the body starting at from, but only the first
+ * send bytes of it.
+ */
+static gboolean
+http_respond(int fd, const char *body, gint64 len, gint64 from, gint64 send)
+{
+    GString *response = g_string_new(NULL);
+    gboolean ret = TRUE;
+
+    if (from > 0)
+        g_string_printf(response, "HTTP/1.1 206 Partial Content\r\n"
+                        "Content-Range: bytes %"G_GINT64_FORMAT"-%"
+                        G_GINT64_FORMAT"/%"G_GINT64_FORMAT"\r\n",
+                        from, len - 1, len);
+    else
+        g_string_printf(response, "HTTP/1.1 200 OK\r\n");
+    g_string_append_printf(response, "Content-Length: %"G_GINT64_FORMAT"\r\n"
+                           "Content-Type: application/octet-stream\r\n"
+                           "\r\n", len - from);
+    g_string_append_len(response, body + from, MIN(send, len - from));
+
+    for (gsize sent = 0; sent < response->len; ) {
+        ssize_t rc = write(fd, response->str + sent, response->len - sent);
+        if (rc <= 0) {
+            ret = FALSE;
+            break;
+        }
+        sent += rc;
+    }
+
+    g_string_free(response, TRUE);
+    return ret;
+}
+
+/** Serve the requests of one keep-alive connection.
+ */
+static void
+http_serve_connection(int fd, int server, HttpHandler handler)
+{
+    char buf[4096];
+    size_t len = 0;
+
+    while (1) {
+        char *end;
+        ssize_t rc;
+
+        buf[len] = '\0';
+        while (!(end = strstr(buf, "\r\n\r\n"))) {
+            if (len == sizeof(buf) - 1)
+                return;
+            rc = read(fd, buf + len, sizeof(buf) - 1 - len);
+            if (rc <= 0)
+                return;
+            len += rc;
+            buf[len] = '\0';
+        }
+
+        char path[256] = "";
+        if (sscanf(buf, "GET %255s", path) != 1)
+            return;
+
+        gint64 from = 0;
+        char *headers = g_strndup(buf, end - buf);
+        char *range = strstr(headers, "\r\nRange: bytes=");
+        if (range)
+            from = g_ascii_strtoll(range + strlen("\r\nRange: bytes="),
+                                   NULL, 10);
+        g_free(headers);
+
+        if (!handler(fd, server, path, from))
+            return;
+
+        end += 4;
+        len -= end - buf;
+        memmove(buf, end, len);
+    }
+}
+
+/** Start a HTTP server listening on two ports of the loopback.
+ * The requests are answered by the handler.
+ * @return              pid of the server process
+ */
+static pid_t
+http_server_start(int ports[2], HttpHandler handler)
+{
+    int socks[2];
+
+    for (int x = 0; x < 2; x++) {
+        struct sockaddr_in addr;
+        socklen_t addrlen = sizeof(addr);
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+
+        socks[x] = socket(AF_INET, SOCK_STREAM, 0);
+        fail_if(socks[x] < 0);
+        fail_if(bind(socks[x], (struct sockaddr *) &addr, sizeof(addr)));
+        fail_if(listen(socks[x], 8));
+        fail_if(getsockname(socks[x], (struct sockaddr *) &addr, &addrlen));
+        ports[x] = ntohs(addr.sin_port);
+    }
+
+    pid_t pid = fork();
+    fail_if(pid < 0);
+    if (pid > 0) {
+        close(socks[0]);
+        close(socks[1]);
+        return pid;
+    }
+
+    // Server, every connection is served by its own process.
+    // It ends together with the test.
+    pid_t test = getppid();
+    signal(SIGCHLD, SIG_IGN);
+    while (getppid() == test) {
+        struct pollfd fds[2] = {{socks[0], POLLIN, 0}, {socks[1], POLLIN, 0}};
+        if (poll(fds, 2, 100) <= 0)
+            continue;
+        for (int x = 0; x < 2; x++) {
+            if (!(fds[x].revents & POLLIN))
+                continue;
+            int conn = accept(socks[x], NULL, NULL);
+            if (conn < 0)
+                continue;
+            if (fork() == 0) {
+                close(socks[0]);
+                close(socks[1]);
+                http_serve_connection(conn, x, handler);
+                _exit(0);
+            }
+            close(conn);
+        }
+    }
+    _exit(0);
+}
+
+/** The body of every response is the requested path.
+ */
+static gboolean
+affinity_handler(int fd,
+                 G_GNUC_UNUSED int server,
+                 const char *path,
+                 G_GNUC_UNUSED gint64 from)
+{
+    return http_respond(fd, path, strlen(path), 0, strlen(path));
+}
+
+static void
+affinity_endcb(void *clientp,
+               LrTransferStatus status,
+               G_GNUC_UNUSED const char *msg)
+{
+    char **order = clientp;
+    GString *log = (GString *) order[0];
+
+    if (status == LR_TRANSFER_SUCCESSFUL)
+        g_string_append(log, order[1]);
+}
+
+/** Download files interleaved from two base urls one by one.
+ * @return              names of the files in the order of the downloads
+ */
+static char *
+affinity_download(int ports[2], gboolean affinity, long *transfers,
+                  long *reused)
+{
+    LrHandle *handle;
+    GSList *list = NULL;
+    GError *err = NULL;
+    GString *log = g_string_new(NULL);
+    char *names[] = {"a1", "b1", "a2", "b2", "a3", "b3"};
+    char *cbdata[6][2];
+    char *baseurls[2];
+    int ret;
+
+    for (int x = 0; x < 2; x++)
+        baseurls[x] = g_strdup_printf("http://127.0.0.1:%d/%c/",
+                                      ports[x], 'a' + x);
+
+    // A new handle, so no connection is open yet
+    handle = lr_handle_init();
+    fail_if(!handle);
+    fail_if(!lr_handle_setopt(handle, NULL, LRO_MAXPARALLELDOWNLOADS, 1L));
+    fail_if(!lr_handle_setopt(handle, NULL, LRO_CONNECTIONAFFINITY,
+                              (long) affinity));
+
+    for (int x = 0; x < 6; x++) {
+        char *basename = g_strconcat("affinity_", names[x], NULL);
+        char *fn = lr_pathconcat(test_globals.tmpdir, basename, NULL);
+        cbdata[x][0] = (char *) log;
+        cbdata[x][1] = names[x];
+        list = g_slist_append(list, lr_downloadtarget_new(handle, names[x],
+                              baseurls[names[x][0] - 'a'], -1, fn, NULL, 0,
+                              FALSE, NULL, cbdata[x], affinity_endcb, NULL,
+                              NULL, 0, 0));
+        g_free(basename);
+        lr_free(fn);
+    }
+
+    ret = lr_download(list, FALSE, &err);
+    fail_if(!ret);
+    fail_if(err);
+
+    for (GSList *elem = list; elem; elem = g_slist_next(elem)) {
+        LrDownloadTarget *target = elem->data;
+        fail_if(target->err, "%s", target->err);
+        unlink(target->fn);
+    }
+
+    fail_if(!lr_handle_getinfo(handle, NULL, LRI_TRANSFERS, transfers));
+    fail_if(!lr_handle_getinfo(handle, NULL, LRI_REUSEDCONNECTIONS, reused));
+
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    lr_handle_free(handle);
+    g_free(baseurls[0]);
+    g_free(baseurls[1]);
+    return g_string_free(log, FALSE);
+}
+
+START_TEST(test_downloader_connection_affinity)
+{
+    int ports[2];
+    long transfers = 0, reused = 0;
+    char *order;
+    pid_t server;
+
+    server = http_server_start(ports, affinity_handler);
+
+    // Without the affinity the targets are started in the order of the list
+    order = affinity_download(ports, FALSE, &transfers, &reused);
+    ck_assert_str_eq(order, "a1b1a2b2a3b3");
+    ck_assert_int_eq(transfers, 6);
+    fail_if(reused > transfers);
+    g_free(order);
+
+    // With the affinity a finished transfer is followed by the target
+    // from the same base url, which reuses its connection
+    order = affinity_download(ports, TRUE, &transfers, &reused);
+    ck_assert_str_eq(order, "a1a2a3b1b2b3");
+    ck_assert_int_eq(transfers, 6);
+    ck_assert_int_eq(reused, 4);
+    g_free(order);
+
+    kill(server, SIGKILL);
+    waitpid(server, NULL, 0);
+}
+END_TEST
+
+/** The first server and the second one for broken.bin send a half of
+ * the requested data and reset the connection. The second server
+ * serves a different beginning of the file, so only a download resumed
+ * from the data of the first one is good.
+ */
+static gboolean
+reset_handler(int fd, int server, const char *path, gint64 from)
+{
+    const char *body = server == 0 ? "0123456789" : "XXXXX56789";
+
+    if (server == 0 || g_str_has_suffix(path, "/broken.bin")) {
+        struct linger linger = {1, 0};
+        http_respond(fd, body, 10, from, (10 - from) / 2);
+        // Let the client read the data before the reset
+        usleep(200000);
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+        return FALSE;
+    }
+
+    return http_respond(fd, body, 10, from, 10 - from);
+}
+
+START_TEST(test_downloader_mirror_resume_reset)
+{
+    int ret;
+    int ports[2];
+    pid_t server;
+    GSList *list = NULL;
+    GError *err = NULL;
+    LrHandle *handle;
+    char *urls[3];
+    char *resumefn, *brokenfn;
+    char *content = NULL;
+    gsize len = 0;
+    LrDownloadTarget *t1, *t2;
+    GSList *checksums1 = NULL, *checksums2 = NULL;
+    int failures1 = 0, failures2 = 0;
+
+    server = http_server_start(ports, reset_handler);
+
+    urls[0] = g_strdup_printf("http://127.0.0.1:%d/", ports[0]);
+    urls[1] = g_strdup_printf("http://127.0.0.1:%d/", ports[1]);
+    urls[2] = NULL;
+
+    handle = lr_handle_init();
+    fail_if(!handle);
+    fail_if(!lr_handle_setopt(handle, NULL, LRO_URLS, urls));
+    fail_if(!lr_handle_setopt(handle, NULL, LRO_REPOTYPE, LR_YUMREPO));
+    fail_if(!lr_handle_setopt(handle, NULL, LRO_MAXPARALLELDOWNLOADS, 1L));
+    fail_if(!lr_handle_setopt(handle, NULL, LRO_MIRRORRESUME, 1L));
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &err);
+    fail_if(err);
+
+    resumefn = lr_pathconcat(test_globals.tmpdir, "reset_resume.bin", NULL);
+    brokenfn = lr_pathconcat(test_globals.tmpdir, "reset_broken.bin", NULL);
+
+    checksums1 = g_slist_append(checksums1, lr_downloadtargetchecksum_new(
+                    LR_CHECKSUM_SHA256,
+                    "84d89877f0d4041efb6bf91a16f0248f2fd573e6af05c19f96bedb9f882f7882"));
+    checksums2 = g_slist_append(checksums2, lr_downloadtargetchecksum_new(
+                    LR_CHECKSUM_SHA256,
+                    "7619ee8cea49187f309616e30ecf54be072259b43760f1f550a644945d5572f2"));
+    t1 = lr_downloadtarget_new(handle, "resume.bin", NULL, -1, resumefn,
+                               checksums1, 10, FALSE, NULL, &failures1, NULL,
+                               resume_mirrorfailurecb, NULL, 0, 0);
+    t2 = lr_downloadtarget_new(handle, "broken.bin", NULL, -1, brokenfn,
+                               checksums2, 10, FALSE, NULL, &failures2, NULL,
+                               resume_mirrorfailurecb, NULL, 0, 0);
+    list = g_slist_append(list, t1);
+    list = g_slist_append(list, t2);
+
+    ret = lr_download(list, FALSE, &err);
+    fail_if(!ret);
+    fail_if(err);
+
+    // Connection reset by the first mirror, resumed from the second one
+    fail_if(t1->err, "%s", t1->err);
+    ck_assert_int_eq(failures1, 1);
+    fail_if(!g_file_get_contents(resumefn, &content, NULL, NULL));
+    ck_assert_str_eq(content, "0123456789");
+    g_free(content);
+
+    // Connection reset by both mirrors, the kept data are removed
+    fail_if(!t2->err);
+    ck_assert_int_eq(failures2, 2);
+    fail_if(!g_file_get_contents(brokenfn, &content, &len, NULL));
+    ck_assert_int_eq(len, 0);
+    g_free(content);
+
+    // The same when the target fails by LRO_MAXMIRRORTRIES
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    list = NULL;
+    failures2 = 0;
+    fail_if(!lr_handle_setopt(handle, NULL, LRO_MAXMIRRORTRIES, 2L));
+    checksums2 = g_slist_append(NULL, lr_downloadtargetchecksum_new(
+                    LR_CHECKSUM_SHA256,
+                    "7619ee8cea49187f309616e30ecf54be072259b43760f1f550a644945d5572f2"));
+    t2 = lr_downloadtarget_new(handle, "broken.bin", NULL, -1, brokenfn,
+                               checksums2, 10, FALSE, NULL, &failures2, NULL,
+                               resume_mirrorfailurecb, NULL, 0, 0);
+    list = g_slist_append(list, t2);
+
+    ret = lr_download(list, FALSE, &err);
+    fail_if(!ret);
+    fail_if(err);
+    fail_if(!t2->err);
+    ck_assert_int_eq(failures2, 2);
+    fail_if(!g_file_get_contents(brokenfn, &content, &len, NULL));
+    ck_assert_int_eq(len, 0);
+    g_free(content);
+
+    unlink(resumefn);
+    unlink(brokenfn);
+    lr_free(resumefn);
+    lr_free(brokenfn);
+    g_free(urls[0]);
+    g_free(urls[1]);
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    lr_handle_free(handle);
+    kill(server, SIGKILL);
+    waitpid(server, NULL, 0);
+}
+END_TEST
+
 Suite *
 downloader_suite(void)
 {
@@ -300,6 +1117,15 @@ downloader_suite(void)
     tcase_add_test(tc, test_downloader_single_file_2);
     tcase_add_test(tc, test_downloader_two_files);
     tcase_add_test(tc, test_downloader_three_files_with_error);
+    tcase_add_test(tc, test_downloader_checksum);
+    tcase_add_test(tc, test_downloader_reused_curl_handle);
+    tcase_add_test(tc, test_downloader_garbage);
+    tcase_add_test(tc, test_downloader_mirror_resume);
+    tcase_add_test(tc, test_downloader_adaptive_connect_timeout);
+    tcase_add_test(tc, test_downloader_rate_too_slow);
+    tcase_add_test(tc, test_downloader_autotune_decide);
+    tcase_add_test(tc, test_downloader_connection_affinity);
+    tcase_add_test(tc, test_downloader_mirror_resume_reset);
     suite_add_tcase(s, tc);
     return s;
 }
@@ -0,0 +1,299 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "librepo/util.h"
+#include "librepo/handle.h"
+#include "librepo/handle_internal.h"
+#include "librepo/lrmirrorlist.h"
+#include "librepo/fastestmirror.h"
+#include "librepo/fastestmirror_internal.h"
+#include "librepo/fastestmirrorcache_internal.h"
+
+#include "fixtures.h"
+#include "testsys.h"
+#include "test_fastestmirror.h"
+
+#define URL_A   "http://a.example.com/repo/"
+#define URL_B   "http://b.example.com/repo/"
+
+static void
+cache_store(const char *path, const char *url, double connecttime)
+{
+    LrFastestMirrorCache *cache;
+    LrFastestMirrorCacheEntry entry;
+    GError *tmp_err = NULL;
+
+    fail_if(!lr_fastestmirrorcache_load(&cache, path, &tmp_err));
+    fail_if(tmp_err);
+    entry.ts = g_get_real_time() / 1000000;
+    entry.connecttime = connecttime;
+    entry.ttfb = 0.0;
+    entry.throughput = 0.0;
+    lr_fastestmirrorcache_update(cache, url, &entry);
+    fail_if(!lr_fastestmirrorcache_write(cache, &tmp_err));
+    fail_if(tmp_err);
+    lr_fastestmirrorcache_free(cache);
+}
+
+START_TEST(test_fastestmirrorcache)
+{
+    char *path;
+    gboolean ret;
+    LrFastestMirrorCache *cache;
+    LrFastestMirrorCacheEntry entry;
+    GError *tmp_err = NULL;
+
+    path = lr_pathconcat(test_globals.tmpdir, "/fastestmirror.cache", NULL);
+
+    // Cache doesn't exist
+    ret = lr_fastestmirrorcache_load(&cache, path, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    fail_if(lr_fastestmirrorcache_lookup(cache, URL_A, &entry));
+
+    entry.ts = g_get_real_time() / 1000000;
+    entry.connecttime = 0.25;
+    entry.ttfb = 0.5;
+    entry.throughput = 1000.0;
+    lr_fastestmirrorcache_update(cache, URL_A, &entry);
+    ret = lr_fastestmirrorcache_write(cache, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    lr_fastestmirrorcache_free(cache);
+
+    // Record survives writing and reloading of the cache
+    ret = lr_fastestmirrorcache_load(&cache, path, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    fail_if(!lr_fastestmirrorcache_lookup(cache, URL_A, &entry));
+    fail_if(entry.connecttime != 0.25);
+    fail_if(entry.ttfb != 0.5);
+    fail_if(entry.throughput != 1000.0);
+    fail_if(lr_fastestmirrorcache_lookup(cache, URL_B, &entry));
+
+    // Record written by somebody else in the meantime is not lost
+    cache_store(path, URL_B, 0.75);
+    entry.connecttime = 0.125;
+    lr_fastestmirrorcache_update(cache, URL_A, &entry);
+    ret = lr_fastestmirrorcache_write(cache, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    lr_fastestmirrorcache_free(cache);
+
+    ret = lr_fastestmirrorcache_load(&cache, path, &tmp_err);
+    fail_if(!ret);
+    fail_if(!lr_fastestmirrorcache_lookup(cache, URL_A, &entry));
+    fail_if(entry.connecttime != 0.125);
+    fail_if(!lr_fastestmirrorcache_lookup(cache, URL_B, &entry));
+    fail_if(entry.connecttime != 0.75);
+    lr_fastestmirrorcache_free(cache);
+
+    unlink(path);
+    lr_free(path);
+}
+END_TEST
+
+START_TEST(test_fastestmirrorcache_concurrent)
+{
+    char *path, *url;
+    int status;
+    pid_t pids[8];
+    LrFastestMirrorCache *cache;
+    LrFastestMirrorCacheEntry entry;
+
+    path = lr_pathconcat(test_globals.tmpdir, "/fastestmirror.cache", NULL);
+
+    for (int x = 0; x < 8; x++) {
+        pids[x] = fork();
+        fail_if(pids[x] < 0);
+        if (pids[x] == 0) {
+            url = g_strdup_printf("http://%d.example.com/", x);
+            cache_store(path, url, x);
+            _exit(0);
+        }
+    }
+
+    for (int x = 0; x < 8; x++) {
+        fail_if(waitpid(pids[x], &status, 0) != pids[x]);
+        fail_if(!WIFEXITED(status) || WEXITSTATUS(status));
+    }
+
+    // Every writer has its record in the cache
+    fail_if(!lr_fastestmirrorcache_load(&cache, path, NULL));
+    for (int x = 0; x < 8; x++) {
+        url = g_strdup_printf("http://%d.example.com/", x);
+        fail_if(!lr_fastestmirrorcache_lookup(cache, url, &entry));
+        fail_if(entry.connecttime != x);
+        g_free(url);
+    }
+    lr_fastestmirrorcache_free(cache);
+
+    unlink(path);
+    lr_free(path);
+}
+END_TEST
+
+START_TEST(test_fastestmirrorcache_old_format)
+{
+    char *path;
+    gboolean ret;
+    FILE *f;
+    LrFastestMirrorCache *cache;
+    LrFastestMirrorCacheEntry entry;
+    GError *tmp_err = NULL;
+    gint64 ts = g_get_real_time() / 1000000;
+
+    path = lr_pathconcat(test_globals.tmpdir, "/fastestmirror.cache", NULL);
+
+    f = fopen(path, "w");
+    fail_if(!f);
+    fprintf(f, "[:_librepo_:]\nversion=1\n\n"
+               "[" URL_A "]\nts=%"G_GINT64_FORMAT"\nconnectime=0.5\n",
+               ts);
+    fclose(f);
+
+    ret = lr_fastestmirrorcache_load(&cache, path, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    fail_if(!lr_fastestmirrorcache_lookup(cache, URL_A, &entry));
+    fail_if(entry.ts != ts);
+    fail_if(entry.connecttime != 0.5);
+    fail_if(entry.throughput != 0.0);
+
+    // The next write converts the cache to the binary format
+    ret = lr_fastestmirrorcache_write(cache, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    lr_fastestmirrorcache_free(cache);
+
+    ret = lr_fastestmirrorcache_load(&cache, path, &tmp_err);
+    fail_if(!ret);
+    fail_if(!lr_fastestmirrorcache_lookup(cache, URL_A, &entry));
+    fail_if(entry.connecttime != 0.5);
+    lr_fastestmirrorcache_free(cache);
+
+    // Garbage is reported
+    f = fopen(path, "w");
+    fail_if(!f);
+    fputs("garbage", f);
+    fclose(f);
+    ret = lr_fastestmirrorcache_load(&cache, path, &tmp_err);
+    fail_if(ret);
+    fail_if(!tmp_err);
+    g_error_free(tmp_err);
+    fail_if(lr_fastestmirrorcache_lookup(cache, URL_A, &entry));
+    lr_fastestmirrorcache_free(cache);
+
+    unlink(path);
+    lr_free(path);
+}
+END_TEST
+
+START_TEST(test_fastestmirror_detection_cached)
+{
+    char *path;
+    gboolean ret;
+    LrHandle *h;
+    LrInternalMirror *mirror;
+    LrFastestMirrorDetection *detection;
+    GSList *handles;
+    GError *tmp_err = NULL;
+    char *urls[] = {URL_A, URL_B, NULL};
+
+    path = lr_pathconcat(test_globals.tmpdir, "/fastestmirror.cache", NULL);
+    // Measurements are cached per host
+    cache_store(path, "http://a.example.com", 0.75);
+    cache_store(path, "http://b.example.com", 0.25);
+
+    h = lr_handle_init();
+    fail_if(!lr_handle_setopt(h, NULL, LRO_URLS, urls));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_REPOTYPE, LR_YUMREPO));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_FASTESTMIRROR, 1L));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_FASTESTMIRRORASYNC, 1L));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_FASTESTMIRRORCACHE, path));
+    ret = lr_handle_prepare_internal_mirrorlist(h, FALSE, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+
+    // Mirrors are ranked by the cache before any probe is done
+    handles = g_slist_prepend(NULL, h);
+    detection = lr_fastestmirror_detection_new(handles, &tmp_err);
+    fail_if(!detection);
+    fail_if(tmp_err);
+    mirror = h->internal_mirrorlist->data;
+    ck_assert_str_eq(mirror->url, URL_B);
+    fail_if(lr_fastestmirror_detection_cmp(detection, URL_B, URL_A) >= 0);
+    fail_if(lr_fastestmirror_detection_cmp(detection, URL_A, URL_B) <= 0);
+
+    lr_fastestmirror_detection_free(detection);
+    g_slist_free(handles);
+    lr_handle_free(h);
+    unlink(path);
+    lr_free(path);
+}
+END_TEST
+
+START_TEST(test_fastestmirror_hosts)
+{
+    char *path;
+    gboolean ret;
+    LrHandle *h;
+    LrFastestMirrorCache *cache;
+    LrFastestMirrorCacheEntry entry;
+    GSList *list = NULL;
+    GError *tmp_err = NULL;
+
+    path = lr_pathconcat(test_globals.tmpdir, "/fastestmirror.cache", NULL);
+    cache_store(path, "http://a.example.com", 0.75);
+    cache_store(path, "http://b.example.com", 0.25);
+
+    h = lr_handle_init();
+    fail_if(!lr_handle_setopt(h, NULL, LRO_FASTESTMIRRORCACHE, path));
+
+    // All URLs of a server share one (here cached) measurement
+    list = g_slist_append(list, "http://a.example.com/repo1/");
+    list = g_slist_append(list, "HTTP://B.example.com:80/repo1/");
+    list = g_slist_append(list, "http://a.example.com/repo2/");
+    list = g_slist_append(list, "http://user@b.example.com/repo2/");
+    ret = lr_fastestmirror(h, &list, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    fail_if(g_slist_length(list) != 4);
+    ck_assert_str_eq(g_slist_nth_data(list, 0), "HTTP://B.example.com:80/repo1/");
+    ck_assert_str_eq(g_slist_nth_data(list, 1), "http://a.example.com/repo1/");
+    ck_assert_str_eq(g_slist_nth_data(list, 2), "http://a.example.com/repo2/");
+    ck_assert_str_eq(g_slist_nth_data(list, 3), "http://user@b.example.com/repo2/");
+
+    // No per URL records were added
+    fail_if(!lr_fastestmirrorcache_load(&cache, path, &tmp_err));
+    fail_if(lr_fastestmirrorcache_lookup(cache, "http://a.example.com/repo1/",
+                                         &entry));
+    fail_if(!lr_fastestmirrorcache_lookup(cache, "http://b.example.com",
+                                          &entry));
+    lr_fastestmirrorcache_free(cache);
+
+    g_slist_free(list);
+    lr_handle_free(h);
+    unlink(path);
+    lr_free(path);
+}
+END_TEST
+
+Suite *
+fastestmirror_suite(void)
+{
+    Suite *s = suite_create("fastestmirror");
+    TCase *tc = tcase_create("Main");
+    tcase_add_test(tc, test_fastestmirrorcache);
+    tcase_add_test(tc, test_fastestmirrorcache_concurrent);
+    tcase_add_test(tc, test_fastestmirrorcache_old_format);
+    tcase_add_test(tc, test_fastestmirror_detection_cached);
+    tcase_add_test(tc, test_fastestmirror_hosts);
+    suite_add_tcase(s, tc);
+    return s;
+}
@@ -0,0 +1,8 @@
+#ifndef LR_TEST_FASTESTMIRROR_H
+#define LR_TEST_FASTESTMIRROR_H
+
+#include <check.h>
+
+Suite *fastestmirror_suite(void);
+
+#endif
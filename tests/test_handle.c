@@ -118,6 +118,53 @@ START_TEST(test_handle_getinfo)
     fail_if(!lr_handle_getinfo(h, NULL, LRI_FASTESTMIRRORMAXAGE, &num));
     fail_if(num != LRO_FASTESTMIRRORMAXAGE_DEFAULT);
 
+    num = -1;
+    fail_if(!lr_handle_getinfo(h, NULL, LRI_MIRRORRESUME, &num));
+    fail_if(num != 0);
+    fail_if(!lr_handle_setopt(h, NULL, LRO_MIRRORRESUME, 1L));
+    fail_if(!lr_handle_getinfo(h, NULL, LRI_MIRRORRESUME, &num));
+    fail_if(num != 1);
+
+    num = -1;
+    fail_if(!lr_handle_getinfo(h, NULL, LRI_ADAPTIVETIMEOUTS, &num));
+    fail_if(num != 0);
+    fail_if(!lr_handle_setopt(h, NULL, LRO_ADAPTIVETIMEOUTS, 1L));
+    fail_if(!lr_handle_getinfo(h, NULL, LRI_ADAPTIVETIMEOUTS, &num));
+    fail_if(num != 1);
+
+    num = -1;
+    fail_if(!lr_handle_getinfo(h, NULL, LRI_AUTOTUNE, &num));
+    fail_if(num != 0);
+    fail_if(!lr_handle_setopt(h, NULL, LRO_AUTOTUNE, 1L));
+    fail_if(!lr_handle_getinfo(h, NULL, LRI_AUTOTUNE, &num));
+    fail_if(num != 1);
+
+    num = -1;
+    fail_if(!lr_handle_getinfo(h, NULL, LRI_AUTOTUNEDPARALLELDOWNLOADS, &num));
+    fail_if(num != 0);
+    fail_if(lr_handle_setopt(h, NULL, LRO_MINPARALLELDOWNLOADS, 0L));
+
+    num = -1;
+    fail_if(!lr_handle_getinfo(h, NULL, LRI_CONNECTIONAFFINITY, &num));
+    fail_if(num != 0);
+    fail_if(!lr_handle_setopt(h, NULL, LRO_CONNECTIONAFFINITY, 1L));
+    fail_if(!lr_handle_getinfo(h, NULL, LRI_CONNECTIONAFFINITY, &num));
+    fail_if(num != 1);
+
+    num = -1;
+    fail_if(!lr_handle_getinfo(h, NULL, LRI_TRANSFERS, &num));
+    fail_if(num != 0);
+    num = -1;
+    fail_if(!lr_handle_getinfo(h, NULL, LRI_REUSEDCONNECTIONS, &num));
+    fail_if(num != 0);
+
+    num = -1;
+    fail_if(!lr_handle_getinfo(h, NULL, LRI_CHECKMAGIC, &num));
+    fail_if(num != 0);
+    fail_if(!lr_handle_setopt(h, NULL, LRO_CHECKMAGIC, 1L));
+    fail_if(!lr_handle_getinfo(h, NULL, LRI_CHECKMAGIC, &num));
+    fail_if(num != 1);
+
     lr_handle_free(h);
 }
 END_TEST
@@ -1,3 +1,5 @@
+#include <float.h>
+
 #include "testsys.h"
 #include "test_lrmirrorlist.h"
 #include "librepo/lrmirrorlist.h"
@@ -101,11 +103,13 @@ START_TEST(test_lrmirrorlist_append_metalink)
     fail_if(strcmp(mirror->url, "http://foo"));
     fail_if(mirror->preference != 100);
     fail_if(mirror->protocol != LR_PROTOCOL_HTTP);
+    fail_if(strcmp(mirror->location, "CZ"));
 
     mirror = lr_lrmirrorlist_nth(iml, 1);
     fail_if(strcmp(mirror->url, "ftp://bar"));
     fail_if(mirror->preference != 95);
     fail_if(mirror->protocol != LR_PROTOCOL_FTP);
+    fail_if(strcmp(mirror->location, "US"));
 
     fail_if(g_slist_length(iml) != 2);
 
@@ -194,6 +198,160 @@ START_TEST(test_lrmirrorlist_append_lrmirrorlist)
 }
 END_TEST
 
+START_TEST(test_lrmirrorlist_duplicates)
+{
+    LrInternalMirrorlist *iml = NULL;
+    LrMirrorlist ml;
+    LrMetalink mtl;
+    LrInternalMirror *mirror;
+    LrMetalinkUrl url1 = {
+            .protocol = "http",
+            .type = "http",
+            .location = "CZ",
+            .preference = 50,
+            .url = "http://baz/repodata/repomd.xml",
+        };
+    LrMetalinkUrl url2 = {
+            .protocol = "http",
+            .type = "http",
+            .location = "CZ",
+            .preference = 90,
+            .url = "http://baz",
+        };
+    LrMetalinkUrl url3 = {
+            .protocol = "ftp",
+            .type = "ftp",
+            .location = "CZ",
+            .preference = 100,
+            .url = "ftp://bar/repodata/repomd.xml",
+        };
+
+    ml.urls = NULL;
+    ml.urls = g_slist_append(ml.urls, "http://foo");
+    ml.urls = g_slist_append(ml.urls, "ftp://bar");
+    ml.urls = g_slist_append(ml.urls, "http://foo");
+
+    memset(&mtl, 0, sizeof(mtl));
+    mtl.urls = g_slist_append(mtl.urls, &url1);
+    mtl.urls = g_slist_append(mtl.urls, &url2);
+    mtl.urls = g_slist_append(mtl.urls, &url3);
+
+    iml = lr_lrmirrorlist_append_url(iml, "http://foo", NULL);
+    iml = lr_lrmirrorlist_append_url(iml, "http://foo", NULL);
+    fail_if(g_slist_length(iml) != 1);
+
+    iml = lr_lrmirrorlist_append_mirrorlist(iml, &ml, NULL);
+    fail_if(g_slist_length(iml) != 2);
+
+    // Duplicates within the metalink keep the best preference
+    iml = lr_lrmirrorlist_append_metalink(iml, &mtl, "/repodata/repomd.xml", NULL);
+    fail_if(g_slist_length(iml) != 3);
+    ck_assert_str_eq(lr_lrmirrorlist_nth_url(iml, 0), "http://foo");
+    ck_assert_str_eq(lr_lrmirrorlist_nth_url(iml, 1), "ftp://bar");
+    mirror = lr_lrmirrorlist_nth(iml, 2);
+    ck_assert_str_eq(mirror->url, "http://baz");
+    fail_if(mirror->preference != 90);
+
+    iml = lr_lrmirrorlist_append_lrmirrorlist(iml, iml);
+    fail_if(g_slist_length(iml) != 3);
+
+    lr_lrmirrorlist_free(iml);
+    g_slist_free(ml.urls);
+    g_slist_free(mtl.urls);
+}
+END_TEST
+
+START_TEST(test_lrmirrorlist_rank)
+{
+    LrInternalMirrorlist *iml = NULL;
+    GHashTable *connecttimes;
+    double fast = 0.1, slow = 0.15, unreachable = DBL_MAX;
+    char *locations[] = {"de", "CZ", NULL};
+    LrMetalinkUrl urls[] = {
+        { .location = "CZ", .preference = 100, .url = "http://a/" },
+        { .location = "US", .preference = 100, .url = "http://b/" },
+        { .location = "DE", .preference = 90,  .url = "http://c/" },
+        { .location = "DE", .preference = 100, .url = "http://d/" },
+        { .location = NULL, .preference = 100, .url = "http://e/" },
+        { .location = "DE", .preference = 100, .url = "http://f/" },
+    };
+    LrMetalink ml = { .urls = NULL, };
+
+    for (int x = G_N_ELEMENTS(urls) - 1; x >= 0; x--)
+        ml.urls = g_slist_prepend(ml.urls, &urls[x]);
+
+    // Without locations and connect times only the preference matters
+    iml = lr_lrmirrorlist_append_metalink(iml, &ml, NULL, NULL);
+    iml = lr_lrmirrorlist_rank(iml, NULL, NULL);
+    fail_if(strcmp(lr_lrmirrorlist_nth_url(iml, 0), "http://a/"));
+    fail_if(strcmp(lr_lrmirrorlist_nth_url(iml, 1), "http://b/"));
+    fail_if(strcmp(lr_lrmirrorlist_nth_url(iml, 2), "http://d/"));
+    fail_if(strcmp(lr_lrmirrorlist_nth_url(iml, 3), "http://e/"));
+    fail_if(strcmp(lr_lrmirrorlist_nth_url(iml, 4), "http://f/"));
+    fail_if(strcmp(lr_lrmirrorlist_nth_url(iml, 5), "http://c/"));
+    lr_lrmirrorlist_free(iml);
+    iml = NULL;
+
+    // Location first, then the connect time weighted by the preference
+    connecttimes = g_hash_table_new(g_str_hash, g_str_equal);
+    g_hash_table_insert(connecttimes, "http://c", &fast);
+    g_hash_table_insert(connecttimes, "http://d", &slow);
+    g_hash_table_insert(connecttimes, "http://f", &unreachable);
+    iml = lr_lrmirrorlist_append_metalink(iml, &ml, NULL, NULL);
+    iml = lr_lrmirrorlist_rank(iml, locations, connecttimes);
+    fail_if(strcmp(lr_lrmirrorlist_nth_url(iml, 0), "http://c/"));
+    fail_if(strcmp(lr_lrmirrorlist_nth_url(iml, 1), "http://d/"));
+    fail_if(strcmp(lr_lrmirrorlist_nth_url(iml, 2), "http://f/"));
+    fail_if(strcmp(lr_lrmirrorlist_nth_url(iml, 3), "http://a/"));
+    fail_if(strcmp(lr_lrmirrorlist_nth_url(iml, 4), "http://b/"));
+    fail_if(strcmp(lr_lrmirrorlist_nth_url(iml, 5), "http://e/"));
+    lr_lrmirrorlist_free(iml);
+
+    // A big enough difference of the preference beats the connect time
+    slow = 0.12;
+    iml = lr_lrmirrorlist_append_metalink(NULL, &ml, NULL, NULL);
+    iml = lr_lrmirrorlist_rank(iml, locations, connecttimes);
+    fail_if(strcmp(lr_lrmirrorlist_nth_url(iml, 0), "http://c/"));
+    lr_lrmirrorlist_free(iml);
+    fast = 0.11;
+    iml = lr_lrmirrorlist_append_metalink(NULL, &ml, NULL, NULL);
+    iml = lr_lrmirrorlist_rank(iml, locations, connecttimes);
+    fail_if(strcmp(lr_lrmirrorlist_nth_url(iml, 0), "http://d/"));
+    lr_lrmirrorlist_free(iml);
+
+    g_hash_table_destroy(connecttimes);
+    g_slist_free(ml.urls);
+}
+END_TEST
+
+START_TEST(test_lrmirrorlist_append_urls)
+{
+    LrInternalMirrorlist *iml = NULL;
+    LrUrlVars *urlvars = NULL;
+    char *urls[] = {"http://foo/$arch", "", "ftp://bar",
+                    "http://foo/x86_64", "file:///baz", NULL};
+
+    urlvars = lr_urlvars_set(urlvars, "arch", "x86_64");
+
+    iml = lr_lrmirrorlist_append_url(iml, "ftp://bar", NULL);
+    iml = lr_lrmirrorlist_append_urls(iml, NULL, urlvars);
+    fail_if(g_slist_length(iml) != 1);
+
+    // Empty urls and duplicates (also after substitution) are skipped
+    iml = lr_lrmirrorlist_append_urls(iml, urls, urlvars);
+    fail_if(g_slist_length(iml) != 3);
+    ck_assert_str_eq(lr_lrmirrorlist_nth_url(iml, 0), "ftp://bar");
+    ck_assert_str_eq(lr_lrmirrorlist_nth_url(iml, 1), "http://foo/x86_64");
+    ck_assert_str_eq(lr_lrmirrorlist_nth_url(iml, 2), "file:///baz");
+    fail_if(lr_lrmirrorlist_nth(iml, 1)->preference != 100);
+    fail_if(lr_lrmirrorlist_nth(iml, 1)->protocol != LR_PROTOCOL_HTTP);
+    fail_if(lr_lrmirrorlist_nth(iml, 2)->protocol != LR_PROTOCOL_FILE);
+
+    lr_lrmirrorlist_free(iml);
+    lr_urlvars_free(urlvars);
+}
+END_TEST
+
 Suite *
 lrmirrorlist_suite(void)
 {
@@ -202,6 +360,9 @@ lrmirrorlist_suite(void)
     tcase_add_test(tc, test_lrmirrorlist_append_mirrorlist);
     tcase_add_test(tc, test_lrmirrorlist_append_metalink);
     tcase_add_test(tc, test_lrmirrorlist_append_lrmirrorlist);
+    tcase_add_test(tc, test_lrmirrorlist_append_urls);
+    tcase_add_test(tc, test_lrmirrorlist_duplicates);
+    tcase_add_test(tc, test_lrmirrorlist_rank);
     suite_add_tcase(s, tc);
     return s;
 }
@@ -10,13 +10,17 @@
 #include "librepo/util.h"
 
 #include "fixtures.h"
+#include "test_arena.h"
 #include "test_checksum.h"
+#include "test_decompressor.h"
 #include "test_downloader.h"
+#include "test_fastestmirror.h"
 #include "test_gpg.h"
 #include "test_handle.h"
 #include "test_lrmirrorlist.h"
 #include "test_metalink.h"
 #include "test_mirrorlist.h"
+#include "test_mirrorstats.h"
 #include "test_package_downloader.h"
 #include "test_repomd.h"
 #include "test_url_substitution.h"
@@ -102,15 +106,19 @@ main(int argc, char **argv)
     }
     printf("Tests using directory: %s\n", test_globals.tmpdir);
 
-    SRunner *sr = srunner_create(checksum_suite());
+    SRunner *sr = srunner_create(arena_suite());
+    srunner_add_suite(sr, checksum_suite());
+    srunner_add_suite(sr, decompressor_suite());
     if (downloading) {
         srunner_add_suite(sr, downloader_suite());
     }
+    srunner_add_suite(sr, fastestmirror_suite());
     srunner_add_suite(sr, gpg_suite());
     srunner_add_suite(sr, handle_suite());
     srunner_add_suite(sr, lrmirrorlist_suite());
     srunner_add_suite(sr, metalink_suite());
     srunner_add_suite(sr, mirrorlist_suite());
+    srunner_add_suite(sr, mirrorstats_suite());
     srunner_add_suite(sr, package_downloader_suite());
     srunner_add_suite(sr, repomd_suite());
     srunner_add_suite(sr, url_substitution_suite());
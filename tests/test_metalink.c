@@ -513,6 +513,57 @@ START_TEST(test_metalink_with_alternates)
 }
 END_TEST
 
+START_TEST(test_metalink_many_urls)
+{
+    int fd;
+    gboolean ret;
+    char *path;
+    FILE *f;
+    LrMetalink *ml = NULL;
+    GError *tmp_err = NULL;
+    int x = 0;
+
+    // Big enough to be parsed from a memory mapping
+    path = lr_pathconcat(test_globals.tmpdir, "metalink_many_urls", NULL);
+    f = fopen(path, "w");
+    fail_if(!f);
+    fprintf(f, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+               "<metalink version=\"3.0\" xmlns=\"http://www.metalinker.org/\">\n"
+               " <files>\n  <file name=\"repomd.xml\">\n   <resources>\n");
+    for (x = 0; x < 3000; x++)
+        fprintf(f, "    <url protocol=\"http\" preference=\"%d\">"
+                   "http://mirror%d.example.com/repodata/repomd.xml</url>\n",
+                   x % 100, x);
+    fprintf(f, "   </resources>\n  </file>\n </files>\n</metalink>\n");
+    fclose(f);
+
+    fd = open(path, O_RDONLY);
+    fail_if(fd < 0);
+    ml = lr_metalink_init();
+    ret = lr_metalink_parse_file(ml, fd, REPOMD, NULL, NULL, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    close(fd);
+    unlink(path);
+    lr_free(path);
+
+    fail_if(g_slist_length(ml->urls) != 3000);
+
+    // Urls are in the document order
+    x = 0;
+    for (GSList *elem = ml->urls; elem; elem = g_slist_next(elem), x++) {
+        LrMetalinkUrl *url = elem->data;
+        char *expected = g_strdup_printf(
+                "http://mirror%d.example.com/repodata/repomd.xml", x);
+        fail_if(strcmp(url->url, expected));
+        fail_if(url->preference != x % 100);
+        g_free(expected);
+    }
+
+    lr_metalink_free(ml);
+}
+END_TEST
+
 Suite *
 metalink_suite(void)
 {
@@ -528,6 +579,7 @@ metalink_suite(void)
     tcase_add_test(tc, test_metalink_really_bad_02);
     tcase_add_test(tc, test_metalink_really_bad_03);
     tcase_add_test(tc, test_metalink_with_alternates);
+    tcase_add_test(tc, test_metalink_many_urls);
     suite_add_tcase(s, tc);
     return s;
 }
@@ -105,6 +105,43 @@ START_TEST(test_mirrorlist_03)
 }
 END_TEST
 
+START_TEST(test_mirrorlist_04)
+{
+    int fd;
+    gboolean ret;
+    char *path;
+    GSList *elem = NULL;
+    LrMirrorlist *ml = NULL;
+    GError *tmp_err = NULL;
+
+    // Duplicates are skipped and lines are not limited in length
+    path = lr_pathconcat(test_globals.testdata_dir, MIRRORLIST_DIR,
+                         "mirrorlist_04", NULL);
+    fd = open(path, O_RDONLY);
+    lr_free(path);
+    fail_if(fd < 0);
+    ml = lr_mirrorlist_init();
+    fail_if(ml == NULL);
+    ret = lr_mirrorlist_parse_file(ml, fd, &tmp_err);
+    close(fd);
+    fail_if(!ret);
+    fail_if(tmp_err);
+
+    fail_if(g_slist_length(ml->urls) != 3);
+
+    elem = g_slist_nth(ml->urls, 0);
+    fail_if(g_strcmp0(elem->data, "http://foo.bar/fedora/linux/"));
+
+    elem = g_slist_nth(ml->urls, 1);
+    fail_if(!g_str_has_prefix(elem->data, "http://long.example.com/xxx"));
+    fail_if(strlen(elem->data) != 5025);
+
+    elem = g_slist_nth(ml->urls, 2);
+    fail_if(g_strcmp0(elem->data, "ftp://ftp.bar.foo/Fedora/17/"));
+    lr_mirrorlist_free(ml);
+}
+END_TEST
+
 Suite *
 mirrorlist_suite(void)
 {
@@ -114,6 +151,7 @@ mirrorlist_suite(void)
     tcase_add_test(tc, test_mirrorlist_01);
     tcase_add_test(tc, test_mirrorlist_02);
     tcase_add_test(tc, test_mirrorlist_03);
+    tcase_add_test(tc, test_mirrorlist_04);
     suite_add_tcase(s, tc);
     return s;
 }
@@ -0,0 +1,176 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <float.h>
+
+#include "librepo/util.h"
+#include "librepo/lrmirrorlist.h"
+#include "librepo/mirrorstats_internal.h"
+
+#include "fixtures.h"
+#include "testsys.h"
+#include "test_mirrorstats.h"
+
+#define URL_A   "http://a.example.com/repo/"
+#define URL_B   "http://b.example.com/repo/"
+#define URL_C   "http://c.example.com/repo/"
+#define URL_D   "http://d.example.com/repo/"
+
+#define MiB     (1024 * 1024)
+
+START_TEST(test_mirrorstats)
+{
+    char *path;
+    gboolean ret;
+    LrMirrorStats *stats;
+    LrMirrorStatsEntry entry;
+    GError *tmp_err = NULL;
+
+    path = lr_pathconcat(test_globals.tmpdir, "/mirrorstats", NULL);
+
+    // Statistics don't exist
+    ret = lr_mirrorstats_load(&stats, path, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    fail_if(lr_mirrorstats_lookup(stats, URL_A, &entry));
+
+    // Not yet written observations are visible
+    lr_mirrorstats_add_success(stats, URL_A, MiB, 0.5, 0.25);
+    lr_mirrorstats_add_failure(stats, URL_A "other/path");
+    fail_if(!lr_mirrorstats_lookup(stats, URL_A, &entry));
+    fail_if(entry.successes < 0.99 || entry.successes > 1.0);
+    fail_if(entry.failures < 0.99 || entry.failures > 1.0);
+
+    ret = lr_mirrorstats_write(stats, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    lr_mirrorstats_free(stats);
+
+    // Observations survive writing and reloading
+    ret = lr_mirrorstats_load(&stats, path, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    fail_if(!lr_mirrorstats_lookup(stats, URL_A, &entry));
+    fail_if(entry.bytes < 0.99 * MiB || entry.bytes > MiB);
+    fail_if(entry.seconds < 0.49 || entry.seconds > 0.5);
+    fail_if(entry.ttfb < 0.24 || entry.ttfb > 0.25);
+    fail_if(lr_mirrorstats_lookup(stats, URL_B, &entry));
+
+    // Observations written by somebody else in the meantime are added
+    LrMirrorStats *other;
+    ret = lr_mirrorstats_load(&other, path, &tmp_err);
+    fail_if(!ret);
+    lr_mirrorstats_add_success(other, URL_A, MiB, 0.5, 0.25);
+    lr_mirrorstats_add_success(other, URL_B, MiB, 1.0, 0.5);
+    ret = lr_mirrorstats_write(other, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    lr_mirrorstats_free(other);
+
+    lr_mirrorstats_add_success(stats, URL_A, MiB, 0.5, 0.25);
+    ret = lr_mirrorstats_write(stats, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    lr_mirrorstats_free(stats);
+
+    ret = lr_mirrorstats_load(&stats, path, &tmp_err);
+    fail_if(!ret);
+    fail_if(!lr_mirrorstats_lookup(stats, URL_A, &entry));
+    fail_if(entry.successes < 2.99 || entry.successes > 3.0);
+    fail_if(entry.failures < 0.99 || entry.failures > 1.0);
+    fail_if(!lr_mirrorstats_lookup(stats, URL_B, &entry));
+    fail_if(entry.successes < 0.99 || entry.successes > 1.0);
+    lr_mirrorstats_free(stats);
+
+    // Broken file is reported, but it's overwritten by the next write
+    fail_if(!g_file_set_contents(path, "garbage", -1, NULL));
+    ret = lr_mirrorstats_load(&stats, path, &tmp_err);
+    fail_if(ret);
+    fail_if(!tmp_err);
+    g_clear_error(&tmp_err);
+    fail_if(lr_mirrorstats_lookup(stats, URL_A, &entry));
+    lr_mirrorstats_add_failure(stats, URL_B);
+    ret = lr_mirrorstats_write(stats, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    lr_mirrorstats_free(stats);
+
+    ret = lr_mirrorstats_load(&stats, path, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    fail_if(!lr_mirrorstats_lookup(stats, URL_B, &entry));
+    lr_mirrorstats_free(stats);
+
+    unlink(path);
+    lr_free(path);
+}
+END_TEST
+
+START_TEST(test_mirrorstats_costs)
+{
+    char *path;
+    gboolean ret;
+    LrMirrorStats *stats;
+    LrInternalMirrorlist *list = NULL;
+    GError *tmp_err = NULL;
+
+    path = lr_pathconcat(test_globals.tmpdir, "/mirrorstats", NULL);
+
+    ret = lr_mirrorstats_load(&stats, path, &tmp_err);
+    fail_if(!ret);
+    // Slow mirror
+    lr_mirrorstats_add_success(stats, URL_A, MiB, 4.0, 0.2);
+    // Fast mirror
+    lr_mirrorstats_add_success(stats, URL_B, 2 * MiB, 1.0, 0.1);
+    lr_mirrorstats_add_success(stats, URL_B, 0, 0.0, 0.1);
+    // Broken mirror
+    lr_mirrorstats_add_failure(stats, URL_C);
+    lr_mirrorstats_add_failure(stats, URL_C);
+    // Not enough data
+    lr_mirrorstats_add_failure(stats, URL_D);
+    ret = lr_mirrorstats_write(stats, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    lr_mirrorstats_free(stats);
+
+    list = lr_lrmirrorlist_append_url(list, URL_A, NULL);
+    list = lr_lrmirrorlist_append_url(list, URL_C, NULL);
+    list = lr_lrmirrorlist_append_url(list, URL_D, NULL);
+    list = lr_lrmirrorlist_append_url(list, URL_B, NULL);
+
+    GHashTable *costs = lr_mirrorstats_costs(path, list);
+    fail_if(!costs);
+    fail_if(g_hash_table_size(costs) != 3);
+    double *cost_a = g_hash_table_lookup(costs, "http://a.example.com");
+    double *cost_b = g_hash_table_lookup(costs, "http://b.example.com");
+    double *cost_c = g_hash_table_lookup(costs, "http://c.example.com");
+    fail_if(!cost_a || !cost_b || !cost_c);
+    fail_if(*cost_b >= *cost_a);
+    fail_if(*cost_c != DBL_MAX);
+
+    // Fast, slow, unknown, broken
+    list = lr_lrmirrorlist_rank(list, NULL, costs);
+    ck_assert_str_eq(lr_lrmirrorlist_nth_url(list, 0), URL_B);
+    ck_assert_str_eq(lr_lrmirrorlist_nth_url(list, 1), URL_A);
+    ck_assert_str_eq(lr_lrmirrorlist_nth_url(list, 2), URL_D);
+    ck_assert_str_eq(lr_lrmirrorlist_nth_url(list, 3), URL_C);
+
+    g_hash_table_destroy(costs);
+    lr_lrmirrorlist_free(list);
+    unlink(path);
+    lr_free(path);
+}
+END_TEST
+
+Suite *
+mirrorstats_suite(void)
+{
+    Suite *s = suite_create("mirrorstats");
+    TCase *tc = tcase_create("Main");
+    tcase_add_test(tc, test_mirrorstats);
+    tcase_add_test(tc, test_mirrorstats_costs);
+    suite_add_tcase(s, tc);
+    return s;
+}
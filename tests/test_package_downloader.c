@@ -15,6 +15,7 @@
 #include "librepo/librepo.h"
 #include "librepo/rcodes.h"
 #include "librepo/package_downloader.h"
+#include "librepo/util.h"
 
 START_TEST(test_package_downloader_new_and_free)
 {
@@ -67,12 +68,308 @@ START_TEST(test_package_downloader_new_and_free)
 }
 END_TEST
 
+static void
+batch_endcb(void *cbdata, LrTransferStatus status, G_GNUC_UNUSED const char *msg)
+{
+    int *statuses = cbdata;
+    statuses[status]++;
+}
+
+START_TEST(test_package_downloader_batch)
+{
+    gboolean ret;
+    LrPackageBatch *batch;
+    GError *err = NULL;
+    int statuses[LR_TRANSFER_ERROR + 1] = {0};
+    char *srcdir, *destdir, *baseurl, *path;
+
+    // Local "repository" with two packages
+    srcdir = lr_pathconcat(test_globals.tmpdir, "batch_src", NULL);
+    destdir = lr_pathconcat(test_globals.tmpdir, "batch_dest", NULL);
+    fail_if(mkdir(srcdir, 0755));
+    fail_if(mkdir(destdir, 0755));
+    path = lr_pathconcat(srcdir, "a.rpm", NULL);
+    fail_if(!g_file_set_contents(path, "foo", -1, NULL));
+    lr_free(path);
+    path = lr_pathconcat(srcdir, "b.rpm", NULL);
+    fail_if(!g_file_set_contents(path, "bar", -1, NULL));
+    lr_free(path);
+    baseurl = g_strconcat("file://", srcdir, "/", NULL);
+
+    batch = lr_packagebatch_new(0);
+    fail_if(!batch);
+    lr_packagebatch_set_callbacks(batch, NULL, batch_endcb, NULL);
+    fail_if(lr_packagebatch_length(batch) != 0);
+
+    // Checksum of "foo"
+    ret = lr_packagebatch_add(batch, NULL, "a.rpm", destdir,
+            LR_CHECKSUM_SHA256,
+            "2c26b46b68ffc68ff99b453c1d30413413422d706483bfa0f98a5e886266e7ae",
+            0, baseurl, FALSE, statuses, &err);
+    fail_if(!ret);
+    fail_if(err);
+    ret = lr_packagebatch_add(batch, NULL, "b.rpm", destdir,
+            LR_CHECKSUM_UNKNOWN, NULL, 0, baseurl, FALSE, statuses, &err);
+    fail_if(!ret);
+    ret = lr_packagebatch_add(batch, NULL, "missing.rpm", destdir,
+            LR_CHECKSUM_UNKNOWN, NULL, 0, baseurl, FALSE, statuses, &err);
+    fail_if(!ret);
+    fail_if(lr_packagebatch_length(batch) != 3);
+    fail_if(lr_packagebatch_local_path(batch, 0));
+    fail_if(lr_packagebatch_error(batch, 0));
+
+    ret = lr_download_packagebatch(batch, 0, &err);
+    fail_if(!ret);
+    fail_if(err);
+
+    path = lr_pathconcat(destdir, "a.rpm", NULL);
+    ck_assert_str_eq(lr_packagebatch_local_path(batch, 0), path);
+    lr_free(path);
+    fail_if(lr_packagebatch_error(batch, 0));
+    fail_if(lr_packagebatch_error(batch, 1));
+    fail_if(!lr_packagebatch_error(batch, 2));
+    fail_if(statuses[LR_TRANSFER_SUCCESSFUL] != 2);
+    fail_if(statuses[LR_TRANSFER_ERROR] != 1);
+
+    // Package with a matching checksum is not downloaded again
+    ret = lr_download_packagebatch(batch, 0, &err);
+    fail_if(!ret);
+    ck_assert_str_eq(lr_packagebatch_error(batch, 0), "Already downloaded");
+    fail_if(lr_packagebatch_error(batch, 1));
+    fail_if(statuses[LR_TRANSFER_ALREDYEXISTS] != 1);
+    fail_if(statuses[LR_TRANSFER_SUCCESSFUL] != 3);
+
+    lr_packagebatch_free(batch);
+    lr_free(baseurl);
+    lr_free(srcdir);
+    lr_free(destdir);
+}
+END_TEST
+
+#define STREAM_PACKAGES 50
+
+typedef struct {
+    char *baseurl;
+    char *destdir;
+    int pulled;
+    int done;
+    int failed;
+    int max_in_progress;
+} StreamData;
+
+static LrPackageTarget *
+stream_nextcb(void *cbdata)
+{
+    StreamData *data = cbdata;
+
+    if (data->pulled == STREAM_PACKAGES)
+        return NULL;
+
+    // Every tenth package doesn't exist
+    const char *relative_url = (data->pulled % 10 == 9) ? "missing.rpm"
+                                                        : "a.rpm";
+    char *dest = g_strdup_printf("%s/%d.rpm", data->destdir, data->pulled);
+    LrPackageTarget *target = lr_packagetarget_new_v2(NULL, relative_url,
+                                dest, LR_CHECKSUM_UNKNOWN, NULL, 0,
+                                data->baseurl, FALSE, NULL, NULL, NULL,
+                                NULL, NULL);
+    g_free(dest);
+    fail_if(!target);
+
+    data->pulled++;
+    if (data->pulled - data->done > data->max_in_progress)
+        data->max_in_progress = data->pulled - data->done;
+    return target;
+}
+
+static void
+stream_donecb(void *cbdata, LrPackageTarget *target)
+{
+    StreamData *data = cbdata;
+
+    fail_if(!target->local_path);
+    if (target->err)
+        data->failed++;
+    data->done++;
+    lr_packagetarget_free(target);
+}
+
+START_TEST(test_package_downloader_stream)
+{
+    gboolean ret;
+    GError *err = NULL;
+    StreamData data;
+    char *srcdir, *path;
+
+    memset(&data, 0, sizeof(data));
+    srcdir = lr_pathconcat(test_globals.tmpdir, "stream_src", NULL);
+    data.destdir = lr_pathconcat(test_globals.tmpdir, "stream_dest", NULL);
+    fail_if(mkdir(srcdir, 0755));
+    fail_if(mkdir(data.destdir, 0755));
+    path = lr_pathconcat(srcdir, "a.rpm", NULL);
+    fail_if(!g_file_set_contents(path, "foo", -1, NULL));
+    lr_free(path);
+    data.baseurl = g_strconcat("file://", srcdir, "/", NULL);
+
+    ret = lr_download_packages_stream(stream_nextcb, stream_donecb, &data,
+                                      0, &err);
+    fail_if(!ret);
+    fail_if(err);
+    fail_if(data.pulled != STREAM_PACKAGES);
+    fail_if(data.done != STREAM_PACKAGES);
+    fail_if(data.failed != STREAM_PACKAGES / 10);
+    // Only a few packages per parallel download are in progress at once
+    fail_if(data.max_in_progress > 3 * LRO_MAXPARALLELDOWNLOADS_DEFAULT);
+
+    path = lr_pathconcat(data.destdir, "0.rpm", NULL);
+    fail_if(access(path, R_OK));
+    lr_free(path);
+
+    lr_free(data.baseurl);
+    lr_free(data.destdir);
+    lr_free(srcdir);
+}
+END_TEST
+
+// Checksums of "foo" and "bar"
+#define FOO_SHA256 "2c26b46b68ffc68ff99b453c1d30413413422d706483bfa0f98a5e886266e7ae"
+#define BAR_SHA256 "fcde2b2edba56bf408601fb721fe9b5c338d10ee429ea04fae5511b68fbf8fb9"
+
+START_TEST(test_package_downloader_duplicates)
+{
+    gboolean ret;
+    GError *err = NULL;
+    GSList *targets = NULL;
+    int statuses[LR_TRANSFER_ERROR + 1] = {0};
+    char *srcdir, *destdir, *baseurl, *missingurl, *path, *content;
+
+    srcdir = lr_pathconcat(test_globals.tmpdir, "dup_src", NULL);
+    destdir = lr_pathconcat(test_globals.tmpdir, "dup_dest", NULL);
+    fail_if(mkdir(srcdir, 0755));
+    fail_if(mkdir(destdir, 0755));
+    path = lr_pathconcat(srcdir, "a.rpm", NULL);
+    fail_if(!g_file_set_contents(path, "foo", -1, NULL));
+    lr_free(path);
+    path = lr_pathconcat(srcdir, "b.rpm", NULL);
+    fail_if(!g_file_set_contents(path, "bar", -1, NULL));
+    lr_free(path);
+    baseurl = g_strconcat("file://", srcdir, "/", NULL);
+    missingurl = g_strconcat("file://", srcdir, "/missing/", NULL);
+
+    const struct {
+        const char *relative_url;
+        const char *checksum;
+        const char *baseurl;
+    } packages[] = {
+        // The duplicate gets the file even if it doesn't exist
+        // at its own url
+        { "a.rpm", FOO_SHA256, baseurl },
+        { "a.rpm", FOO_SHA256, missingurl },
+        // The duplicate is downloaded from its own url if the first
+        // target failed
+        { "b.rpm", BAR_SHA256, missingurl },
+        { "b.rpm", BAR_SHA256, baseurl },
+        // The same url
+        { "b.rpm", NULL, baseurl },
+        { "b.rpm", NULL, baseurl },
+    };
+
+    for (int x = 0; x < 6; x++) {
+        char *dest = g_strdup_printf("%s/%d.rpm", destdir, x);
+        LrChecksumType type = packages[x].checksum ? LR_CHECKSUM_SHA256
+                                                   : LR_CHECKSUM_UNKNOWN;
+        LrPackageTarget *target = lr_packagetarget_new_v2(NULL,
+                packages[x].relative_url, dest, type, packages[x].checksum,
+                0, packages[x].baseurl, FALSE,
+                NULL, statuses, batch_endcb, NULL, &err);
+        fail_if(!target);
+        targets = g_slist_append(targets, target);
+        g_free(dest);
+    }
+
+    ret = lr_download_packages(targets, 0, &err);
+    fail_if(!ret);
+    fail_if(err);
+
+    for (int x = 0; x < 6; x++) {
+        LrPackageTarget *target = g_slist_nth_data(targets, x);
+        if (x == 2) {
+            fail_if(!target->err);
+            continue;
+        }
+        fail_if(target->err);
+        fail_if(!g_file_get_contents(target->local_path, &content, NULL, NULL));
+        ck_assert_str_eq(content, x < 2 ? "foo" : "bar");
+        g_free(content);
+    }
+    fail_if(statuses[LR_TRANSFER_SUCCESSFUL] != 5);
+    fail_if(statuses[LR_TRANSFER_ERROR] != 1);
+
+    g_slist_free_full(targets, (GDestroyNotify) lr_packagetarget_free);
+    lr_free(missingurl);
+    lr_free(baseurl);
+    lr_free(srcdir);
+    lr_free(destdir);
+}
+END_TEST
+
+START_TEST(test_package_downloader_checksumcache_per_handle)
+{
+    gboolean ret;
+    GError *err = NULL;
+    GSList *targets = NULL;
+    LrHandle *handles[2];
+    char *indexes[2];
+
+    // Device files cannot have user extended attributes, so the checksum
+    // of /dev/null is always stored to the index file of the cache
+    for (int x = 0; x < 2; x++) {
+        char *name = g_strdup_printf("checksumcache_%d.idx", x);
+        indexes[x] = lr_pathconcat(test_globals.tmpdir, name, NULL);
+        g_free(name);
+
+        handles[x] = lr_handle_init();
+        fail_if(!lr_handle_setopt(handles[x], NULL, LRO_CHECKSUMCACHE,
+                                  indexes[x]));
+
+        // Checksum of an empty file
+        LrPackageTarget *target = lr_packagetarget_new_v2(handles[x],
+                "null.rpm", "/dev/null", LR_CHECKSUM_SHA256,
+                "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+                0, NULL, FALSE, NULL, NULL, NULL, NULL, &err);
+        fail_if(!target);
+        targets = g_slist_append(targets, target);
+    }
+
+    ret = lr_check_packages(targets, 0, &err);
+    fail_if(!ret);
+    fail_if(err);
+    fail_if(((LrPackageTarget *) targets->data)->err);
+    fail_if(((LrPackageTarget *) targets->next->data)->err);
+
+    // Every handle has its own cache
+    for (int x = 0; x < 2; x++) {
+        fail_if(access(indexes[x], R_OK));
+        unlink(indexes[x]);
+        lr_free(indexes[x]);
+    }
+
+    g_slist_free_full(targets, (GDestroyNotify) lr_packagetarget_free);
+    lr_handle_free(handles[0]);
+    lr_handle_free(handles[1]);
+}
+END_TEST
+
 Suite *
 package_downloader_suite(void)
 {
     Suite *s = suite_create("package_downloader");
     TCase *tc = tcase_create("Main");
     tcase_add_test(tc, test_package_downloader_new_and_free);
+    tcase_add_test(tc, test_package_downloader_batch);
+    tcase_add_test(tc, test_package_downloader_stream);
+    tcase_add_test(tc, test_package_downloader_duplicates);
+    tcase_add_test(tc, test_package_downloader_checksumcache_per_handle);
     suite_add_tcase(s, tc);
     return s;
 }
@@ -128,6 +128,77 @@ START_TEST(test_url_substitute_empty_var)
 }
 END_TEST
 
+START_TEST(test_urltemplate)
+{
+    char *url;
+    LrUrlVars *urlvars = NULL;
+    LrUrlVarsIndex *index;
+    LrUrlTemplate *tmpl;
+
+    fail_if(lr_urlvars_index_new(NULL));
+
+    // The first matching variable in the list wins
+    urlvars = lr_urlvars_set(urlvars, "arch", "i386");
+    urlvars = lr_urlvars_set(urlvars, "basearch", "x86_64");
+    urlvars = lr_urlvars_set(urlvars, "release", "20");
+    urlvars = lr_urlvars_set(urlvars, "releasever", "f20");
+    index = lr_urlvars_index_new(urlvars);
+    fail_if(!index);
+
+    tmpl = lr_urltemplate_new("http://foo/$releasever/$basearch/$arch$", index);
+    url = lr_urltemplate_render(tmpl);
+    fail_if(strcmp(url, "http://foo/f20/x86_64/i386$"));
+    lr_free(url);
+
+    // Rendering uses the current values of the variables
+    urlvars = lr_urlvars_set(urlvars, "basearch", "ppc64");
+    url = lr_urltemplate_render(tmpl);
+    fail_if(strcmp(url, "http://foo/f20/ppc64/i386$"));
+    lr_free(url);
+    lr_urltemplate_free(tmpl);
+
+    tmpl = lr_urltemplate_new("$unknown$", index);
+    url = lr_urltemplate_render(tmpl);
+    fail_if(strcmp(url, "$unknown$"));
+    lr_free(url);
+    lr_urltemplate_free(tmpl);
+
+    tmpl = lr_urltemplate_new("", index);
+    url = lr_urltemplate_render(tmpl);
+    fail_if(strcmp(url, ""));
+    lr_free(url);
+    lr_urltemplate_free(tmpl);
+
+    url = lr_url_substitute_index("http://$releasever", index);
+    fail_if(strcmp(url, "http://f20"));
+    lr_free(url);
+
+    url = lr_url_substitute_index("http://$releasever", NULL);
+    fail_if(strcmp(url, "http://$releasever"));
+    lr_free(url);
+
+    fail_if(lr_url_substitute_index(NULL, index));
+
+    lr_urlvars_index_free(index);
+    lr_urlvars_free(urlvars);
+
+    // Variable with empty name matches everywhere, but only
+    // the variables before it in the list take precedence
+    urlvars = NULL;
+    urlvars = lr_urlvars_set(urlvars, "foo", "FOO");
+    urlvars = lr_urlvars_set(urlvars, "", "version");
+    urlvars = lr_urlvars_set(urlvars, "bar", "repo");
+    index = lr_urlvars_index_new(urlvars);
+
+    url = lr_url_substitute_index("http://$bar/$foo/$", index);
+    fail_if(strcmp(url, "http://repo/versionfoo/version"));
+    lr_free(url);
+
+    lr_urlvars_index_free(index);
+    lr_urlvars_free(urlvars);
+}
+END_TEST
+
 Suite *
 url_substitution_suite(void)
 {
@@ -137,6 +208,7 @@ url_substitution_suite(void)
     tcase_add_test(tc, test_url_substitute_without_urlvars);
     tcase_add_test(tc, test_url_substitute);
     tcase_add_test(tc, test_url_substitute_empty_var);
+    tcase_add_test(tc, test_urltemplate);
     suite_add_tcase(s, tc);
     return s;
 }